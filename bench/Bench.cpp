@@ -0,0 +1,535 @@
+//Cycle counts for the per-sample hot path: everything loop() does for one
+//channel between the sampler handing over a sample and the 'D' line going
+//out.  Built instead of main.cpp by the bench environments in
+//platformio.ini, either on the board (env:bench) or on the PC against
+//SimHAL (env:native_bench).
+//
+//Each stage is run BENCH_ITERATIONS times, timed with ESP.getCycleCount(),
+//and reported as CSV so two runs can be diffed (see tools/bench_compare.py):
+//
+//  BENCH,<format version>,<target>,<cpu MHz>,<iterations>,<timer overhead>
+//  STAGE,<name>,<min>,<p50>,<p90>,<p99>,<max>,<mean>
+//  HIST,<name>,<b0>,...,<b19>    b<k> counts runs of 2^k to 2^(k+1)-1 cycles
+//  RATE,<name>,<edges per second>        on the board only
+//  SIZE,<name>,<channels>,<bytes>,<bytes per channel>
+//  STEP,<name>,<samples to 90%>
+//  END
+//
+//RATE follows the GPIO interrupt decoder stages: the quadrature edges a
+//second that decoder could keep up with, going by its p99 and any limit
+//it puts on itself.  It leaves out the core's own interrupt dispatch,
+//which costs the same per interrupt either way.  Only the board prints
+//it: on the PC the ISR runs from the cache at several GHz, and the
+//figure would be tens of millions of edges a second no S2 gets near.
+//The stage timings still compare the two there.
+//
+//STEP follows the RPM filter stages: how many samples each filter, at a
+//channel's default depth (and gains, for the tracker), takes to get to 90%
+//of a step from stood still to BENCH_RPM.  -1 if it never does.
+//
+//SIZE follows each of the output formats: what one sample pass puts on
+//the link, for the 'D' line (format) and the binary frames (frame_sample,
+//and frame_multi with every channel on).
+//
+//angle_double and rpm_double are angle and rpm_scale done in double, as
+//loop() used to, to show what the fixed point saves on the S2.  The PC has
+//an FPU, so there they come out much the same.
+//
+//All figures are in CPU cycles with the overhead of reading the cycle
+//counter already taken off.  On the PC the "cycles" are host time scaled
+//to the ESP32-S2's 240MHz, so they are only good for comparing one host
+//run with another.
+#include <Arduino.h>
+#include <algorithm>
+#include <math.h>
+#include "Channel.h"
+#include "CommandParser.h"
+#include "Metrics.h"
+#include "TelemetryFrame.h"
+#include <InterruptEncoder.h>
+
+#define BENCH_FORMAT_VERSION 1
+#define BENCH_ITERATIONS 1024
+#define BENCH_HIST_BUCKETS 20
+
+//The synthetic shaft the RPM stages are fed with: a steady speed, sampled
+//at the default loop interval.
+#define BENCH_RPM 600
+#define BENCH_SAMPLE_PERIOD_US 100000
+//Samples stood still before the step, and the most to wait for 90% after.
+#define BENCH_STEP_SETTLE 64
+#define BENCH_STEP_MAX 1000
+
+//Spare pins for the GPIO interrupt decoders.  Nothing drives them, the
+//ISRs are called directly.
+#define BENCH_ISR_A_PIN 1
+#define BENCH_ISR_B_PIN 2
+//What the A only decoder InterruptEncoder used to have, and its debounce.
+#define BENCH_LEGACY_DEBOUNCE_US 10
+
+//The target carries the encoder backend too, so bench_compare.py warns
+//about comparing one backend's figures with another's.
+#if ENCODER_BACKEND == ENCODER_BACKEND_GPIO
+#define BENCH_BACKEND "gpio"
+#elif ENCODER_BACKEND == ENCODER_BACKEND_SIM
+#define BENCH_BACKEND "sim"
+#else
+#define BENCH_BACKEND "pcnt"
+#endif
+#ifdef ARDUINO_ARCH_ESP32
+#define BENCH_TARGET "esp32/" BENCH_BACKEND
+#else
+#define BENCH_TARGET "native/" BENCH_BACKEND
+#endif
+
+/// @brief Somewhere for the 'D' line to go that costs nothing but the
+/// formatting, so the figure doesn't depend on the UART.  It only counts
+/// what went through it.
+class NullPrint : public Print
+{
+public:
+  size_t write(uint8_t c) override
+  {
+    (void)c;
+    written++;
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    (void)buffer;
+    written += size;
+    return size;
+  }
+
+  size_t written = 0;
+};
+
+static uint32_t _cycles[BENCH_ITERATIONS];
+static uint32_t _overhead = 0;
+static Channel _channel;
+static NullPrint _null;
+
+//Results go here so the compiler can't throw the work away.
+static volatile int64_t _sinkValue;
+static volatile int64_t _sinkCount;
+
+/// @brief Count, in cycles, of back to back reads of the cycle counter.
+/// Taken off every other figure.
+static uint32_t MeasureOverhead()
+{
+  uint32_t best = UINT32_MAX;
+  for(int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    uint32_t start = ESP.getCycleCount();
+    uint32_t cycles = ESP.getCycleCount() - start;
+    if(cycles < best)
+      best = cycles;
+  }
+  return best;
+}
+
+/// @brief Shaft count at sample n of the synthetic run.
+static int64_t SyntheticCount(int n)
+{
+  return (int64_t)BENCH_RPM * _channel.pulsePerRev * n * BENCH_SAMPLE_PERIOD_US / 60000000LL;
+}
+
+static int64_t SyntheticTimestamp(int n)
+{
+  return (int64_t)n * BENCH_SAMPLE_PERIOD_US;
+}
+
+/// @brief Print the stats and histogram for the figures in _cycles.
+static void Report(const char *name)
+{
+  uint32_t hist[BENCH_HIST_BUCKETS] = {0};
+  uint64_t total = 0;
+  for(int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    uint32_t c = _cycles[i];
+    total += c;
+    int bucket = 0;
+    while(c > 1 && bucket < BENCH_HIST_BUCKETS - 1)
+    {
+      c >>= 1;
+      bucket++;
+    }
+    hist[bucket]++;
+  }
+
+  std::sort(_cycles, _cycles + BENCH_ITERATIONS);
+
+  Serial.print("STAGE,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.print(_cycles[0]);
+  Serial.print(",");
+  Serial.print(_cycles[BENCH_ITERATIONS / 2]);
+  Serial.print(",");
+  Serial.print(_cycles[BENCH_ITERATIONS * 9 / 10]);
+  Serial.print(",");
+  Serial.print(_cycles[BENCH_ITERATIONS * 99 / 100]);
+  Serial.print(",");
+  Serial.print(_cycles[BENCH_ITERATIONS - 1]);
+  Serial.print(",");
+  Serial.println((uint32_t)(total / BENCH_ITERATIONS));
+
+  Serial.print("HIST,");
+  Serial.print(name);
+  for(int i = 0; i < BENCH_HIST_BUCKETS; i++)
+  {
+    Serial.print(",");
+    Serial.print(hist[i]);
+  }
+  Serial.println();
+}
+
+/// @brief Time one stage, BENCH_ITERATIONS times, and report it.
+/// @param name Stage name for the report.
+/// @param stage Called with the iteration number.  Anything it needs to set
+/// up must be done in prepare, which isn't timed.
+template <typename Prepare, typename Stage>
+static void Run(const char *name, Prepare prepare, Stage stage)
+{
+  for(int i = 0; i < BENCH_ITERATIONS; i++)
+  {
+    prepare(i);
+    uint32_t start = ESP.getCycleCount();
+    stage(i);
+    uint32_t cycles = ESP.getCycleCount() - start;
+    _cycles[i] = cycles > _overhead ? cycles - _overhead : 0;
+  }
+  Report(name);
+}
+
+static void NoPrepare(int) {}
+
+/// @brief InterruptEncoder as it was: an interrupt on A only, two calls
+/// to digitalRead() and one to micros(), 64 bit volatile counts, and any
+/// edge within the debounce of the last one thrown away.  Kept here so the
+/// new decoder has something to be measured against.
+struct LegacyInterruptEncoder
+{
+  int apin = BENCH_ISR_A_PIN;
+  int bpin = BENCH_ISR_B_PIN;
+  volatile bool aState = 0;
+  volatile bool bState = 0;
+  volatile int64_t count = 0;
+  volatile int64_t microsLastA = 0;
+  volatile int64_t microsTimeBetweenTicks = 0;
+};
+
+static void LegacyAISR(void *arg)
+{
+  LegacyInterruptEncoder *object = (LegacyInterruptEncoder *)arg;
+  long start = micros();
+  long duration = start - object->microsLastA;
+  if(duration >= BENCH_LEGACY_DEBOUNCE_US)
+  {
+    object->microsLastA = start;
+    object->microsTimeBetweenTicks = duration;
+    object->aState = digitalRead(object->apin);
+    object->bState = digitalRead(object->bpin);
+    if(object->aState == object->bState)
+      object->count++;
+    else
+      object->count--;
+  }
+}
+
+/// @brief The encoder behind a virtual call, as it would be with a run
+/// time choice of backend.  Only here to put a figure on what choosing it
+/// at build time saves on the sampler's read.
+class VirtualEncoder
+{
+public:
+  virtual ~VirtualEncoder() {}
+  virtual EncoderSnapshot getSnapshot() = 0;
+};
+
+template <typename E>
+class VirtualEncoderOf : public VirtualEncoder
+{
+public:
+  explicit VirtualEncoderOf(E &encoder) : _encoder(encoder) {}
+  EncoderSnapshot getSnapshot() override { return _encoder.getSnapshot(); }
+
+private:
+  E &_encoder;
+};
+
+static VirtualEncoderOf<Encoder> _virtualEncoder(_channel.encoder);
+//Volatile, so the compiler can't see through the call.
+static VirtualEncoder *volatile _virtualEncoderPtr = &_virtualEncoder;
+
+static CommandParser _commandParser;
+//One full read's worth: the end of an overlong line, then a command with
+//three fields.
+static const char BENCH_COMMAND_BYTES[] = "\nK1 12345678 12345678 123456789\n";
+static_assert(sizeof(BENCH_COMMAND_BYTES) - 1 == COMMAND_MAX_BYTES_PER_LOOP, "one full read");
+
+static LegacyInterruptEncoder _legacyEncoder;
+static InterruptEncoder _interruptEncoder;
+
+/// @brief Print the edge rate a decoder could keep up with, from the p99
+/// of the stage just run (Report() leaves _cycles sorted).
+/// @param edgesPerCall Quadrature edges each call of its ISR accounts for.
+/// @param limit Edges a second it would never go past anyway, 0 if none.
+static void ReportRate(const char *name, uint32_t edgesPerCall, uint32_t limit)
+{
+#ifdef ARDUINO_ARCH_ESP32
+  uint32_t cycles = _cycles[BENCH_ITERATIONS * 99 / 100];
+  uint64_t rate = (uint64_t)ESP.getCpuFreqMHz() * 1000000ULL * edgesPerCall / (cycles > 0 ? cycles : 1);
+  if(limit > 0 && rate > limit)
+    rate = limit;
+  Serial.print("RATE,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.println((uint32_t)rate);
+#else
+  (void)name;
+  (void)edgesPerCall;
+  (void)limit;
+#endif
+}
+
+/// @brief The 'D' line, exactly as SendSample() prints it.
+static void PrintSample(Print &out, const Channel &channel)
+{
+  char text[FIXED_TEXT_SIZE];
+  out.print("D ");
+  out.write((const uint8_t *)text, FormatFixed(text, channel.ang, ENCODER_SCALE_ANGLE, 2));
+  out.print(" ");
+  out.print(channel.pos);
+  out.print(" ");
+  out.write((const uint8_t *)text, FormatFixed(text, channel.rpm, ENCODER_SCALE_RPM, 2));
+  out.println();
+}
+
+/// @brief Print what one sample pass of a format puts on the link.
+static void ReportSize(const char *name, uint8_t channels, size_t bytes)
+{
+  Serial.print("SIZE,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.print(channels);
+  Serial.print(",");
+  Serial.print((uint32_t)bytes);
+  Serial.print(",");
+  Serial.println((double)bytes / channels, 2);
+}
+
+/// @brief The binary frame for channel 0, as SendSample() builds it.
+static size_t EncodeSample(int i, uint8_t *buf)
+{
+  TelemetrySample frame;
+  frame.sequence = (uint16_t)i;
+  frame.timestampUs = (uint32_t)SyntheticTimestamp(i);
+  frame.count = _channel.pos;
+  frame.rpmMilli = _channel.rpm;
+  return EncodeTelemetrySample(frame, buf);
+}
+
+/// @brief The multi channel frame with every channel on, as SendSample()
+/// builds it.  Channel 0 stands in for all of them.
+static size_t EncodeMulti(int i, uint8_t *buf)
+{
+  TelemetryMultiSample frame;
+  frame.sequence = (uint16_t)i;
+  frame.timestampUs = (uint32_t)SyntheticTimestamp(i);
+  frame.channelMask = (1 << MAX_CHANNELS) - 1;
+  for(uint8_t ch = 0; ch < MAX_CHANNELS; ch++)
+  {
+    frame.count[ch] = _channel.pos;
+    frame.rpmMilli[ch] = _channel.rpm;
+  }
+  return EncodeTelemetryMultiSample(frame, buf);
+}
+
+static uint8_t _frame[TELEMETRY_MAX_FRAME_SIZE];
+
+/// @brief Time the RPM filter of one type, fed the synthetic shaft.
+static void RunFilter(const char *name, RpmFilterType type)
+{
+  _channel.rpmFilterType = type;
+  _channel.configureFilter();
+  _channel.filter.reset();
+  Run(name, NoPrepare, [](int i) {
+    _sinkValue = _channel.filter.update(BENCH_RPM * ENCODER_SCALE_RPM, SyntheticCount(i), SyntheticTimestamp(i));
+  });
+}
+
+/// @brief Print how many samples a filter takes to follow a step from
+/// stood still to BENCH_RPM.
+static void ReportStep(const char *name, RpmFilterType type)
+{
+  _channel.rpmFilterType = type;
+  _channel.configureFilter();
+  //Settled at a stop, then the shaft is going from sample 0.  The tracker
+  //works from the count, so that steps too.
+  int n;
+  for(n = -BENCH_STEP_SETTLE; n < 0; n++)
+    _channel.filter.update(0, 0, SyntheticTimestamp(n));
+  for(n = 0; n < BENCH_STEP_MAX; n++)
+  {
+    int32_t rpm = _channel.filter.update(BENCH_RPM * ENCODER_SCALE_RPM, SyntheticCount(n + 1),
+                                         SyntheticTimestamp(n + 1));
+    if(rpm >= BENCH_RPM * ENCODER_SCALE_RPM * 9 / 10)
+      break;
+  }
+
+  Serial.print("STEP,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.println(n < BENCH_STEP_MAX ? n + 1 : -1);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  //Give the host a moment to open the port before the figures go.
+  delay(3000);
+
+  //Channel 0 on its usual pins.  Nothing needs to be connected, it's only
+  //there so the read stage has a real PCNT unit to read.
+  _channel.index = 0;
+  _channel.aPin = 36;
+  _channel.bPin = 37;
+  _channel.attach();
+
+  _overhead = MeasureOverhead();
+
+  Serial.println();
+  Serial.print("BENCH,");
+  Serial.print(BENCH_FORMAT_VERSION);
+  Serial.print(",");
+  Serial.print(BENCH_TARGET);
+  Serial.print(",");
+  Serial.print(ESP.getCpuFreqMHz());
+  Serial.print(",");
+  Serial.print(BENCH_ITERATIONS);
+  Serial.print(",");
+  Serial.println(_overhead);
+
+  //What the sampler's timer callback does for each encoder.
+  Run("read", NoPrepare, [](int) {
+    _sinkCount = _channel.encoder.getSnapshot().count;
+  });
+
+  Run("read_virtual", NoPrepare, [](int) {
+    _sinkCount = _virtualEncoderPtr->getSnapshot().count;
+  });
+
+  Run("angle", NoPrepare, [](int i) {
+    _sinkValue = _channel.angle((long)SyntheticCount(i));
+  });
+
+  //The same count to angle done in double, as loop() used to, for the
+  //saving.  Each operation is a software floating point call on the S2.
+  Run("angle_double", NoPrepare, [](int i) {
+    _sinkValue = llround((double)SyntheticCount(i) * 360.0 * ENCODER_SCALE_ANGLE / _channel.scale.countsPerRev());
+  });
+
+  _channel.estimator.reset();
+  Run("rpm", NoPrepare, [](int i) {
+    _sinkValue = _channel.estimator.update(SyntheticCount(i), SyntheticTimestamp(i));
+  });
+
+  //Just the count change to RPM in the estimator, fixed point and double.
+  Run("rpm_scale", NoPrepare, [](int i) {
+    _sinkValue = _channel.scale.rpm(SyntheticCount(i + 1) - SyntheticCount(i),
+                                    SyntheticTimestamp(i + 1) - SyntheticTimestamp(i));
+  });
+
+  Run("rpm_double", NoPrepare, [](int i) {
+    double deltaCount = (double)(SyntheticCount(i + 1) - SyntheticCount(i));
+    double deltaUs = (double)(SyntheticTimestamp(i + 1) - SyntheticTimestamp(i));
+    _sinkValue = llround(deltaCount * 60e6 * ENCODER_SCALE_RPM / (deltaUs * _channel.scale.countsPerRev()));
+  });
+
+  RunFilter("filter_none", RPM_FILTER_NONE);
+  RunFilter("filter_ema", RPM_FILTER_EMA);
+  RunFilter("filter_boxcar", RPM_FILTER_BOXCAR);
+  RunFilter("filter_median", RPM_FILTER_MEDIAN);
+  RunFilter("filter_alphabeta", RPM_FILTER_ALPHA_BETA);
+
+  ReportStep("filter_ema", RPM_FILTER_EMA);
+  ReportStep("filter_boxcar", RPM_FILTER_BOXCAR);
+  ReportStep("filter_median", RPM_FILTER_MEDIAN);
+  ReportStep("filter_alphabeta", RPM_FILTER_ALPHA_BETA);
+
+  //Back to the default filter for the whole-path figures.
+  _channel.rpmFilterType = RPM_FILTER_EMA;
+  _channel.configureFilter();
+
+  _channel.justReset = true;
+  Run("update", NoPrepare, [](int i) {
+    _channel.update(SyntheticCount(i), SyntheticTimestamp(i));
+  });
+
+  Run("format", [](int i) { _channel.update(SyntheticCount(i), SyntheticTimestamp(i)); },
+      [](int) { PrintSample(_null, _channel); });
+  _null.written = 0;
+  PrintSample(_null, _channel);
+  ReportSize("format", 1, _null.written);
+
+  Run("frame_sample", [](int i) { _channel.update(SyntheticCount(i), SyntheticTimestamp(i)); },
+      [](int i) { _sinkCount = EncodeSample(i, _frame); });
+  ReportSize("frame_sample", 1, EncodeSample(0, _frame));
+
+  Run("frame_multi", [](int i) { _channel.update(SyntheticCount(i), SyntheticTimestamp(i)); },
+      [](int i) { _sinkCount = EncodeMulti(i, _frame); });
+  ReportSize("frame_multi", MAX_CHANNELS, EncodeMulti(0, _frame));
+
+  //One whole sample: read, angle, RPM, filter and the 'D' line.
+  _channel.justReset = true;
+  Run("total", NoPrepare, [](int i) {
+    _sinkCount = _channel.encoder.getSnapshot().count;
+    _channel.update(SyntheticCount(i), SyntheticTimestamp(i));
+    PrintSample(_null, _channel);
+  });
+
+  //What the hot path pays for a metric, see Metrics.h.
+  Run("metric_count", NoPrepare, [](int) { MetricCount(METRIC_WRITE_BYTES, 22); });
+  Run("metric_gauge", NoPrepare, [](int i) { MetricGauge(METRIC_SAMPLE_AGE_US, i); });
+
+  //The most framing one pass of PollCommands() can be left with: a full
+  //read into a ring already holding the rest of an overlong line, all of
+  //which has to be thrown away before the command after it comes out.
+  Run("command",
+      [](int) {
+        _commandParser.clear();
+        for(int i = 0; i < COMMAND_RING_SIZE - COMMAND_MAX_BYTES_PER_LOOP; i++)
+          _commandParser.push('F', 0);
+      },
+      [](int) {
+        for(int i = 0; i < COMMAND_MAX_BYTES_PER_LOOP; i++)
+          _commandParser.push((uint8_t)BENCH_COMMAND_BYTES[i], 0);
+        Command cmd;
+        long val = 0;
+        if(_commandParser.next(cmd, 0))
+          for(uint8_t field = 0; field < 3; field++)
+            cmd.fieldToLong(field, val);
+        _sinkValue = val;
+      });
+
+  //The GPIO interrupt decoders, one interrupt's worth each.  The old one
+  //always goes the whole way through, rather than taking its debounce
+  //early out.  It only interrupts on A, so each call covers an A and a B
+  //edge, but the debounce means no more than one A edge per 10 us.
+  Run("isr_legacy", [](int) { _legacyEncoder.microsLastA = -BENCH_LEGACY_DEBOUNCE_US; },
+      [](int) { LegacyAISR(&_legacyEncoder); });
+  ReportRate("isr_legacy", 2, 2 * 1000000 / BENCH_LEGACY_DEBOUNCE_US);
+
+  _interruptEncoder.attach(BENCH_ISR_A_PIN, BENCH_ISR_B_PIN);
+  Run("isr_table", NoPrepare, [](int) { InterruptEncoder::isr(&_interruptEncoder); });
+  ReportRate("isr_table", 1, 0);
+  _interruptEncoder.detach();
+
+  Serial.println("END");
+}
+
+void loop()
+{
+  //Nothing to do, the figures have all gone out from setup().
+}
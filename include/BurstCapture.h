@@ -0,0 +1,115 @@
+#pragma once
+#include <stdint.h>
+#include <esp_timer.h>
+#include "EncoderBackend.h"
+#include "EncoderScale.h"
+
+//Samples the burst buffer holds, 8 bytes each, allocated up front whether
+//a burst is ever taken or not.
+#define BURST_CAPTURE_MAX_SAMPLES 4096
+//Fastest the burst timer is allowed to run, 10 kHz.  Much quicker and the
+//esp_timer task can't keep up.
+#define BURST_CAPTURE_MIN_PERIOD_US 100
+//The RPM trigger looks at how far the count has moved over this many
+//samples.
+#define BURST_CAPTURE_RPM_WINDOW 16
+
+/// @brief What starts a burst.  The values go over the serial link.
+enum BurstTrigger
+{
+  //Straight away.  There is no pretrigger.
+  BURST_TRIGGER_NONE = 0,
+  //Count at or above the value.
+  BURST_TRIGGER_COUNT_ABOVE = 1,
+  //Count at or below the value.
+  BURST_TRIGGER_COUNT_BELOW = 2,
+  //Speed, either way, at or above the value in whole RPM.
+  BURST_TRIGGER_RPM_ABOVE = 3,
+  BURST_TRIGGER_TYPE_COUNT
+};
+
+enum BurstState
+{
+  BURST_IDLE = 0,
+  //Sampling into the pretrigger ring, waiting for the trigger.
+  BURST_ARMED,
+  //Triggered, filling the rest of the buffer.
+  BURST_TRIGGERED,
+  //Full, and ready to be read out.
+  BURST_DONE
+};
+
+/// @brief One burst sample, packed.  The timestamp is the bottom 32 bits of
+/// esp_timer_get_time(), which is plenty for differences inside a burst.
+struct BurstRecord
+{
+  uint32_t timestampUs;
+  int32_t count;
+};
+
+/// @brief Samples one encoder at up to 10 kHz, on its own esp_timer, into a
+/// RAM buffer that is read out once it is full.  Nothing goes over the
+/// serial link while it runs, so the rate isn't limited by the link, only
+/// by how fast the timer can run.
+///
+/// Once armed it samples into the buffer as a ring, so when the trigger
+/// comes the samples leading up to it are already there.  After the
+/// trigger it carries on until the buffer holds the requested number of
+/// samples, with the trigger sample at index pretrigger().
+class BurstCapture
+{
+public:
+  BurstCapture();
+
+  /// @brief Create the timer.
+  bool begin();
+
+  /// @brief Start a burst, throwing away any previous one.
+  /// @param encoder What to sample.
+  /// @param scale The encoder's scale, for the RPM trigger.
+  /// @param periodUs Sample period, at least BURST_CAPTURE_MIN_PERIOD_US.
+  /// @param samples Samples to keep, up to BURST_CAPTURE_MAX_SAMPLES.
+  /// @param trigger One of BurstTrigger.
+  /// @param value Count or RPM for the trigger.
+  /// @param pretrigger Samples to keep from before the trigger.
+  /// @return false if any of it is out of range.
+  bool arm(Encoder &encoder, const EncoderScale &scale, uint32_t periodUs, uint32_t samples,
+           uint8_t trigger, int32_t value, uint32_t pretrigger);
+
+  /// @brief Stop sampling.  Whatever was in the buffer is thrown away.
+  void stop();
+
+  BurstState state() const { return _state; }
+  uint32_t periodUs() const { return _periodUs; }
+  /// @brief Samples taken since being armed, including the ones that have
+  /// since been overwritten in the pretrigger ring.
+  uint32_t written() const { return _written; }
+
+  /// @brief Samples in a finished burst, 0 until it is done.
+  uint32_t length() const { return _state == BURST_DONE ? _length : 0; }
+  /// @brief Index of the trigger sample in a finished burst.
+  uint32_t pretrigger() const { return _pretrigger; }
+  /// @brief A sample of a finished burst, oldest first.
+  bool record(uint32_t index, BurstRecord &record) const;
+
+private:
+  static void onTimer(void *arg);
+  void takeSample();
+  bool triggered(int32_t count) const;
+
+  esp_timer_handle_t _timer;
+  Encoder *_encoder;
+  uint32_t _periodUs;
+  uint32_t _length;
+  uint32_t _pretrigger;
+  uint8_t _trigger;
+  int32_t _value;
+  //For the RPM trigger, counts moved over BURST_CAPTURE_RPM_WINDOW samples.
+  int32_t _windowCounts;
+
+  //Written by the timer callback.
+  volatile BurstState _state;
+  volatile uint32_t _written;
+  uint32_t _triggerAt;
+  BurstRecord _buffer[BURST_CAPTURE_MAX_SAMPLES];
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include "EncoderBackend.h"
+#include "RpmEstimator.h"
+#include "RpmFilter.h"
+#include "PvaEstimator.h"
+#include "EncoderScale.h"
+#include "GlitchFilter.h"
+#include "CountPoller.h"
+
+//One channel per PCNT unit, at most.  That's 4 on the S2.
+#define MAX_CHANNELS MAX_ESP32_ENCODERS
+#define CHANNEL_NO_PIN -1
+
+/// @brief A channel's persisted settings, as they sit in the settings blob.
+/// Fixed width fields, so the layout in flash never depends on the build.
+struct ChannelSettings
+{
+  int32_t aPin;
+  int32_t bPin;
+  uint32_t pulsePerRev;
+  uint32_t countMode;
+  uint32_t rpmFilterDepth;
+  uint32_t rpmFilterType;
+  uint32_t rpmFilterAlpha;
+  uint32_t rpmFilterBeta;
+};
+
+/// @brief One encoder input: its pins, its settings, the encoder itself and
+/// the RPM maths that goes with it.  main.cpp keeps a table of these.
+struct Channel
+{
+  uint8_t index = 0;
+
+  //Settings, persisted per channel.  A channel with no pins is disabled.
+  long aPin = CHANNEL_NO_PIN;
+  long bPin = CHANNEL_NO_PIN;
+  unsigned long pulsePerRev = 1200;
+  //ENCODER_COUNT_SINGLE, _HALF or _FULL.  pulsePerRev is always given in
+  //half quadrature counts whatever this is, see EncoderScale.
+  unsigned long countMode = ENCODER_COUNT_HALF;
+  unsigned long rpmFilterDepth = 5;
+  //Which smoothing filter the RPM goes through, and the tracker gains (in
+  //thousandths) for when it is the alpha-beta one.  rpmFilterDepth is the
+  //EMA depth, or the window for the boxcar and median filters.
+  unsigned long rpmFilterType = RPM_FILTER_EMA;
+  unsigned long rpmFilterAlpha = 500;
+  unsigned long rpmFilterBeta = 100;
+  //PCNT glitch filter, in APB cycles, 0 for off.  See GlitchFilter.h.
+  unsigned long glitchFilter = PCNT_FILTER_DEFAULT;
+  //Count with the wrap interrupts off, polled fast enough for this many
+  //RPM, or 0 to count with the interrupts.  See the 'H' command.
+  unsigned long pollMaxRpm = 0;
+
+  //Whichever backend the build counts with, see EncoderBackend.h.
+  Encoder encoder;
+  //Counts to angle and RPM, from pulsePerRev and countMode.
+  EncoderScale scale;
+  //Turns the timestamped samples into a shaft speed...
+  RpmEstimator estimator;
+  //...and smooths it.
+  RpmFilter filter;
+  //Position, velocity and acceleration, for sending the angle and RPM on
+  //ahead of the sample, see the 'V' command.
+  PvaEstimator pva;
+
+  //just reset flag.  We use this to zero the RPM immediately
+  //if we have done an encoder reset to a value, so that the
+  //RPM doesnt spike when this occurs.
+  bool justReset = false;
+  //esp_timer_get_time() when the count was moved.  Samples the sampler
+  //queued before then still have the old count in them, so update()
+  //passes over them, and justReset waits for one that doesn't.
+  int64_t resetUs = 0;
+
+  //Results of the last update().  The angle is in 1/ENCODER_SCALE_ANGLE
+  //degrees and the RPM in 1/ENCODER_SCALE_RPM RPM.
+  long pos = 0;
+  int64_t ang = 0;
+  int32_t rpm = 0;
+
+  bool enabled() const { return aPin != CHANNEL_NO_PIN && bPin != CHANNEL_NO_PIN; }
+
+  /// @brief Take on a set of saved settings.  Anything out of range falls
+  /// back to the defaults.
+  void load(const ChannelSettings &settings);
+  /// @brief Copy this channel's settings out, ready to be saved.
+  void save(ChannelSettings &settings) const;
+
+  /// @brief Attach the encoder to the configured pins, if there are any,
+  /// counting in countMode.
+  void attach();
+  /// @brief Let go of the pins and the PCNT unit.
+  void detach();
+
+  /// @brief Push the filter settings into the RPM filter.  If the type has
+  /// somehow ended up as something we don't know, fall back to the EMA.
+  void configureFilter();
+  void setPulsePerRev(unsigned long ppr);
+  /// @brief Change the counting mode.  Only takes effect on the encoder the
+  /// next time it is attached.
+  /// @return false if mode isn't one of the ENCODER_COUNT_ values.
+  bool setCountMode(unsigned long mode);
+  /// @brief Change the glitch filter, straight away if attached.
+  /// @return false if it is more than PCNT_FILTER_MAX.
+  bool setGlitchFilter(unsigned long filter);
+  /// @brief Fastest the shaft can go, in whole RPM, before the glitch
+  /// filter starts losing counts.
+  uint32_t maxRpm() const { return FilterMaxRpm(pulsePerRev, glitchFilter); }
+  /// @brief Count polled, with the wrap interrupts off, or not.  Straight
+  /// away if attached, keeping the count.
+  /// @param maxRpm Fastest the shaft will go, 0 to go back to interrupts.
+  /// @return false if the backend can't, or the speed needs polling
+  /// quicker than POLL_MIN_PERIOD_US.
+  bool setPolled(unsigned long maxRpm);
+  /// @brief Longest the encoder can go between polls at pollMaxRpm.  0 if
+  /// it isn't to be polled, or the speed is now too much to poll for.
+  uint32_t pollPeriodUs() const;
+
+  /// @brief Set the count, and have the next update() start the RPM afresh.
+  void reset(long count);
+  /// @brief The count has been moved, as of fromUs.  update() starts the
+  /// RPM afresh from the first sample taken after then.
+  void restartRpm(int64_t fromUs);
+
+  /// @brief Angle for a count, in 1/ENCODER_SCALE_ANGLE degrees.
+  int64_t angle(long count) const { return scale.angle(count); }
+
+  /// @brief Take a new sample for this channel.  One taken before the
+  /// last reset is dropped.
+  /// @return true if the count has moved since the last one.
+  bool update(int64_t count, int64_t timestampUs);
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//Size of the raw byte ring that sits between the serial port and the
+//framer.  Must be a power of two so the index wrap is just a mask.
+#define COMMAND_RING_SIZE 128
+//Longest command line we will accept, including the command character.
+//Anything longer is thrown away up to the next terminator.
+#define COMMAND_MAX_LENGTH 48
+//If the PC sends a command with no newline on the end (the old
+//Serial.readString() behaviour let it do that), we treat a quiet gap of
+//this many ms as the end of the frame.
+#define COMMAND_IDLE_TIMEOUT_MS 50
+//Never pull more than this many bytes off the serial port per pass of
+//loop(), so a flood of commands can't hold the sampling up.
+#define COMMAND_MAX_BYTES_PER_LOOP 32
+
+/// @brief A single framed command.  The first character is the command
+/// code, anything after it (with surrounding white space trimmed) is the
+/// parameter.
+struct Command
+{
+  char code = 0;
+  char parameter[COMMAND_MAX_LENGTH] = {0};
+  uint8_t parameterLength = 0;
+
+  bool hasParameter() const { return parameterLength > 0; }
+
+  /// @brief Parse the parameter as a base 10 integer.
+  /// @param val Set to the parsed value on success, left alone otherwise.
+  /// @return true if the whole parameter was a valid number.
+  bool parameterToLong(long &val) const;
+
+  /// @brief Parse the n'th white space separated field of the parameter.
+  /// @return true if the field exists and is a valid number.
+  bool fieldToLong(uint8_t index, long &val) const;
+};
+
+/// @brief Incremental, allocation free command framer.  Bytes are pushed
+/// in one at a time as they arrive, and complete commands are pulled out
+/// with next().  Neither call ever waits for more data, so it is safe to
+/// call from the sampling loop.
+class CommandParser
+{
+public:
+  CommandParser();
+
+  /// @brief Push a single received byte into the ring.
+  /// @param b The byte.
+  /// @param nowMs Current millis(), used for idle gap framing.
+  /// @return false if the ring was full and the byte was dropped.
+  bool push(uint8_t b, unsigned long nowMs);
+
+  /// @brief Pull the next complete command out of the ring, if there is one.
+  /// @param cmd Filled in with the command on success.
+  /// @param nowMs Current millis(), used for idle gap framing.
+  /// @return true if a command was produced.
+  bool next(Command &cmd, unsigned long nowMs);
+
+  /// @brief Number of bytes that can still be pushed without dropping.
+  size_t space() const { return COMMAND_RING_SIZE - (_head - _tail); }
+
+  /// @brief Discard everything buffered, including any partial frame.
+  void clear();
+
+  //Error counters, handy when working out why the PC and the board
+  //disagree about what was sent.
+  uint32_t droppedBytes() const { return _droppedBytes; }
+  uint32_t overlongFrames() const { return _overlongFrames; }
+
+private:
+  bool complete(Command &cmd);
+
+  uint8_t _ring[COMMAND_RING_SIZE];
+  //Free running indices, masked on access.  head is written by push(),
+  //tail by next().
+  uint16_t _head;
+  uint16_t _tail;
+
+  char _frame[COMMAND_MAX_LENGTH];
+  uint8_t _frameLength;
+  bool _discarding;
+  unsigned long _lastByteMs;
+
+  uint32_t _droppedBytes;
+  uint32_t _overlongFrames;
+};
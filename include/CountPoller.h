@@ -0,0 +1,90 @@
+#pragma once
+#include <stdint.h>
+#include <esp_timer.h>
+#include "EncoderBackend.h"
+
+//One slot per PCNT unit, the same as the Sampler's.
+#define POLL_MAX_ENCODERS MAX_ESP32_ENCODERS
+//Counts the PCNT counter can move between polls and still be read the
+//right way round.  It only holds the count modulo its limit, so that's
+//half the limit, see ESP32Encoder::setPolled().
+#define POLL_SAFE_COUNTS (_INT16_MAX / 2)
+//Polls come this many times more often than the top speed strictly
+//needs, so one that is held up by the rest of the esp_timer task still
+//lands in time.
+#define POLL_MARGIN 4
+//Quickest the poll timer may run.  A channel that would need it any
+//quicker stays on the wrap interrupts.
+#define POLL_MIN_PERIOD_US 200
+//Slowest it runs, however slow the channels.
+#define POLL_MAX_PERIOD_US 100000
+
+/// @brief Longest the poll timer can leave between polls of a channel
+/// that counts this fast, with POLL_MARGIN to spare.
+/// @param countsPerSec Fastest the count can move.
+/// @return At most POLL_MAX_PERIOD_US, or 0 if it would have to be under
+/// POLL_MIN_PERIOD_US.
+uint32_t PollPeriodUs(uint64_t countsPerSec);
+
+/// @brief What the poll timer has managed, in microseconds.
+struct PollStats
+{
+  uint32_t periodUs;
+  uint32_t polls;
+  //Longest between two polls.
+  int64_t maxGapUs;
+  //Polls that came more than POLL_MARGIN periods after the last, past
+  //where counts could have been lost at top speed.
+  uint32_t late;
+};
+
+/// @brief Polls the encoders that count with their wrap interrupts off,
+/// on its own esp_timer, at the period the fastest of them needs.  See the
+/// 'H' command.
+///
+/// At high edge rates the wrap interrupts come thick and fast, and each
+/// one is a window for the count read to race.  Polled, the PCNT unit
+/// interrupts for nothing, and the count only changes when the timer
+/// reads the counter, at a rate set by the speed rather than by the shaft.
+class CountPoller
+{
+public:
+  CountPoller();
+
+  /// @brief Create the timer.  Call once from setup().
+  bool begin();
+
+  /// @brief Which encoder to poll for a channel, and the period its top
+  /// speed needs, or nullptr to stop polling it.
+  void setEncoder(uint8_t channel, Encoder *encoder, uint32_t periodUs);
+
+  /// @brief Start the timer at the shortest period the channels asked
+  /// for, or stop it if none are polled.  Call after setEncoder().
+  void update();
+
+  /// @brief Poll every channel now, as the timer does.
+  void pollAll();
+
+  PollStats stats() const;
+  /// @brief Start the figures again, done by the timer callback as the
+  /// Sampler's are.
+  void resetStats() { _resetRequested = true; }
+
+private:
+  static void onTimer(void *arg);
+
+  esp_timer_handle_t _timer;
+  uint32_t _periodUs;
+  Encoder *volatile _encoders[POLL_MAX_ENCODERS];
+  uint32_t _periods[POLL_MAX_ENCODERS];
+
+  //Written only by the timer callback.  _maxGapUs takes two stores, so
+  //as the Sampler's figures, the callback makes the sequence odd while it
+  //updates them, and stats() reads them again if it changed.
+  volatile uint32_t _statsSequence;
+  int64_t _lastUs;
+  volatile uint32_t _polls;
+  volatile int64_t _maxGapUs;
+  volatile uint32_t _late;
+  volatile bool _resetRequested;
+};
@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+#include "EncoderBackend.h"
+#include "SpscQueue.h"
+
+//Edges the ISR can get ahead of loop() by.  Each one is 24 bytes.
+#define EDGE_CAPTURE_RING_SIZE 256
+
+/// @brief One encoder edge, as seen by the PCNT interrupt.
+struct EdgeEvent
+{
+  //esp_timer_get_time() in the interrupt.
+  int64_t timestampUs;
+  //Count just after the edge.
+  int64_t count;
+  //+1 or -1.
+  int8_t direction;
+};
+
+/// @brief Timing figures for the captured edges, in microseconds.
+struct EdgeStats
+{
+  uint32_t edges;
+  uint32_t overflows;
+  //Shortest and longest time between two edges in the same direction.
+  int64_t minPeriodUs;
+  int64_t maxPeriodUs;
+};
+
+/// @brief Captures every edge on one encoder, with its time, using the
+/// ESP32Encoder's always_interrupt mode.
+///
+/// The encoder's ISR calls onEdge() after each count, which stamps it and
+/// pushes it into a lock free ring.  loop() drains the ring, in time order
+/// with the samples, so the RPM estimator gets the real edge times at low
+/// speed instead of the sample times.  If loop() falls behind, edges are
+/// dropped and counted rather than blocking the ISR.
+///
+/// An interrupt per edge costs a few us of CPU each, so this is for slow
+/// shafts and timing analysis, and is off until asked for.
+class EdgeCapture
+{
+public:
+  EdgeCapture();
+
+  /// @brief Set an encoder up to report every edge here.  Must be done
+  /// while it is detached; the interrupt is set up when it is attached.
+  /// Does nothing, and hooked() stays false, unless the encoders are on
+  /// the PCNT backend (ENCODER_HAS_EDGE_CAPTURE).
+  void hook(Encoder &encoder);
+
+  /// @brief Set an encoder back to interrupting on wraps only.  Also only
+  /// while it is detached.
+  void unhook(Encoder &encoder);
+
+  bool hooked() const { return _encoder != nullptr; }
+
+  /// @brief Take the oldest edge, if it happened at or before untilUs.
+  /// Only call from loop().
+  /// @param untilUs Leave edges after this time for later, so they can be
+  /// fed in order with samples.
+  /// @return false if there is nothing that old waiting.
+  bool read(EdgeEvent &edge, int64_t untilUs);
+
+  /// @brief Figures since the last resetStats().  Only call from loop().
+  EdgeStats stats() const;
+  void resetStats();
+
+private:
+  static void onEdge(void *arg);
+
+  ESP32Encoder *_encoder;
+  SpscQueue<EdgeEvent, EDGE_CAPTURE_RING_SIZE> _ring;
+
+  //Written only by the ISR.
+  int64_t _lastCount;
+  volatile uint32_t _overflows;
+
+  //Written only by loop().
+  bool _held;
+  EdgeEvent _heldEdge;
+  uint32_t _edges;
+  uint32_t _overflowsAtReset;
+  EdgeEvent _lastEdge;
+  bool _haveLastEdge;
+  int64_t _minPeriodUs;
+  int64_t _maxPeriodUs;
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include <stdint.h>
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <ESP32Encoder.h>
+#include <InterruptEncoder.h>
+#include "EncoderScale.h"
+
+//Which encoder hardware the channels count with, picked at build time with
+//-DENCODER_BACKEND=n (see platformio.ini).
+//  0  the PCNT units, the default.  4 channels on the S2.
+//  1  GPIO interrupts on both pins (InterruptEncoder), for boards or pins
+//     the PCNT units can't cover.  No glitch filter or edge capture.
+//  2  no pins at all, the count is whatever the firmware moves it to.  For
+//     benchmarking the sampling and reporting code on the host, or running
+//     it with nothing connected.
+#define ENCODER_BACKEND_PCNT 0
+#define ENCODER_BACKEND_GPIO 1
+#define ENCODER_BACKEND_SIM 2
+#ifndef ENCODER_BACKEND
+#define ENCODER_BACKEND ENCODER_BACKEND_PCNT
+#endif
+
+//Per edge interrupts with timestamps (EdgeCapture) need the PCNT unit.
+#define ENCODER_HAS_EDGE_CAPTURE (ENCODER_BACKEND == ENCODER_BACKEND_PCNT)
+//So does counting with the wrap interrupts off (CountPoller), as only the
+//PCNT unit has a counter that wraps.
+#define ENCODER_HAS_POLLING (ENCODER_BACKEND == ENCODER_BACKEND_PCNT)
+
+//What the rest of the firmware needs from an encoder, whichever backend:
+//
+//  void attach(int aPin, int bPin, unsigned long countMode)
+//      countMode is ENCODER_COUNT_SINGLE, _HALF or _FULL.
+//  void detach()
+//  bool isAttached()
+//  EncoderSnapshot getSnapshot()   count and esp_timer time, together.
+//                                  Safe from a timer callback or an ISR.
+//  int64_t getCount()
+//  void setCount(int64_t value)
+//  void offsetCount(int64_t delta) safe from an ISR, keeps any counts
+//                                  made meanwhile.
+//  void setFilter(uint16_t cycles) PCNT glitch filter, ignored elsewhere.
+//  void move(int64_t counts)       turn the shaft by some counts, as if
+//                                  they came off the pins, for the motion
+//                                  generator.
+//  bool setPolled(bool polled)     count with no wrap interrupts, poll()
+//                                  keeping the count instead.  false if
+//                                  the backend can't.
+//  bool isPolled()
+//  void poll()                     fold the hardware counter into the
+//                                  count, if polled.
+//
+//The backend is a plain type, chosen once below as Encoder, so none of
+//these are virtual and the sampler's read compiles down to the backend's
+//own code.
+
+/// @brief The PCNT backend, which is ESP32Encoder with an attach that
+/// takes the counting mode.
+class PcntEncoder : public ESP32Encoder
+{
+public:
+  void attach(int aPin, int bPin, unsigned long countMode)
+  {
+    if(countMode == ENCODER_COUNT_SINGLE)
+      attachSingleEdge(aPin, bPin);
+    else if(countMode == ENCODER_COUNT_FULL)
+      attachFullQuad(aPin, bPin);
+    else
+      attachHalfQuad(aPin, bPin);
+  }
+  void detach() { detatch(); }
+
+  /// @brief On the board this is offsetCount(), as nothing can pulse the
+  /// PCNT unit's inputs from software.  On the host it steps the simulated
+  /// unit, so its limits, wraps and interrupts are all exercised.
+  void move(int64_t counts);
+};
+
+/// @brief The count handling for backends that keep their count in
+/// software: a raw count from Derived::rawCount(), plus an offset that
+/// setCount() and offsetCount() move, read together under a lock.
+template <typename Derived>
+class SoftwareEncoder
+{
+public:
+  EncoderSnapshot IRAM_ATTR getSnapshot()
+  {
+    EncoderSnapshot snap;
+    portENTER_CRITICAL_SAFE(&_lock);
+    snap.count = static_cast<Derived *>(this)->rawCount() + _offset;
+    snap.timestampUs = esp_timer_get_time();
+    portEXIT_CRITICAL_SAFE(&_lock);
+    return snap;
+  }
+
+  int64_t getCount() { return getSnapshot().count; }
+
+  void setCount(int64_t value)
+  {
+    portENTER_CRITICAL_SAFE(&_lock);
+    _offset = value - static_cast<Derived *>(this)->rawCount();
+    portEXIT_CRITICAL_SAFE(&_lock);
+  }
+
+  void IRAM_ATTR offsetCount(int64_t delta)
+  {
+    portENTER_CRITICAL_SAFE(&_lock);
+    _offset += delta;
+    portEXIT_CRITICAL_SAFE(&_lock);
+  }
+
+  //No hardware filter to set.
+  void setFilter(uint16_t cycles) { (void)cycles; }
+
+  void IRAM_ATTR move(int64_t counts) { offsetCount(counts); }
+
+  //No hardware counter to wrap, so nothing to poll.
+  bool setPolled(bool polled) { return !polled; }
+  bool isPolled() const { return false; }
+  void poll() {}
+
+protected:
+  int64_t _offset = 0;
+
+private:
+  static portMUX_TYPE _lock;
+};
+
+template <typename Derived>
+portMUX_TYPE SoftwareEncoder<Derived>::_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// @brief The GPIO interrupt backend.  InterruptEncoder always decodes full
+/// quadrature, so the count is scaled down to the counting mode asked for,
+/// the same counts per line as the PCNT unit would make.
+class GpioEncoder : public SoftwareEncoder<GpioEncoder>
+{
+public:
+  void attach(int aPin, int bPin, unsigned long countMode);
+  void detach() { _decoder.detach(); }
+  bool isAttached() const { return _decoder.isAttached(); }
+
+  /// @brief Both pins changing between interrupts, see InterruptEncoder.
+  uint32_t illegalTransitions() const { return _decoder.illegalTransitions(); }
+
+  int64_t IRAM_ATTR rawCount();
+
+private:
+  InterruptEncoder _decoder;
+  //Counts per line, 1, 2 or 4.
+  uint8_t _countMode = ENCODER_COUNT_HALF;
+};
+
+/// @brief No pins, the count only moves when move() is called.
+class SimEncoder : public SoftwareEncoder<SimEncoder>
+{
+public:
+  void attach(int aPin, int bPin, unsigned long countMode)
+  {
+    (void)aPin;
+    (void)bPin;
+    (void)countMode;
+    _attached = true;
+  }
+  void detach() { _attached = false; }
+  bool isAttached() const { return _attached; }
+
+  int64_t rawCount() const { return 0; }
+
+private:
+  bool _attached = false;
+};
+
+#if ENCODER_BACKEND == ENCODER_BACKEND_GPIO
+typedef GpioEncoder Encoder;
+#elif ENCODER_BACKEND == ENCODER_BACKEND_SIM
+typedef SimEncoder Encoder;
+#else
+typedef PcntEncoder Encoder;
+#endif
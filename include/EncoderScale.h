@@ -0,0 +1,91 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//Angles come out in thousandths of a degree, RPM in thousandths of an RPM
+//(the same scale as the telemetry frames use).
+#define ENCODER_SCALE_ANGLE 1000
+#define ENCODER_SCALE_RPM 1000
+
+//How many counts the encoder makes per line of the disc, which is how the
+//PCNT unit has been set up.
+#define ENCODER_COUNT_SINGLE 1
+#define ENCODER_COUNT_HALF 2
+#define ENCODER_COUNT_FULL 4
+
+/// @brief Integer conversion of counts to angle and count rates to RPM.
+///
+/// The S2 has no FPU, so doing this in double on every sample is all
+/// software floating point.  Instead the scale factors are worked out once,
+/// in configure(), as fixed point reciprocals, and each conversion is a few
+/// integer multiplies and at most one divide.
+///
+/// The pulse per rev setting has always been in half quadrature counts (a
+/// 600 line disc is 1200), so the counts in one revolution are
+/// pulsePerRev * countMode / 2.  Everything is worked in units of half a
+/// count, which keeps that exact whatever the mode.
+class EncoderScale
+{
+public:
+  EncoderScale();
+
+  /// @brief Set the scale, and work out the reciprocals.  Call whenever the
+  /// PPR or counting mode changes.
+  /// @param pulsePerRev Counts per rev in half quadrature.  Zero is taken as 1.
+  /// @param countMode ENCODER_COUNT_SINGLE, _HALF or _FULL.
+  void configure(uint32_t pulsePerRev, uint8_t countMode);
+
+  uint32_t pulsePerRev() const { return _pulsePerRev; }
+  uint8_t countMode() const { return _countMode; }
+  /// @brief Counts in one revolution in the current mode.  Only for the odd
+  /// bit of floating point that's left, like the alpha-beta tracker.
+  double countsPerRev() const { return _halfCountsPerRev / 2.0; }
+  /// @brief Counts in two revolutions, which is always a whole number.
+  uint32_t halfCountsPerRev() const { return _halfCountsPerRev; }
+
+  /// @brief Angle for a count, not wrapped, in 1/ENCODER_SCALE_ANGLE degrees.
+  int64_t angle(int32_t count) const;
+
+  /// @brief The count at an angle, the other way to angle(), rounded toward
+  /// zero.
+  /// @param angle 1/ENCODER_SCALE_ANGLE degrees.
+  int32_t count(int64_t angle) const;
+
+  /// @brief Shaft speed for a count change over a time.
+  /// @param deltaCount Counts moved.
+  /// @param deltaUs Time taken, must be above zero.
+  /// @return 1/ENCODER_SCALE_RPM RPM, rounded, and held within int32.
+  /// Exact, bar the rounding, for any change under some 77 million counts.
+  int32_t rpm(int64_t deltaCount, int64_t deltaUs) const;
+
+private:
+  uint32_t _pulsePerRev;
+  uint8_t _countMode;
+
+  //Half counts in one rev, i.e. pulsePerRev * countMode.
+  uint32_t _halfCountsPerRev;
+  //Thousandths of a degree per half count, Q32.32.  Only ever multiplied
+  //by the part of a rev left over after the whole revs, so its rounding
+  //can't build up as the count grows.
+  uint64_t _angleRecip;
+  //Thousandths of an RPM for one count per us, rounded.
+  uint64_t _rpmFactor;
+  //Largest count change that can be multiplied by _rpmFactor without
+  //overflowing.
+  int64_t _rpmMaxDelta;
+  //Longest time the exact RPM sum can be done over without overflowing.
+  int64_t _rpmMaxUs;
+};
+
+//Longest string FormatFixed() can produce, with the null.
+#define FIXED_TEXT_SIZE 24
+
+/// @brief Write a scaled integer as a decimal, like Print::print(double,
+/// digits) would the value / scale, without going through a double.
+/// @param buf At least FIXED_TEXT_SIZE bytes.
+/// @param value The scaled value, e.g. thousandths.
+/// @param scale What value is scaled by, a power of ten.
+/// @param digits Decimal places to show, rounded half away from zero.  No
+/// more than the scale has.
+/// @return The length written, not counting the null.
+size_t FormatFixed(char *buf, int64_t value, uint32_t scale, uint8_t digits);
@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include "EdgeCapture.h"
+
+//The PCNT glitch filter ignores any pulse on an encoder pin shorter than
+//this many APB cycles.  The S2's APB runs at 80 MHz, so 250 (what the
+//encoder library has always set) is about 3 us.
+#define PCNT_FILTER_APB_HZ 80000000UL
+#define PCNT_FILTER_DEFAULT 250
+#define PCNT_FILTER_MAX 1023
+
+//During calibration, an edge that undoes the one before within this long
+//is taken as noise rather than the shaft turning back.
+#define FILTER_CAL_GLITCH_US 50
+//Calibration recommends a filter that still leaves this much headroom over
+//the fastest the shaft went while it was watching.
+#define FILTER_CAL_HEADROOM 2
+
+/// @brief Fastest the shaft can turn before the filter starts eating real
+/// edges.  Each pin is high (and low) for half a line, and that has to be
+/// longer than the filter, so with pulsePerRev/2 lines this is
+/// 60 * APB / (pulsePerRev * filter).
+/// @param pulsePerRev In half quadrature counts, as the 'P' command.
+/// @param filter APB cycles.  0 (filter off) counts as 1, which is about as
+/// fast as the PCNT inputs are sampled anyway.
+uint32_t FilterMaxRpm(uint32_t pulsePerRev, uint32_t filter);
+
+/// @brief What calibration found, and the filter it recommends.
+struct FilterCalibrationResult
+{
+  uint32_t edges;
+  //Shortest time between two edges in the same direction, i.e. the
+  //fastest the shaft went.  0 if it never moved enough to tell.
+  int64_t minIntervalUs;
+  //Edges that were undone again within FILTER_CAL_GLITCH_US, and the
+  //longest such pulse.
+  uint32_t glitches;
+  int64_t maxGlitchUs;
+  //Glitches per second over the whole run.
+  uint32_t glitchRate;
+  uint32_t recommended;
+  //False if no filter can both stop the glitches seen and leave the
+  //headroom, in which case recommended only stops the glitches.
+  bool headroom;
+};
+
+/// @brief Works out a glitch filter setting from the edges seen with the
+/// filter off.  Feed it every captured edge on the channel while the shaft
+/// is run at its fastest, then ask for the result.
+class FilterCalibration
+{
+public:
+  FilterCalibration();
+
+  /// @brief Start a fresh run.
+  /// @param countMode Counts per line the channel makes, which turns count
+  /// intervals into pin pulse widths.
+  void begin(int64_t startUs, uint8_t countMode);
+  void edge(const EdgeEvent &edge);
+  FilterCalibrationResult result(int64_t nowUs) const;
+
+private:
+  int64_t _startUs;
+  uint8_t _countMode;
+  bool _haveLast;
+  EdgeEvent _last;
+  uint32_t _edges;
+  int64_t _minIntervalUs;
+  uint32_t _glitches;
+  int64_t _maxGlitchUs;
+};
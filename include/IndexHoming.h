@@ -0,0 +1,96 @@
+#pragma once
+#include <stdint.h>
+#include "EncoderBackend.h"
+
+//What an index pulse does, see the 'Z' command.  The values go over the
+//serial link and into flash.
+#define INDEX_MODE_OFF 0
+//The first index after attaching sets the count to the home count.  Later
+//ones only measure how far out the count has drifted.
+#define INDEX_MODE_ONCE 1
+//Every index puts the count back on the home count (give or take whole
+//revs), so counts lost to noise never build up.
+#define INDEX_MODE_EVERY 2
+
+/// @brief The index settings, as saved in the settings blob.
+struct IndexSettings
+{
+  uint32_t channel;
+  //CHANNEL_NO_PIN (-1) for no index.
+  int32_t pin;
+  uint32_t mode;
+  //Angle the shaft is at when the index goes, 1/ENCODER_SCALE_ANGLE degrees.
+  int32_t homeAngle;
+};
+
+/// @brief Index pulse figures.  Errors are in counts, how far the count
+/// was from home (plus whole revs) when the index came round, before any
+/// correction.
+struct IndexStats
+{
+  uint32_t hits;
+  int32_t lastError;
+  int32_t minError;
+  int32_t maxError;
+  //esp_timer_get_time() at the last index.
+  int64_t lastUs;
+};
+
+/// @brief Homes an encoder off its index (Z) output, on a GPIO of its own.
+/// It all happens in the pin's interrupt, so the count is set within a few
+/// us of the pulse, rather than a loop interval plus a serial round trip
+/// later as when the PC spots home and sends 'R'.
+///
+/// The index is taken on its rising edge.  For an open collector output,
+/// where the pulse pulls the line low, that is the end of the pulse, which
+/// is a fixed count or so on from the start, and the home angle can take it
+/// out.
+class IndexHoming
+{
+public:
+  IndexHoming();
+
+  /// @brief Start watching the index pin.
+  /// @param encoder The encoder the index belongs to.  Must be attached.
+  /// @param pin GPIO the index is on.
+  /// @param mode INDEX_MODE_ONCE or _EVERY.
+  /// @param homeCount What the count should be at the index.
+  /// @param halfCountsPerRev See EncoderScale::halfCountsPerRev().
+  void attach(Encoder &encoder, int pin, uint8_t mode, int64_t homeCount, uint32_t halfCountsPerRev);
+  void detach();
+  bool attached() const { return _encoder != nullptr; }
+
+  /// @brief Has an index set the count since attaching?
+  bool homed() const { return _homed; }
+
+  /// @brief Times the count has been moved by an index.  A change means the
+  /// RPM estimate wants starting again.
+  uint32_t corrections() const { return _corrections; }
+
+  /// @brief The figures, all from the same moment.
+  IndexStats stats() const;
+  void resetStats();
+
+private:
+  //Not IRAM_ATTR: it reads the count through the encoder library and the
+  //PCNT driver, which live in flash.  The pin interrupt isn't registered
+  //as an IRAM one either, so during a flash write it waits, and the
+  //snapshot it takes puts its own time on the count.
+  static void onIndex(void *arg);
+
+  Encoder *_encoder;
+  int _pin;
+  uint8_t _mode;
+  int64_t _homeCount;
+  uint32_t _halfCountsPerRev;
+
+  //Written by the interrupt.  The figures from _hits on are read and
+  //reset together under a lock, see stats().
+  volatile bool _homed;
+  volatile uint32_t _corrections;
+  volatile uint32_t _hits;
+  volatile int32_t _lastError;
+  volatile int32_t _minError;
+  volatile int32_t _maxError;
+  volatile int64_t _lastUs;
+};
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <Arduino.h>
+
+//Which kind of figure a metric is.
+#define METRIC_COUNTER 0
+//min, max and mean of the values it has been given.
+#define METRIC_GAUGE 1
+
+/// @brief Everything the firmware keeps a figure for.  The order is the
+/// order of the compact 'X' dump, so new ones only ever go on the end.
+enum MetricId
+{
+  //us each pass of loop() took, and the passes longer than a sample
+  //interval.
+  METRIC_LOOP_US = 0,
+  METRIC_LOOP_OVERRUNS,
+  //Samples the sampler had no room to queue, see Sampler.
+  METRIC_SAMPLE_DROPS,
+  //us from a sample being latched to its line or frame being built.
+  METRIC_SAMPLE_AGE_US,
+  //us each drain of the output ring spent in the port's write, and the
+  //bytes it wrote...
+  METRIC_WRITE_US,
+  METRIC_WRITE_BYTES,
+  //...and bytes that were lost, the port taking less than it said it had
+  //room for or the ring having no room for text.
+  METRIC_OUTPUT_DROPPED,
+  //Runs of the PCNT interrupt, wraps and per edge alike.
+  METRIC_PCNT_INTERRUPTS,
+  //Times a channel started its RPM afresh after a count reset.
+  METRIC_FILTER_RESETS,
+  //Commands framed, and those that went nowhere: bytes the ring had no
+  //room for, overlong lines and codes nothing knows.
+  METRIC_COMMANDS,
+  METRIC_COMMAND_ERRORS,
+  //Settings blobs written to flash.
+  METRIC_SETTINGS_WRITES,
+  //Samples the output ring's policy threw away, see OutputRing.
+  METRIC_RECORDS_DROPPED,
+  METRIC_COUNT
+};
+
+/// @brief One metric's figures.
+struct MetricValue
+{
+  uint8_t kind;
+  //Events, or values given to a gauge.
+  uint32_t count;
+  //Gauges only, 0 until they have a value.
+  int32_t min;
+  int32_t max;
+  int32_t mean;
+};
+
+//A fixed table of counters and gauges in RAM, for seeing from the PC what
+//the firmware has been up to (see the 'X' command).  Updating one is a
+//few instructions under a spinlock, with no allocation, so it's fine from
+//the hot path, the timer callbacks or an ISR.
+
+/// @brief Add n to a counter.
+void MetricCount(MetricId id, uint32_t n = 1);
+/// @brief Give a gauge a value.
+void MetricGauge(MetricId id, int32_t value);
+/// @brief A consistent copy of one metric.
+MetricValue MetricRead(MetricId id);
+/// @brief Short name, for the readable dump.
+const char *MetricName(MetricId id);
+/// @brief Zero the lot.
+void MetricsReset();
+/// @brief millis() at the last MetricsReset(), or power up.
+unsigned long MetricsSince();
@@ -0,0 +1,101 @@
+#pragma once
+#include <stdint.h>
+#include <esp_timer.h>
+#include "EncoderBackend.h"
+
+//One generator drives every attached channel, each in its own counts.
+#define MOTION_MAX_ENCODERS MAX_ESP32_ENCODERS
+//How often the generator moves the encoders, unless told otherwise, and
+//the quickest it may.
+#define MOTION_DEFAULT_STEP_US 1000
+#define MOTION_MIN_STEP_US 100
+//Counts between PCNT wrap interrupts, the unit's high limit (see
+//ESP32Encoder.h).
+#define MOTION_WRAP_COUNTS _INT16_MAX
+
+/// @brief The shape of the motion.  The values go over the serial link.
+enum MotionType
+{
+  MOTION_OFF = 0,
+  //Steady at speed.
+  MOTION_CONSTANT = 1,
+  //Speed ramps from 0 up to speed over the period, and back down over the
+  //next, over and over.
+  MOTION_RAMP = 2,
+  //Speed is speed * sin(2 pi t / period), so the shaft swings back and
+  //forth, turning round every half period.
+  MOTION_SINE = 3,
+  //Full speed one way for a period, then the other way for a period.
+  MOTION_REVERSE = 4,
+  //Steady, at whatever speed makes the PCNT unit wrap speed times a
+  //second, whatever the PPR.
+  MOTION_WRAP = 5,
+  MOTION_TYPE_COUNT
+};
+
+/// @brief What to generate.
+struct MotionSettings
+{
+  uint8_t type;
+  //Whole RPM, or wraps a second for MOTION_WRAP.  Negative runs backwards.
+  int32_t speed;
+  uint32_t periodMs;
+  //Each step the count is put up to this many counts either side of where
+  //the profile says, at random, like a shaft sat buzzing on an edge.
+  uint32_t jitterCounts;
+  uint32_t stepUs;
+};
+
+/// @brief Where a profile has the shaft, in counts, some time after it
+/// started.  Plain maths, the generator and anything checking its output
+/// work from this.
+double MotionCounts(const MotionSettings &settings, double countsPerRev, double seconds);
+
+/// @brief Turns the encoders along a motion profile, on its own esp_timer,
+/// for exercising the sampling, filtering and reporting, and whatever is
+/// listening on the PC, without a real shaft.
+///
+/// The encoders are moved with Encoder::move(), which adds to the count
+/// rather than setting it, so a real encoder on the pins still counts
+/// too.  On the host that steps the simulated PCNT unit, so its wrap and
+/// edge interrupts run just as they would for a real shaft.
+class MotionGenerator
+{
+public:
+  MotionGenerator();
+
+  /// @brief Create the timer.  Call once from setup().
+  bool begin();
+
+  /// @brief Which encoders to drive, or nullptr for none, and their
+  /// counts per rev.  Same slots as the Sampler's.
+  void setEncoder(uint8_t channel, Encoder *encoder, double countsPerRev);
+
+  /// @brief Start a profile from where the encoders are now.
+  /// @return false if the settings make no sense.
+  bool start(const MotionSettings &settings);
+  void stop();
+  bool running() const { return _running; }
+
+  const MotionSettings &settings() const { return _settings; }
+  /// @brief esp_timer_get_time() at the start of the profile.
+  int64_t startUs() const { return _startUs; }
+  /// @brief Counts moved so far, on channel 0's scale.
+  int64_t moved() const { return _moved[0]; }
+
+private:
+  static void onTimer(void *arg);
+  int32_t jitter();
+
+  esp_timer_handle_t _timer;
+  MotionSettings _settings;
+  bool _running;
+  int64_t _startUs;
+  uint32_t _random;
+
+  Encoder *volatile _encoders[MOTION_MAX_ENCODERS];
+  double _countsPerRev[MOTION_MAX_ENCODERS];
+  //Counts each encoder has been moved since start(), only touched by the
+  //timer callback once running.
+  int64_t _moved[MOTION_MAX_ENCODERS];
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include <Arduino.h>
+
+//Room for command replies and other text.  Must be a power of two so the
+//index wrap is just a mask.  Big enough for the start up banner with every
+//channel on.
+#define OUTPUT_TEXT_SIZE 2048
+//Samples waiting to go, one line or frame each, and the longest one.  An
+//'M' line for every channel with prediction and timestamps on is about
+//240 bytes.
+#define OUTPUT_RECORD_SLOTS 16
+#define OUTPUT_RECORD_MAX 256
+//Most that goes to the port in one write, so USB gets full packets.
+#define OUTPUT_CHUNK_SIZE 512
+
+#if (OUTPUT_TEXT_SIZE & (OUTPUT_TEXT_SIZE - 1)) != 0
+#error "OUTPUT_TEXT_SIZE must be a power of two"
+#endif
+
+/// @brief What happens to a sample when the ring is full.  The values go
+/// over the serial link.
+enum OutputPolicy
+{
+  //Throw away the oldest sample still waiting, so the PC gets the most
+  //recent run of them once it reads again.
+  OUTPUT_DROP_OLDEST = 0,
+  //Throw away the new one, so what the PC gets is unbroken up to the
+  //stall.
+  OUTPUT_DROP_NEWEST = 1,
+  //Throw away every sample waiting, and queue just the new one, so the PC
+  //gets the latest the moment it reads again.
+  OUTPUT_COALESCE = 2,
+  OUTPUT_POLICY_COUNT
+};
+
+/// @brief Figures since the last resetStats().
+struct OutputStats
+{
+  //Samples queued, and those thrown away by the policy.
+  uint32_t records;
+  uint32_t dropped;
+  //Most samples that were ever waiting at once.
+  uint32_t maxQueued;
+  //Bytes of text there was no room for.
+  uint32_t textDropped;
+};
+
+/// @brief Everything going to the PC waits here until the port can take
+/// it, so nothing that prints ever blocks on a slow or stalled reader.
+///
+/// Text (replies, the banner) goes into a byte ring, and is only lost if
+/// that is full.  Samples are records, each a whole line or frame, held in
+/// slots, and when the slots are full the policy decides which sample
+/// goes.  A small queue of entries keeps the order both went in, so a
+/// reply never overtakes the samples before it, and a sample is always
+/// sent whole: the one part way out is never dropped.
+///
+/// drain() hands the port what it says it has room for and no more.  The
+/// samples carry their own sequence numbers (the binary frames always, the
+/// lines if asked), so the PC can see where any went.
+class OutputRing
+{
+public:
+  OutputRing();
+
+  void setPolicy(uint8_t policy) { _policy = policy < OUTPUT_POLICY_COUNT ? policy : OUTPUT_DROP_OLDEST; }
+  uint8_t policy() const { return _policy; }
+
+  /// @brief Queue text.  Whatever doesn't fit is lost.
+  /// @return Bytes queued.
+  size_t writeText(const uint8_t *buffer, size_t size);
+  /// @brief Bytes of text that can still be queued.
+  size_t textSpace() const { return OUTPUT_TEXT_SIZE - (_textHead - _textTail); }
+
+  /// @brief Queue one sample, applying the policy if the slots are full.
+  /// @return false if it was dropped.
+  bool pushRecord(const uint8_t *buffer, size_t size);
+
+  /// @brief Send what out can take, from the front.
+  /// @param room Bytes out can take without waiting.
+  void drain(Print &out, size_t room);
+
+  /// @brief Bytes waiting to go.
+  size_t pending() const { return _pending; }
+
+  OutputStats stats() const { return _stats; }
+  void resetStats() { _stats = {}; }
+
+private:
+  //An entry is either a run of text, or a slot holding a record.
+  struct Entry
+  {
+    uint8_t slot;
+    uint16_t length;
+  };
+  static const uint8_t TEXT = 0xFF;
+  //Text runs only sit between records, so there are never more than one
+  //more of them than there are slots.
+  static const uint8_t ENTRIES = 2 * OUTPUT_RECORD_SLOTS + 1;
+
+  Entry &entry(uint8_t n) { return _entries[(_first + n) % ENTRIES]; }
+  void removeEntry(uint8_t n);
+  /// @brief Throw away record entries, oldest first, leaving the one part
+  /// way out alone.
+  /// @param all Every one, rather than just the oldest.
+  void dropRecords(bool all);
+
+  uint8_t _policy;
+
+  uint8_t _text[OUTPUT_TEXT_SIZE];
+  //Free running, masked on access.
+  uint32_t _textHead;
+  uint32_t _textTail;
+
+  uint8_t _records[OUTPUT_RECORD_SLOTS][OUTPUT_RECORD_MAX];
+  //Bit n set if slot n is free.
+  uint32_t _freeSlots;
+  uint8_t _queued;
+
+  Entry _entries[ENTRIES];
+  uint8_t _first;
+  uint8_t _count;
+  //How far into the first entry has gone out, for a record.
+  uint16_t _sent;
+  size_t _pending;
+
+  uint8_t _chunk[OUTPUT_CHUNK_SIZE];
+  OutputStats _stats;
+};
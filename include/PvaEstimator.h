@@ -0,0 +1,84 @@
+#pragma once
+#include <stdint.h>
+#include "EncoderScale.h"
+
+//Gains are sent in thousandths, as the alpha-beta filter's are.
+#define PVA_GAIN_SCALE 1000
+//Critically damped for alpha 0.8, see PvaEstimator.  That follows a
+//2.5 Hz swing at 100 samples a second to a couple of degrees, and the
+//noise is still well under a count.  tools/prediction_sim.py compares
+//others.
+#define PVA_DEFAULT_ALPHA 800
+#define PVA_DEFAULT_BETA 611
+#define PVA_DEFAULT_GAMMA 233
+//Furthest ahead (or back) predict() will go from the last sample.  Past a
+//second the acceleration term is more guess than estimate.
+#define PVA_MAX_PREDICT_US 1000000
+
+/// @brief Where the estimator has the shaft at some moment.
+struct PvaPrediction
+{
+  //Nearest whole count.
+  int64_t count;
+  //1/ENCODER_SCALE_ANGLE degrees, not wrapped, with the part of a count
+  //the estimate has, so it moves smoothly between counts.
+  int64_t angle;
+  //1/ENCODER_SCALE_RPM RPM.
+  int32_t rpm;
+  //1/ENCODER_SCALE_RPM RPM per second.
+  int32_t accel;
+};
+
+/// @brief Alpha-beta-gamma tracker on the count: position, velocity and
+/// acceleration, from the timestamped samples.  The same fixed point as
+/// AlphaBetaFilter with one more term, so it costs a few multiplies and
+/// divides a sample with no FPU.
+///
+/// What it adds is predict(), which carries the last count forward to any
+/// moment along the estimated velocity and acceleration, so the angle and
+/// RPM sent can be for when the PC gets them rather than for when the
+/// count was latched.
+///
+/// Gains are in 1/PVA_GAIN_SCALE.  For a given alpha the critically damped
+/// beta and gamma are beta = 2(2 - alpha) - 4 sqrt(1 - alpha) and
+/// gamma = beta^2 / (2 alpha), which is where the defaults come from.
+class PvaEstimator
+{
+public:
+  void setGains(uint32_t alpha, uint32_t beta, uint32_t gamma);
+  void setScale(const EncoderScale &scale) { _scale = scale; }
+  void reset() { _primed = false; }
+
+  uint32_t alpha() const { return _alphaSetting; }
+  uint32_t beta() const { return _betaSetting; }
+  uint32_t gamma() const { return _gammaSetting; }
+
+  /// @brief Feed a sample.
+  void update(int64_t count, int64_t timestampUs);
+
+  /// @brief The state carried on to atUs, along the estimated velocity and
+  /// acceleration.  Until the first sample it is all zero.
+  PvaPrediction predict(int64_t atUs) const;
+
+private:
+  uint32_t _alphaSetting = PVA_DEFAULT_ALPHA;
+  uint32_t _betaSetting = PVA_DEFAULT_BETA;
+  uint32_t _gammaSetting = PVA_DEFAULT_GAMMA;
+  //Gains, Q16.  Gamma is doubled here, as the correction needs it.
+  int64_t _alpha = ((int64_t)PVA_DEFAULT_ALPHA << 16) / PVA_GAIN_SCALE;
+  int64_t _beta = ((int64_t)PVA_DEFAULT_BETA << 16) / PVA_GAIN_SCALE;
+  int64_t _gamma2 = ((int64_t)PVA_DEFAULT_GAMMA << 17) / PVA_GAIN_SCALE;
+
+  EncoderScale _scale;
+  bool _primed = false;
+  int64_t _lastCount = 0;
+  int64_t _lastTimestampUs = 0;
+  //As AlphaBetaFilter: counts Q16 from _originCount, and counts per us
+  //Q32.
+  int64_t _originCount = 0;
+  int64_t _position = 0;
+  int64_t _velocity = 0;
+  //Counts per us per us, Q48.  1000 RPM/s at 1200 counts a rev is about
+  //5600.
+  int64_t _accel = 0;
+};
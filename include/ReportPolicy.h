@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+#include "Sampler.h"
+
+/// @brief When samples get sent to the PC.  Everything zero (or a
+/// decimation of 1) is how it has always been: a sample goes out whenever
+/// any count has moved, and nothing at all while the shaft is still.
+struct ReportSettings
+{
+  //Counts a channel has to move from what was last sent before it is worth
+  //sending again.  0 sends on any change, 1 ignores a one count dither.
+  uint32_t deadbandCounts;
+  //Never send more often than this, in ms.  Movement in between is not
+  //lost, the next sample sent has it.
+  uint32_t minIntervalMs;
+  //Send at least this often, in ms, moving or not, so the PC can tell a
+  //still shaft from a dead link.  0 for none.
+  uint32_t heartbeatMs;
+  //Below this speed, in whole RPM, only every slowDecimation'th sample that
+  //would have gone is sent.  Above it everything goes.
+  uint32_t slowRpm;
+  uint32_t slowDecimation;
+};
+
+/// @brief Why a sample was or wasn't sent.
+enum ReportDecision
+{
+  REPORT_SKIP = 0,
+  REPORT_MOVED,
+  REPORT_HEARTBEAT
+};
+
+/// @brief Decides, sample by sample, which ones are worth sending, so the
+/// link isn't full of lines for a shaft that is sat still or dithering by a
+/// count, but still gets every sample while it really turns.
+class ReportPolicy
+{
+public:
+  ReportPolicy();
+
+  void configure(const ReportSettings &settings);
+  const ReportSettings &settings() const { return _settings; }
+
+  /// @brief Look at a sample, and remember it as sent if it is to be.
+  /// @param sample The latched counts.
+  /// @param speedMilliRpm Fastest of the sample's channels, as an absolute
+  /// value in 1/ENCODER_SCALE_RPM RPM.
+  ReportDecision decide(const Sample &sample, int32_t speedMilliRpm);
+
+  uint32_t sent() const { return _sent; }
+  uint32_t skipped() const { return _skipped; }
+  void resetStats();
+
+private:
+  ReportSettings _settings;
+  int64_t _reported[SAMPLER_MAX_CHANNELS];
+  int64_t _lastReportUs;
+  uint32_t _slowCount;
+  uint32_t _sent;
+  uint32_t _skipped;
+};
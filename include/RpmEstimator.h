@@ -0,0 +1,84 @@
+#pragma once
+#include <stdint.h>
+#include "EncoderScale.h"
+
+//Below this many counts between two samples we stop trusting the count
+//difference (it is +/-1 count of quantisation on a handful of counts) and
+//time the edges instead.
+#define RPM_ESTIMATOR_MIN_COUNTS 4
+//If no edge turns up for this long the shaft is taken to be stopped.
+#define RPM_ESTIMATOR_STOP_TIMEOUT_US 3000000
+
+/// @brief Works out shaft speed from encoder counts and the time they were
+/// taken, rather than assuming the samples are exactly one loop interval
+/// apart.
+///
+/// At speed it divides the count change by the measured time between
+/// samples.  At low speed, where only a few counts (or none) turn up per
+/// sample, it switches to timing the edges themselves, the same idea as
+/// InterruptEncoder::microsTimeBetweenTicks, so the RPM doesn't just drop
+/// to zero between counts.  When no edge arrives the estimate is bounded
+/// by "one count in the time since the last edge", which makes it decay
+/// smoothly to a stop instead of holding its last value.
+class RpmEstimator
+{
+public:
+  RpmEstimator();
+
+  /// @brief Set the counts per rev (PPR and counting mode) to work the RPM
+  /// out with.
+  void setScale(const EncoderScale &scale) { _scale = scale; }
+  const EncoderScale &scale() const { return _scale; }
+
+  /// @brief Forget the history, e.g. after the count has been reset.  The
+  /// next update() just primes the estimator and reports zero.
+  void reset();
+
+  /// @brief Feed a sample.
+  /// @param count Encoder count.
+  /// @param timestampUs When the count was taken.
+  /// @return The new estimate, in 1/ENCODER_SCALE_RPM RPM.
+  int32_t update(int64_t count, int64_t timestampUs);
+
+  /// @brief Tell the estimator exactly when an edge happened, if something
+  /// (an edge capture interrupt, say) knows better than the sample time.
+  /// @param count Count just after the edge.
+  /// @param timestampUs Time of the edge.
+  void edge(int64_t count, int64_t timestampUs);
+
+  int32_t rpm() const { return _rpm; }
+
+  //Which method produced the last estimate, for diagnostics.
+  enum Method
+  {
+    Stopped,
+    CountDelta,
+    EdgePeriod,
+    Decaying
+  };
+  Method method() const { return _method; }
+
+private:
+  EncoderScale _scale;
+  bool _primed;
+
+  int64_t _lastCount;
+  int64_t _lastTimestampUs;
+
+  //The last place we saw the count change, and when.  This is the sample
+  //time unless edge() has told us something more precise.
+  int64_t _edgeCount;
+  int64_t _edgeTimestampUs;
+  //Whether that came from edge(), so is the edge's own time.
+  bool _edgeTimed;
+  //The same as at the last sample, which is where the edges since then
+  //are timed from.
+  int64_t _spanCount;
+  int64_t _spanTimestampUs;
+  bool _spanTimed;
+  int8_t _direction;
+
+  //1/ENCODER_SCALE_RPM RPM
+  int32_t _rpm;
+  Method _method;
+};
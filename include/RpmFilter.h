@@ -0,0 +1,160 @@
+#pragma once
+#include <stdint.h>
+#include "EncoderScale.h"
+
+//Largest window the boxcar and median filters will take.  Storage for it
+//is allocated statically whatever filter is in use.
+#define RPM_FILTER_MAX_WINDOW 32
+//Deepest EMA there is.  The filter holds the RPM with 8 more bits, up to
+//about 2^39, and multiplies that by the depth, so this keeps it well
+//inside 64 bits (and depth + 1 well away from wrapping to a divide by
+//zero).  A thousand samples is already a very long time constant.
+#define RPM_FILTER_MAX_DEPTH 1000
+//Alpha and beta for the tracker are sent and stored in thousandths.
+#define RPM_FILTER_GAIN_SCALE 1000
+
+/// @brief Which smoothing is applied to the raw RPM estimate.  The values
+/// are what goes over the serial link and into flash, so don't renumber.
+enum RpmFilterType
+{
+  RPM_FILTER_NONE = 0,
+  //Recursive rpm = (rpm * depth + new) / (depth + 1), which is what the
+  //'F' command has always done.
+  RPM_FILTER_EMA = 1,
+  //Plain average of the last depth estimates.
+  RPM_FILTER_BOXCAR = 2,
+  //Median of the last depth estimates.  Throws away single sample spikes.
+  RPM_FILTER_MEDIAN = 3,
+  //Alpha-beta tracker on the count itself, velocity is the output.
+  RPM_FILTER_ALPHA_BETA = 4,
+  RPM_FILTER_TYPE_COUNT
+};
+
+//All the filters work in 1/ENCODER_SCALE_RPM RPM, same as the estimator.
+
+/// @brief Exponential moving average, the original 'F' filter.
+class EmaFilter
+{
+public:
+  void setDepth(uint32_t depth) { _depth = depth; }
+  void reset() { _value = 0; }
+  int32_t update(int32_t x)
+  {
+    _value = ((_value * _depth) + ((int64_t)x << 8)) / (_depth + 1);
+    return (int32_t)((_value + 128) >> 8);
+  }
+
+private:
+  uint32_t _depth = 0;
+  //Carries 8 more bits than the output, so the truncation in the divide
+  //doesn't drag a steady value down by a count every sample.
+  int64_t _value = 0;
+};
+
+/// @brief Boxcar moving average over a fixed window, with a running sum so
+/// each sample costs the same whatever the window.
+class BoxcarFilter
+{
+public:
+  void setWindow(uint8_t window);
+  void reset();
+  int32_t update(int32_t x);
+
+private:
+  int32_t _history[RPM_FILTER_MAX_WINDOW];
+  uint8_t _window = 1;
+  uint8_t _next = 0;
+  uint8_t _filled = 0;
+  int64_t _sum = 0;
+};
+
+/// @brief Running median over a fixed window.  Keeps the window both in
+/// arrival order (to know what to drop) and sorted (to find the middle), so
+/// each sample is one linear remove and insert rather than a full sort.
+class MedianFilter
+{
+public:
+  void setWindow(uint8_t window);
+  void reset();
+  int32_t update(int32_t x);
+
+private:
+  int32_t _history[RPM_FILTER_MAX_WINDOW];
+  int32_t _sorted[RPM_FILTER_MAX_WINDOW];
+  uint8_t _window = 1;
+  uint8_t _next = 0;
+  uint8_t _filled = 0;
+};
+
+/// @brief Alpha-beta position/velocity tracker.  Rather than smoothing the
+/// RPM after the fact it tracks the count directly and predicts forward by
+/// the measured sample time, so there is less lag for the same noise.
+class AlphaBetaFilter
+{
+public:
+  /// @brief Gains in 1/RPM_FILTER_GAIN_SCALE.
+  void setGains(uint32_t alpha, uint32_t beta);
+  void setScale(const EncoderScale &scale) { _scale = scale; }
+  void reset() { _primed = false; }
+  int32_t update(int64_t count, int64_t timestampUs);
+
+private:
+  //Gains, Q16.
+  int64_t _alpha = 0x8000;
+  int64_t _beta = 0x1999;
+  EncoderScale _scale;
+  bool _primed = false;
+  int64_t _lastTimestampUs = 0;
+  //Position is kept relative to _originCount, so it never needs more than
+  //a fraction of a count plus the residual.  Counts, Q16.
+  int64_t _originCount = 0;
+  int64_t _position = 0;
+  //Counts per us, Q32.
+  int64_t _velocity = 0;
+};
+
+/// @brief The RPM filter stage.  All of the filters live here statically
+/// and the selected one is picked with a switch, so changing filter over
+/// serial never allocates.
+class RpmFilter
+{
+public:
+  RpmFilter();
+
+  /// @brief Pick the filter and its parameters.  Resets the filter state.
+  /// @param type One of RpmFilterType.
+  /// @param depth EMA depth, or window for boxcar and median.  Held to
+  /// RPM_FILTER_MAX_DEPTH.
+  /// @param alpha Tracker gain, in thousandths.
+  /// @param beta Tracker gain, in thousandths.
+  /// @return false (and nothing changed) if the type is unknown.
+  bool configure(uint8_t type, uint32_t depth, uint32_t alpha, uint32_t beta);
+
+  void setScale(const EncoderScale &scale) { _alphaBeta.setScale(scale); }
+
+  uint8_t type() const { return _type; }
+  uint32_t depth() const { return _depth; }
+  uint32_t alpha() const { return _alpha; }
+  uint32_t beta() const { return _beta; }
+
+  /// @brief Start again from nothing, e.g. after an encoder reset.
+  void reset();
+
+  /// @brief Run one sample through the selected filter.
+  /// @param rpm Raw estimate from the RpmEstimator.
+  /// @param count The count it came from, for the tracker.
+  /// @param timestampUs When the count was taken, for the tracker.
+  /// @return Filtered RPM.
+  int32_t update(int32_t rpm, int64_t count, int64_t timestampUs);
+
+private:
+  uint8_t _type;
+  uint32_t _depth;
+  uint32_t _alpha;
+  uint32_t _beta;
+
+  EmaFilter _ema;
+  BoxcarFilter _boxcar;
+  MedianFilter _median;
+  AlphaBetaFilter _alphaBeta;
+};
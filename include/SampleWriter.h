@@ -0,0 +1,38 @@
+#pragma once
+#include <Arduino.h>
+#include "OutputRing.h"
+
+//One sample's line or frame is built up in this, then queued whole.
+#define SAMPLE_WRITER_BUFFER_SIZE OUTPUT_RECORD_MAX
+
+/// @brief Builds each sample's output, then queues it on the output ring
+/// as one record, so the ring can drop it whole if the PC isn't keeping
+/// up, rather than as a handful of tiny print calls per sample.
+///
+/// It's a Print, so lines are built up with the usual print calls.  The
+/// sample is only queued on flush(), or if it somehow outgrows the buffer.
+class SampleWriter : public Print
+{
+public:
+  SampleWriter() : _out(nullptr), _used(0) {}
+
+  /// @brief Where flush() queues to.
+  void begin(OutputRing &out) { _out = &out; }
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+  /// @brief Print a scaled integer to two places, see FormatFixed().
+  size_t printFixed(int64_t value, uint32_t scale);
+
+  /// @brief Queue what has been built as one record.
+  void flush() override;
+
+  size_t pending() const { return _used; }
+
+private:
+  OutputRing *_out;
+  size_t _used;
+  uint8_t _buffer[SAMPLE_WRITER_BUFFER_SIZE];
+};
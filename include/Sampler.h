@@ -0,0 +1,96 @@
+#pragma once
+#include <stdint.h>
+#include <esp_timer.h>
+#include "EncoderBackend.h"
+#include "SpscQueue.h"
+
+//How many samples can pile up before loop() gets round to draining them.
+//At the fastest useful interval this is still a good few hundred ms of
+//slack for slow serial writes.
+#define SAMPLER_QUEUE_SIZE 32
+//One slot per PCNT unit.
+#define SAMPLER_MAX_CHANNELS MAX_ESP32_ENCODERS
+
+/// @brief One latched reading of every encoder, all taken in the same pass.
+struct Sample
+{
+  //esp_timer_get_time() at the moment the first count was read.
+  int64_t timestampUs;
+  //Bit n set if count[n] was read this pass.
+  uint8_t channelMask;
+  int64_t count[SAMPLER_MAX_CHANNELS];
+};
+
+/// @brief Period jitter figures for the sampling timer, in microseconds.
+/// These are measured from the timestamps the sampler itself takes, so they
+/// show exactly the cadence that the RPM maths sees.
+struct JitterStats
+{
+  uint32_t nominalUs;
+  int64_t minUs;
+  int64_t maxUs;
+  int64_t meanUs;
+  uint32_t periods;
+  uint32_t overruns;
+};
+
+/// @brief Reads the encoders on a periodic esp_timer, rather than whenever
+/// loop() happens to get round to it.  The timer callback latches the count
+/// of every channel and a timestamp into a lock free queue and loop() drains
+/// it at leisure, so slow serial output or flash writes no longer move the
+/// sample points.
+class Sampler
+{
+public:
+  Sampler();
+
+  /// @brief Create the timer and start sampling.
+  /// @param periodUs Sample period in microseconds.
+  bool begin(uint32_t periodUs);
+
+  /// @brief Say which encoder to read for a channel, or nullptr to stop
+  /// reading it.  Stop the sampler first if the encoder is about to be
+  /// attached or detached.
+  void setEncoder(uint8_t channel, Encoder *encoder);
+
+  /// @brief Stop the timer, e.g. while encoders are being reconfigured.
+  /// setPeriod() starts it again.
+  void stop();
+
+  /// @brief Change the sample period.  Restarts the timer and the jitter
+  /// figures.
+  void setPeriod(uint32_t periodUs);
+  uint32_t period() const { return _periodUs; }
+
+  /// @brief Take the oldest sample off the queue.  Only call from loop().
+  /// @return false if there are no samples waiting.
+  bool read(Sample &sample) { return _queue.pop(sample); }
+
+  /// @brief Snapshot of the period jitter since the last reset.
+  JitterStats jitter() const;
+
+  /// @brief Start the jitter figures again.  The timer callback does the
+  /// actual clearing, so there is no race with it.
+  void resetJitter() { _resetRequested = true; }
+
+private:
+  static void onTimer(void *arg);
+  void takeSample();
+
+  Encoder *_encoders[SAMPLER_MAX_CHANNELS];
+  esp_timer_handle_t _timer;
+  uint32_t _periodUs;
+  SpscQueue<Sample, SAMPLER_QUEUE_SIZE> _queue;
+
+  //Everything below is written only by the timer callback.  The 64 bit
+  //figures take two stores each, so the callback makes the sequence odd
+  //while it updates them, and jitter() reads them again if it changed.
+  volatile uint32_t _jitterSequence;
+  int64_t _lastTimestampUs;
+  volatile int64_t _minPeriodUs;
+  volatile int64_t _maxPeriodUs;
+  volatile int64_t _totalPeriodUs;
+  volatile uint32_t _periods;
+  volatile uint32_t _overruns;
+  volatile bool _resetRequested;
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include <stdint.h>
+#include "Preferences.h"
+#include "Channel.h"
+#include "ReportPolicy.h"
+#include "IndexHoming.h"
+#include "OutputRing.h"
+
+//All the settings now live in flash as one blob under this key, with a
+//small header in front: format version, length and a CRC of the data.
+#define PREFS_NAMESPACE "AngleReader"
+#define PREFS_SETTINGS "Settings"
+//1 first blob.
+//2 adds the report policy.
+//3 adds the index input.
+//4 adds the per channel glitch filter.
+//5 adds polled counting.
+//6 adds the output ring's policy and sample sequence numbers.
+#define SETTINGS_VERSION 6
+
+//The keys the firmware saved before the blob, one each, all for what is
+//now channel 0.  Only read to bring old settings across.
+#define PREFS_LOOP_INTERVAL "LoopInterval"
+#define PREFS_PULSE_PER_REV "PulsePerRev"
+#define PREFS_RPM_FILTER_DEPTH "RpmFilterDepth"
+
+//How long the settings have to be left alone before they go to flash.  A
+//GUI tweaking a setting sends a run of commands, this way they all end up
+//in a single write, and never in the middle of them.
+#define SETTINGS_QUIET_MS 2000
+
+/// @brief Everything that is saved.  Fields are only ever added on the
+/// end, with SETTINGS_VERSION bumped, so the blob from older firmware
+/// still loads: its data is copied over the defaults, and whatever it is
+/// too short to hold keeps the default value.
+struct SettingsData
+{
+  uint32_t loopInterval;
+  uint32_t outputFormat;
+  ChannelSettings channels[MAX_CHANNELS];
+  //Version 2.
+  ReportSettings report;
+  //Version 3.
+  IndexSettings index;
+  //Version 4.  Kept out of ChannelSettings so the channels above stay
+  //where they were.
+  uint32_t glitchFilter[MAX_CHANNELS];
+  //Version 5.  0 for the wrap interrupts, see Channel::pollMaxRpm.
+  uint32_t pollMaxRpm[MAX_CHANNELS];
+  //Version 6.  An OutputPolicy, and whether the lines carry the sample
+  //sequence number, see the 'O' command.
+  uint32_t outputPolicy;
+  uint32_t outputSequence;
+};
+
+/// @brief Where the settings came from at start up.
+enum SettingsSource
+{
+  SETTINGS_DEFAULTS = 0,
+  SETTINGS_LOADED,
+  SETTINGS_MIGRATED,
+  //The blob is from newer firmware, a later version or longer than this
+  //one knows.  Running on the defaults, and the blob is left as it is.
+  SETTINGS_NEWER
+};
+
+/// @brief Holds the settings and looks after getting them to and from
+/// flash.  Commands change the copy here and call markDirty(), and poll()
+/// writes the whole lot out once they have gone quiet, so the sampling
+/// loop never stops for a flash write per command.
+class Settings
+{
+public:
+  Settings();
+
+  /// @brief Read the blob, in one getBytes.  With no blob, or a damaged
+  /// one, the old per setting keys (PREFS_LOOP_INTERVAL and friends) are
+  /// read instead and saved as a blob.
+  /// A blob from newer firmware is never written over from here, or by
+  /// poll(), only by an explicit save(), so going back to the newer
+  /// firmware finds its settings still there.
+  /// @return Where the settings came from.
+  SettingsSource begin();
+
+  /// @brief The live copy.  Change it, then call markDirty().
+  SettingsData &data() { return _data; }
+
+  /// @brief Something in data() has changed and wants saving.
+  /// @param now millis().
+  void markDirty(unsigned long now);
+  bool dirty() const { return _dirty; }
+
+  /// @brief Save if there are changes and nothing else has changed for
+  /// SETTINGS_QUIET_MS.  Call on every pass of loop().  Does nothing
+  /// while newer firmware's blob is being kept, see begin().
+  /// @return true if it wrote to flash.
+  bool poll(unsigned long now);
+
+  /// @brief Save now, if there is anything to save, newer firmware's
+  /// blob or not.
+  /// @return true if it wrote to flash.
+  bool save();
+
+  /// @brief Number of times the blob has been written since power up.
+  uint32_t commits() const { return _commits; }
+
+  /// @brief The factory settings.
+  static void defaults(SettingsData &data);
+
+private:
+  /// @brief What goes in front of the data in flash.
+  struct Header
+  {
+    uint16_t version;
+    uint16_t length;
+    uint16_t crc;
+    uint16_t reserved;
+  };
+
+  bool load();
+  bool migrate();
+  bool commit();
+
+  Preferences _prefs;
+  SettingsData _data;
+  bool _dirty;
+  //The blob in flash is newer firmware's, and only save() replaces it.
+  bool _keep;
+  unsigned long _changedAt;
+  uint32_t _commits;
+};
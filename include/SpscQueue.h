@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/// @brief Fixed size, lock free queue for exactly one producer and one
+/// consumer, e.g. a timer callback handing samples to loop().  Nothing is
+/// allocated, and neither side ever blocks - push() fails when full and
+/// pop() fails when empty.
+/// @tparam T Item type, copied in and out.
+/// @tparam N Capacity, must be a power of two.
+template <typename T, size_t N>
+class SpscQueue
+{
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+  /// @brief Producer side.  Returns false (and drops the item) if full.
+  bool push(const T &item)
+  {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if(head - _tail.load(std::memory_order_acquire) == N)
+      return false;
+    _items[head & (N - 1)] = item;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Consumer side.  Returns false if there is nothing to take.
+  bool pop(T &item)
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if(_head.load(std::memory_order_acquire) == tail)
+      return false;
+    item = _items[tail & (N - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Approximate fill level, exact only when called from one side
+  /// while the other is idle.
+  size_t size() const
+  {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return N; }
+
+private:
+  T _items[N];
+  std::atomic<uint32_t> _head{0};
+  std::atomic<uint32_t> _tail{0};
+};
@@ -0,0 +1,291 @@
+#pragma once
+//Compact binary alternative to the ASCII "D ang pos rpm" line.
+//
+//This header has no Arduino dependencies on purpose, so the PC side can
+//drop it straight into its own build to decode what the board sends.
+//
+//Frame layout, all multi-byte fields little endian:
+//
+//  offset size  field
+//  0      1     sync, TELEMETRY_SYNC
+//  1      1     frame type, TELEMETRY_TYPE_SAMPLE
+//  2      2     sequence number, wraps, lets the PC spot dropped frames
+//  4      4     sample timestamp, low 32 bits of esp_timer_get_time() in us
+//  8      8     encoder count
+//  16     4     RPM * TELEMETRY_RPM_SCALE, signed
+//  20     2     CRC-16/CCITT-FALSE over bytes 1..19
+//
+//When more than one channel is enabled, each sample pass goes out as a
+//single multi channel frame instead, so extra channels only cost their
+//own data and not another header, timestamp and CRC each:
+//
+//  offset size  field
+//  0      1     sync, TELEMETRY_SYNC
+//  1      1     frame type, TELEMETRY_TYPE_MULTI
+//  2      2     sequence number (shared with sample frames)
+//  4      4     sample timestamp
+//  8      1     channel mask, bit n set if channel n is in the frame
+//  9      12*n  for each channel in the mask, lowest first:
+//                 8 byte count, 4 byte RPM * TELEMETRY_RPM_SCALE
+//  9+12n  2     CRC-16/CCITT-FALSE over bytes 1..8+12n
+//
+//With prediction on (the 'V' command) the count and RPM are the ones
+//predicted for the time in the timestamp, rather than those sampled then.
+//
+//ASCII text (command replies etc.) can be interleaved with frames on the
+//same link.  The sync byte is outside the ASCII range, so the decoder
+//simply skips the text.
+#include <stdint.h>
+#include <stddef.h>
+
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_TYPE_SAMPLE 0x01
+#define TELEMETRY_TYPE_MULTI 0x02
+#define TELEMETRY_RPM_SCALE 1000
+#define TELEMETRY_SAMPLE_FRAME_SIZE 22
+#define TELEMETRY_MAX_CHANNELS 8
+#define TELEMETRY_MULTI_HEADER_SIZE 9
+#define TELEMETRY_CHANNEL_SIZE 12
+#define TELEMETRY_MAX_FRAME_SIZE (TELEMETRY_MULTI_HEADER_SIZE + TELEMETRY_MAX_CHANNELS * TELEMETRY_CHANNEL_SIZE + 2)
+
+/// @brief The decoded contents of a sample frame.
+struct TelemetrySample
+{
+  uint16_t sequence;
+  uint32_t timestampUs;
+  int64_t count;
+  //RPM in thousandths, i.e. RPM * TELEMETRY_RPM_SCALE.
+  int32_t rpmMilli;
+};
+
+/// @brief The decoded contents of a multi channel frame.  Only the entries
+/// with their bit set in channelMask mean anything.
+struct TelemetryMultiSample
+{
+  uint16_t sequence;
+  uint32_t timestampUs;
+  uint8_t channelMask;
+  int64_t count[TELEMETRY_MAX_CHANNELS];
+  int32_t rpmMilli[TELEMETRY_MAX_CHANNELS];
+};
+
+/// @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), bitwise so that it
+/// needs no table in flash.
+inline uint16_t TelemetryCrc16(const uint8_t *data, size_t len, uint16_t crc = 0xFFFF)
+{
+  while(len--)
+  {
+    crc ^= (uint16_t)(*data++) << 8;
+    for(uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+inline void TelemetryPut(uint8_t *buf, uint64_t val, uint8_t bytes)
+{
+  for(uint8_t i = 0; i < bytes; i++)
+    buf[i] = (uint8_t)(val >> (8 * i));
+}
+
+inline uint64_t TelemetryGet(const uint8_t *buf, uint8_t bytes)
+{
+  uint64_t val = 0;
+  for(uint8_t i = 0; i < bytes; i++)
+    val |= (uint64_t)buf[i] << (8 * i);
+  return val;
+}
+
+/// @brief Build a sample frame.
+/// @param sample What to send.
+/// @param buf At least TELEMETRY_SAMPLE_FRAME_SIZE bytes.
+/// @return Number of bytes written, always TELEMETRY_SAMPLE_FRAME_SIZE.
+inline size_t EncodeTelemetrySample(const TelemetrySample &sample, uint8_t *buf)
+{
+  buf[0] = TELEMETRY_SYNC;
+  buf[1] = TELEMETRY_TYPE_SAMPLE;
+  TelemetryPut(buf + 2, sample.sequence, 2);
+  TelemetryPut(buf + 4, sample.timestampUs, 4);
+  TelemetryPut(buf + 8, (uint64_t)sample.count, 8);
+  TelemetryPut(buf + 16, (uint32_t)sample.rpmMilli, 4);
+  TelemetryPut(buf + 20, TelemetryCrc16(buf + 1, 19), 2);
+  return TELEMETRY_SAMPLE_FRAME_SIZE;
+}
+
+inline uint8_t TelemetryChannelsInMask(uint8_t mask)
+{
+  uint8_t n = 0;
+  for(; mask; mask >>= 1)
+    n += mask & 1;
+  return n;
+}
+
+/// @brief Build a multi channel frame.
+/// @param sample What to send.
+/// @param buf At least TELEMETRY_MAX_FRAME_SIZE bytes.
+/// @return Number of bytes written.
+inline size_t EncodeTelemetryMultiSample(const TelemetryMultiSample &sample, uint8_t *buf)
+{
+  buf[0] = TELEMETRY_SYNC;
+  buf[1] = TELEMETRY_TYPE_MULTI;
+  TelemetryPut(buf + 2, sample.sequence, 2);
+  TelemetryPut(buf + 4, sample.timestampUs, 4);
+  buf[8] = sample.channelMask;
+
+  size_t length = TELEMETRY_MULTI_HEADER_SIZE;
+  for(uint8_t i = 0; i < TELEMETRY_MAX_CHANNELS; i++)
+  {
+    if(!(sample.channelMask & (1 << i)))
+      continue;
+    TelemetryPut(buf + length, (uint64_t)sample.count[i], 8);
+    TelemetryPut(buf + length + 8, (uint32_t)sample.rpmMilli[i], 4);
+    length += TELEMETRY_CHANNEL_SIZE;
+  }
+  TelemetryPut(buf + length, TelemetryCrc16(buf + 1, length - 1), 2);
+  return length + 2;
+}
+
+/// @brief Byte at a time frame decoder for the receiving end.  Anything that
+/// is not a valid frame (ASCII replies, line noise, frames with a bad CRC)
+/// is skipped, and it resynchronises on the next sync byte.
+///
+/// Resynchronising rescans the bytes held since the bad sync byte, and
+/// there can be more than one whole frame among them, so take every frame
+/// a byte completes:
+///
+///   if(decoder.feed(b))
+///     do
+///       use(decoder);
+///     while(decoder.next());
+class TelemetryDecoder
+{
+public:
+  /// @brief Feed one received byte.
+  /// @return true if a valid frame is ready.  type() says which kind, and
+  /// sample() or multiSample() has its contents.
+  bool feed(uint8_t b)
+  {
+    //Never full here: next() leaves less than a whole frame, or has just
+    //taken one out.
+    _frame[_length++] = b;
+    return next();
+  }
+
+  /// @brief Look for another frame in the bytes already fed.
+  /// @return true if one is ready, as for feed().
+  bool next()
+  {
+    for(;;)
+    {
+      //Anything before a sync byte is text or noise.
+      uint8_t start = 0;
+      while(start < _length && _frame[start] != TELEMETRY_SYNC)
+        start++;
+      _skippedBytes += start;
+      drop(start);
+      if(_length < 2)
+        return false;
+
+      uint8_t expected;
+      if(_frame[1] == TELEMETRY_TYPE_SAMPLE)
+        expected = TELEMETRY_SAMPLE_FRAME_SIZE;
+      else if(_frame[1] == TELEMETRY_TYPE_MULTI)
+      {
+        if(_length < TELEMETRY_MULTI_HEADER_SIZE)
+          return false;
+        expected = TELEMETRY_MULTI_HEADER_SIZE + TelemetryChannelsInMask(_frame[8]) * TELEMETRY_CHANNEL_SIZE + 2;
+      }
+      else
+      {
+        resync();
+        continue;
+      }
+      if(_length < expected)
+        return false;
+
+      uint16_t crc = (uint16_t)TelemetryGet(_frame + expected - 2, 2);
+      if(crc != TelemetryCrc16(_frame + 1, expected - 3))
+      {
+        _crcErrors++;
+        resync();
+        continue;
+      }
+
+      decode();
+      drop(expected);
+      return true;
+    }
+  }
+
+  uint8_t type() const { return _type; }
+  const TelemetrySample &sample() const { return _sample; }
+  const TelemetryMultiSample &multiSample() const { return _multiSample; }
+
+  uint32_t skippedBytes() const { return _skippedBytes; }
+  uint32_t crcErrors() const { return _crcErrors; }
+  uint32_t lostFrames() const { return _lostFrames; }
+
+private:
+  /// @brief Take the contents out of the frame at the front.
+  void decode()
+  {
+    _type = _frame[1];
+    uint16_t sequence = (uint16_t)TelemetryGet(_frame + 2, 2);
+    uint32_t timestampUs = (uint32_t)TelemetryGet(_frame + 4, 4);
+    if(_type == TELEMETRY_TYPE_SAMPLE)
+    {
+      _sample.sequence = sequence;
+      _sample.timestampUs = timestampUs;
+      _sample.count = (int64_t)TelemetryGet(_frame + 8, 8);
+      _sample.rpmMilli = (int32_t)(uint32_t)TelemetryGet(_frame + 16, 4);
+    }
+    else
+    {
+      _multiSample.sequence = sequence;
+      _multiSample.timestampUs = timestampUs;
+      _multiSample.channelMask = _frame[8];
+      const uint8_t *p = _frame + TELEMETRY_MULTI_HEADER_SIZE;
+      for(uint8_t i = 0; i < TELEMETRY_MAX_CHANNELS; i++)
+      {
+        if(!(_multiSample.channelMask & (1 << i)))
+          continue;
+        _multiSample.count[i] = (int64_t)TelemetryGet(p, 8);
+        _multiSample.rpmMilli[i] = (int32_t)(uint32_t)TelemetryGet(p + 8, 4);
+        p += TELEMETRY_CHANNEL_SIZE;
+      }
+    }
+
+    //Sequence gaps mean the board (or the link) dropped frames.
+    if(_haveSequence)
+      _lostFrames += (uint16_t)(sequence - _lastSequence - 1);
+    _lastSequence = sequence;
+    _haveSequence = true;
+  }
+
+  /// @brief Throw away the sync byte we locked on to.  next() then rescans
+  /// the rest of the partial frame for another one.
+  void resync()
+  {
+    _skippedBytes++;
+    drop(1);
+  }
+
+  /// @brief Take n bytes off the front.
+  void drop(uint8_t n)
+  {
+    _length -= n;
+    for(uint8_t i = 0; i < _length; i++)
+      _frame[i] = _frame[i + n];
+  }
+
+  uint8_t _frame[TELEMETRY_MAX_FRAME_SIZE];
+  uint8_t _length = 0;
+  uint8_t _type = 0;
+  TelemetrySample _sample = {};
+  TelemetryMultiSample _multiSample = {};
+  uint16_t _lastSequence = 0;
+  bool _haveSequence = false;
+  uint32_t _skippedBytes = 0;
+  uint32_t _crcErrors = 0;
+  uint32_t _lostFrames = 0;
+};
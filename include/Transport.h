@@ -0,0 +1,115 @@
+#pragma once
+#include <Arduino.h>
+
+//How the PC is connected, picked at build time with -DTRANSPORT=...
+//  TRANSPORT_UART     a hardware UART at TRANSPORT_UART_BAUD.
+//  TRANSPORT_USB_CDC  the S2's native USB, where the baud rate means
+//                     nothing and the link is many times faster.
+//Left unset it is whatever Serial already is for the board, so the
+//default build talks to the PC exactly as it always has.
+#define TRANSPORT_UART 0
+#define TRANSPORT_USB_CDC 1
+
+#ifndef TRANSPORT
+#if ARDUINO_USB_CDC_ON_BOOT
+#define TRANSPORT TRANSPORT_USB_CDC
+#else
+#define TRANSPORT TRANSPORT_UART
+#endif
+#endif
+
+#ifndef TRANSPORT_UART_BAUD
+#define TRANSPORT_UART_BAUD 115200
+#endif
+
+#include "OutputRing.h"
+
+#if TRANSPORT == TRANSPORT_USB_CDC
+#include <USB.h>
+#include <USBCDC.h>
+#endif
+
+/// @brief The serial link to the PC.  It's a Stream, so everything that
+/// used to print to Serial prints to this instead, and the port behind it
+/// is chosen at build time.
+///
+/// Nothing printed goes straight to the port: it waits in the output ring
+/// (see OutputRing) until poll() hands the port what it has room for, so a
+/// slow or stalled reader never holds up the loop.
+class Transport : public Stream
+{
+public:
+  /// @param port What the output ring drains to.
+  explicit Transport(Print &port) : _link(port) {}
+
+  /// @brief Bring the link up.
+  virtual void begin() = 0;
+  /// @brief For the start up banner.
+  virtual const char *name() const = 0;
+  /// @brief How long a byte takes to go down the link, in ns, or 0 if it
+  /// is quick enough not to matter.
+  virtual uint32_t byteNs() const = 0;
+
+  /// @brief Send what the port can take now, without waiting.
+  void poll()
+  {
+    int room = _link.availableForWrite();
+    if(room > 0)
+      _output.drain(_link, room);
+  }
+  OutputRing &output() { return _output; }
+
+  int availableForWrite() override { return (int)_output.textSpace(); }
+  //Never waits, it's just poll().
+  void flush() override { poll(); }
+  size_t write(uint8_t c) override { return _output.writeText(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override { return _output.writeText(buffer, size); }
+  using Print::write;
+
+private:
+  Print &_link;
+  OutputRing _output;
+};
+
+/// @brief A hardware UART.
+class UartTransport : public Transport
+{
+public:
+  UartTransport(HardwareSerial &port, unsigned long baud) : Transport(port), _port(port), _baud(baud) {}
+
+  void begin() override { _port.begin(_baud); }
+  const char *name() const override { return "UART"; }
+  //Start, 8 data and stop bits.
+  uint32_t byteNs() const override { return (uint32_t)(10000000000ULL / _baud); }
+
+  int available() override { return _port.available(); }
+  int read() override { return _port.read(); }
+  int peek() override { return _port.peek(); }
+
+private:
+  HardwareSerial &_port;
+  unsigned long _baud;
+};
+
+#if TRANSPORT == TRANSPORT_USB_CDC
+/// @brief The native USB CDC port.
+class UsbCdcTransport : public Transport
+{
+public:
+  explicit UsbCdcTransport(USBCDC &port) : Transport(port), _port(port) {}
+
+  void begin() override;
+  const char *name() const override { return "USB CDC"; }
+  uint32_t byteNs() const override { return 0; }
+
+  int available() override { return _port.available(); }
+  int read() override { return _port.read(); }
+  int peek() override { return _port.peek(); }
+
+private:
+  USBCDC &_port;
+};
+#endif
+
+/// @brief The transport this build was made for.
+Transport &SelectedTransport();
@@ -19,6 +19,8 @@ enum puType ESP32Encoder::useInternalWeakPullResistors=DOWN;
 ESP32Encoder *ESP32Encoder::encoders[MAX_ESP32_ENCODERS] = { NULL, };
 
 bool ESP32Encoder::attachedInterrupt=false;
+volatile uint32_t ESP32Encoder::interruptCount=0;
+portMUX_TYPE ESP32Encoder::spinlock = portMUX_INITIALIZER_UNLOCKED;
 pcnt_isr_handle_t ESP32Encoder::user_isr_handle = NULL;
 
 ESP32Encoder::ESP32Encoder(bool always_interrupt_, enc_isr_cb_t enc_isr_cb, void* enc_isr_cb_data):
@@ -63,16 +65,24 @@ ESP32Encoder::~ESP32Encoder() {}
 static void IRAM_ATTR esp32encoder_pcnt_intr_handler(void *arg) {
 	ESP32Encoder * esp32enc = {};
 	uint32_t intr_status = PCNT.int_st.val;
+	ESP32Encoder::interruptCount++;
 	for (uint8_t i = 0; i < PCNT_UNIT_MAX; i++) {
 		if (intr_status & (BIT(i))) {
 			pcnt_unit_t unit = static_cast<pcnt_unit_t>(i);
 			esp32enc = ESP32Encoder::encoders[i];
-			if(PCNT.status_unit[i].COUNTER_H_LIM){
+			bool callback = false;
+			portENTER_CRITICAL_ISR(&ESP32Encoder::spinlock);
+			esp32enc->countSequence++;
+			// The hardware has already reset the counter to zero on reaching
+			// the limit, and may have counted on since.  Clearing it again
+			// here would throw those counts away.
+			if(esp32enc->polled){
+				// A wrap latched just before the switch to polling, which
+				// poll() has already taken care of.
+			} else if(PCNT.status_unit[i].COUNTER_H_LIM){
 				esp32enc->count += esp32enc->r_enc_config.counter_h_lim;
-				pcnt_counter_clear(unit);
 			} else if(PCNT.status_unit[i].COUNTER_L_LIM){
 				esp32enc->count += esp32enc->r_enc_config.counter_l_lim;
-				pcnt_counter_clear(unit);
 			} else if(esp32enc->always_interrupt && (PCNT.status_unit[i].thres0_lat || PCNT.status_unit[i].thres1_lat)) {
 				int16_t c;
 				pcnt_get_counter_value(unit, &c);
@@ -82,18 +92,23 @@ static void IRAM_ATTR esp32encoder_pcnt_intr_handler(void *arg) {
 				pcnt_event_enable(unit, PCNT_EVT_THRES_0);
 				pcnt_event_enable(unit, PCNT_EVT_THRES_1);
 				pcnt_counter_clear(unit);
-				if (esp32enc->_enc_isr_cb) {
-					esp32enc->_enc_isr_cb(esp32enc->_enc_isr_cb_data);
-				}
+				callback = esp32enc->_enc_isr_cb != nullptr;
 			}
 			PCNT.int_clr.val = BIT(i); // clear the interrupt
+			esp32enc->countSequence++;
+			portEXIT_CRITICAL_ISR(&ESP32Encoder::spinlock);
+			if (callback) {
+				esp32enc->_enc_isr_cb(esp32enc->_enc_isr_cb_data);
+			}
 		}
 	}
 }
 
 void ESP32Encoder::detatch(){
 	pcnt_counter_pause(unit);
+	pcnt_intr_disable(unit);
 	ESP32Encoder::encoders[unit]=NULL;
+	attached = false;
 
 }
 void ESP32Encoder::attach(int a, int b, enum encType et) {
@@ -209,9 +224,17 @@ void ESP32Encoder::attach(int a, int b, enum encType et) {
 		pcnt_event_enable(unit, PCNT_EVT_THRES_0);
 		pcnt_event_enable(unit, PCNT_EVT_THRES_1);
 	}
+	// Per edge interrupts need the ISR, so they win over polling.
+	if (always_interrupt) {
+		polled = false;
+	}
 	pcnt_counter_clear(unit);
-	pcnt_intr_enable(unit);
+	lastRaw = 0;
+	if (!polled) {
+		pcnt_intr_enable(unit);
+	}
 	pcnt_counter_resume(unit);
+	attached = true;
 
 }
 
@@ -227,20 +250,162 @@ void ESP32Encoder::attachFullQuad(int aPintNumber, int bPinNumber) {
 }
 
 void ESP32Encoder::setCount(int64_t value) {
-	count = value - getCountRaw();
+	int64_t raw;
+	int64_t wrap;
+	portENTER_CRITICAL(&spinlock);
+	countSequence++;
+	if (polled) {
+		lastRaw = getCountRaw();
+		count = value;
+		countSequence++;
+		portEXIT_CRITICAL(&spinlock);
+		return;
+	}
+	// Any wrap still waiting for the ISR will be added to count when it
+	// runs, so take it off now.
+	do {
+		wrap = pendingWrap();
+		raw = getCountRaw();
+	} while (wrap != pendingWrap());
+	count = value - raw - wrap;
+	countSequence++;
+	portEXIT_CRITICAL(&spinlock);
+}
+void IRAM_ATTR ESP32Encoder::offsetCount(int64_t delta) {
+	portENTER_CRITICAL_SAFE(&spinlock);
+	countSequence++;
+	count += delta;
+	countSequence++;
+	portEXIT_CRITICAL_SAFE(&spinlock);
+}
+bool ESP32Encoder::setPolled(bool value) {
+	if (value && always_interrupt) {
+		return false;
+	}
+	if (!attached) {
+		polled = value;
+		return true;
+	}
+	if (value == polled) {
+		return true;
+	}
+	int64_t raw;
+	int64_t wrap;
+	portENTER_CRITICAL(&spinlock);
+	countSequence++;
+	if (value) {
+		// Take in any wrap the ISR has yet to add, and carry on from the
+		// counter as it is.  A wrap the ISR is already on its way to
+		// handle is ignored there once polled is set.
+		do {
+			wrap = pendingWrap();
+			raw = getCountRaw();
+		} while (wrap != pendingWrap());
+		count += wrap + raw;
+		lastRaw = raw;
+		polled = true;
+		pcnt_intr_disable(unit);
+		PCNT.int_clr.val = BIT(unit);
+	} else {
+		// Wraps latched while polling were counted by poll(), so clear them
+		// before the interrupt goes back on.  Anything after the counter is
+		// read is the ISR's again.
+		do {
+			PCNT.int_clr.val = BIT(unit);
+			raw = getCountRaw();
+		} while (PCNT.int_raw.val & BIT(unit));
+		count += polledDelta(raw) - raw;
+		polled = false;
+		pcnt_intr_enable(unit);
+	}
+	countSequence++;
+	portEXIT_CRITICAL(&spinlock);
+	return true;
+}
+/* The counter goes back to zero at either limit, so it only holds the
+ * count modulo the limit.  Its movement since the last poll is taken as
+ * the shorter way round.
+ */
+int64_t IRAM_ATTR ESP32Encoder::polledDelta(int16_t raw) {
+	int32_t delta = (int32_t)raw - lastRaw;
+	if (delta > _INT16_MAX / 2) {
+		delta -= _INT16_MAX;
+	} else if (delta < -(_INT16_MAX / 2)) {
+		delta += _INT16_MAX;
+	}
+	return delta;
+}
+void IRAM_ATTR ESP32Encoder::poll() {
+	if (!polled) {
+		return;
+	}
+	int16_t raw;
+	portENTER_CRITICAL_SAFE(&spinlock);
+	countSequence++;
+	pcnt_get_counter_value(unit, &raw);
+	count += polledDelta(raw);
+	lastRaw = raw;
+	countSequence++;
+	portEXIT_CRITICAL_SAFE(&spinlock);
 }
 int64_t ESP32Encoder::getCountRaw() {
 	int16_t c;
 	pcnt_get_counter_value(unit, &c);
 	return c;
 }
+/* Counts the hardware has wrapped off the raw counter that the ISR has
+ * not yet added to count.  Non zero only in the short window between the
+ * PCNT hitting a limit and the interrupt being serviced.
+ */
+int64_t ESP32Encoder::pendingWrap() {
+	if (!(PCNT.int_st.val & BIT(unit))) {
+		return 0;
+	}
+	if (PCNT.status_unit[unit].COUNTER_H_LIM) {
+		return r_enc_config.counter_h_lim;
+	}
+	if (PCNT.status_unit[unit].COUNTER_L_LIM) {
+		return r_enc_config.counter_l_lim;
+	}
+	return 0;
+}
+EncoderSnapshot ESP32Encoder::getSnapshot() {
+	EncoderSnapshot snap;
+	uint32_t seq;
+	int64_t wrap;
+	// Sequence lock: if the ISR (or setCount) touched count while we were
+	// reading, or the hardware wrapped under us, just go round again.
+	do {
+		seq = countSequence;
+		if (polled) {
+			// Nothing to race with but poll(), and it bumps the sequence.
+			wrap = 0;
+			snap.count = count + polledDelta(getCountRaw());
+		} else {
+			wrap = pendingWrap();
+			snap.count = count + getCountRaw();
+		}
+		snap.timestampUs = esp_timer_get_time();
+	} while ((seq & 1) || seq != countSequence || wrap != pendingWrap());
+	snap.count += wrap;
+	return snap;
+}
 int64_t ESP32Encoder::getCount() {
-	return count + getCountRaw();
+	return getSnapshot().count;
 }
 
 int64_t ESP32Encoder::clearCount() {
+	esp_err_t er;
+	portENTER_CRITICAL(&spinlock);
+	countSequence++;
 	count = 0;
-	return pcnt_counter_clear(unit);
+	er = pcnt_counter_clear(unit);
+	lastRaw = 0;
+	// A wrap the ISR has yet to see no longer means anything.
+	PCNT.int_clr.val = BIT(unit);
+	countSequence++;
+	portEXIT_CRITICAL(&spinlock);
+	return er;
 }
 
 int64_t ESP32Encoder::pauseCount() {
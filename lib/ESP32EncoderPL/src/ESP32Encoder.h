@@ -2,6 +2,7 @@
 #include <Arduino.h>
 #include <driver/gpio.h>
 #include <driver/pcnt.h>
+#include <esp_timer.h>
 #define MAX_ESP32_ENCODERS PCNT_UNIT_MAX
 #define 	_INT16_MAX 32766
 #define  	_INT16_MIN -32766
@@ -23,6 +24,15 @@ class ESP32Encoder;
 
 typedef void (*enc_isr_cb_t)(void*);
 
+/**
+ * @brief A count and the time it was read, taken together so that neither
+ * can be torn by a wrap interrupt landing part way through.
+ */
+struct EncoderSnapshot {
+	int64_t count;
+	int64_t timestampUs; // esp_timer_get_time()
+};
+
 class ESP32Encoder {
 public:
 	/**
@@ -39,14 +49,49 @@ public:
 	void attachFullQuad(int aPintNumber, int bPinNumber);
 	void attachSingleEdge(int aPintNumber, int bPinNumber);
 	int64_t getCount();
+	/**
+	 * @brief Read the count and a timestamp as one consistent pair.
+	 *
+	 * The 64 bit count is kept partly in software and partly in the 16 bit
+	 * PCNT register, and a wrap interrupt can land between reading the two.
+	 * This retries (lock free) until it gets a read that no wrap interrupt
+	 * touched, and allows for a wrap the hardware has done but the ISR has
+	 * not yet got round to.
+	 */
+	EncoderSnapshot getSnapshot();
 	int64_t clearCount();
 	int64_t pauseCount();
 	int64_t resumeCount();
 	void detatch();
 	boolean isAttached(){return attached;}
 	void setCount(int64_t value);
+	/**
+	 * @brief Move the count by delta, leaving whatever it has counted since
+	 * alone.  Unlike setCount() nothing read earlier has to still be true,
+	 * so it is exact however fast the shaft turns.  Safe from an ISR.
+	 */
+	void offsetCount(int64_t delta);
+	/**
+	 * @brief Count without the limit interrupts.  The PCNT counter is left
+	 * to go round on its own, and poll() adds whatever it has moved since
+	 * the last poll to count.  The counter only holds the count modulo its
+	 * limit, so poll() has to be called before it can move
+	 * _INT16_MAX / 2 counts, or it takes the movement the wrong way round.
+	 * Can be switched either way while attached, keeping the count.
+	 *
+	 * @return false if always_interrupt is set, which needs the interrupt.
+	 */
+	bool setPolled(bool value);
+	bool isPolled(){return polled;}
+	/**
+	 * @brief Fold the counter's movement since the last poll into count.
+	 * Does nothing unless polled.  Safe from an ISR.
+	 */
+	void poll();
 	void setFilter(uint16_t value);
 	static ESP32Encoder *encoders[MAX_ESP32_ENCODERS];
+	// Runs of the PCNT interrupt handler, for all units, since power up.
+	static volatile uint32_t interruptCount;
 	bool always_interrupt;
 	gpio_num_t aPinNumber;
 	gpio_num_t bPinNumber;
@@ -54,6 +99,14 @@ public:
 	bool fullQuad=false;
 	int countsMode = 2;
 	volatile int64_t count=0;
+	// Bumped by anything writing count, odd while a write is in progress.
+	volatile uint32_t countSequence=0;
+	// Serialises writers of count (the ISR, setCount, clearCount) across cores.
+	static portMUX_TYPE spinlock;
+	// Polled mode, see setPolled(): the ISR leaves count alone, and lastRaw
+	// is the counter as of the last poll, which count includes.
+	volatile bool polled=false;
+	volatile int16_t lastRaw=0;
 	pcnt_config_t r_enc_config;
 	static enum puType useInternalWeakPullResistors;
 	enc_isr_cb_t _enc_isr_cb;
@@ -64,6 +117,8 @@ private:
 	static bool attachedInterrupt;
 	void attach(int aPintNumber, int bPinNumber, enum encType et);
 	int64_t getCountRaw();
+	int64_t pendingWrap();
+	int64_t polledDelta(int16_t raw);
 	bool attached;
   bool direction;
   bool working;
@@ -5,36 +5,82 @@
  *      Author: hephaestus
  */
 #include "InterruptEncoder.h"
-void IRAM_ATTR encoderAISR(void * arg) {
+#include "soc/gpio_reg.h"
+
+// Marks a transition where both pins changed.
+#define QUAD_ILLEGAL 2
+
+// Indexed by (old state << 2) | new state, state being (A << 1) | B.  B
+// leading A counts up, as the old A only decoder did: 00 01 11 10 00 ...
+static const DRAM_ATTR int8_t quadTable[16] = {
+	0,  +1, -1, QUAD_ILLEGAL,
+	-1, 0,  QUAD_ILLEGAL, +1,
+	+1, QUAD_ILLEGAL, 0,  -1,
+	QUAD_ILLEGAL, -1, +1, 0
+};
+
+static volatile uint32_t *inputRegister(int pin) {
+	return (volatile uint32_t *) (pin < 32 ? GPIO_IN_REG : GPIO_IN1_REG);
+}
+
+static uint32_t inputMask(int pin) {
+	return 1UL << (pin < 32 ? pin : pin - 32);
+}
+
+void IRAM_ATTR InterruptEncoder::isr(void * arg) {
 	InterruptEncoder* object=(InterruptEncoder*)arg;
-	long start = micros();
-	long duration=start - object->microsLastA;
-	if (duration >= US_DEBOUNCE) {
-		object->microsLastA = start;
-		object->microsTimeBetweenTicks=duration;
-		object->aState = digitalRead(object->apin);
-		object->bState = digitalRead(object->bpin);
-		if (object->aState == object->bState)
-			object->count++;
-		else
-			object->count--;
-	}
+	uint8_t now = ((*object->aReg & object->aMask) ? 2 : 0) | ((*object->bReg & object->bMask) ? 1 : 0);
+	int8_t step = quadTable[(object->state << 2) | now];
+	object->state = now;
+	if (step == QUAD_ILLEGAL)
+		object->illegal = object->illegal + 1;
+	else
+		object->count = object->count + step;
 }
+
 InterruptEncoder::InterruptEncoder() {}
 InterruptEncoder::~InterruptEncoder() {
-	if(attached)
-		detachInterrupt(digitalPinToInterrupt(apin));
+	detach();
+}
+
+uint8_t InterruptEncoder::readState() {
+	return ((*aReg & aMask) ? 2 : 0) | ((*bReg & bMask) ? 1 : 0);
 }
-int64_t  InterruptEncoder::read(){
-	return count*2;
+
+int64_t IRAM_ATTR InterruptEncoder::read(){
+	// Unsigned difference, so the ISR's count can wrap.
+	int32_t raw = count;
+	total += (int32_t) ((uint32_t) raw - (uint32_t) lastRaw);
+	lastRaw = raw;
+	return total;
 }
+
 void InterruptEncoder::attach(int aPinNum, int bPinNum) {
 	if(attached)
 		return;
 	apin = aPinNum;
 	bpin = bPinNum;
+	aReg = inputRegister(apin);
+	bReg = inputRegister(bpin);
+	aMask = inputMask(apin);
+	bMask = inputMask(bpin);
 	pinMode(apin, INPUT_PULLUP);
 	pinMode(bpin, INPUT_PULLUP);
-	attachInterruptArg(digitalPinToInterrupt(apin), encoderAISR,this, CHANGE);
+	count = 0;
+	illegal = 0;
+	total = 0;
+	lastRaw = 0;
+	// Start from where the pins are, or the first edge could look illegal.
+	state = readState();
+	attachInterruptArg(digitalPinToInterrupt(apin), isr, this, CHANGE);
+	attachInterruptArg(digitalPinToInterrupt(bpin), isr, this, CHANGE);
+	attached = true;
 }
 
+void InterruptEncoder::detach() {
+	if(!attached)
+		return;
+	detachInterrupt(digitalPinToInterrupt(apin));
+	detachInterrupt(digitalPinToInterrupt(bpin));
+	attached = false;
+}
@@ -9,14 +9,36 @@
 #define INTERRUPTENCODER_H_
 
 #define MAX_ENCODERS 16
-#define US_DEBOUNCE 10
 #include <Arduino.h>
 
+/**
+ * Quadrature decoder on plain GPIO interrupts, for pins or boards that
+ * have run out of PCNT units.
+ *
+ * Both pins interrupt on every change.  The ISR reads the two pins straight
+ * from the GPIO input registers, and looks the old and new A/B state up in
+ * a 16 entry table, which gives +1, -1, no change, or illegal (both pins
+ * changed at once, i.e. an edge was missed).  Illegal transitions don't
+ * move the count, they are counted on their own as a measure of how
+ * badly the ISR is keeping up, or how noisy the lines are.
+ *
+ * Counts are full quadrature, 4 per line, the same as ESP32Encoder's
+ * attachFullQuad().
+ */
 class InterruptEncoder {
 private:
-bool attached=false;
-
+	bool attached=false;
+	// Input register and bit for each pin, worked out once at attach.
+	volatile uint32_t *aReg=nullptr;
+	volatile uint32_t *bReg=nullptr;
+	uint32_t aMask=0;
+	uint32_t bMask=0;
+	// read() widens the ISR's 32 bit count to 64 bits.  Only touched by
+	// read(), never the ISR.
+	int64_t total=0;
+	int32_t lastRaw=0;
 
+	uint8_t readState();
 
 public:
 
@@ -25,12 +47,30 @@ public:
 	InterruptEncoder();
 	virtual ~InterruptEncoder();
 	void attach(int aPinNum, int bPinNum);
-	volatile bool aState=0;
-	volatile bool bState=0;
-	volatile int64_t count=0;
-	volatile int64_t microsLastA=0;
-	volatile int64_t microsTimeBetweenTicks=0;
+	void detach();
+	bool isAttached() const { return attached; }
+
+	// Written only by the ISR.  32 bits, so a read or write of it is a
+	// single instruction and never torn.
+	volatile uint8_t state=0;
+	volatile int32_t count=0;
+	volatile uint32_t illegal=0;
+
+	/**
+	 * Count since attach, in full quadrature counts.  Has to be called at
+	 * least every 2^31 counts to keep track of the wrap of the ISR's count.
+	 */
 	int64_t read();
+	/**
+	 * Number of transitions where both pins had changed since the last
+	 * interrupt.
+	 */
+	uint32_t illegalTransitions() const { return illegal; }
+
+	/**
+	 * The pin interrupt.  Public so it can be timed on its own.
+	 */
+	static void isr(void *arg);
 };
 
 #endif /* INTERRUPTENCODER_H_ */
@@ -0,0 +1,348 @@
+#include "Arduino.h"
+#include "SimHAL.h"
+#include "soc/gpio_reg.h"
+#include "driver/gpio.h"
+#include "USB.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <chrono>
+#include <deque>
+
+HardwareSerial Serial;
+EspClass ESP;
+ESPUSB USB;
+
+//-----------------------------------------------------------------------------
+// Time
+//-----------------------------------------------------------------------------
+
+unsigned long millis()
+{
+  return (unsigned long)(SimNowUs() / 1000);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)SimNowUs();
+}
+
+void delay(uint32_t ms)
+{
+  SimAdvanceUs((int64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  SimAdvanceUs(us);
+}
+
+uint32_t EspClass::getCycleCount()
+{
+  using namespace std::chrono;
+  uint64_t ns = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+  return (uint32_t)(ns * getCpuFreqMHz() / 1000);
+}
+
+//-----------------------------------------------------------------------------
+// GPIO
+//-----------------------------------------------------------------------------
+
+#define SIM_GPIO_COUNT 48
+
+struct SimPin
+{
+  int level;
+  void (*handler)(void *);
+  void *arg;
+  int mode;
+  //Set by SimSetPin(), after which the pull up no longer decides the level.
+  bool driven;
+};
+
+static SimPin _pins[SIM_GPIO_COUNT];
+volatile uint32_t SimGpioIn[2] = {0, 0};
+
+/// @brief Set a pin's level, and its bit in the input registers.
+static void SetLevel(uint8_t pin, int level)
+{
+  _pins[pin].level = level ? HIGH : LOW;
+  uint32_t mask = 1UL << (pin % 32);
+  if(level)
+    SimGpioIn[pin / 32] |= mask;
+  else
+    SimGpioIn[pin / 32] &= ~mask;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if(pin >= SIM_GPIO_COUNT)
+    return;
+  //Pull ups read high until something drives the pin.  Setting the mode
+  //again, as a re-attach does, leaves a driven line where it is.
+  if(mode == INPUT_PULLUP && !_pins[pin].driven)
+    SetLevel(pin, HIGH);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if(pin < SIM_GPIO_COUNT)
+    SetLevel(pin, val);
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pin < SIM_GPIO_COUNT ? _pins[pin].level : LOW;
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode)
+{
+  if(pin >= SIM_GPIO_COUNT)
+    return;
+  _pins[pin].handler = handler;
+  _pins[pin].arg = arg;
+  _pins[pin].mode = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  if(pin < SIM_GPIO_COUNT)
+    _pins[pin].handler = nullptr;
+}
+
+void SimSetPin(uint8_t pin, int level)
+{
+  if(pin >= SIM_GPIO_COUNT)
+    return;
+
+  SimPin &p = _pins[pin];
+  int old = p.level;
+  p.driven = true;
+  SetLevel(pin, level);
+  if(p.handler == nullptr || old == p.level)
+    return;
+
+  bool rising = p.level == HIGH;
+  if(p.mode == CHANGE || (p.mode == RISING && rising) || (p.mode == FALLING && !rising))
+    p.handler(p.arg);
+}
+
+int SimGetPin(uint8_t pin)
+{
+  return digitalRead(pin);
+}
+
+void gpio_pad_select_gpio(uint32_t gpio_num)
+{
+  (void)gpio_num;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+  (void)gpio_num;
+  (void)mode;
+  return ESP_OK;
+}
+
+esp_err_t gpio_pullup_en(gpio_num_t gpio_num)
+{
+  pinMode(gpio_num, INPUT_PULLUP);
+  return ESP_OK;
+}
+
+esp_err_t gpio_pulldown_en(gpio_num_t gpio_num)
+{
+  (void)gpio_num;
+  return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+  return digitalRead(gpio_num);
+}
+
+//-----------------------------------------------------------------------------
+// Print
+//-----------------------------------------------------------------------------
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while(size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(long n, int base)
+{
+  if(base == DEC)
+    return print((long long)n, base);
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  return print((unsigned long long)n, base);
+}
+
+size_t Print::print(long long n, int base)
+{
+  if(base != DEC)
+    return print((unsigned long long)n, base);
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%" PRId64, (int64_t)n);
+  return write(buf);
+}
+
+size_t Print::print(unsigned long long n, int base)
+{
+  char buf[24];
+  snprintf(buf, sizeof(buf), base == HEX ? "%" PRIX64 : "%" PRIu64, (uint64_t)n);
+  return write(buf);
+}
+
+size_t Print::print(double n, int digits)
+{
+  //The real core prints these as words rather than digits.
+  if(isnan(n))
+    return print("nan");
+  if(isinf(n))
+    return print("inf");
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+//-----------------------------------------------------------------------------
+// Serial
+//-----------------------------------------------------------------------------
+
+static std::deque<uint8_t> _serialRx;
+static void (*_serialSink)(const uint8_t *, size_t, void *) = nullptr;
+static void *_serialSinkArg = nullptr;
+static uint64_t _serialBytesWritten = 0;
+static int64_t _serialSentUs = 0;
+static bool _serialStalled = false;
+
+void SimSerialInject(const char *data, size_t len)
+{
+  _serialRx.insert(_serialRx.end(), data, data + len);
+}
+
+void SimSerialInject(const char *str)
+{
+  SimSerialInject(str, strlen(str));
+}
+
+void SimSerialSetSink(void (*sink)(const uint8_t *data, size_t len, void *arg), void *arg)
+{
+  _serialSink = sink;
+  _serialSinkArg = arg;
+}
+
+uint64_t SimSerialBytesWritten()
+{
+  return _serialBytesWritten;
+}
+
+int64_t SimSerialSentUs()
+{
+  return _serialSentUs;
+}
+
+void SimSerialStall(bool stalled)
+{
+  _serialStalled = stalled;
+}
+
+void SimSerialLink::configure(uint32_t bytesPerSecond, size_t bufferSize)
+{
+  _bytesPerSecond = bytesPerSecond;
+  _bufferSize = bufferSize;
+  _buffered = 0;
+  _drainedUs = SimNowUs();
+}
+
+void SimSerialLink::drain()
+{
+  //Nothing goes while the PC isn't reading, and the time doesn't count.
+  if(_serialStalled)
+  {
+    _drainedUs = SimNowUs();
+    return;
+  }
+  if(_bytesPerSecond == 0)
+  {
+    _buffered = 0;
+    return;
+  }
+  int64_t now = SimNowUs();
+  size_t gone = (size_t)((now - _drainedUs) * _bytesPerSecond / 1000000);
+  if(gone == 0)
+    return;
+  //Only move the drain time on by what the bytes took, so the fractions
+  //aren't lost.
+  _drainedUs += (int64_t)gone * 1000000 / _bytesPerSecond;
+  if(gone >= _buffered)
+  {
+    _buffered = 0;
+    _drainedUs = now;
+  }
+  else
+  {
+    _buffered -= gone;
+  }
+}
+
+int SimSerialLink::available()
+{
+  return (int)_serialRx.size();
+}
+
+int SimSerialLink::read()
+{
+  if(_serialRx.empty())
+    return -1;
+  uint8_t b = _serialRx.front();
+  _serialRx.pop_front();
+  return b;
+}
+
+int SimSerialLink::peek()
+{
+  return _serialRx.empty() ? -1 : _serialRx.front();
+}
+
+int SimSerialLink::availableForWrite()
+{
+  drain();
+  return (int)(_bufferSize - _buffered);
+}
+
+size_t SimSerialLink::write(const uint8_t *buffer, size_t size)
+{
+  size_t left = size;
+  while(left > 0)
+  {
+    size_t room = (size_t)availableForWrite();
+    if(room == 0)
+    {
+      //Wait for one byte time, the way the driver would block.  Only a
+      //stall fills a link with no drain rate.
+      SimAdvanceUs(_bytesPerSecond != 0 ? 1000000 / _bytesPerSecond + 1 : 100);
+      continue;
+    }
+    size_t n = left < room ? left : room;
+    if(_bytesPerSecond != 0 || _serialStalled)
+      _buffered += n;
+    _serialBytesWritten += n;
+    //Whatever is buffered goes first.
+    _serialSentUs = SimNowUs() + (_bytesPerSecond != 0 ? (int64_t)_buffered * 1000000 / _bytesPerSecond : 0);
+    if(_serialSink)
+      _serialSink(buffer, n, _serialSinkArg);
+    else
+      fwrite(buffer, 1, n, stdout);
+    buffer += n;
+    left -= n;
+  }
+  return size;
+}
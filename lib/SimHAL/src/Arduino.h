@@ -0,0 +1,152 @@
+#pragma once
+//Stand-in for the bits of the Arduino-ESP32 core the firmware uses.  Time
+//is simulated (see SimHAL.h), so delay() returns straight away having
+//moved the clock on, and a run is the same every time.
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+//No IRAM or DRAM to put things in on the host.
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define INPUT_PULLDOWN 0x09
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define LED_BUILTIN 15
+
+#define DEC 10
+#define HEX 16
+
+#ifndef BIT
+#define BIT(nr) (1UL << (nr))
+#endif
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+#define digitalPinToInterrupt(p) (p)
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+/// @brief Just enough of Arduino's Print for the firmware: everything ends
+/// up in write(), and numbers are formatted the same way the real core
+/// does it (two decimal places for floating point).
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const char str[]) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(long long n, int base = DEC);
+  size_t print(unsigned long long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println() { return print("\r\n"); }
+  template <typename T>
+  size_t println(T val) { size_t n = print(val); return n + println(); }
+  template <typename T>
+  size_t println(T val, int format) { size_t n = print(val, format); return n + println(); }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+/// @brief A simulated serial link: a transmit buffer drained at a fixed
+/// rate in simulated time.  Writing into a full buffer waits (moves the
+/// clock on) until there's room, as the real drivers block.  Everything
+/// sent goes to stdout or the SimSerialSetSink() sink; everything read
+/// comes from SimSerialInject().
+class SimSerialLink
+{
+public:
+  /// @param bytesPerSecond Drain rate, 0 for as fast as it's written.
+  /// @param bufferSize Transmit buffer size.
+  void configure(uint32_t bytesPerSecond, size_t bufferSize);
+  int available();
+  int read();
+  int peek();
+  int availableForWrite();
+  size_t write(const uint8_t *buffer, size_t size);
+
+private:
+  void drain();
+
+  uint32_t _bytesPerSecond = 0;
+  size_t _bufferSize = 256;
+  size_t _buffered = 0;
+  int64_t _drainedUs = 0;
+};
+
+/// @brief The UART.  Drains at baud/10 bytes a second out of the 128 byte
+/// hardware FIFO.
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) { _link.configure(baud / 10, 128); }
+  void end() {}
+  int available() override { return _link.available(); }
+  int read() override { return _link.read(); }
+  int peek() override { return _link.peek(); }
+  int availableForWrite() override { return _link.availableForWrite(); }
+  void flush() override {}
+  size_t write(uint8_t c) override { return _link.write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override { return _link.write(buffer, size); }
+  using Print::write;
+  operator bool() const { return true; }
+
+private:
+  SimSerialLink _link;
+};
+
+extern HardwareSerial Serial;
+
+/// @brief Stand-in for the ESP object.  getCycleCount() is the host's own
+/// monotonic clock scaled to the S2's 240 MHz, not the simulated one, so
+/// that code timed with it on the host gives real (host) costs.
+class EspClass
+{
+public:
+  uint32_t getCycleCount();
+  uint32_t getCpuFreqMHz() { return 240; }
+  uint32_t getFreeHeap() { return 320 * 1024; }
+};
+
+extern EspClass ESP;
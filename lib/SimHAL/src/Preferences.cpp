@@ -0,0 +1,152 @@
+#include "Preferences.h"
+#include "SimHAL.h"
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+//namespace -> key -> value.  Lives as long as the process, the same way
+//flash outlives a reboot.
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> _store;
+static uint32_t _writes = 0;
+
+//Rough time an NVS write holds up the caller on the S2, entry write plus
+//the odd page erase averaged in.  The clock moves on by this much for each
+//one, so a flash write in loop() shows up as a loop() that took that long.
+#define SIM_PREFS_WRITE_US 6000
+
+static void FlashWrite()
+{
+  _writes++;
+  SimAdvanceUs(SIM_PREFS_WRITE_US);
+}
+
+uint32_t SimPrefsWrites()
+{
+  return _writes;
+}
+
+void SimPrefsClear()
+{
+  _store.clear();
+  _writes = 0;
+}
+
+void SimPrefsSeed(const char *name, const char *key, int32_t value)
+{
+  const uint8_t *bytes = (const uint8_t *)&value;
+  _store[name][key] = std::vector<uint8_t>(bytes, bytes + sizeof(value));
+}
+
+bool Preferences::begin(const char *name, bool readOnly, const char *partition_label)
+{
+  (void)partition_label;
+  //NVS namespaces are limited to 15 characters.
+  if(name == nullptr || strlen(name) > 15)
+    return false;
+  strcpy(_name, name);
+  _readOnly = readOnly;
+  _started = true;
+  return true;
+}
+
+void Preferences::end()
+{
+  _started = false;
+}
+
+bool Preferences::clear()
+{
+  if(!_started || _readOnly)
+    return false;
+  _store[_name].clear();
+  FlashWrite();
+  return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+  if(!_started || _readOnly)
+    return false;
+  bool removed = _store[_name].erase(key) > 0;
+  if(removed)
+    FlashWrite();
+  return removed;
+}
+
+bool Preferences::isKey(const char *key)
+{
+  if(!_started)
+    return false;
+  return _store[_name].count(key) > 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+  //NVS keys are limited to 15 characters too.
+  if(!_started || _readOnly || key == nullptr || strlen(key) > 15)
+    return 0;
+  const uint8_t *bytes = (const uint8_t *)value;
+  _store[_name][key] = std::vector<uint8_t>(bytes, bytes + len);
+  FlashWrite();
+  return len;
+}
+
+size_t Preferences::putUChar(const char *key, uint8_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+size_t Preferences::putLong(const char *key, int32_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+size_t Preferences::putULong(const char *key, uint32_t value)
+{
+  return putBytes(key, &value, sizeof(value));
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+  if(!_started)
+    return 0;
+  auto &ns = _store[_name];
+  auto it = ns.find(key);
+  return it == ns.end() ? 0 : it->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen)
+{
+  size_t len = getBytesLength(key);
+  if(len == 0 || len > maxLen)
+    return 0;
+  memcpy(buf, _store[_name][key].data(), len);
+  return len;
+}
+
+/// @brief Fixed size getter.  Like NVS, a key stored as a different size
+/// reads back as the default.
+template <typename T>
+static T GetValue(Preferences &prefs, const char *key, T defaultValue)
+{
+  T value;
+  if(prefs.getBytesLength(key) != sizeof(T) || prefs.getBytes(key, &value, sizeof(T)) != sizeof(T))
+    return defaultValue;
+  return value;
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue)
+{
+  return GetValue(*this, key, defaultValue);
+}
+
+int32_t Preferences::getLong(const char *key, int32_t defaultValue)
+{
+  return GetValue(*this, key, defaultValue);
+}
+
+uint32_t Preferences::getULong(const char *key, uint32_t defaultValue)
+{
+  return GetValue(*this, key, defaultValue);
+}
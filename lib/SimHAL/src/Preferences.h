@@ -0,0 +1,33 @@
+#pragma once
+//Stand-in for the Arduino-ESP32 Preferences library.  Everything is kept
+//in memory for the life of the process, and every put counts as a flash
+//write (see SimPrefsWrites()), so flash traffic can be measured.
+#include <stdint.h>
+#include <stddef.h>
+
+class Preferences
+{
+public:
+  bool begin(const char *name, bool readOnly = false, const char *partition_label = nullptr);
+  void end();
+
+  bool clear();
+  bool remove(const char *key);
+  bool isKey(const char *key);
+
+  size_t putUChar(const char *key, uint8_t value);
+  size_t putLong(const char *key, int32_t value);
+  size_t putULong(const char *key, uint32_t value);
+  size_t putBytes(const char *key, const void *value, size_t len);
+
+  uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+  int32_t getLong(const char *key, int32_t defaultValue = 0);
+  uint32_t getULong(const char *key, uint32_t defaultValue = 0);
+  size_t getBytesLength(const char *key);
+  size_t getBytes(const char *key, void *buf, size_t maxLen);
+
+private:
+  bool _started = false;
+  bool _readOnly = false;
+  char _name[16] = {0};
+};
@@ -0,0 +1,73 @@
+#pragma once
+//Control side of the simulated hardware.  The firmware never includes
+//this, it only sees the stand-in Arduino/ESP-IDF headers.  The native
+//main() (SimMain.cpp) and anything else driving a simulation use these to
+//move the clock, turn the shaft and talk over the serial port.
+#include <stdint.h>
+#include <stddef.h>
+
+/// @brief Current simulated time in us since "power on".
+int64_t SimNowUs();
+
+/// @brief Move the simulated clock on, firing any esp_timer callbacks that
+/// come due on the way, in order, each at its own deadline.
+void SimAdvanceUs(int64_t us);
+
+/// @brief Queue bytes for the firmware to read from Serial.
+void SimSerialInject(const char *data, size_t len);
+void SimSerialInject(const char *str);
+
+/// @brief Where Serial writes go.  By default they are written to stdout.
+/// @param sink Called with each chunk written, or nullptr for stdout.
+/// @param arg Passed back to the sink.
+void SimSerialSetSink(void (*sink)(const uint8_t *data, size_t len, void *arg), void *arg);
+uint64_t SimSerialBytesWritten();
+/// @brief When the last byte handed to the sink will have reached the
+/// other end of the link, in simulated us, after everything buffered
+/// ahead of it has drained.
+int64_t SimSerialSentUs();
+/// @brief Stop the PC reading, or let it carry on.  While stalled the
+/// transmit buffer doesn't drain, so once it fills, writes block as the
+/// driver's would.
+void SimSerialStall(bool stalled);
+
+/// @brief Set the level of a GPIO input, running any interrupt handler
+/// attached to it.
+void SimSetPin(uint8_t pin, int level);
+int SimGetPin(uint8_t pin);
+
+/// @brief Count on a PCNT unit as the hardware would: go back to zero on
+/// reaching a limit, latch the events, and run the ISR if the unit's
+/// interrupt is enabled.
+/// @param unit PCNT unit.
+/// @param steps Counts to move, either direction.  Each one is a separate
+/// edge as far as events are concerned.
+/// @param pulseNs How long each pin stays high or low for while making
+/// them.  If that is shorter than the unit's glitch filter, the filter eats
+/// the pulses and nothing is counted.  0 leaves the filter out of it.
+void SimPcntStep(int unit, int32_t steps, uint32_t pulseNs = 0);
+
+/// @brief Call hook either side of each PCNT counter read the firmware
+/// makes.  A hook that steps the unit puts the edge, and any interrupt it
+/// raises, at that exact point in the firmware's code.
+/// @param hook Told whether the read has been made yet, or nullptr to stop.
+void SimPcntSetReadHook(void (*hook)(int unit, bool after, void *arg), void *arg);
+
+/// @brief Hold the PCNT interrupt off, as a long ISR latency would.  Events
+/// still latch, and the ISR runs for them once released, or as soon after
+/// as no critical section is in the way.
+void SimPcntHoldIsr(bool held);
+
+/// @brief Number of times the PCNT ISR has been run, across all units.
+uint32_t SimPcntInterrupts();
+
+/// @brief Glitch filter setting on a unit, in APB cycles, 0 when disabled.
+uint16_t SimPcntFilter(int unit);
+
+/// @brief Flash write statistics for the Preferences stand-in.  Each write
+/// also moves the clock on, as the real one blocks the caller.
+uint32_t SimPrefsWrites();
+void SimPrefsClear();
+/// @brief Put a long in flash before the firmware starts, without it
+/// counting as a write.  For settings left by older firmware.
+void SimPrefsSeed(const char *name, const char *key, int32_t value);
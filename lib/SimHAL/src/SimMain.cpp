@@ -0,0 +1,438 @@
+//main() for the native build.  Runs the firmware's setup() and loop()
+//against the simulated hardware, on simulated time, so a run with the same
+//arguments always produces the same output.
+//
+//  program [--seconds N] [--tick US] [--rpm RPM] [--cpr COUNTS] [--unit U]
+//          [--script FILE] [--trace FILE] [--pref NS/KEY=VALUE]...
+//          [--index PIN] [--index-at COUNT] [--index-latency US]
+//          [--count-mode N] [--glitch-rate HZ] [--glitch-us US]
+//          [--pins A B] [--arrivals FILE] [--stall MS LEN]...
+//
+//  --seconds  how much simulated time to run for (default 10)
+//  --tick     simulated time between passes of loop(), in us (default 100)
+//  --rpm      turn a simulated shaft at this speed (default 0)
+//  --cpr      counts per rev of the simulated shaft (default 1200)
+//  --unit     PCNT unit the simulated shaft drives (default 0)
+//  --script   file of "<ms> <command>" lines, each sent over the serial
+//             port (with a newline) when the clock reaches <ms>, which
+//             can have a fraction
+//  --trace    file of "<ms> <count>" lines, a recorded shaft position to
+//             play back instead of --rpm.  The count moves in a straight
+//             line from one point to the next, and stays at the last.
+//  --pref     a long already in flash at power up, e.g. from older firmware
+//  --index    pulse this GPIO once a rev, as an encoder's Z output would
+//  --index-at shaft count (mod --cpr) the index is at (default 0)
+//  --index-latency
+//             us from the index edge to its interrupt reading the count,
+//             during which the shaft keeps turning (default 0)
+//  --count-mode
+//             counts the firmware makes per encoder line, 1, 2 or 4
+//             (default 2).  With --cpr it gives how long the pins stay
+//             high and low for, which is what the PCNT glitch filter sees.
+//  --glitch-rate
+//             this many times a second, put a spike on an encoder pin,
+//             which counts one way and straight back again
+//  --glitch-us
+//             how long each spike lasts (default 1)
+//  --pins     also drive these two GPIOs in quadrature as the shaft turns,
+//             4 / --count-mode changes a count, for the GPIO interrupt
+//             encoder backend (see EncoderBackend.h)
+//  --arrivals write "<us> <line>" to FILE for every line sent over the
+//             serial port, us being the simulated time its last byte
+//             reached the PC, after whatever was queued ahead of it.  At
+//             the end "# start <us>" gives the time --script counts from.
+//             For timing replies from the PC's side, e.g.
+//             tools/clock_sync.py.
+//  --stall    the PC stops reading the serial port at MS, counted as
+//             --script does, for LEN ms.  The transmit buffer fills and
+//             stays full until it reads again.  Can be given more than
+//             once.
+//
+//At the end it reports, on stderr, what went over the serial port, the
+//flash writes, and the longest pass of loop() in simulated time.
+#include "Arduino.h"
+#include "SimHAL.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+void setup();
+void loop();
+
+struct ScriptLine
+{
+  int64_t atUs;
+  std::string text;
+};
+
+struct TracePoint
+{
+  int64_t atUs;
+  double count;
+};
+
+static bool LoadTrace(const char *path, std::vector<TracePoint> &points)
+{
+  FILE *f = fopen(path, "r");
+  if(f == nullptr)
+    return false;
+
+  char buf[128];
+  while(fgets(buf, sizeof(buf), f))
+  {
+    double ms, count;
+    if(buf[0] != '#' && sscanf(buf, "%lf %lf", &ms, &count) == 2)
+      points.push_back({(int64_t)(ms * 1000), count});
+  }
+  fclose(f);
+  return !points.empty();
+}
+
+/// @brief Where the traced shaft is at a time, from the start of the run.
+static double TraceCount(const std::vector<TracePoint> &points, int64_t us)
+{
+  if(us <= points.front().atUs)
+    return points.front().count;
+  for(size_t i = 1; i < points.size(); i++)
+  {
+    const TracePoint &a = points[i - 1];
+    const TracePoint &b = points[i];
+    if(us < b.atUs)
+      return a.count + (b.count - a.count) * (double)(us - a.atUs) / (double)(b.atUs - a.atUs);
+  }
+  return points.back().count;
+}
+
+//An index the shaft has passed whose interrupt hasn't read the count yet.
+//It does once the shaft gets to fireAt, which may be a tick or two later.
+struct PendingIndex
+{
+  bool pending;
+  int64_t direction;
+  int64_t fireAt;
+};
+static PendingIndex _pendingIndex = {false, 0, 0};
+
+//The A and B pins, if driven, and where they are in the quadrature cycle:
+//00 01 11 10 for B leading A, counting up.  They start at 11, where the
+//firmware's pull ups leave them.
+static int _aPin = -1;
+static int _bPin = -1;
+static int _quadChanges = 2;
+static int _quadState = 2;
+
+/// @brief Move the shaft some counts: step the PCNT unit, and the A and B
+/// pins if there are any.
+static void Step(int unit, int32_t counts, uint32_t pulseNs)
+{
+  SimPcntStep(unit, counts, pulseNs);
+  if(_aPin < 0)
+    return;
+  static const int levels[4][2] = {{0, 0}, {0, 1}, {1, 1}, {1, 0}};
+  int direction = counts > 0 ? 1 : 3;
+  for(int64_t n = (int64_t)(counts > 0 ? counts : -counts) * _quadChanges; n > 0; n--)
+  {
+    _quadState = (_quadState + direction) % 4;
+    SimSetPin(_aPin, levels[_quadState][0]);
+    SimSetPin(_bPin, levels[_quadState][1]);
+  }
+}
+
+/// @brief Turn the shaft from one count to another, pulsing the index pin on
+/// the way past each index, latencyCounts late.
+static void TurnShaft(int unit, int64_t from, int64_t to, int indexPin, int64_t indexAt, int64_t cpr,
+                      int64_t latencyCounts, uint32_t pulseNs)
+{
+  int64_t direction = to > from ? 1 : -1;
+  //Turned back before the interrupt got to it.  Can't happen for real,
+  //the interrupt isn't that slow, but the shaft here moves in steps.
+  if(_pendingIndex.pending && _pendingIndex.direction != direction)
+    _pendingIndex.pending = false;
+
+  while(indexPin >= 0 && from != to)
+  {
+    if(!_pendingIndex.pending)
+    {
+      //Next index strictly past from, in the direction of travel.
+      int64_t offset = ((indexAt - from) % cpr + cpr) % cpr;
+      if(direction < 0)
+        offset = offset == 0 ? cpr : cpr - offset;
+      else if(offset == 0)
+        offset = cpr;
+      int64_t index = from + direction * offset;
+      if((to - index) * direction < 0)
+        break;
+      _pendingIndex = {true, direction, index + direction * latencyCounts};
+    }
+    if((to - _pendingIndex.fireAt) * direction < 0)
+      break;
+
+    //Up to where the shaft has got to by the time the interrupt reads the
+    //count.  The encoder drives the pin, whatever pull the firmware has
+    //set, and the pulse is the rising edge.
+    Step(unit, (int32_t)(_pendingIndex.fireAt - from), pulseNs);
+    from = _pendingIndex.fireAt;
+    _pendingIndex.pending = false;
+    SimSetPin(indexPin, LOW);
+    SimSetPin(indexPin, HIGH);
+    SimSetPin(indexPin, LOW);
+  }
+  if(from != to)
+    Step(unit, (int32_t)(to - from), pulseNs);
+}
+
+static bool LoadScript(const char *path, std::vector<ScriptLine> &lines)
+{
+  FILE *f = fopen(path, "r");
+  if(f == nullptr)
+    return false;
+
+  char buf[256];
+  while(fgets(buf, sizeof(buf), f))
+  {
+    char *end;
+    if(buf[0] == '#')
+      continue;
+    double ms = strtod(buf, &end);
+    if(end == buf)
+      continue;
+    while(*end == ' ' || *end == '\t')
+      end++;
+    //Keep the text as is, and make sure it ends in exactly one newline.
+    std::string text(end);
+    while(!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+      text.pop_back();
+    lines.push_back({(int64_t)llround(ms * 1000), text + "\n"});
+  }
+  fclose(f);
+  return true;
+}
+
+/// @brief Serial sink for --arrivals.  Still writes everything to stdout,
+/// and logs each line as it ends.
+struct ArrivalLog
+{
+  FILE *file;
+  std::string line;
+};
+
+static void LogArrivals(const uint8_t *data, size_t len, void *arg)
+{
+  ArrivalLog *log = static_cast<ArrivalLog *>(arg);
+  fwrite(data, 1, len, stdout);
+  for(size_t i = 0; i < len; i++)
+  {
+    if(data[i] == '\n')
+    {
+      while(!log->line.empty() && log->line.back() == '\r')
+        log->line.pop_back();
+      fprintf(log->file, "%lld %s\n", (long long)SimSerialSentUs(), log->line.c_str());
+      log->line.clear();
+    }
+    else
+      log->line += (char)data[i];
+  }
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = 10;
+  int64_t tickUs = 100;
+  double rpm = 0;
+  double cpr = 1200;
+  int unit = 0;
+  std::vector<ScriptLine> script;
+  std::vector<TracePoint> trace;
+  int indexPin = -1;
+  int64_t indexAt = 0;
+  double indexLatencyUs = 0;
+  double countMode = 2;
+  double glitchRate = 0;
+  double glitchUs = 1;
+  ArrivalLog arrivals = {nullptr, std::string()};
+  //Start and end of each --stall, us from the start.
+  std::vector<std::pair<int64_t, int64_t>> stalls;
+
+  for(int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+    if(val == nullptr)
+    {
+      fprintf(stderr, "%s needs a value\n", arg);
+      return 2;
+    }
+    if(strcmp(arg, "--seconds") == 0)
+      seconds = atof(val);
+    else if(strcmp(arg, "--tick") == 0)
+      tickUs = atoll(val);
+    else if(strcmp(arg, "--rpm") == 0)
+      rpm = atof(val);
+    else if(strcmp(arg, "--cpr") == 0)
+      cpr = atof(val);
+    else if(strcmp(arg, "--unit") == 0)
+      unit = atoi(val);
+    else if(strcmp(arg, "--index") == 0)
+      indexPin = atoi(val);
+    else if(strcmp(arg, "--index-at") == 0)
+      indexAt = atoll(val);
+    else if(strcmp(arg, "--index-latency") == 0)
+      indexLatencyUs = atof(val);
+    else if(strcmp(arg, "--count-mode") == 0)
+      countMode = atof(val);
+    else if(strcmp(arg, "--glitch-rate") == 0)
+      glitchRate = atof(val);
+    else if(strcmp(arg, "--glitch-us") == 0)
+      glitchUs = atof(val);
+    else if(strcmp(arg, "--pins") == 0)
+    {
+      if(i + 2 >= argc)
+      {
+        fprintf(stderr, "--pins needs two pins\n");
+        return 2;
+      }
+      _aPin = atoi(val);
+      _bPin = atoi(argv[i + 2]);
+      i++;
+    }
+    else if(strcmp(arg, "--stall") == 0)
+    {
+      if(i + 2 >= argc)
+      {
+        fprintf(stderr, "--stall needs a time and a length\n");
+        return 2;
+      }
+      int64_t from = (int64_t)llround(atof(val) * 1000.0);
+      stalls.push_back(std::make_pair(from, from + (int64_t)llround(atof(argv[i + 2]) * 1000.0)));
+      i++;
+    }
+    else if(strcmp(arg, "--trace") == 0)
+    {
+      if(!LoadTrace(val, trace))
+      {
+        fprintf(stderr, "Can't read trace %s\n", val);
+        return 2;
+      }
+    }
+    else if(strcmp(arg, "--pref") == 0)
+    {
+      const char *slash = strchr(val, '/');
+      const char *equals = strchr(val, '=');
+      if(slash == nullptr || equals == nullptr || equals < slash)
+      {
+        fprintf(stderr, "--pref wants NS/KEY=VALUE\n");
+        return 2;
+      }
+      std::string name(val, slash - val);
+      std::string key(slash + 1, equals - slash - 1);
+      SimPrefsSeed(name.c_str(), key.c_str(), atol(equals + 1));
+    }
+    else if(strcmp(arg, "--arrivals") == 0)
+    {
+      arrivals.file = fopen(val, "w");
+      if(arrivals.file == nullptr)
+      {
+        fprintf(stderr, "Can't write %s\n", val);
+        return 2;
+      }
+      SimSerialSetSink(LogArrivals, &arrivals);
+    }
+    else if(strcmp(arg, "--script") == 0)
+    {
+      if(!LoadScript(val, script))
+      {
+        fprintf(stderr, "Can't read script %s\n", val);
+        return 2;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if(tickUs <= 0)
+    tickUs = 1;
+  if(countMode <= 0)
+    countMode = 2;
+  _quadChanges = (int)(4 / countMode);
+
+  setup();
+  //The shaft starts turning once setup() is done, from count zero.
+  int64_t startUs = SimNowUs();
+  int64_t endUs = startUs + (int64_t)(seconds * 1e6);
+  int64_t shaftCount = 0;
+  size_t nextLine = 0;
+  int64_t longestLoopUs = 0;
+  double nextGlitchUs = glitchRate > 0 ? 1e6 / glitchRate : 0;
+  int64_t shaftUs = startUs;
+
+  while(SimNowUs() < endUs)
+  {
+    int64_t now = SimNowUs();
+
+    while(nextLine < script.size() && script[nextLine].atUs <= now - startUs)
+    {
+      SimSerialInject(script[nextLine].text.c_str());
+      nextLine++;
+    }
+
+    bool stalled = false;
+    for(const auto &stall : stalls)
+      stalled = stalled || (now - startUs >= stall.first && now - startUs < stall.second);
+    SimSerialStall(stalled);
+
+    int64_t target;
+    if(!trace.empty())
+      target = (int64_t)floor(TraceCount(trace, now - startUs));
+    else
+      target = (int64_t)floor(rpm * cpr * (double)(now - startUs) / 60e6);
+    if(target != shaftCount)
+    {
+      //The shaft's speed over this tick decides how far it gets in the
+      //index interrupt's latency.
+      int64_t moved = target > shaftCount ? target - shaftCount : shaftCount - target;
+      //A slow pass of loop() makes for a longer step, so go by the time
+      //since the shaft last moved, not the tick.
+      double elapsedUs = (double)(now - shaftUs);
+      int64_t latencyCounts = (int64_t)llround((double)moved * indexLatencyUs / elapsedUs);
+      //Each pin is high, then low, for half a line.
+      uint32_t pulseNs = (uint32_t)llround(elapsedUs * 1000.0 * countMode / 2.0 / (double)moved);
+      TurnShaft(unit, shaftCount, target, indexPin, indexAt, (int64_t)llround(cpr), latencyCounts, pulseNs);
+      shaftCount = target;
+    }
+    shaftUs = now;
+
+    if(glitchRate > 0 && (double)(now - startUs) >= nextGlitchUs)
+    {
+      //Up and straight back down.  The glitch filter eats both or neither.
+      uint32_t glitchNs = (uint32_t)llround(glitchUs * 1000.0);
+      SimPcntStep(unit, 1, glitchNs > 0 ? glitchNs : 1);
+      SimAdvanceUs((int64_t)llround(glitchUs));
+      SimPcntStep(unit, -1, glitchNs > 0 ? glitchNs : 1);
+      nextGlitchUs += 1e6 / glitchRate;
+    }
+
+    int64_t loopStartUs = SimNowUs();
+    loop();
+    if(SimNowUs() - loopStartUs > longestLoopUs)
+      longestLoopUs = SimNowUs() - loopStartUs;
+    SimAdvanceUs(tickUs);
+  }
+
+  fflush(stdout);
+  if(arrivals.file != nullptr)
+  {
+    fprintf(arrivals.file, "# start %lld\n", (long long)startUs);
+    fclose(arrivals.file);
+  }
+  fprintf(stderr, "Simulated %.3f s, %llu bytes sent, %u PCNT interrupts, %u flash writes, longest loop %lld us\n",
+          (double)(SimNowUs() - startUs) / 1e6, (unsigned long long)SimSerialBytesWritten(),
+          SimPcntInterrupts(), SimPrefsWrites(), (long long)longestLoopUs);
+  return 0;
+}
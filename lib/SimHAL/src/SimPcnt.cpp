@@ -0,0 +1,320 @@
+//Simulated pulse counter units.  Nothing moves them except SimPcntStep(),
+//which plays the part of the encoder pins.
+#include "driver/pcnt.h"
+#include "soc/pcnt_struct.h"
+#include "freertos/FreeRTOS.h"
+#include "SimHAL.h"
+
+pcnt_dev_t PCNT;
+
+struct SimPcntUnit
+{
+  int16_t counter;
+  int16_t hLim;
+  int16_t lLim;
+  int16_t thres0;
+  int16_t thres1;
+  uint32_t events;
+  bool paused;
+  bool intrEnabled;
+  uint16_t filter;
+  bool filterEnabled;
+};
+
+static SimPcntUnit _units[PCNT_UNIT_MAX];
+static void (*_isr)(void *) = nullptr;
+static void *_isrArg = nullptr;
+static uint32_t _interrupts = 0;
+//Interrupts are held off while either of these is set, and while the ISR
+//is already running.
+static int _criticalDepth = 0;
+static bool _isrHeld = false;
+static bool _inIsr = false;
+static void (*_readHook)(int unit, bool after, void *arg) = nullptr;
+static void *_readHookArg = nullptr;
+
+SimPcntIntClr &SimPcntIntClr::operator=(uint32_t bits)
+{
+  PCNT.int_st.val &= ~bits;
+  PCNT.int_raw.val &= ~bits;
+  return *this;
+}
+
+static bool ValidUnit(pcnt_unit_t unit)
+{
+  return unit >= 0 && unit < PCNT_UNIT_MAX;
+}
+
+/// @brief Run the ISR for whatever is pending, unless something is holding
+/// interrupts off.  Goes round again if more latched while it ran, as the
+/// chip would take the interrupt again straight away.
+static void ServiceInterrupts()
+{
+  while(PCNT.int_st.val != 0 && _isr && _criticalDepth == 0 && !_isrHeld && !_inIsr)
+  {
+    uint32_t pending = PCNT.int_st.val;
+    _inIsr = true;
+    _interrupts++;
+    _isr(_isrArg);
+    _inIsr = false;
+    //An ISR that leaves it all set would never return on the chip either.
+    if(PCNT.int_st.val == pending)
+      break;
+  }
+}
+
+/// @brief Latch an event on a unit and, if its interrupt is on, run the ISR
+/// there and then, the way a real interrupt would cut in, or as soon as
+/// interrupts are let in again.
+static void RaiseEvent(int unit, uint32_t latchMask)
+{
+  PCNT.status_unit[unit].val = latchMask;
+  PCNT.int_raw.val |= BIT(unit);
+  if(!_units[unit].intrEnabled)
+    return;
+
+  PCNT.int_st.val |= BIT(unit);
+  ServiceInterrupts();
+}
+
+void SimCriticalEnter()
+{
+  _criticalDepth++;
+}
+
+void SimCriticalExit()
+{
+  if(_criticalDepth > 0)
+    _criticalDepth--;
+  ServiceInterrupts();
+}
+
+void SimPcntStep(int unit, int32_t steps, uint32_t pulseNs)
+{
+  if(unit < 0 || unit >= PCNT_UNIT_MAX)
+    return;
+
+  SimPcntUnit &u = _units[unit];
+  if(u.paused)
+    return;
+  //The filter counts APB cycles at 80 MHz, 12.5 ns each.
+  if(pulseNs > 0 && u.filterEnabled && (uint64_t)pulseNs * 80 < (uint64_t)u.filter * 1000)
+    return;
+
+  int16_t dir = steps > 0 ? 1 : -1;
+  for(int32_t n = steps > 0 ? steps : -steps; n > 0; n--)
+  {
+    u.counter += dir;
+
+    //Status bit positions match the pcnt_struct.h stand-in.
+    uint32_t latch = 0;
+    if(u.hLim != 0 && u.counter >= u.hLim)
+    {
+      //The hardware goes back to zero on reaching a limit, whether or not
+      //anyone asked for the event.
+      u.counter = 0;
+      if(u.events & PCNT_EVT_H_LIM)
+        latch |= 1 << 5;
+    }
+    else if(u.lLim != 0 && u.counter <= u.lLim)
+    {
+      u.counter = 0;
+      if(u.events & PCNT_EVT_L_LIM)
+        latch |= 1 << 4;
+    }
+    else
+    {
+      if((u.events & PCNT_EVT_THRES_0) && u.counter == u.thres0)
+        latch |= 1 << 3;
+      if((u.events & PCNT_EVT_THRES_1) && u.counter == u.thres1)
+        latch |= 1 << 2;
+    }
+
+    if(latch)
+      RaiseEvent(unit, latch);
+  }
+}
+
+void SimPcntSetReadHook(void (*hook)(int unit, bool after, void *arg), void *arg)
+{
+  _readHook = hook;
+  _readHookArg = arg;
+}
+
+void SimPcntHoldIsr(bool held)
+{
+  _isrHeld = held;
+  ServiceInterrupts();
+}
+
+uint32_t SimPcntInterrupts()
+{
+  return _interrupts;
+}
+
+uint16_t SimPcntFilter(int unit)
+{
+  if(unit < 0 || unit >= PCNT_UNIT_MAX || !_units[unit].filterEnabled)
+    return 0;
+  return _units[unit].filter;
+}
+
+esp_err_t pcnt_unit_config(const pcnt_config_t *pcnt_config)
+{
+  if(pcnt_config == nullptr || !ValidUnit(pcnt_config->unit))
+    return ESP_ERR_INVALID_ARG;
+
+  SimPcntUnit &u = _units[pcnt_config->unit];
+  u.hLim = pcnt_config->counter_h_lim;
+  u.lLim = pcnt_config->counter_l_lim;
+  u.counter = 0;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_get_counter_value(pcnt_unit_t pcnt_unit, int16_t *count)
+{
+  if(!ValidUnit(pcnt_unit) || count == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  //Whatever the hook does happens right next to the register read.
+  if(_readHook)
+    _readHook(pcnt_unit, false, _readHookArg);
+  *count = _units[pcnt_unit].counter;
+  if(_readHook)
+    _readHook(pcnt_unit, true, _readHookArg);
+  return ESP_OK;
+}
+
+esp_err_t pcnt_counter_pause(pcnt_unit_t pcnt_unit)
+{
+  if(!ValidUnit(pcnt_unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[pcnt_unit].paused = true;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_counter_resume(pcnt_unit_t pcnt_unit)
+{
+  if(!ValidUnit(pcnt_unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[pcnt_unit].paused = false;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_counter_clear(pcnt_unit_t pcnt_unit)
+{
+  if(!ValidUnit(pcnt_unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[pcnt_unit].counter = 0;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_intr_enable(pcnt_unit_t pcnt_unit)
+{
+  if(!ValidUnit(pcnt_unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[pcnt_unit].intrEnabled = true;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_intr_disable(pcnt_unit_t pcnt_unit)
+{
+  if(!ValidUnit(pcnt_unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[pcnt_unit].intrEnabled = false;
+  PCNT.int_st.val &= ~BIT(pcnt_unit);
+  return ESP_OK;
+}
+
+esp_err_t pcnt_event_enable(pcnt_unit_t unit, pcnt_evt_type_t evt_type)
+{
+  if(!ValidUnit(unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[unit].events |= evt_type;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_event_disable(pcnt_unit_t unit, pcnt_evt_type_t evt_type)
+{
+  if(!ValidUnit(unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[unit].events &= ~(uint32_t)evt_type;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_set_event_value(pcnt_unit_t unit, pcnt_evt_type_t evt_type, int16_t value)
+{
+  if(!ValidUnit(unit))
+    return ESP_ERR_INVALID_ARG;
+  if(evt_type == PCNT_EVT_THRES_0)
+    _units[unit].thres0 = value;
+  else if(evt_type == PCNT_EVT_THRES_1)
+    _units[unit].thres1 = value;
+  else if(evt_type == PCNT_EVT_H_LIM)
+    _units[unit].hLim = value;
+  else if(evt_type == PCNT_EVT_L_LIM)
+    _units[unit].lLim = value;
+  else
+    return ESP_ERR_INVALID_ARG;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_get_event_value(pcnt_unit_t unit, pcnt_evt_type_t evt_type, int16_t *value)
+{
+  if(!ValidUnit(unit) || value == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  if(evt_type == PCNT_EVT_THRES_0)
+    *value = _units[unit].thres0;
+  else if(evt_type == PCNT_EVT_THRES_1)
+    *value = _units[unit].thres1;
+  else if(evt_type == PCNT_EVT_H_LIM)
+    *value = _units[unit].hLim;
+  else if(evt_type == PCNT_EVT_L_LIM)
+    *value = _units[unit].lLim;
+  else
+    return ESP_ERR_INVALID_ARG;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t filter_val)
+{
+  if(!ValidUnit(unit) || filter_val > 1023)
+    return ESP_ERR_INVALID_ARG;
+  _units[unit].filter = filter_val;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_get_filter_value(pcnt_unit_t unit, uint16_t *filter_val)
+{
+  if(!ValidUnit(unit) || filter_val == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  *filter_val = _units[unit].filter;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_filter_enable(pcnt_unit_t unit)
+{
+  if(!ValidUnit(unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[unit].filterEnabled = true;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_filter_disable(pcnt_unit_t unit)
+{
+  if(!ValidUnit(unit))
+    return ESP_ERR_INVALID_ARG;
+  _units[unit].filterEnabled = false;
+  return ESP_OK;
+}
+
+esp_err_t pcnt_isr_register(void (*fn)(void *), void *arg, int intr_alloc_flags, pcnt_isr_handle_t *handle)
+{
+  (void)intr_alloc_flags;
+  if(fn == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  _isr = fn;
+  _isrArg = arg;
+  if(handle)
+    *handle = nullptr;
+  return ESP_OK;
+}
@@ -0,0 +1,128 @@
+//The simulated clock, and esp_timer on top of it.
+#include "esp_timer.h"
+#include "SimHAL.h"
+#include <vector>
+
+struct esp_timer
+{
+  esp_timer_cb_t callback;
+  void *arg;
+  bool running;
+  int64_t deadlineUs;
+  uint64_t periodUs;
+};
+
+static int64_t _nowUs = 0;
+static std::vector<esp_timer *> _timers;
+
+int64_t SimNowUs()
+{
+  return _nowUs;
+}
+
+int64_t esp_timer_get_time()
+{
+  return _nowUs;
+}
+
+/// @brief The running timer with the earliest deadline at or before
+/// limitUs, or nullptr.
+static esp_timer *NextDue(int64_t limitUs)
+{
+  esp_timer *next = nullptr;
+  for(esp_timer *t : _timers)
+  {
+    if(t->running && t->deadlineUs <= limitUs && (next == nullptr || t->deadlineUs < next->deadlineUs))
+      next = t;
+  }
+  return next;
+}
+
+void SimAdvanceUs(int64_t us)
+{
+  int64_t endUs = _nowUs + us;
+
+  //Step through the deadlines one at a time, so every callback sees the
+  //clock at the moment it was due, and a callback that starts or stops a
+  //timer is seen straight away.
+  esp_timer *t;
+  while((t = NextDue(endUs)) != nullptr)
+  {
+    if(t->deadlineUs > _nowUs)
+      _nowUs = t->deadlineUs;
+    if(t->periodUs > 0)
+      t->deadlineUs += t->periodUs;
+    else
+      t->running = false;
+    t->callback(t->arg);
+  }
+  _nowUs = endUs;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+  if(create_args == nullptr || create_args->callback == nullptr || out_handle == nullptr)
+    return ESP_ERR_INVALID_ARG;
+
+  esp_timer *t = new esp_timer();
+  t->callback = create_args->callback;
+  t->arg = create_args->arg;
+  t->running = false;
+  t->deadlineUs = 0;
+  t->periodUs = 0;
+  _timers.push_back(t);
+  *out_handle = t;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+  if(timer == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  if(timer->running)
+    return ESP_ERR_INVALID_STATE;
+  timer->running = true;
+  timer->periodUs = 0;
+  timer->deadlineUs = _nowUs + (int64_t)timeout_us;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+  if(timer == nullptr || period == 0)
+    return ESP_ERR_INVALID_ARG;
+  if(timer->running)
+    return ESP_ERR_INVALID_STATE;
+  timer->running = true;
+  timer->periodUs = period;
+  timer->deadlineUs = _nowUs + (int64_t)period;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+  if(timer == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  if(!timer->running)
+    return ESP_ERR_INVALID_STATE;
+  timer->running = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+  if(timer == nullptr)
+    return ESP_ERR_INVALID_ARG;
+  if(timer->running)
+    return ESP_ERR_INVALID_STATE;
+  for(size_t i = 0; i < _timers.size(); i++)
+  {
+    if(_timers[i] == timer)
+    {
+      _timers.erase(_timers.begin() + i);
+      break;
+    }
+  }
+  delete timer;
+  return ESP_OK;
+}
@@ -0,0 +1,11 @@
+#pragma once
+//Stand-in for the core's native USB stack.  There's nothing to start, the
+//simulated CDC port is always there.
+
+class ESPUSB
+{
+public:
+  bool begin() { return true; }
+};
+
+extern ESPUSB USB;
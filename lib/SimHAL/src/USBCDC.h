@@ -0,0 +1,32 @@
+#pragma once
+#include "Arduino.h"
+
+//Full speed USB bulk transfers manage about a megabyte a second.
+#define SIM_USB_CDC_BYTES_PER_SECOND 1000000
+
+/// @brief Native USB serial port.  Shares the simulated pipe with
+/// HardwareSerial (only one is ever in use), but runs at USB speed whatever
+/// baud rate is asked for.
+class USBCDC : public Stream
+{
+public:
+  USBCDC(uint8_t itf = 0) { (void)itf; }
+  void begin(unsigned long baud = 0)
+  {
+    (void)baud;
+    _link.configure(SIM_USB_CDC_BYTES_PER_SECOND, 256);
+  }
+  void end() {}
+  int available() override { return _link.available(); }
+  int read() override { return _link.read(); }
+  int peek() override { return _link.peek(); }
+  int availableForWrite() override { return _link.availableForWrite(); }
+  void flush() override {}
+  size_t write(uint8_t c) override { return _link.write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override { return _link.write(buffer, size); }
+  using Print::write;
+  operator bool() const { return true; }
+
+private:
+  SimSerialLink _link;
+};
@@ -0,0 +1,10 @@
+#pragma once
+//Stand-in for ESP-IDF's esp_err.h.
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
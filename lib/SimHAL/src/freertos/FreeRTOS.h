@@ -0,0 +1,25 @@
+#pragma once
+//Stand-in for the FreeRTOS port macros.  The simulation is single
+//threaded, like the S2.  Critical sections hold the PCNT interrupt off the
+//way masking interrupts does on the chip: a limit reached inside one
+//latches, and the ISR runs as the outermost section is left.
+
+typedef struct
+{
+  int owner;
+  int count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+
+/// @brief Nesting counted, so only the outermost exit lets a held
+/// interrupt in.  Defined in SimPcnt.cpp.
+void SimCriticalEnter();
+void SimCriticalExit();
+
+#define portENTER_CRITICAL(mux) ((void)(mux), SimCriticalEnter())
+#define portEXIT_CRITICAL(mux) ((void)(mux), SimCriticalExit())
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux), SimCriticalEnter())
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux), SimCriticalExit())
+#define portENTER_CRITICAL_SAFE(mux) ((void)(mux), SimCriticalEnter())
+#define portEXIT_CRITICAL_SAFE(mux) ((void)(mux), SimCriticalExit())
@@ -0,0 +1,9 @@
+#pragma once
+//Stand-in for the GPIO input registers, GPIO 0-31 and 32 up, which is all
+//anything reads directly.  The simulated pins keep them up to date.
+#include <stdint.h>
+
+extern volatile uint32_t SimGpioIn[2];
+
+#define GPIO_IN_REG (&SimGpioIn[0])
+#define GPIO_IN1_REG (&SimGpioIn[1])
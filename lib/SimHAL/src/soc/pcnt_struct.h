@@ -0,0 +1,43 @@
+#pragma once
+//Stand-in for the PCNT register block, with just the registers the
+//encoder ISR touches.  The field names are the original ESP32 ones, which
+//is what ESP32Encoder.cpp uses when no S2/S3 target is defined.
+#include <stdint.h>
+
+/// @brief Writing a bit here clears it in int_st, like the real register.
+struct SimPcntIntClr
+{
+  SimPcntIntClr &operator=(uint32_t bits);
+};
+
+typedef struct
+{
+  union
+  {
+    struct
+    {
+      uint32_t cnt_mode : 2;
+      uint32_t thres1_lat : 1;
+      uint32_t thres0_lat : 1;
+      uint32_t l_lim_lat : 1;
+      uint32_t h_lim_lat : 1;
+      uint32_t zero_lat : 1;
+      uint32_t reserved : 25;
+    };
+    uint32_t val;
+  } status_unit[8];
+  union
+  {
+    uint32_t val;
+  } int_raw;
+  union
+  {
+    uint32_t val;
+  } int_st;
+  struct
+  {
+    SimPcntIntClr val;
+  } int_clr;
+} pcnt_dev_t;
+
+extern pcnt_dev_t PCNT;
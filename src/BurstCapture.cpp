@@ -0,0 +1,129 @@
+#include "BurstCapture.h"
+#include <math.h>
+
+BurstCapture::BurstCapture() :
+  _timer(nullptr),
+  _encoder(nullptr),
+  _periodUs(0),
+  _length(0),
+  _pretrigger(0),
+  _trigger(BURST_TRIGGER_NONE),
+  _value(0),
+  _windowCounts(0),
+  _state(BURST_IDLE),
+  _written(0),
+  _triggerAt(0)
+{
+}
+
+bool BurstCapture::begin()
+{
+  esp_timer_create_args_t args = {};
+  args.callback = &BurstCapture::onTimer;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "burst";
+  return esp_timer_create(&args, &_timer) == ESP_OK;
+}
+
+bool BurstCapture::arm(Encoder &encoder, const EncoderScale &scale, uint32_t periodUs, uint32_t samples,
+                       uint8_t trigger, int32_t value, uint32_t pretrigger)
+{
+  if(_timer == nullptr || periodUs < BURST_CAPTURE_MIN_PERIOD_US ||
+     samples == 0 || samples > BURST_CAPTURE_MAX_SAMPLES || trigger >= BURST_TRIGGER_TYPE_COUNT)
+    return false;
+  if(trigger == BURST_TRIGGER_NONE)
+    pretrigger = 0;
+  if(pretrigger >= samples)
+    return false;
+  if(trigger == BURST_TRIGGER_RPM_ABOVE && (value <= 0 || samples <= BURST_CAPTURE_RPM_WINDOW))
+    return false;
+
+  stop();
+  _encoder = &encoder;
+  _periodUs = periodUs;
+  _length = samples;
+  _pretrigger = pretrigger;
+  _trigger = trigger;
+  _value = value;
+  //Turn the RPM into counts over the window once, here, rather than
+  //working out a speed in the timer callback.
+  _windowCounts = (int32_t)ceil((double)value * scale.countsPerRev() *
+                                BURST_CAPTURE_RPM_WINDOW * periodUs / 60e6);
+  if(_windowCounts < 1)
+    _windowCounts = 1;
+  _written = 0;
+  _triggerAt = 0;
+  _state = BURST_ARMED;
+  esp_timer_start_periodic(_timer, _periodUs);
+  return true;
+}
+
+void BurstCapture::stop()
+{
+  if(_timer != nullptr)
+    esp_timer_stop(_timer);
+  _state = BURST_IDLE;
+}
+
+bool BurstCapture::record(uint32_t index, BurstRecord &record) const
+{
+  if(_state != BURST_DONE || index >= _length)
+    return false;
+  //The oldest sample is the one after the newest in the ring.
+  record = _buffer[(_written - _length + index) % _length];
+  return true;
+}
+
+void BurstCapture::onTimer(void *arg)
+{
+  static_cast<BurstCapture *>(arg)->takeSample();
+}
+
+bool BurstCapture::triggered(int32_t count) const
+{
+  switch(_trigger)
+  {
+    case BURST_TRIGGER_COUNT_ABOVE:
+      return count >= _value;
+    case BURST_TRIGGER_COUNT_BELOW:
+      return count <= _value;
+    case BURST_TRIGGER_RPM_ABOVE:
+    {
+      //_written has already counted this sample.
+      if(_written <= BURST_CAPTURE_RPM_WINDOW)
+        return false;
+      int32_t then = _buffer[(_written - 1 - BURST_CAPTURE_RPM_WINDOW) % _length].count;
+      int32_t moved = count - then;
+      return (moved < 0 ? -moved : moved) >= _windowCounts;
+    }
+    default:
+      return true;
+  }
+}
+
+void BurstCapture::takeSample()
+{
+  if(_state != BURST_ARMED && _state != BURST_TRIGGERED)
+    return;
+
+  EncoderSnapshot snap = _encoder->getSnapshot();
+  BurstRecord &record = _buffer[_written % _length];
+  record.timestampUs = (uint32_t)snap.timestampUs;
+  record.count = (int32_t)snap.count;
+  _written = _written + 1;
+
+  //Only once the pretrigger part is full, so a burst always has the
+  //samples asked for in front of the trigger.
+  if(_state == BURST_ARMED && _written > _pretrigger && triggered(record.count))
+  {
+    _triggerAt = _written - 1;
+    _state = BURST_TRIGGERED;
+  }
+
+  if(_state == BURST_TRIGGERED && _written - _triggerAt >= _length - _pretrigger)
+  {
+    esp_timer_stop(_timer);
+    _state = BURST_DONE;
+  }
+}
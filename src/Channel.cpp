@@ -0,0 +1,170 @@
+#include "Channel.h"
+#include "Metrics.h"
+
+void Channel::load(const ChannelSettings &settings)
+{
+  aPin = settings.aPin;
+  bPin = settings.bPin;
+  //Zero would have us dividing by zero later on.
+  if(settings.pulsePerRev != 0)
+    pulsePerRev = settings.pulsePerRev;
+  if(!setCountMode(settings.countMode))
+    countMode = ENCODER_COUNT_HALF;
+  //Anything deeper came from a build without the limit.
+  rpmFilterDepth = settings.rpmFilterDepth <= RPM_FILTER_MAX_DEPTH ? settings.rpmFilterDepth : RPM_FILTER_MAX_DEPTH;
+  rpmFilterType = settings.rpmFilterType;
+  rpmFilterAlpha = settings.rpmFilterAlpha;
+  rpmFilterBeta = settings.rpmFilterBeta;
+
+  setPulsePerRev(pulsePerRev);
+  configureFilter();
+}
+
+void Channel::save(ChannelSettings &settings) const
+{
+  settings.aPin = aPin;
+  settings.bPin = bPin;
+  settings.pulsePerRev = pulsePerRev;
+  settings.countMode = countMode;
+  settings.rpmFilterDepth = rpmFilterDepth;
+  settings.rpmFilterType = rpmFilterType;
+  settings.rpmFilterAlpha = rpmFilterAlpha;
+  settings.rpmFilterBeta = rpmFilterBeta;
+}
+
+void Channel::attach()
+{
+  if(!enabled() || encoder.isAttached())
+    return;
+
+  encoder.attach(aPin, bPin, countMode);
+  //The library always sets its own filter, so ours goes on after.
+  encoder.setFilter(glitchFilter);
+  //Edge capture wants the interrupts, and keeps them if it has hooked the
+  //encoder.
+  encoder.setPolled(pollPeriodUs() > 0);
+  // set starting count value after attaching
+  encoder.setCount(0);
+  restartRpm(esp_timer_get_time());
+}
+
+void Channel::detach()
+{
+  if(encoder.isAttached())
+    encoder.detach();
+}
+
+void Channel::configureFilter()
+{
+  if(!filter.configure(rpmFilterType, rpmFilterDepth, rpmFilterAlpha, rpmFilterBeta))
+  {
+    rpmFilterType = RPM_FILTER_EMA;
+    filter.configure(rpmFilterType, rpmFilterDepth, rpmFilterAlpha, rpmFilterBeta);
+  }
+}
+
+void Channel::setPulsePerRev(unsigned long ppr)
+{
+  pulsePerRev = ppr;
+  //Work the reciprocals out once here, rather than dividing every sample.
+  scale.configure(pulsePerRev, countMode);
+  estimator.setScale(scale);
+  filter.setScale(scale);
+  pva.setScale(scale);
+}
+
+bool Channel::setCountMode(unsigned long mode)
+{
+  if(mode != ENCODER_COUNT_SINGLE && mode != ENCODER_COUNT_HALF && mode != ENCODER_COUNT_FULL)
+    return false;
+  countMode = mode;
+  setPulsePerRev(pulsePerRev);
+  return true;
+}
+
+bool Channel::setGlitchFilter(unsigned long filter)
+{
+  if(filter > PCNT_FILTER_MAX)
+    return false;
+  glitchFilter = filter;
+  if(encoder.isAttached())
+    encoder.setFilter(glitchFilter);
+  return true;
+}
+
+bool Channel::setPolled(unsigned long maxRpm)
+{
+  unsigned long old = pollMaxRpm;
+  pollMaxRpm = maxRpm;
+  if(maxRpm > 0 && pollPeriodUs() == 0)
+  {
+    pollMaxRpm = old;
+    return false;
+  }
+  if(encoder.isAttached())
+    encoder.setPolled(pollPeriodUs() > 0);
+  return true;
+}
+
+uint32_t Channel::pollPeriodUs() const
+{
+  if(pollMaxRpm == 0 || !ENCODER_HAS_POLLING)
+    return 0;
+  //Half counts per rev over two revs a second, rounded up.
+  return PollPeriodUs((uint64_t)pollMaxRpm * scale.halfCountsPerRev() / 120 + 1);
+}
+
+void Channel::reset(long count)
+{
+  if(!encoder.isAttached())
+    return;
+  encoder.setCount(count);
+  restartRpm(esp_timer_get_time());
+}
+
+void Channel::restartRpm(int64_t fromUs)
+{
+  justReset = true;
+  resetUs = fromUs;
+}
+
+bool Channel::update(int64_t count, int64_t timestampUs)
+{
+  //Lets check to see if we have just done a reset before this sample.
+  if(justReset)
+  {
+    //The sampler got to this one first, so its count is from before.
+    //Starting the estimator from it would only give it the whole jump on
+    //the next sample.
+    if(timestampUs <= resetUs)
+      return false;
+
+    //aha.  We have.  So we dont scare the user, we'll quietly zero the
+    //rpm, and start the estimator again from this count, so
+    //that it doesnt spike to something silly...
+    rpm = 0;
+    estimator.reset();
+    filter.reset();
+    pva.reset();
+    MetricCount(METRIC_FILTER_RESETS);
+    //and then reset the flag.
+    justReset = false;
+  }
+
+  long newPos = count;
+
+  //Convert this to an angle.
+  ang = angle(newPos);
+
+  //The estimator needs to see every sample, moving or not, so it can tell
+  //how long it has been since the last edge.
+  int32_t newRpm = estimator.update(count, timestampUs);
+
+  //...and run that through whichever filter has been asked for.
+  rpm = filter.update(newRpm, count, timestampUs);
+  pva.update(count, timestampUs);
+
+  bool moved = pos != newPos;
+  pos = newPos;
+  return moved;
+}
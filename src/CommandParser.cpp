@@ -0,0 +1,165 @@
+#include "CommandParser.h"
+#include <stdlib.h>
+#include <string.h>
+#include "Metrics.h"
+
+#if (COMMAND_RING_SIZE & (COMMAND_RING_SIZE - 1)) != 0
+#error "COMMAND_RING_SIZE must be a power of two"
+#endif
+
+static bool IsSpace(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+/// @brief strtol, but only succeeds if the whole of [start, end) was used.
+static bool ParseLong(const char *start, const char *end, long &val)
+{
+  if(start == end)
+    return false;
+
+  char buf[COMMAND_MAX_LENGTH];
+  size_t len = end - start;
+  memcpy(buf, start, len);
+  buf[len] = 0;
+
+  char *parseEnd;
+  long parsed = strtol(buf, &parseEnd, 10);
+  if(parseEnd != buf + len)
+    return false;
+
+  val = parsed;
+  return true;
+}
+
+bool Command::parameterToLong(long &val) const
+{
+  return ParseLong(parameter, parameter + parameterLength, val);
+}
+
+bool Command::fieldToLong(uint8_t index, long &val) const
+{
+  const char *p = parameter;
+  const char *end = parameter + parameterLength;
+
+  for(;;)
+  {
+    while(p < end && IsSpace(*p))
+      p++;
+    if(p == end)
+      return false;
+
+    const char *fieldEnd = p;
+    while(fieldEnd < end && !IsSpace(*fieldEnd))
+      fieldEnd++;
+
+    if(index == 0)
+      return ParseLong(p, fieldEnd, val);
+
+    index--;
+    p = fieldEnd;
+  }
+}
+
+CommandParser::CommandParser()
+{
+  clear();
+  _droppedBytes = 0;
+  _overlongFrames = 0;
+}
+
+void CommandParser::clear()
+{
+  _head = 0;
+  _tail = 0;
+  _frameLength = 0;
+  _discarding = false;
+  _lastByteMs = 0;
+}
+
+bool CommandParser::push(uint8_t b, unsigned long nowMs)
+{
+  _lastByteMs = nowMs;
+  if(space() == 0)
+  {
+    _droppedBytes++;
+    MetricCount(METRIC_COMMAND_ERRORS);
+    return false;
+  }
+  _ring[_head & (COMMAND_RING_SIZE - 1)] = b;
+  _head++;
+  return true;
+}
+
+bool CommandParser::next(Command &cmd, unsigned long nowMs)
+{
+  //Move bytes out of the ring into the frame until we hit a terminator.
+  while(_tail != _head)
+  {
+    char c = (char)_ring[_tail & (COMMAND_RING_SIZE - 1)];
+    _tail++;
+
+    if(c == '\n' || c == '\r' || c == 0)
+    {
+      if(_discarding)
+      {
+        //End of an overlong frame, start afresh with the next byte.
+        _discarding = false;
+        _frameLength = 0;
+        continue;
+      }
+      //A bare terminator (the second half of \r\n, for example) is not a
+      //command, so keep looking.
+      if(complete(cmd))
+        return true;
+      continue;
+    }
+
+    if(_discarding)
+      continue;
+
+    if(_frameLength == COMMAND_MAX_LENGTH)
+    {
+      //Too long to be anything we understand.  Drop it all up to the next
+      //terminator rather than executing half a command.
+      _overlongFrames++;
+      MetricCount(METRIC_COMMAND_ERRORS);
+      _discarding = true;
+      _frameLength = 0;
+      continue;
+    }
+    _frame[_frameLength++] = c;
+  }
+
+  //Nothing more in the ring.  If there is a partial frame that has been
+  //sitting there for a while, assume the sender does not bother with
+  //terminators and run with what we have.
+  if(_frameLength > 0 && !_discarding && nowMs - _lastByteMs >= COMMAND_IDLE_TIMEOUT_MS)
+    return complete(cmd);
+
+  return false;
+}
+
+bool CommandParser::complete(Command &cmd)
+{
+  uint8_t start = 0;
+  uint8_t end = _frameLength;
+  _frameLength = 0;
+
+  while(start < end && IsSpace(_frame[start]))
+    start++;
+  if(start == end)
+    return false;
+
+  cmd.code = _frame[start++];
+
+  while(start < end && IsSpace(_frame[start]))
+    start++;
+  while(end > start && IsSpace(_frame[end - 1]))
+    end--;
+
+  cmd.parameterLength = end - start;
+  memcpy(cmd.parameter, _frame + start, cmd.parameterLength);
+  cmd.parameter[cmd.parameterLength] = 0;
+  return true;
+}
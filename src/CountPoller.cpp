@@ -0,0 +1,115 @@
+#include "CountPoller.h"
+
+uint32_t PollPeriodUs(uint64_t countsPerSec)
+{
+  if(countsPerSec == 0)
+    return POLL_MAX_PERIOD_US;
+  uint64_t period = (uint64_t)POLL_SAFE_COUNTS * 1000000ULL / (countsPerSec * POLL_MARGIN);
+  if(period < POLL_MIN_PERIOD_US)
+    return 0;
+  return period > POLL_MAX_PERIOD_US ? POLL_MAX_PERIOD_US : (uint32_t)period;
+}
+
+CountPoller::CountPoller() :
+  _timer(nullptr),
+  _periodUs(0),
+  _encoders{},
+  _periods{},
+  _statsSequence(0),
+  _lastUs(0),
+  _polls(0),
+  _maxGapUs(0),
+  _late(0),
+  _resetRequested(true)
+{
+}
+
+bool CountPoller::begin()
+{
+  esp_timer_create_args_t args = {};
+  args.callback = &CountPoller::onTimer;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "poller";
+  return esp_timer_create(&args, &_timer) == ESP_OK;
+}
+
+void CountPoller::setEncoder(uint8_t channel, Encoder *encoder, uint32_t periodUs)
+{
+  if(channel >= POLL_MAX_ENCODERS)
+    return;
+  _periods[channel] = periodUs;
+  _encoders[channel] = encoder;
+}
+
+void CountPoller::update()
+{
+  uint32_t period = 0;
+  for(uint8_t i = 0; i < POLL_MAX_ENCODERS; i++)
+  {
+    if(_encoders[i] != nullptr && _periods[i] > 0 && (period == 0 || _periods[i] < period))
+      period = _periods[i];
+  }
+  if(period == _periodUs || _timer == nullptr)
+    return;
+
+  esp_timer_stop(_timer);
+  _periodUs = period;
+  _resetRequested = true;
+  if(_periodUs > 0)
+    esp_timer_start_periodic(_timer, _periodUs);
+}
+
+void CountPoller::pollAll()
+{
+  for(uint8_t i = 0; i < POLL_MAX_ENCODERS; i++)
+  {
+    Encoder *encoder = _encoders[i];
+    if(encoder != nullptr)
+      encoder->poll();
+  }
+}
+
+PollStats CountPoller::stats() const
+{
+  PollStats stats;
+  uint32_t seq;
+  //Go again if the timer callback was part way through, or got in while
+  //these were being read, as Sampler::jitter() does.
+  do
+  {
+    seq = _statsSequence;
+    stats.polls = _polls;
+    stats.maxGapUs = _maxGapUs;
+    stats.late = _late;
+  } while((seq & 1) || seq != _statsSequence);
+  stats.periodUs = _periodUs;
+  return stats;
+}
+
+void CountPoller::onTimer(void *arg)
+{
+  CountPoller *poller = static_cast<CountPoller *>(arg);
+  poller->pollAll();
+
+  int64_t now = esp_timer_get_time();
+  poller->_statsSequence++;
+  if(poller->_resetRequested)
+  {
+    poller->_resetRequested = false;
+    poller->_polls = 0;
+    poller->_maxGapUs = 0;
+    poller->_late = 0;
+  }
+  else
+  {
+    int64_t gap = now - poller->_lastUs;
+    if(gap > poller->_maxGapUs)
+      poller->_maxGapUs = gap;
+    if(gap > (int64_t)poller->_periodUs * POLL_MARGIN)
+      poller->_late++;
+  }
+  poller->_polls++;
+  poller->_lastUs = now;
+  poller->_statsSequence++;
+}
@@ -0,0 +1,107 @@
+#include "EdgeCapture.h"
+
+EdgeCapture::EdgeCapture() :
+  _encoder(nullptr),
+  _lastCount(0),
+  _overflows(0),
+  _held(false),
+  _heldEdge{}
+{
+  resetStats();
+}
+
+void EdgeCapture::hook(Encoder &encoder)
+{
+#if ENCODER_HAS_EDGE_CAPTURE
+  //Nothing is pushing while the encoder is detached, so anything left from
+  //the last encoder can go.
+  EdgeEvent stale;
+  while(_ring.pop(stale))
+    ;
+  _held = false;
+  resetStats();
+
+  _encoder = &encoder;
+  _lastCount = encoder.count;
+  encoder.always_interrupt = true;
+  encoder._enc_isr_cb = &EdgeCapture::onEdge;
+  encoder._enc_isr_cb_data = this;
+#else
+  //Only the PCNT unit interrupts per edge, so this stays unhooked.
+  (void)encoder;
+#endif
+}
+
+void EdgeCapture::unhook(Encoder &encoder)
+{
+#if ENCODER_HAS_EDGE_CAPTURE
+  encoder.always_interrupt = false;
+  encoder._enc_isr_cb = nullptr;
+  encoder._enc_isr_cb_data = nullptr;
+  if(_encoder == &encoder)
+    _encoder = nullptr;
+#else
+  (void)encoder;
+#endif
+}
+
+void IRAM_ATTR EdgeCapture::onEdge(void *arg)
+{
+  EdgeCapture *capture = static_cast<EdgeCapture *>(arg);
+
+  //The ISR has just folded the edge into count and cleared the hardware
+  //counter, so count on its own is the position right after the edge.
+  EdgeEvent edge;
+  edge.timestampUs = esp_timer_get_time();
+  edge.count = capture->_encoder->count;
+  edge.direction = edge.count >= capture->_lastCount ? 1 : -1;
+  capture->_lastCount = edge.count;
+
+  if(!capture->_ring.push(edge))
+    capture->_overflows++;
+}
+
+bool EdgeCapture::read(EdgeEvent &edge, int64_t untilUs)
+{
+  if(!_held)
+    _held = _ring.pop(_heldEdge);
+  if(!_held || _heldEdge.timestampUs > untilUs)
+    return false;
+
+  edge = _heldEdge;
+  _held = false;
+  _edges++;
+
+  //Periods only mean anything between edges going the same way.
+  if(_haveLastEdge && edge.direction == _lastEdge.direction)
+  {
+    int64_t period = edge.timestampUs - _lastEdge.timestampUs;
+    if(period < _minPeriodUs)
+      _minPeriodUs = period;
+    if(period > _maxPeriodUs)
+      _maxPeriodUs = period;
+  }
+  _lastEdge = edge;
+  _haveLastEdge = true;
+  return true;
+}
+
+EdgeStats EdgeCapture::stats() const
+{
+  EdgeStats stats;
+  stats.edges = _edges;
+  stats.overflows = _overflows - _overflowsAtReset;
+  stats.minPeriodUs = _minPeriodUs == INT64_MAX ? 0 : _minPeriodUs;
+  stats.maxPeriodUs = _maxPeriodUs;
+  return stats;
+}
+
+void EdgeCapture::resetStats()
+{
+  _edges = 0;
+  _overflowsAtReset = _overflows;
+  _haveLastEdge = false;
+  _lastEdge = {};
+  _minPeriodUs = INT64_MAX;
+  _maxPeriodUs = 0;
+}
@@ -0,0 +1,37 @@
+#include "EncoderBackend.h"
+#ifndef ARDUINO_ARCH_ESP32
+#include <SimHAL.h>
+#endif
+
+void PcntEncoder::move(int64_t counts)
+{
+#ifdef ARDUINO_ARCH_ESP32
+  offsetCount(counts);
+#else
+  //A step at a time as far as the unit is concerned, in lumps it can take.
+  while(counts != 0)
+  {
+    int32_t steps = counts > INT32_MAX ? INT32_MAX : counts < -INT32_MAX ? -INT32_MAX : (int32_t)counts;
+    SimPcntStep(unit, steps);
+    counts -= steps;
+  }
+#endif
+}
+
+void GpioEncoder::attach(int aPin, int bPin, unsigned long countMode)
+{
+  _countMode = countMode == ENCODER_COUNT_SINGLE || countMode == ENCODER_COUNT_FULL ? countMode : ENCODER_COUNT_HALF;
+  _offset = 0;
+  _decoder.attach(aPin, bPin);
+}
+
+int64_t IRAM_ATTR GpioEncoder::rawCount()
+{
+  //Full quadrature is 4 a line, floor division so the count doesn't
+  //stick either side of zero.
+  int64_t full = _decoder.read();
+  if(_countMode == ENCODER_COUNT_FULL)
+    return full;
+  int64_t per = 4 / _countMode;
+  return full >= 0 ? full / per : -((-full + per - 1) / per);
+}
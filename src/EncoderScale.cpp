@@ -0,0 +1,149 @@
+#include "EncoderScale.h"
+#include <string.h>
+
+#define MILLIDEG_PER_REV (360LL * ENCODER_SCALE_ANGLE)
+//Thousandths of an RPM at one count per us, times half counts per rev.
+#define RPM_NUMERATOR (2LL * 60000000LL * ENCODER_SCALE_RPM)
+//Largest count change the exact RPM sum can take, some 77 million.
+#define RPM_EXACT_MAX_DELTA (INT64_MAX / RPM_NUMERATOR)
+
+EncoderScale::EncoderScale()
+{
+  configure(1200, ENCODER_COUNT_HALF);
+}
+
+void EncoderScale::configure(uint32_t pulsePerRev, uint8_t countMode)
+{
+  if(pulsePerRev == 0)
+    pulsePerRev = 1;
+  //Anything bigger would overflow the half count maths, and there's no
+  //such encoder anyway.
+  if(pulsePerRev > 0x10000000)
+    pulsePerRev = 0x10000000;
+  if(countMode != ENCODER_COUNT_SINGLE && countMode != ENCODER_COUNT_FULL)
+    countMode = ENCODER_COUNT_HALF;
+
+  _pulsePerRev = pulsePerRev;
+  _countMode = countMode;
+  _halfCountsPerRev = pulsePerRev * countMode;
+
+  _angleRecip = ((MILLIDEG_PER_REV << 32) + _halfCountsPerRev / 2) / _halfCountsPerRev;
+  _rpmFactor = (RPM_NUMERATOR + _halfCountsPerRev / 2) / _halfCountsPerRev;
+  _rpmMaxDelta = INT64_MAX / (int64_t)_rpmFactor;
+  _rpmMaxUs = INT64_MAX / _halfCountsPerRev;
+}
+
+int64_t EncoderScale::angle(int32_t count) const
+{
+  //Work on the size and put the sign back at the end, so the angle is the
+  //same either side of zero.
+  uint32_t magnitude = count < 0 ? 0u - (uint32_t)count : (uint32_t)count;
+
+  //Whole revs and what's left over, in half counts.  Doubling the
+  //magnitude could overflow, so divide first and double afterwards.
+  uint32_t whole = magnitude / _halfCountsPerRev;
+  uint32_t rest = magnitude - whole * _halfCountsPerRev;
+  uint64_t revs = (uint64_t)whole * 2;
+  rest *= 2;
+  if(rest >= _halfCountsPerRev)
+  {
+    revs++;
+    rest -= _halfCountsPerRev;
+  }
+
+  int64_t result = (int64_t)revs * MILLIDEG_PER_REV + (int64_t)(((uint64_t)rest * _angleRecip + 0x80000000) >> 32);
+  return count < 0 ? -result : result;
+}
+
+int32_t EncoderScale::count(int64_t angle) const
+{
+  //Not on the sample path, so a plain divide will do.
+  return (int32_t)(angle * _halfCountsPerRev / (2 * MILLIDEG_PER_REV));
+}
+
+int32_t EncoderScale::rpm(int64_t deltaCount, int64_t deltaUs) const
+{
+  if(deltaUs <= 0)
+    return 0;
+
+  bool negative = deltaCount < 0;
+  uint64_t magnitude = negative ? 0 - (uint64_t)deltaCount : (uint64_t)deltaCount;
+
+  uint64_t result;
+  if(magnitude <= (uint64_t)RPM_EXACT_MAX_DELTA && deltaUs <= _rpmMaxUs)
+  {
+    //The whole sum in one divide, so the only rounding is the last.  The
+    //rounded _rpmFactor is out by up to half a part in itself, which at
+    //thousands of counts a rev is a few thousandths of an RPM at speed.
+    uint64_t denominator = (uint64_t)deltaUs * _halfCountsPerRev;
+    result = (magnitude * (uint64_t)RPM_NUMERATOR + denominator / 2) / denominator;
+  }
+  else if(magnitude <= (uint64_t)_rpmMaxDelta)
+    result = (magnitude * _rpmFactor + (uint64_t)deltaUs / 2) / (uint64_t)deltaUs;
+  else
+  {
+    //Only when something has gone badly wrong with the count, but don't
+    //let it wrap round to a sensible looking speed.
+    uint64_t perUs = magnitude / (uint64_t)deltaUs;
+    result = perUs > (uint64_t)INT32_MAX / _rpmFactor ? INT32_MAX : perUs * _rpmFactor;
+  }
+
+  if(result > INT32_MAX)
+    result = INT32_MAX;
+  return negative ? -(int32_t)result : (int32_t)result;
+}
+
+/// @brief Write the digits of a number backwards from p, with a decimal
+/// point places digits from the end.
+/// @return Where the first digit went.
+template <typename T>
+static char *WriteDigits(char *p, T magnitude, uint8_t places)
+{
+  for(uint8_t i = 0; i < places; i++)
+  {
+    *--p = '0' + magnitude % 10;
+    magnitude /= 10;
+  }
+  if(places > 0)
+    *--p = '.';
+  do
+  {
+    *--p = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while(magnitude > 0);
+  return p;
+}
+
+size_t FormatFixed(char *buf, int64_t value, uint32_t scale, uint8_t digits)
+{
+  //Rescale to the number of digits wanted, rounding off what's dropped.
+  //There can't be more digits than the scale has.
+  uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  uint8_t places = 0;
+  uint32_t shown = 1;
+  while(places < digits && shown < scale)
+  {
+    shown *= 10;
+    places++;
+  }
+  uint32_t drop = scale / shown;
+  if(magnitude < UINT32_MAX / 2)
+    magnitude = ((uint32_t)magnitude + drop / 2) / drop;
+  else
+    magnitude = (magnitude + drop / 2) / drop;
+
+  //Nearly always fits in 32 bits, where the divides are done in hardware.
+  char text[FIXED_TEXT_SIZE];
+  char *p = text + sizeof(text);
+  if(magnitude <= UINT32_MAX)
+    p = WriteDigits(p, (uint32_t)magnitude, places);
+  else
+    p = WriteDigits(p, magnitude, places);
+  if(value < 0)
+    *--p = '-';
+
+  size_t len = text + sizeof(text) - p;
+  memcpy(buf, p, len);
+  buf[len] = 0;
+  return len;
+}
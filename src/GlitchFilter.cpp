@@ -0,0 +1,92 @@
+#include "GlitchFilter.h"
+
+uint32_t FilterMaxRpm(uint32_t pulsePerRev, uint32_t filter)
+{
+  if(pulsePerRev == 0)
+    pulsePerRev = 1;
+  if(filter == 0)
+    filter = 1;
+  uint64_t rpm = 60ULL * PCNT_FILTER_APB_HZ / ((uint64_t)pulsePerRev * filter);
+  return rpm > UINT32_MAX ? UINT32_MAX : (uint32_t)rpm;
+}
+
+FilterCalibration::FilterCalibration()
+{
+  begin(0, 2);
+}
+
+void FilterCalibration::begin(int64_t startUs, uint8_t countMode)
+{
+  _startUs = startUs;
+  _countMode = countMode > 0 ? countMode : 2;
+  _haveLast = false;
+  _last = {};
+  _edges = 0;
+  _minIntervalUs = 0;
+  _glitches = 0;
+  _maxGlitchUs = 0;
+}
+
+void FilterCalibration::edge(const EdgeEvent &edge)
+{
+  _edges++;
+  if(_haveLast)
+  {
+    int64_t interval = edge.timestampUs - _last.timestampUs;
+    if(edge.direction != _last.direction && interval <= FILTER_CAL_GLITCH_US)
+    {
+      //Straight back again.  A shaft can't do that, it's a spike on a pin.
+      _glitches++;
+      if(interval > _maxGlitchUs)
+        _maxGlitchUs = interval;
+      //The next real edge will look like the shaft turning back again, so
+      //don't time it against the spike.
+      _haveLast = false;
+      return;
+    }
+    else if(edge.direction == _last.direction && interval > 0 &&
+            (_minIntervalUs == 0 || interval < _minIntervalUs))
+    {
+      _minIntervalUs = interval;
+    }
+  }
+  _last = edge;
+  _haveLast = true;
+}
+
+FilterCalibrationResult FilterCalibration::result(int64_t nowUs) const
+{
+  FilterCalibrationResult r;
+  r.edges = _edges;
+  r.minIntervalUs = _minIntervalUs;
+  r.glitches = _glitches;
+  r.maxGlitchUs = _maxGlitchUs;
+  int64_t runUs = nowUs - _startUs;
+  r.glitchRate = runUs > 0 ? (uint32_t)(_glitches * 1000000LL / runUs) : 0;
+
+  //The filter has to outlast the longest glitch.  Timestamps are whole us,
+  //so a glitch that read as n us may have been nearly n + 1.
+  uint32_t needed = _glitches > 0 ? (uint32_t)((_maxGlitchUs + 1) * (PCNT_FILTER_APB_HZ / 1000000)) : 0;
+
+  //...and be well short of the narrowest real pulse.  Each pin is high for
+  //half a line, which is countMode / 2 count intervals.
+  uint32_t allowed = PCNT_FILTER_MAX;
+  if(_minIntervalUs > 0)
+  {
+    int64_t pulseNs = _minIntervalUs * 1000 * _countMode / 2;
+    int64_t cycles = pulseNs * (int64_t)(PCNT_FILTER_APB_HZ / 1000000) / 1000 / FILTER_CAL_HEADROOM;
+    if(cycles < allowed)
+      allowed = cycles < 1 ? 1 : (uint32_t)cycles;
+  }
+
+  r.headroom = needed <= allowed;
+  if(!r.headroom)
+    r.recommended = needed > PCNT_FILTER_MAX ? PCNT_FILTER_MAX : needed;
+  else if(needed > 0)
+    r.recommended = needed;
+  else
+    //Nothing to stop, so as much filtering as the speed allows, but no
+    //more than the library's long standing default.
+    r.recommended = allowed < PCNT_FILTER_DEFAULT ? allowed : PCNT_FILTER_DEFAULT;
+  return r;
+}
@@ -0,0 +1,128 @@
+#include "IndexHoming.h"
+
+//Holds the pin interrupt off while the figures are copied or reset, so
+//they all come from one side of an index, and the 64 bit time can't be
+//caught half written.
+static portMUX_TYPE _statsLock = portMUX_INITIALIZER_UNLOCKED;
+
+IndexHoming::IndexHoming() :
+  _encoder(nullptr),
+  _pin(-1),
+  _mode(INDEX_MODE_OFF),
+  _homeCount(0),
+  _halfCountsPerRev(2),
+  _homed(false),
+  _corrections(0)
+{
+  resetStats();
+}
+
+void IndexHoming::attach(Encoder &encoder, int pin, uint8_t mode, int64_t homeCount, uint32_t halfCountsPerRev)
+{
+  detach();
+  _encoder = &encoder;
+  _pin = pin;
+  _mode = mode;
+  _homeCount = homeCount;
+  _halfCountsPerRev = halfCountsPerRev > 0 ? halfCountsPerRev : 2;
+  _homed = false;
+  resetStats();
+
+  //Same pull as the encoder pins, the index is usually the same kind of
+  //output.
+  pinMode(_pin, ESP32Encoder::useInternalWeakPullResistors == DOWN ? INPUT_PULLDOWN :
+                ESP32Encoder::useInternalWeakPullResistors == UP ? INPUT_PULLUP : INPUT);
+  attachInterruptArg(_pin, &IndexHoming::onIndex, this, RISING);
+}
+
+void IndexHoming::detach()
+{
+  if(_encoder == nullptr)
+    return;
+  detachInterrupt(_pin);
+  _encoder = nullptr;
+}
+
+IndexStats IndexHoming::stats() const
+{
+  IndexStats stats;
+  portENTER_CRITICAL(&_statsLock);
+  stats.hits = _hits;
+  stats.lastError = _lastError;
+  stats.minError = _minError;
+  stats.maxError = _maxError;
+  stats.lastUs = _lastUs;
+  portEXIT_CRITICAL(&_statsLock);
+  //Nothing measured until the second hit.
+  if(stats.minError > stats.maxError)
+  {
+    stats.minError = 0;
+    stats.maxError = 0;
+  }
+  return stats;
+}
+
+void IndexHoming::resetStats()
+{
+  portENTER_CRITICAL(&_statsLock);
+  _hits = 0;
+  _lastError = 0;
+  _minError = INT32_MAX;
+  _maxError = INT32_MIN;
+  _lastUs = 0;
+  portEXIT_CRITICAL(&_statsLock);
+}
+
+void IndexHoming::onIndex(void *arg)
+{
+  IndexHoming *index = static_cast<IndexHoming *>(arg);
+  Encoder *encoder = index->_encoder;
+  if(encoder == nullptr)
+    return;
+
+  EncoderSnapshot snap = encoder->getSnapshot();
+
+  if(!index->_homed)
+  {
+    portENTER_CRITICAL_ISR(&_statsLock);
+    index->_lastUs = snap.timestampUs;
+    index->_hits = index->_hits + 1;
+    portEXIT_CRITICAL_ISR(&_statsLock);
+    //First time round there is nothing to measure against, just set it,
+    //as of the moment of the snapshot.
+    encoder->offsetCount(index->_homeCount - snap.count);
+    index->_homed = true;
+    index->_corrections = index->_corrections + 1;
+    return;
+  }
+
+  //How far off home the count is, to the nearest whole rev.  Worked in
+  //half counts so a rev is a whole number whatever the counting mode.
+  int64_t half = (int64_t)index->_halfCountsPerRev;
+  int64_t offset = ((snap.count - index->_homeCount) * 2) % half;
+  if(offset > half / 2)
+    offset -= half;
+  else if(offset <= -half / 2)
+    offset += half;
+  int32_t error = (int32_t)(offset / 2);
+
+  portENTER_CRITICAL_ISR(&_statsLock);
+  index->_lastUs = snap.timestampUs;
+  index->_hits = index->_hits + 1;
+  index->_lastError = error;
+  if(error < index->_minError)
+    index->_minError = error;
+  if(error > index->_maxError)
+    index->_maxError = error;
+  portEXIT_CRITICAL_ISR(&_statsLock);
+
+  //Take the error out, which keeps the whole revs, so the angle and RPM
+  //carry on from where they were.  This moves the same software part of
+  //the count that setCount() and the PCNT wrap interrupt do, so any counts
+  //since the snapshot are kept.
+  if(index->_mode == INDEX_MODE_EVERY && error != 0)
+  {
+    encoder->offsetCount(-error);
+    index->_corrections = index->_corrections + 1;
+  }
+}
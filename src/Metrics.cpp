@@ -0,0 +1,93 @@
+#include "Metrics.h"
+
+struct MetricInfo
+{
+  const char *name;
+  uint8_t kind;
+};
+
+static const MetricInfo _info[] = {
+  {"loop_us", METRIC_GAUGE},
+  {"loop_overruns", METRIC_COUNTER},
+  {"sample_drops", METRIC_COUNTER},
+  {"sample_age_us", METRIC_GAUGE},
+  {"write_us", METRIC_GAUGE},
+  {"write_bytes", METRIC_COUNTER},
+  {"output_dropped", METRIC_COUNTER},
+  {"pcnt_interrupts", METRIC_COUNTER},
+  {"filter_resets", METRIC_COUNTER},
+  {"commands", METRIC_COUNTER},
+  {"command_errors", METRIC_COUNTER},
+  {"settings_writes", METRIC_COUNTER},
+  {"records_dropped", METRIC_COUNTER},
+};
+static_assert(sizeof(_info) / sizeof(_info[0]) == METRIC_COUNT, "a metric has no name");
+
+struct MetricState
+{
+  uint32_t count;
+  int32_t min;
+  int32_t max;
+  int64_t sum;
+};
+
+static MetricState _state[METRIC_COUNT];
+static unsigned long _since = 0;
+static portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+
+void IRAM_ATTR MetricCount(MetricId id, uint32_t n)
+{
+  portENTER_CRITICAL_SAFE(&_lock);
+  _state[id].count += n;
+  portEXIT_CRITICAL_SAFE(&_lock);
+}
+
+void IRAM_ATTR MetricGauge(MetricId id, int32_t value)
+{
+  portENTER_CRITICAL_SAFE(&_lock);
+  MetricState &state = _state[id];
+  if(state.count == 0 || value < state.min)
+    state.min = value;
+  if(state.count == 0 || value > state.max)
+    state.max = value;
+  state.sum += value;
+  state.count++;
+  portEXIT_CRITICAL_SAFE(&_lock);
+}
+
+MetricValue MetricRead(MetricId id)
+{
+  portENTER_CRITICAL_SAFE(&_lock);
+  MetricState state = _state[id];
+  portEXIT_CRITICAL_SAFE(&_lock);
+
+  MetricValue value = {};
+  value.kind = _info[id].kind;
+  value.count = state.count;
+  if(value.kind == METRIC_GAUGE && state.count > 0)
+  {
+    value.min = state.min;
+    value.max = state.max;
+    value.mean = (int32_t)(state.sum / state.count);
+  }
+  return value;
+}
+
+const char *MetricName(MetricId id)
+{
+  return id < METRIC_COUNT ? _info[id].name : "";
+}
+
+void MetricsReset()
+{
+  portENTER_CRITICAL_SAFE(&_lock);
+  for(uint8_t i = 0; i < METRIC_COUNT; i++)
+    _state[i] = {};
+  portEXIT_CRITICAL_SAFE(&_lock);
+  _since = millis();
+}
+
+unsigned long MetricsSince()
+{
+  return _since;
+}
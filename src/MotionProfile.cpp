@@ -0,0 +1,129 @@
+#include "MotionProfile.h"
+#include <math.h>
+
+double MotionCounts(const MotionSettings &settings, double countsPerRev, double seconds)
+{
+  //Full speed in counts a second.
+  double v = settings.type == MOTION_WRAP ? (double)settings.speed * MOTION_WRAP_COUNTS
+                                          : (double)settings.speed * countsPerRev / 60.0;
+  double period = settings.periodMs / 1000.0;
+
+  switch(settings.type)
+  {
+    case MOTION_CONSTANT:
+    case MOTION_WRAP:
+      return v * seconds;
+
+    case MOTION_RAMP:
+    {
+      //Up and down again covers v * period, a triangle.
+      double cycles = floor(seconds / (2 * period));
+      double t = seconds - cycles * 2 * period;
+      double counts = cycles * v * period;
+      if(t < period)
+        return counts + v * t * t / (2 * period);
+      t -= period;
+      return counts + v * period / 2 + v * t - v * t * t / (2 * period);
+    }
+
+    case MOTION_SINE:
+      return v * period / (2 * M_PI) * (1 - cos(2 * M_PI * seconds / period));
+
+    case MOTION_REVERSE:
+    {
+      double t = fmod(seconds, 2 * period);
+      return t < period ? v * t : v * (2 * period - t);
+    }
+  }
+  return 0;
+}
+
+MotionGenerator::MotionGenerator() :
+  _timer(nullptr),
+  _settings{},
+  _running(false),
+  _startUs(0),
+  _random(1),
+  _encoders{},
+  _countsPerRev{},
+  _moved{}
+{
+}
+
+bool MotionGenerator::begin()
+{
+  esp_timer_create_args_t args = {};
+  args.callback = &MotionGenerator::onTimer;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "motion";
+  return esp_timer_create(&args, &_timer) == ESP_OK;
+}
+
+void MotionGenerator::setEncoder(uint8_t channel, Encoder *encoder, double countsPerRev)
+{
+  if(channel >= MOTION_MAX_ENCODERS)
+    return;
+  _countsPerRev[channel] = countsPerRev;
+  _encoders[channel] = encoder;
+}
+
+bool MotionGenerator::start(const MotionSettings &settings)
+{
+  if(_timer == nullptr || settings.type == MOTION_OFF || settings.type >= MOTION_TYPE_COUNT ||
+     settings.stepUs < MOTION_MIN_STEP_US)
+    return false;
+  //The shapes that repeat need something to repeat over.
+  if(settings.type != MOTION_CONSTANT && settings.type != MOTION_WRAP && settings.periodMs == 0)
+    return false;
+
+  stop();
+  _settings = settings;
+  for(uint8_t i = 0; i < MOTION_MAX_ENCODERS; i++)
+    _moved[i] = 0;
+  //Same jitter every run, so host runs repeat exactly.
+  _random = 1;
+  _startUs = esp_timer_get_time();
+  _running = true;
+  esp_timer_start_periodic(_timer, _settings.stepUs);
+  return true;
+}
+
+void MotionGenerator::stop()
+{
+  if(_timer != nullptr)
+    esp_timer_stop(_timer);
+  _running = false;
+}
+
+int32_t MotionGenerator::jitter()
+{
+  if(_settings.jitterCounts == 0)
+    return 0;
+  //xorshift32, plenty for a bit of noise.
+  _random ^= _random << 13;
+  _random ^= _random >> 17;
+  _random ^= _random << 5;
+  return (int32_t)(_random % (2 * _settings.jitterCounts + 1)) - (int32_t)_settings.jitterCounts;
+}
+
+void MotionGenerator::onTimer(void *arg)
+{
+  MotionGenerator *generator = static_cast<MotionGenerator *>(arg);
+  double seconds = (esp_timer_get_time() - generator->_startUs) / 1e6;
+  int32_t noise = generator->jitter();
+
+  for(uint8_t i = 0; i < MOTION_MAX_ENCODERS; i++)
+  {
+    Encoder *encoder = generator->_encoders[i];
+    if(encoder == nullptr)
+      continue;
+    int64_t target = llround(MotionCounts(generator->_settings, generator->_countsPerRev[i], seconds)) + noise;
+    int64_t delta = target - generator->_moved[i];
+    if(delta != 0)
+    {
+      encoder->move(delta);
+      generator->_moved[i] = target;
+    }
+  }
+}
@@ -0,0 +1,180 @@
+#include "OutputRing.h"
+#include <esp_timer.h>
+#include "Metrics.h"
+
+static_assert(OUTPUT_RECORD_SLOTS <= 32, "free slots are a 32 bit mask");
+static_assert(OUTPUT_RECORD_MAX <= OUTPUT_CHUNK_SIZE, "a record must fit a chunk");
+
+OutputRing::OutputRing() :
+  _policy(OUTPUT_DROP_OLDEST),
+  _textHead(0),
+  _textTail(0),
+  _freeSlots(OUTPUT_RECORD_SLOTS == 32 ? 0xFFFFFFFF : (1UL << OUTPUT_RECORD_SLOTS) - 1),
+  _queued(0),
+  _first(0),
+  _count(0),
+  _sent(0),
+  _pending(0),
+  _stats{}
+{
+}
+
+size_t OutputRing::writeText(const uint8_t *buffer, size_t size)
+{
+  size_t space = textSpace();
+  size_t n = size < space ? size : space;
+  if(n < size)
+  {
+    _stats.textDropped += size - n;
+    MetricCount(METRIC_OUTPUT_DROPPED, size - n);
+  }
+  if(n == 0)
+    return 0;
+
+  //In two goes if it runs past the end.
+  size_t at = _textHead & (OUTPUT_TEXT_SIZE - 1);
+  size_t first = OUTPUT_TEXT_SIZE - at;
+  if(first > n)
+    first = n;
+  memcpy(_text + at, buffer, first);
+  memcpy(_text, buffer + first, n - first);
+  _textHead += n;
+
+  //Straight on from the text before it, unless a record came in between.
+  if(_count > 0 && entry(_count - 1).slot == TEXT)
+    entry(_count - 1).length += n;
+  else
+  {
+    entry(_count) = {TEXT, (uint16_t)n};
+    _count++;
+  }
+  _pending += n;
+  return n;
+}
+
+bool OutputRing::pushRecord(const uint8_t *buffer, size_t size)
+{
+  if(size == 0)
+    return true;
+  if(size > OUTPUT_RECORD_MAX)
+    size = OUTPUT_RECORD_MAX;
+
+  if(_freeSlots == 0)
+  {
+    if(_policy == OUTPUT_DROP_NEWEST)
+    {
+      _stats.dropped++;
+      MetricCount(METRIC_RECORDS_DROPPED);
+      return false;
+    }
+    dropRecords(_policy == OUTPUT_COALESCE);
+  }
+
+  uint8_t slot = __builtin_ctz(_freeSlots);
+  _freeSlots &= ~(1UL << slot);
+  memcpy(_records[slot], buffer, size);
+  entry(_count) = {slot, (uint16_t)size};
+  _count++;
+  _pending += size;
+
+  _queued++;
+  _stats.records++;
+  if(_queued > _stats.maxQueued)
+    _stats.maxQueued = _queued;
+  return true;
+}
+
+void OutputRing::dropRecords(bool all)
+{
+  uint8_t n = 0;
+  //The front record is part way out, so has to go whole.
+  if(_count > 0 && entry(0).slot != TEXT && _sent > 0)
+    n = 1;
+  while(n < _count)
+  {
+    Entry &e = entry(n);
+    if(e.slot == TEXT)
+    {
+      n++;
+      continue;
+    }
+    _freeSlots |= 1UL << e.slot;
+    _queued--;
+    _stats.dropped++;
+    MetricCount(METRIC_RECORDS_DROPPED);
+    //Whatever came after it is now at n.
+    removeEntry(n);
+    if(!all)
+      return;
+  }
+}
+
+void OutputRing::removeEntry(uint8_t n)
+{
+  _pending -= entry(n).length;
+  for(uint8_t i = n; i + 1 < _count; i++)
+    entry(i) = entry(i + 1);
+  _count--;
+
+  //Text either side of it is one run again.
+  if(n > 0 && n < _count && entry(n - 1).slot == TEXT && entry(n).slot == TEXT)
+  {
+    entry(n - 1).length += entry(n).length;
+    for(uint8_t i = n; i + 1 < _count; i++)
+      entry(i) = entry(i + 1);
+    _count--;
+  }
+}
+
+void OutputRing::drain(Print &out, size_t room)
+{
+  size_t want = room < sizeof(_chunk) ? room : sizeof(_chunk);
+  size_t used = 0;
+  while(used < want && _count > 0)
+  {
+    Entry &e = entry(0);
+    size_t take;
+    if(e.slot == TEXT)
+    {
+      take = e.length < want - used ? e.length : want - used;
+      size_t at = _textTail & (OUTPUT_TEXT_SIZE - 1);
+      size_t first = OUTPUT_TEXT_SIZE - at;
+      if(first > take)
+        first = take;
+      memcpy(_chunk + used, _text + at, first);
+      memcpy(_chunk + used + first, _text, take - first);
+      _textTail += take;
+      e.length -= take;
+    }
+    else
+    {
+      take = (size_t)(e.length - _sent) < want - used ? e.length - _sent : want - used;
+      memcpy(_chunk + used, _records[e.slot] + _sent, take);
+      _sent += take;
+      if(_sent == e.length)
+      {
+        _freeSlots |= 1UL << e.slot;
+        _queued--;
+        _sent = 0;
+        e.length = 0;
+      }
+    }
+    used += take;
+    _pending -= take;
+    if(e.length == 0)
+    {
+      _first = (_first + 1) % ENTRIES;
+      _count--;
+    }
+  }
+  if(used == 0)
+    return;
+
+  int64_t startUs = esp_timer_get_time();
+  size_t sent = out.write(_chunk, used);
+  MetricGauge(METRIC_WRITE_US, (int32_t)(esp_timer_get_time() - startUs));
+  MetricCount(METRIC_WRITE_BYTES, sent);
+  //Only if the port took less than it said it had room for.
+  if(sent < used)
+    MetricCount(METRIC_OUTPUT_DROPPED, used - sent);
+}
@@ -0,0 +1,90 @@
+#include "PvaEstimator.h"
+
+//Thousandths of a degree in two revs, the half count scale.
+#define PVA_MILLIDEG_PER_TWO_REVS (720LL * ENCODER_SCALE_ANGLE)
+//2^48 / 10^6, rounded, turns the Q48 acceleration into counts per us per
+//second for EncoderScale::rpm().
+#define PVA_ACCEL_UNIT 281474977LL
+
+void PvaEstimator::setGains(uint32_t alpha, uint32_t beta, uint32_t gamma)
+{
+  _alphaSetting = alpha;
+  _betaSetting = beta;
+  _gammaSetting = gamma;
+  _alpha = ((int64_t)alpha << 16) / PVA_GAIN_SCALE;
+  _beta = ((int64_t)beta << 16) / PVA_GAIN_SCALE;
+  _gamma2 = ((int64_t)gamma << 17) / PVA_GAIN_SCALE;
+}
+
+void PvaEstimator::update(int64_t count, int64_t timestampUs)
+{
+  if(!_primed)
+  {
+    _primed = true;
+    _originCount = count;
+    _position = 0;
+    _velocity = 0;
+    _accel = 0;
+    _lastCount = count;
+    _lastTimestampUs = timestampUs;
+    return;
+  }
+
+  int64_t dt = timestampUs - _lastTimestampUs;
+  if(dt <= 0)
+    return;
+  _lastCount = count;
+  _lastTimestampUs = timestampUs;
+
+  //Predict, halving the velocity change so the position follows the
+  //curve rather than the chord...
+  int64_t dv = (_accel * dt) >> 16;
+  _position += ((_velocity + dv / 2) * dt) >> 16;
+  _velocity += dv;
+
+  //...and correct all three by the residual.  The acceleration one is
+  //divided by dt twice, a step at a time so it can't overflow.
+  int64_t residual = ((count - _originCount) << 16) - _position;
+  _position += (residual * _alpha) >> 16;
+  _velocity += (residual * _beta) / dt;
+  _accel += (((residual * _gamma2) / dt) << 16) / dt;
+
+  //Keep the origin near the current position.
+  int64_t whole = _position >> 16;
+  _originCount += whole;
+  _position -= whole << 16;
+}
+
+PvaPrediction PvaEstimator::predict(int64_t atUs) const
+{
+  PvaPrediction result = {};
+  if(!_primed)
+    return result;
+
+  int64_t tau = atUs - _lastTimestampUs;
+  if(tau > PVA_MAX_PREDICT_US)
+    tau = PVA_MAX_PREDICT_US;
+  else if(tau < -PVA_MAX_PREDICT_US)
+    tau = -PVA_MAX_PREDICT_US;
+
+  //From the count itself rather than the smoothed position, which lags
+  //it on anything but a steady shaft.  The count is only ever out by its
+  //quantisation, so what the tracker adds is the velocity and
+  //acceleration to carry it forward.
+  int64_t dv = (_accel * tau) >> 16;
+  int64_t position = ((_lastCount - _originCount) << 16) + (((_velocity + dv / 2) * tau) >> 16);
+
+  //Split into whole counts and the fraction of one left over, always
+  //upwards, so the angle has no step at zero.
+  int64_t whole = position >> 16;
+  int64_t fraction = position - (whole << 16);
+  whole += _originCount;
+
+  result.count = whole + (fraction >= 0x8000 ? 1 : 0);
+  result.angle = _scale.angle((int32_t)whole) +
+                 ((fraction * PVA_MILLIDEG_PER_TWO_REVS / _scale.halfCountsPerRev()) >> 16);
+  //The velocity is counts per 2^32 us.
+  result.rpm = _scale.rpm(_velocity + dv, 1LL << 32);
+  result.accel = _scale.rpm(_accel, PVA_ACCEL_UNIT);
+  return result;
+}
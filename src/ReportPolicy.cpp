@@ -0,0 +1,81 @@
+#include "ReportPolicy.h"
+#include "EncoderScale.h"
+
+ReportPolicy::ReportPolicy() :
+  _settings{},
+  _reported{},
+  _lastReportUs(0),
+  _slowCount(0),
+  _sent(0),
+  _skipped(0)
+{
+  _settings.slowDecimation = 1;
+}
+
+void ReportPolicy::configure(const ReportSettings &settings)
+{
+  _settings = settings;
+  if(_settings.slowDecimation == 0)
+    _settings.slowDecimation = 1;
+  _slowCount = 0;
+}
+
+void ReportPolicy::resetStats()
+{
+  _sent = 0;
+  _skipped = 0;
+}
+
+ReportDecision ReportPolicy::decide(const Sample &sample, int32_t speedMilliRpm)
+{
+  int64_t sinceUs = sample.timestampUs - _lastReportUs;
+  ReportDecision decision = REPORT_SKIP;
+
+  //Has any channel moved further than the deadband from what the PC last
+  //saw?  A channel that has just been attached starts from zero, same as
+  //the _reported it has never had.
+  bool moved = false;
+  for(uint8_t i = 0; i < SAMPLER_MAX_CHANNELS && !moved; i++)
+  {
+    if(!(sample.channelMask & (1 << i)))
+      continue;
+    int64_t delta = sample.count[i] - _reported[i];
+    if(delta < 0)
+      delta = -delta;
+    moved = delta > (int64_t)_settings.deadbandCounts;
+  }
+
+  if(moved && sinceUs >= (int64_t)_settings.minIntervalMs * 1000)
+  {
+    //Slow enough that every sample isn't needed, so only send some.
+    if(_settings.slowDecimation > 1 && speedMilliRpm < (int64_t)_settings.slowRpm * ENCODER_SCALE_RPM)
+    {
+      if(++_slowCount >= _settings.slowDecimation)
+        decision = REPORT_MOVED;
+    }
+    else
+    {
+      decision = REPORT_MOVED;
+    }
+  }
+
+  if(decision == REPORT_SKIP && _settings.heartbeatMs > 0 &&
+     sinceUs >= (int64_t)_settings.heartbeatMs * 1000)
+    decision = REPORT_HEARTBEAT;
+
+  if(decision == REPORT_SKIP)
+  {
+    _skipped++;
+    return decision;
+  }
+
+  for(uint8_t i = 0; i < SAMPLER_MAX_CHANNELS; i++)
+  {
+    if(sample.channelMask & (1 << i))
+      _reported[i] = sample.count[i];
+  }
+  _lastReportUs = sample.timestampUs;
+  _slowCount = 0;
+  _sent++;
+  return decision;
+}
@@ -0,0 +1,155 @@
+#include "RpmEstimator.h"
+
+RpmEstimator::RpmEstimator()
+{
+  reset();
+}
+
+void RpmEstimator::reset()
+{
+  _primed = false;
+  _lastCount = 0;
+  _lastTimestampUs = 0;
+  _edgeCount = 0;
+  _edgeTimestampUs = 0;
+  _edgeTimed = false;
+  _spanCount = 0;
+  _spanTimestampUs = 0;
+  _spanTimed = false;
+  _direction = 0;
+  _rpm = 0;
+  _method = Stopped;
+}
+
+void RpmEstimator::edge(int64_t count, int64_t timestampUs)
+{
+  if(!_primed || count == _edgeCount)
+    return;
+
+  int8_t direction = count > _edgeCount ? 1 : -1;
+  if(direction == _direction && timestampUs > _edgeTimestampUs)
+  {
+    _rpm = _scale.rpm(count - _edgeCount, timestampUs - _edgeTimestampUs);
+    _method = EdgePeriod;
+  }
+  _direction = direction;
+  _edgeCount = count;
+  _edgeTimestampUs = timestampUs;
+  _edgeTimed = true;
+}
+
+int32_t RpmEstimator::update(int64_t count, int64_t timestampUs)
+{
+  if(!_primed)
+  {
+    _primed = true;
+    _lastCount = count;
+    _lastTimestampUs = timestampUs;
+    _edgeCount = count;
+    _edgeTimestampUs = timestampUs;
+    _edgeTimed = false;
+    _spanCount = count;
+    _spanTimestampUs = timestampUs;
+    _spanTimed = false;
+    _rpm = 0;
+    _method = Stopped;
+    return _rpm;
+  }
+
+  int64_t deltaCount = count - _lastCount;
+  int64_t deltaUs = timestampUs - _lastTimestampUs;
+  if(deltaUs <= 0)
+    return _rpm;
+
+  int64_t absDelta = deltaCount < 0 ? -deltaCount : deltaCount;
+
+  if(absDelta >= RPM_ESTIMATOR_MIN_COUNTS)
+  {
+    int8_t direction = deltaCount > 0 ? 1 : -1;
+    //Whether edge() has timed the last edge before this sample, or one
+    //after it in the same us.
+    bool timed = _edgeTimed && (count - _edgeCount) * direction <= 0;
+    if(timed && _spanTimed && (_edgeCount - _spanCount) * direction > 0)
+    {
+      //And the last one before the sample before, so the time between
+      //them is exact rather than to the nearest sample.
+      _rpm = _scale.rpm(_edgeCount - _spanCount, _edgeTimestampUs - _spanTimestampUs);
+      _method = EdgePeriod;
+    }
+    else
+    {
+      //Plenty of counts, so the plain count difference over the measured
+      //time is the best we can do.
+      _rpm = _scale.rpm(deltaCount, deltaUs);
+      _method = CountDelta;
+      //A timed edge is kept for the next sample to measure from.
+      if(!timed)
+      {
+        _edgeCount = count;
+        _edgeTimestampUs = timestampUs;
+        _edgeTimed = false;
+      }
+    }
+    _direction = direction;
+  }
+  else if(deltaCount != 0)
+  {
+    //Only a few counts.  Time from the last edge we know about to this one,
+    //unless edge() has already been told about it, or about a later one
+    //(an edge in the same us as the sample can get in first).
+    int8_t direction = deltaCount > 0 ? 1 : -1;
+    bool known = direction == _direction && (count - _edgeCount) * direction <= 0;
+    if(!known)
+    {
+      if(direction == _direction)
+      {
+        _rpm = _scale.rpm(count - _edgeCount, timestampUs - _edgeTimestampUs);
+        _method = EdgePeriod;
+      }
+      else
+      {
+        //Changed direction, so the last edge is no use for a period.  The
+        //count difference is all we have until the next edge.
+        _rpm = _scale.rpm(deltaCount, deltaUs);
+        _method = CountDelta;
+      }
+      _direction = direction;
+      _edgeCount = count;
+      _edgeTimestampUs = timestampUs;
+      _edgeTimed = false;
+    }
+  }
+  else
+  {
+    //No edges this time.  The shaft can't be going any faster than one
+    //count in the time since the last edge, so bring the estimate down to
+    //that if it is above it, and to zero if we have waited long enough.
+    int64_t sinceEdgeUs = timestampUs - _edgeTimestampUs;
+    if(sinceEdgeUs >= RPM_ESTIMATOR_STOP_TIMEOUT_US || _direction == 0)
+    {
+      _rpm = 0;
+      _method = Stopped;
+    }
+    else
+    {
+      int32_t bound = _scale.rpm(1, sinceEdgeUs);
+      if(_rpm > bound)
+      {
+        _rpm = bound;
+        _method = Decaying;
+      }
+      else if(_rpm < -bound)
+      {
+        _rpm = -bound;
+        _method = Decaying;
+      }
+    }
+  }
+
+  _lastCount = count;
+  _lastTimestampUs = timestampUs;
+  _spanCount = _edgeCount;
+  _spanTimestampUs = _edgeTimestampUs;
+  _spanTimed = _edgeTimed;
+  return _rpm;
+}
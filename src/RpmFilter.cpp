@@ -0,0 +1,167 @@
+#include "RpmFilter.h"
+
+static uint8_t ClampWindow(uint32_t window)
+{
+  if(window < 1)
+    return 1;
+  if(window > RPM_FILTER_MAX_WINDOW)
+    return RPM_FILTER_MAX_WINDOW;
+  return (uint8_t)window;
+}
+
+void BoxcarFilter::setWindow(uint8_t window)
+{
+  _window = ClampWindow(window);
+  reset();
+}
+
+void BoxcarFilter::reset()
+{
+  _next = 0;
+  _filled = 0;
+  _sum = 0;
+}
+
+int32_t BoxcarFilter::update(int32_t x)
+{
+  if(_filled == _window)
+    _sum -= _history[_next];
+  else
+    _filled++;
+
+  _history[_next] = x;
+  _sum += x;
+  _next = (_next + 1) % _window;
+
+  //Round to nearest, either side of zero.
+  int64_t half = _sum < 0 ? -(_filled / 2) : _filled / 2;
+  return (int32_t)((_sum + half) / _filled);
+}
+
+void MedianFilter::setWindow(uint8_t window)
+{
+  _window = ClampWindow(window);
+  reset();
+}
+
+void MedianFilter::reset()
+{
+  _next = 0;
+  _filled = 0;
+}
+
+int32_t MedianFilter::update(int32_t x)
+{
+  uint8_t i;
+
+  if(_filled == _window)
+  {
+    //Take the oldest value out of the sorted copy.
+    int32_t oldest = _history[_next];
+    for(i = 0; i < _filled && _sorted[i] != oldest; i++)
+      ;
+    for(; i + 1 < _filled; i++)
+      _sorted[i] = _sorted[i + 1];
+    _filled--;
+  }
+
+  _history[_next] = x;
+  _next = (_next + 1) % _window;
+
+  //And put the new one in, in order.
+  for(i = _filled; i > 0 && _sorted[i - 1] > x; i--)
+    _sorted[i] = _sorted[i - 1];
+  _sorted[i] = x;
+  _filled++;
+
+  return _sorted[(_filled - 1) / 2];
+}
+
+void AlphaBetaFilter::setGains(uint32_t alpha, uint32_t beta)
+{
+  _alpha = ((int64_t)alpha << 16) / RPM_FILTER_GAIN_SCALE;
+  _beta = ((int64_t)beta << 16) / RPM_FILTER_GAIN_SCALE;
+}
+
+int32_t AlphaBetaFilter::update(int64_t count, int64_t timestampUs)
+{
+  if(!_primed)
+  {
+    _primed = true;
+    _originCount = count;
+    _position = 0;
+    _velocity = 0;
+    _lastTimestampUs = timestampUs;
+    return 0;
+  }
+
+  int64_t dt = timestampUs - _lastTimestampUs;
+  _lastTimestampUs = timestampUs;
+  if(dt > 0)
+  {
+    //Predict where we should be, then correct by the residual.
+    _position += (_velocity * dt) >> 16;
+    int64_t residual = ((count - _originCount) << 16) - _position;
+    _position += (residual * _alpha) >> 16;
+    _velocity += (residual * _beta) / dt;
+
+    //Keep the origin near the current position.
+    int64_t whole = _position >> 16;
+    _originCount += whole;
+    _position -= whole << 16;
+  }
+
+  //The velocity is counts per 2^32 us.
+  return _scale.rpm(_velocity, 1LL << 32);
+}
+
+RpmFilter::RpmFilter()
+{
+  configure(RPM_FILTER_EMA, 5, 500, 100);
+}
+
+bool RpmFilter::configure(uint8_t type, uint32_t depth, uint32_t alpha, uint32_t beta)
+{
+  if(type >= RPM_FILTER_TYPE_COUNT)
+    return false;
+
+  if(depth > RPM_FILTER_MAX_DEPTH)
+    depth = RPM_FILTER_MAX_DEPTH;
+
+  _type = type;
+  _depth = depth;
+  _alpha = alpha;
+  _beta = beta;
+
+  _ema.setDepth(depth);
+  _boxcar.setWindow(ClampWindow(depth));
+  _median.setWindow(ClampWindow(depth));
+  _alphaBeta.setGains(alpha, beta);
+  reset();
+  return true;
+}
+
+void RpmFilter::reset()
+{
+  _ema.reset();
+  _boxcar.reset();
+  _median.reset();
+  _alphaBeta.reset();
+}
+
+int32_t RpmFilter::update(int32_t rpm, int64_t count, int64_t timestampUs)
+{
+  switch(_type)
+  {
+    case RPM_FILTER_EMA:
+      return _ema.update(rpm);
+    case RPM_FILTER_BOXCAR:
+      return _boxcar.update(rpm);
+    case RPM_FILTER_MEDIAN:
+      return _median.update(rpm);
+    case RPM_FILTER_ALPHA_BETA:
+      return _alphaBeta.update(count, timestampUs);
+    default:
+      return rpm;
+  }
+}
@@ -0,0 +1,34 @@
+#include "SampleWriter.h"
+#include "EncoderScale.h"
+
+size_t SampleWriter::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t SampleWriter::write(const uint8_t *buffer, size_t size)
+{
+  if(_used + size > sizeof(_buffer))
+  {
+    flush();
+    //Too big for a record at all, so it's cut short.
+    if(size > sizeof(_buffer))
+      size = sizeof(_buffer);
+  }
+  memcpy(_buffer + _used, buffer, size);
+  _used += size;
+  return size;
+}
+
+size_t SampleWriter::printFixed(int64_t value, uint32_t scale)
+{
+  char text[FIXED_TEXT_SIZE];
+  return write((const uint8_t *)text, FormatFixed(text, value, scale, 2));
+}
+
+void SampleWriter::flush()
+{
+  if(_used > 0 && _out != nullptr)
+    _out->pushRecord(_buffer, _used);
+  _used = 0;
+}
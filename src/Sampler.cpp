@@ -0,0 +1,137 @@
+#include "Sampler.h"
+#include "Metrics.h"
+
+Sampler::Sampler() :
+  _encoders{},
+  _timer(nullptr),
+  _periodUs(0),
+  _jitterSequence(0),
+  _lastTimestampUs(0),
+  _minPeriodUs(0),
+  _maxPeriodUs(0),
+  _totalPeriodUs(0),
+  _periods(0),
+  _overruns(0),
+  _resetRequested(true)
+{
+}
+
+bool Sampler::begin(uint32_t periodUs)
+{
+  esp_timer_create_args_t args = {};
+  args.callback = &Sampler::onTimer;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "sampler";
+  if(esp_timer_create(&args, &_timer) != ESP_OK)
+    return false;
+
+  setPeriod(periodUs);
+  return true;
+}
+
+void Sampler::setEncoder(uint8_t channel, Encoder *encoder)
+{
+  if(channel < SAMPLER_MAX_CHANNELS)
+    _encoders[channel] = encoder;
+}
+
+void Sampler::stop()
+{
+  if(_timer != nullptr)
+    esp_timer_stop(_timer);
+}
+
+void Sampler::setPeriod(uint32_t periodUs)
+{
+  if(_timer == nullptr)
+    return;
+
+  esp_timer_stop(_timer);
+  _periodUs = periodUs;
+  _resetRequested = true;
+  esp_timer_start_periodic(_timer, _periodUs);
+}
+
+JitterStats Sampler::jitter() const
+{
+  JitterStats stats;
+  int64_t totalUs;
+  uint32_t seq;
+  //Same as ESP32Encoder::getSnapshot(): go again if the timer callback
+  //was part way through, or got in while these were being read.
+  do
+  {
+    seq = _jitterSequence;
+    stats.periods = _periods;
+    stats.overruns = _overruns;
+    stats.minUs = _minPeriodUs;
+    stats.maxUs = _maxPeriodUs;
+    totalUs = _totalPeriodUs;
+  } while((seq & 1) || seq != _jitterSequence);
+
+  stats.nominalUs = _periodUs;
+  if(stats.periods == 0)
+    stats.minUs = 0;
+  stats.meanUs = stats.periods > 0 ? totalUs / stats.periods : 0;
+  return stats;
+}
+
+void Sampler::onTimer(void *arg)
+{
+  static_cast<Sampler *>(arg)->takeSample();
+}
+
+void Sampler::takeSample()
+{
+  //Latch every channel in one go.  Each count and its time are one
+  //consistent pair, and the first channel's time stands for the lot; the
+  //rest follow within a few us.
+  Sample sample;
+  sample.channelMask = 0;
+  sample.timestampUs = 0;
+  for(uint8_t i = 0; i < SAMPLER_MAX_CHANNELS; i++)
+  {
+    sample.count[i] = 0;
+    if(_encoders[i] == nullptr)
+      continue;
+    EncoderSnapshot snap = _encoders[i]->getSnapshot();
+    if(sample.channelMask == 0)
+      sample.timestampUs = snap.timestampUs;
+    sample.count[i] = snap.count;
+    sample.channelMask |= 1 << i;
+  }
+  //With nothing enabled there is nothing to time the period by.
+  if(sample.channelMask == 0)
+    sample.timestampUs = esp_timer_get_time();
+
+  _jitterSequence++;
+  if(_resetRequested)
+  {
+    //The first sample after a (re)start has nothing to measure against.
+    _resetRequested = false;
+    _minPeriodUs = INT64_MAX;
+    _maxPeriodUs = 0;
+    _totalPeriodUs = 0;
+    _periods = 0;
+    _overruns = 0;
+  }
+  else
+  {
+    int64_t period = sample.timestampUs - _lastTimestampUs;
+    if(period < _minPeriodUs)
+      _minPeriodUs = period;
+    if(period > _maxPeriodUs)
+      _maxPeriodUs = period;
+    _totalPeriodUs += period;
+    _periods++;
+  }
+  _lastTimestampUs = sample.timestampUs;
+
+  if(!_queue.push(sample))
+  {
+    _overruns++;
+    MetricCount(METRIC_SAMPLE_DROPS);
+  }
+  _jitterSequence++;
+}
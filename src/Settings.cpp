@@ -0,0 +1,176 @@
+#include "Settings.h"
+#include <Arduino.h>
+#include "TelemetryFrame.h"
+#include "Metrics.h"
+#include <string.h>
+
+Settings::Settings() :
+  _dirty(false),
+  _keep(false),
+  _changedAt(0),
+  _commits(0)
+{
+  defaults(_data);
+}
+
+void Settings::defaults(SettingsData &data)
+{
+  memset(&data, 0, sizeof(data));
+  data.loopInterval = 100;
+  data.outputFormat = 0;
+  for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+  {
+    ChannelSettings &channel = data.channels[i];
+    //Only channel 0 has pins unless told otherwise, pin 36 and 37 on the
+    //S2 mini, same as it always was.
+    channel.aPin = i == 0 ? 36 : CHANNEL_NO_PIN;
+    channel.bPin = i == 0 ? 37 : CHANNEL_NO_PIN;
+    channel.pulsePerRev = 1200;
+    channel.countMode = ENCODER_COUNT_HALF;
+    channel.rpmFilterDepth = 5;
+    channel.rpmFilterType = RPM_FILTER_EMA;
+    channel.rpmFilterAlpha = 500;
+    channel.rpmFilterBeta = 100;
+    data.glitchFilter[i] = PCNT_FILTER_DEFAULT;
+  }
+  //Send on every change, as before there was a choice.
+  data.report.slowDecimation = 1;
+  data.index.pin = CHANNEL_NO_PIN;
+  data.outputPolicy = OUTPUT_DROP_OLDEST;
+}
+
+SettingsSource Settings::begin()
+{
+  if(load())
+    return SETTINGS_LOADED;
+
+  //Newer firmware's settings, this one can't say what's in them.  Saving
+  //over them, or over them with what the old keys say, would lose them
+  //for good on the way back up.
+  if(_keep)
+  {
+    defaults(_data);
+    return SETTINGS_NEWER;
+  }
+
+  //Nothing usable, so start from the defaults with anything the old keys
+  //have to say on top, and save that so this only happens the once.
+  defaults(_data);
+  bool migrated = migrate();
+  commit();
+  return migrated ? SETTINGS_MIGRATED : SETTINGS_DEFAULTS;
+}
+
+bool Settings::load()
+{
+  uint8_t blob[sizeof(Header) + sizeof(SettingsData)];
+  Header header;
+
+  _prefs.begin(PREFS_NAMESPACE, true);
+  //getBytes won't read a blob into a buffer too small for it, and a blob
+  //longer than any this firmware writes has had fields added since.
+  size_t stored = _prefs.getBytesLength(PREFS_SETTINGS);
+  size_t len = stored <= sizeof(blob) ? _prefs.getBytes(PREFS_SETTINGS, blob, sizeof(blob)) : 0;
+  _prefs.end();
+
+  if(stored > sizeof(blob))
+  {
+    _keep = true;
+    return false;
+  }
+  if(len < sizeof(header))
+    return false;
+  memcpy(&header, blob, sizeof(header));
+  const uint8_t *data = blob + sizeof(header);
+  if(header.version == 0 || header.length != len - sizeof(header) ||
+     header.crc != TelemetryCrc16(data, header.length))
+    return false;
+  //Whole, but from a later version, which could have changed what the
+  //fields this one knows mean.
+  if(header.version > SETTINGS_VERSION)
+  {
+    _keep = true;
+    return false;
+  }
+
+  //Older, shorter blobs only cover the start of the data, see SettingsData.
+  defaults(_data);
+  memcpy(&_data, data, header.length < sizeof(_data) ? header.length : sizeof(_data));
+  return true;
+}
+
+bool Settings::migrate()
+{
+  ChannelSettings &channel = _data.channels[0];
+
+  _prefs.begin(PREFS_NAMESPACE, true);
+
+  //The old firmware treated zero as never set for these.
+  long loopInterval = _prefs.getLong(PREFS_LOOP_INTERVAL);
+  if(loopInterval > 0)
+    _data.loopInterval = loopInterval;
+  long ppr = _prefs.getLong(PREFS_PULSE_PER_REV);
+  if(ppr > 0)
+    channel.pulsePerRev = ppr;
+  long depth = _prefs.getLong(PREFS_RPM_FILTER_DEPTH);
+  if(depth > 0)
+    channel.rpmFilterDepth = depth;
+  bool found = _prefs.isKey(PREFS_LOOP_INTERVAL) || _prefs.isKey(PREFS_PULSE_PER_REV) ||
+               _prefs.isKey(PREFS_RPM_FILTER_DEPTH);
+
+  _prefs.end();
+  return found;
+}
+
+void Settings::markDirty(unsigned long now)
+{
+  _dirty = true;
+  _changedAt = now;
+}
+
+bool Settings::poll(unsigned long now)
+{
+  if(!_dirty || _keep || now - _changedAt < SETTINGS_QUIET_MS)
+    return false;
+  return save();
+}
+
+bool Settings::save()
+{
+  if(!_dirty)
+    return false;
+  return commit();
+}
+
+bool Settings::commit()
+{
+  uint8_t blob[sizeof(Header) + sizeof(SettingsData)];
+  Header header;
+  header.version = SETTINGS_VERSION;
+  header.length = sizeof(_data);
+  header.crc = TelemetryCrc16((const uint8_t *)&_data, sizeof(_data));
+  header.reserved = 0;
+  memcpy(blob, &header, sizeof(header));
+  memcpy(blob + sizeof(header), &_data, sizeof(_data));
+
+  //The old keys are left where they are.  Nothing reads them once there is
+  //a blob, and older firmware can still find its settings after a downgrade.
+  _prefs.begin(PREFS_NAMESPACE);
+  bool ok = _prefs.putBytes(PREFS_SETTINGS, blob, sizeof(blob)) == sizeof(blob);
+  _prefs.end();
+
+  //A failed write stays dirty, and poll() has another go after the next
+  //quiet period.
+  if(ok)
+  {
+    _dirty = false;
+    _keep = false;
+    _commits++;
+    MetricCount(METRIC_SETTINGS_WRITES);
+  }
+  else
+  {
+    _changedAt = millis();
+  }
+  return ok;
+}
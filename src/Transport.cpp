@@ -0,0 +1,36 @@
+#include "Transport.h"
+
+#if TRANSPORT == TRANSPORT_USB_CDC
+
+#if ARDUINO_USB_CDC_ON_BOOT
+//The core has already made Serial the CDC port and started USB.
+static UsbCdcTransport _transport(Serial);
+#else
+//Otherwise the port is ours to make, and USB ours to start.
+static USBCDC _usbSerial;
+static UsbCdcTransport _transport(_usbSerial);
+#endif
+
+void UsbCdcTransport::begin()
+{
+  _port.begin();
+#if !ARDUINO_USB_CDC_ON_BOOT
+  USB.begin();
+#endif
+}
+
+#else
+
+#if ARDUINO_USB_CDC_ON_BOOT
+//Serial is the USB port on this board, the first UART is Serial0.
+static UartTransport _transport(Serial0, TRANSPORT_UART_BAUD);
+#else
+static UartTransport _transport(Serial, TRANSPORT_UART_BAUD);
+#endif
+
+#endif
+
+Transport &SelectedTransport()
+{
+  return _transport;
+}
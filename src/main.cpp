@@ -1,82 +1,336 @@
-#include <ESP32Encoder.h>
-#include "Preferences.h"
+#include "CommandParser.h"
+#include "Sampler.h"
+#include "TelemetryFrame.h"
+#include "Channel.h"
+#include "EdgeCapture.h"
+#include "Transport.h"
+#include "SampleWriter.h"
+#include "Settings.h"
+#include "ReportPolicy.h"
+#include "BurstCapture.h"
+#include "IndexHoming.h"
+#include "GlitchFilter.h"
+#include "MotionProfile.h"
+#include "CountPoller.h"
+#include "Metrics.h"
 
-//instance of the encode object
-ESP32Encoder _encoder;
-//long to keep track of microseconds;
-unsigned long _previousTime = millis();
+//The encoder inputs.  Channel 0 is the original one on pins 36 and 37,
+//the others are off until given pins with the 'C' command.
+Channel _channels[MAX_CHANNELS];
+//The channel that the P, F, K, R and S commands talk to.
+uint8_t _activeChannel = 0;
+
+//Sample period in ms.  The sampler's timer runs at this rate.
 unsigned long _loopInterval = 100;
-unsigned long _pulsePerRev = 1200;
-unsigned long _rpmFilterDepth = 5;
+//Longest sample period 'L' will take, in ms.  The sampler's timer wants
+//the period in us as 32 bits, which runs out at about 71 minutes, and a
+//minute is already far slower than anything the GUI asks for.
+#define LOOP_INTERVAL_MAX_MS 60000
+
+//The settings, and getting them to and from non-volatile flash on the ESP32.
+Settings _settings;
+
+//How samples go out to the PC.  ASCII "D ang pos rpm" lines are the
+//default, the binary frames in TelemetryFrame.h are selected with 'B1'.
+#define OUTPUT_FORMAT_ASCII 0
+#define OUTPUT_FORMAT_BINARY 1
+unsigned long _outputFormat = OUTPUT_FORMAT_ASCII;
+//The frames carry the channels' RPM as it is, with no rescaling.
+static_assert(ENCODER_SCALE_RPM == TELEMETRY_RPM_SCALE, "RPM scales differ");
+//Sequence number for every sample sent, so the PC can spot gaps where the
+//output ring has dropped some.  The binary frames always carry it, the
+//lines only with 'O' asking.
+uint16_t _sampleSequence = 0;
+bool _lineSequence = false;
+//Which samples are worth sending, see the 'Q' command.
+ReportPolicy _reportPolicy;
+//Send the angle and RPM as the PVA estimator has them when the sample goes
+//out, plus a lead the PC asks for, instead of as they were when latched.
+//See the 'V' command.
+#define PREDICT_OFF 0
+#define PREDICT_ON 1
+unsigned long _predictMode = PREDICT_OFF;
+long _predictLeadUs = 0;
+
+//The link to the PC, UART or native USB, picked at build time.  Nothing
+//printed to it waits on the PC, it all goes through the output ring.
+Transport &_transport = SelectedTransport();
+//Each sample line, frame and edge is built here and queued on the output
+//ring as one record, so the ring can drop it whole.
+SampleWriter _sampleWriter;
+//Longest setup() waits for its banner to go.
+#define OUTPUT_SETUP_WAIT_MS 1000
+
+//Incoming command bytes are framed here, a byte at a time, so that
+//the sampling loop never has to wait on the serial port.
+CommandParser _commandParser;
+//esp_timer_get_time() when the last line end came off the serial port, for
+//the 'Y' ping to report when it arrived.
+int64_t _commandRxUs = 0;
+//Put the sample timestamp on the end of the D and M lines, see 'Y'.
+bool _sampleTimestamps = false;
+
+//Reads the encoders on a hardware timer and queues the results for loop().
+Sampler _sampler;
+//Keeps the count of any channel counting with its wrap interrupts off, see
+//the 'H' command.
+CountPoller _poller;
+
+//How long the LED stays lit to acknowledge a command, and when that ends.
+#define LED_FLASH_MS 200
+unsigned long _ledFlashUntil = 0;
+
+//Test mode, see the 'T' command.  Moves the encoders along a motion
+//profile on its own timer.  Dont use this when connected with a real
+//encoder, the results will be all over the place.
+MotionGenerator _motion;
+
+//Per edge timing on one channel at a time, see the 'E' command.
+#define EDGE_MODE_OFF 0
+#define EDGE_MODE_CAPTURE 1
+#define EDGE_MODE_STREAM 2
+EdgeCapture _edgeCapture;
+uint8_t _edgeChannel = 0;
+unsigned long _edgeMode = EDGE_MODE_OFF;
 
-//Used to store settings in non-volatile flash on the ESP32.
-Preferences prefs;
+//Fast triggered capture into RAM, see the 'A' and 'U' commands.  Lines of a
+//dump go out a few per pass of loop(), between the samples.
+#define BURST_DUMP_LINES_PER_LOOP 16
+//Longest a 'u' line can be, "u -2147483648 -2147483648".
+#define BURST_DUMP_LINE_MAX 32
+BurstCapture _burstCapture;
+uint8_t _burstChannel = 0;
+bool _burstDumping = false;
+uint32_t _burstDumpNext = 0;
 
-#define PREFS_NAMESPACE "AngleReader"
-#define PREFS_LOOP_INTERVAL "LoopInterval"
-#define PREFS_PULSE_PER_REV "PulsePerRev"
-#define PREFS_RPM_FILTER_DEPTH "RpmFilterDepth"
+//Index (Z) input for one channel, which homes the count in its interrupt,
+//see the 'Z' command.
+IndexHoming _indexHoming;
+uint8_t _indexChannel = 0;
+long _indexPin = CHANNEL_NO_PIN;
+unsigned long _indexMode = INDEX_MODE_OFF;
+//1/ENCODER_SCALE_ANGLE degrees.
+long _indexHomeAngle = 0;
+//Whether the index had homed the channel as of the last sample.
+bool _indexHomed = false;
 
-//Test mode.  If this is enabled, the main loop will increment 
-//the encoder in the loop.  Dont use this when connected with a 
-//real encoder, the results will be all over the place.
-bool _testMode = false;
+//ESP32Encoder::interruptCount as of the last pass of loop(), which has put
+//everything up to there into the metrics.
+uint32_t _metricInterrupts = 0;
 
-//just reset flag.  We use this to zero the RPM immediately
-//if we have done an encoder reset to a value, so that the
-//RPM doesnt spike when this occurs.
-bool _justReset = false;
+//Glitch filter calibration, see the 'G' command.  It borrows the edge
+//capture, on the channel being calibrated, with that channel's filter off.
+#define FILTER_CAL_DEFAULT_MS 2000
+FilterCalibration _filterCalibration;
+bool _calibrating = false;
+unsigned long _calibrateStart = 0;
+unsigned long _calibrateMs = 0;
+
+/// @brief Note that a command has changed the settings.  They are copied
+/// across now, and go to flash once the commands stop coming, see Settings.
+void SettingsChanged()
+{
+  SettingsData &data = _settings.data();
+  data.loopInterval = _loopInterval;
+  data.outputFormat = _outputFormat;
+  data.report = _reportPolicy.settings();
+  data.index.channel = _indexChannel;
+  data.index.pin = _indexPin;
+  data.index.mode = _indexMode;
+  data.index.homeAngle = _indexHomeAngle;
+  for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+  {
+    _channels[i].save(data.channels[i]);
+    data.glitchFilter[i] = _channels[i].glitchFilter;
+    data.pollMaxRpm[i] = _channels[i].pollMaxRpm;
+  }
+  data.outputPolicy = _transport.output().policy();
+  data.outputSequence = _lineSequence ? 1 : 0;
+  _settings.markDirty(millis());
+}
+
+/// @brief Tell the sampler which channels to read, after one has been
+/// attached or detached, and the poller which to poll and how often.
+void UpdateSamplerChannels()
+{
+  for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+  {
+    Encoder *encoder = _channels[i].encoder.isAttached() ? &_channels[i].encoder : nullptr;
+    _sampler.setEncoder(i, encoder);
+    _motion.setEncoder(i, encoder, _channels[i].scale.countsPerRev());
+    //Only those really polled, edge capture keeps the interrupts on.
+    bool polled = encoder != nullptr && encoder->isPolled();
+    _poller.setEncoder(i, polled ? encoder : nullptr, _channels[i].pollPeriodUs());
+  }
+  _poller.update();
+}
+
+/// @brief Start (or stop) watching the index input, with the current
+/// settings.  The channel has to be homed again afterwards.
+void AttachIndex()
+{
+  _indexHoming.detach();
+  _indexHomed = false;
+  Channel &channel = _channels[_indexChannel];
+  if(_indexMode == INDEX_MODE_OFF || _indexPin == CHANNEL_NO_PIN || !channel.encoder.isAttached())
+    return;
+  _indexHoming.attach(channel.encoder, _indexPin, _indexMode,
+                      channel.scale.count(_indexHomeAngle), channel.scale.halfCountsPerRev());
+}
+
+/// @brief Detach a channel's encoder and attach it again, so a change to
+/// its pins, counting mode or interrupts takes effect.
+/// @param channel The channel.
+/// @param change Called while the encoder is detached, to make the change.
+/// @param keepCount Put the count back afterwards, otherwise it starts
+/// from zero as on power up.
+template <typename Change>
+void ReattachChannel(Channel &channel, Change change, bool keepCount)
+{
+  //Don't let the timers read an encoder while it is being re-attached.
+  _sampler.stop();
+  _poller.setEncoder(channel.index, nullptr, 0);
+  if(_burstChannel == channel.index && _burstCapture.state() != BURST_DONE)
+    _burstCapture.stop();
+  int64_t count = channel.encoder.isAttached() ? channel.encoder.getCount() : 0;
+  channel.detach();
+  change();
+  channel.attach();
+  if(keepCount)
+    channel.reset(count);
+  UpdateSamplerChannels();
+  _sampler.setPeriod(_loopInterval * 1000);
+  if(_indexChannel == channel.index)
+    AttachIndex();
+}
+
+/// @brief Print the report policy settings, space separated, finishing
+/// the line.  Shared by the start up banner and the 'Q' command.
+void PrintReportPolicy()
+{
+  const ReportSettings &report = _reportPolicy.settings();
+  _transport.print(report.deadbandCounts);
+  _transport.print(" ");
+  _transport.print(report.minIntervalMs);
+  _transport.print(" ");
+  _transport.print(report.heartbeatMs);
+  _transport.print(" ");
+  _transport.print(report.slowRpm);
+  _transport.print(" ");
+  _transport.println(report.slowDecimation);
+}
+
+/// @brief Let the output ring empty, for setup() only, which is in no hurry
+/// and prints more than the ring holds.  Gives up after a while, in case
+/// nothing is listening on the USB port.
+void WaitForOutput()
+{
+  unsigned long start = millis();
+  while(_transport.output().pending() > 0 && millis() - start < OUTPUT_SETUP_WAIT_MS)
+  {
+    _transport.poll();
+    delay(1);
+  }
+}
 
 /// @brief Main Setup up pfunction called on chip start.
 void setup(){
 	
-  //Usual serial setup.  Use 115200, because we need
-  //this to be FAST.
-	Serial.begin(115200);
+  //Bring up the link to the PC, UART or native USB depending on the
+  //build, see Transport.h.
+	_transport.begin();
+  _sampleWriter.begin(_transport.output());
 	// Enable the weak pull down resistors
 	//ESP32Encoder::useInternalWeakPullResistors=DOWN;
 	// Enable the weak pull up resistors
 	ESP32Encoder::useInternalWeakPullResistors=UP;
 
-	// use pin 36 and 37 for the encoder on the S2 mini.
-	_encoder.attachHalfQuad(36, 37);
-	
-	// set starting count value after attaching
-	_encoder.setCount(0);
-
   //Short delay to allow the serial port to sort itself out.
   delay(3000);
   pinMode(LED_BUILTIN, OUTPUT);
 
-  //First thing, is to grab the preferences out of flash.
-  prefs.begin("AngleReader");
+  //First thing, is to grab the settings out of flash.
+  SettingsSource source = _settings.begin();
+  const SettingsData &settings = _settings.data();
 
-  long loopInterval = prefs.getLong(PREFS_LOOP_INTERVAL);
-  if(loopInterval != 0)
-    _loopInterval = loopInterval;
+  if(settings.loopInterval > 0)
+    _loopInterval = settings.loopInterval < LOOP_INTERVAL_MAX_MS ? settings.loopInterval : LOOP_INTERVAL_MAX_MS;
 
-  long pulsePerRev = prefs.getLong(PREFS_PULSE_PER_REV);
-  if(pulsePerRev != 0)
-    _pulsePerRev = pulsePerRev;
+  //Each channel picks up its own pins, PPR and filter.  Channel 0
+  //defaults to pin 36 and 37 for the encoder on the S2 mini.
+  for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+  {
+    _channels[i].index = i;
+    _channels[i].load(settings.channels[i]);
+    _channels[i].setGlitchFilter(settings.glitchFilter[i]);
+    _channels[i].setPolled(settings.pollMaxRpm[i]);
+  }
 
-  long rpmFilterDepth = prefs.getLong(PREFS_RPM_FILTER_DEPTH);
-  if(rpmFilterDepth != 0)
-    _rpmFilterDepth = rpmFilterDepth;
+  if(settings.outputFormat == OUTPUT_FORMAT_BINARY)
+    _outputFormat = OUTPUT_FORMAT_BINARY;
+  _reportPolicy.configure(settings.report);
+  if(settings.index.channel < MAX_CHANNELS)
+    _indexChannel = settings.index.channel;
+  _indexPin = settings.index.pin;
+  _indexMode = settings.index.mode <= INDEX_MODE_EVERY ? settings.index.mode : INDEX_MODE_OFF;
+  _indexHomeAngle = settings.index.homeAngle;
+  _transport.output().setPolicy(settings.outputPolicy);
+  _lineSequence = settings.outputSequence != 0;
 
   //Having got the preferences from flash memory, just echo them out onto the
   //serial line so we can observe them, if the log window is open.  The software
   //will not try and parse these.  To retreive the params later, use the 'S' command
   //described later in the line received delegate.
-  Serial.println();
-  Serial.println("Loading Settings from flash");
-  Serial.print("Loop Interval: ");
-  Serial.println(_loopInterval);
-  Serial.print("Pulse Per Rev (Half Quadrature): ");
-  Serial.println(_pulsePerRev);
-  Serial.print("RPM Filter Depth: ");
-  Serial.println(_rpmFilterDepth);
-  Serial.println();
-  prefs.end();
+  _transport.println();
+  _transport.print("Loading Settings from flash: ");
+  _transport.println(source == SETTINGS_LOADED ? "Loaded" : source == SETTINGS_MIGRATED ? "Migrated" :
+                     source == SETTINGS_NEWER ? "Defaults, newer firmware's kept until 'W'" : "Defaults");
+  _transport.print("Loop Interval: ");
+  _transport.println(_loopInterval);
+  for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+  {
+    Channel &channel = _channels[i];
+    if(!channel.enabled())
+      continue;
+    _transport.print("Channel ");
+    _transport.print(i);
+    _transport.print(" pins ");
+    _transport.print(channel.aPin);
+    _transport.print("/");
+    _transport.println(channel.bPin);
+    _transport.print("  Pulse Per Rev (Half Quadrature): ");
+    _transport.println(channel.pulsePerRev);
+    _transport.print("  Count Mode: ");
+    _transport.println(channel.countMode);
+    _transport.print("  RPM Filter Depth: ");
+    _transport.println(channel.rpmFilterDepth);
+    _transport.print("  RPM Filter Type: ");
+    _transport.println(channel.rpmFilterType);
+    _transport.print("  Glitch Filter: ");
+    _transport.print(channel.glitchFilter);
+    _transport.print(" (max ");
+    _transport.print(channel.maxRpm());
+    _transport.println(" RPM)");
+    if(channel.pollMaxRpm > 0)
+    {
+      _transport.print("  Polled: ");
+      _transport.print(channel.pollMaxRpm);
+      _transport.print(" RPM, every ");
+      _transport.print(channel.pollPeriodUs());
+      _transport.println(" us");
+    }
+  }
+  _transport.print("Transport: ");
+  _transport.println(_transport.name());
+  _transport.print("Output Format: ");
+  _transport.println(_outputFormat == OUTPUT_FORMAT_BINARY ? "Binary" : "ASCII");
+  _transport.print("Output Policy: ");
+  _transport.print(_transport.output().policy());
+  _transport.println(_lineSequence ? " (sequenced)" : "");
+  _transport.print("Report Policy: ");
+  PrintReportPolicy();
+  _transport.println();
+  WaitForOutput();
 
   //Flash the LED, basically just to tell me that we have got to this point 
   //in the setup.
@@ -84,261 +338,1178 @@ void setup(){
   delay(1000);                      // wait for a second
   digitalWrite(LED_BUILTIN, LOW);   // turn the LED off by making the voltage LOW
   delay(1000);  
-  Serial.println("v0.2");
-  Serial.println("LoftSoft AngleReader Ready.");
+
+  //Everything is loaded, so attach the encoders and start the sample
+  //timer going.
+  for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+    _channels[i].attach();
+  _poller.begin();
+  UpdateSamplerChannels();
+  _sampler.begin(_loopInterval * 1000);
+  _burstCapture.begin();
+  _motion.begin();
+  AttachIndex();
+
+  _transport.println("v0.2");
+  _transport.println("LoftSoft AngleReader Ready.");
+  WaitForOutput();
 }
 
-/// @brief Reset the encoder value to the parameter value.
+/// @brief Reset the active channel's encoder value to the parameter value.
 /// @param val The long pos val of the enocder to be set to.
 void ResetEncoder(long val)
 {
-  _encoder.setCount(val);
+  _channels[_activeChannel].reset(val);
 }
 
-/// @brief A quick toggle of the LED on the built in pin.  This is blocking so
-/// only use in Setup() or when the loop period is not critical.
-void FlashLED()
+/// @brief A quick flash of the LED on the built in pin, to show a command
+/// has arrived.  This just sets the deadline, loop() turns it off again so
+/// we never sit in a delay() while the encoder is being sampled.
+void FlashLED(unsigned long currentTime)
 {
   digitalWrite(LED_BUILTIN, HIGH);  // turn the LED on (HIGH is the voltage level)
-  delay(200);                       // wait for 200 mil
-  digitalWrite(LED_BUILTIN, LOW);   // turn the LED off by making the voltage LOW
-  delay(200);  
+  _ledFlashUntil = currentTime + LED_FLASH_MS;
 }
 
-/// @brief Main Loop - free running, but interesting stuff is limited
-/// by time slicing - check my #define at the top to see the
-/// the timing rate in ms.
-void loop(){
+/// @brief 'T type speed periodMs jitter stepUs startUs', type 0 if the
+/// generator is stopped.  startUs is cut to 32 bits, as in the frames.
+void ReportMotion()
+{
+  const MotionSettings &settings = _motion.settings();
+  _transport.print("T ");
+  _transport.print(_motion.running() ? settings.type : MOTION_OFF);
+  _transport.print(" ");
+  _transport.print((long)settings.speed);
+  _transport.print(" ");
+  _transport.print((unsigned long)settings.periodMs);
+  _transport.print(" ");
+  _transport.print((unsigned long)settings.jitterCounts);
+  _transport.print(" ");
+  _transport.print((unsigned long)settings.stepUs);
+  _transport.print(" ");
+  _transport.println((unsigned long)(uint32_t)_motion.startUs());
+}
 
-  unsigned long currentTime = millis();
+/// @brief Act on a single framed command from the PC.
+/// @param cmd The command code and its (possibly empty) parameter.
+void HandleCommand(const Command &cmd)
+{
+  long val;
+  Channel &channel = _channels[_activeChannel];
+  MetricCount(METRIC_COMMANDS);
 
-  //Limit this loop cycle to the time interval specified.
-  if (currentTime - _previousTime > _loopInterval) 
+  //Is it a Reset?
+  if(cmd.code == 'R')
   {
-    //Ok, we are greater than the time interval.  Save the
-    //current time to compare next time around.
-    _previousTime = currentTime;
+      _transport.println("Received Reset Command");
 
-    static double ang = 0;
-    static long pos = 0;
-    static double rpm = 0;
+      //Yes it is! Reset the encoder count.
+      if(cmd.parameterToLong(val))
+      {
+        //we have an angle, in degrees, to use as the reset value, so now
+        //we need to do some math.
+        
+        long resetAngle = val;
+        long resetPos = channel.scale.count((int64_t)resetAngle * ENCODER_SCALE_ANGLE);
+        
+        //Dump this text to the serial port to see the results.
+        _transport.print("Resetting encoder to ");
+        _transport.print(resetAngle);
+        _transport.print(" deg. Pos: ");
+        _transport.print(resetPos);
+        _transport.print(" of ");
+        _transport.println(channel.pulsePerRev);
 
-    //Check incoming Serial commands before we do anything
-    //else.
-    if (Serial.available() > 0) 
+        ResetEncoder(resetPos);
+      }
+      else if(!cmd.hasParameter())
+      {
+        //no parameter sent with the reset, so just plain old
+        //reset to 0.
+        _transport.println("Resetting encoder to 0");
+        ResetEncoder(0);
+      }            
+  }
+  else if(cmd.code == 'F')
+  {
+    //This is an RPM filter depth command;
+    //This should have a parameter with it, to say what the filter
+    //depth is, and it has to parse to a numeric value no deeper than the
+    //filter can hold.
+    if(cmd.parameterToLong(val) && val >= 0 && val <= RPM_FILTER_MAX_DEPTH)
     {
-
-      char commandChar;
-      String parameter;
-      // we have data!  Lets see what it is..
-      //Get the full string up until the null terminator
-      String incomingString = Serial.readString();
-      //echo it back for debug
-      //Serial.println(incomingString);
-      //if its not zero length, then we can get the
-      //command characeter...
-      if(incomingString.length() > 0)
+      //...aaaand set it to the filter depth variable.
+      channel.rpmFilterDepth = val;
+      channel.configureFilter();
+      //and to flash, in a while.
+      SettingsChanged();
+      _transport.print("Received Filter Command: ");
+      _transport.println(channel.rpmFilterDepth);
+    }
+  }
+  else if(cmd.code == 'P')
+  {
+    //This is a Pulse Per Rev setting command;
+    //This should have a parameter with it, and zero would
+    //have us dividing by zero later on.  'P<ppr> <mode>' also sets the
+    //counting mode, 1, 2 or 4 counts per line (single edge, half or full
+    //quadrature).  The PPR is in half quadrature counts either way.
+    long mode;
+    if(cmd.fieldToLong(0, val) && val > 0)
+    {
+      //...aaaand set it to the PPR variable
+      channel.setPulsePerRev(val);
+      if(cmd.fieldToLong(1, mode) && mode != (long)channel.countMode && channel.setCountMode(mode))
       {
-        FlashLED();
-        commandChar = incomingString[0];
-
-        //Lets see if there is anything else...
-        if(incomingString.length() > 1)
-        {
-          //there is!  It must have parameters sent with the command.
-           parameter = incomingString.substring(1);
-        }
+        //The PCNT unit has to be set up again to count differently.
+        ReattachChannel(channel, []() {}, false);
       }
-      //Now we have a command code, and a potential parameter with it,
-      //lets use it!
+      //The home count moves with the scale.
+      if(_indexChannel == channel.index)
+        AttachIndex();
+      //So does the poll rate.  If polling can't keep up at the new scale
+      //the channel goes back to the wrap interrupts.
+      if(!channel.setPolled(channel.pollMaxRpm))
+        channel.setPolled(0);
+      UpdateSamplerChannels();
+      //and to flash, in a while.
+      SettingsChanged();
+      _transport.print("Received PPR Command: ");
+      _transport.print(channel.pulsePerRev);
+      _transport.print(" ");
+      _transport.println(channel.countMode);
+    }
+  }
+  else if(cmd.code == 'L')
+  {
+    //This is a Loop Interval setting command;
+    //This should have a parameter with it,
+    if(cmd.parameterToLong(val) && val > 0)
+    {
+      //...aaaand set it to the loop interval variable, and the timer,
+      //no slower than the timer can count to.
+      _loopInterval = val < LOOP_INTERVAL_MAX_MS ? val : LOOP_INTERVAL_MAX_MS;
+      _sampler.setPeriod(_loopInterval * 1000);
+      //and to flash, in a while.
+      SettingsChanged();
+      _transport.print("Received Loop Interval Command: ");
+      _transport.println(_loopInterval);
+    }
+  }
+  else if(cmd.code=='S')
+  {
+    //this is a request to return all the settings parameters
+    //to the GUI. These will have to be packaged differently to the
+    _transport.print("S ");
+    _transport.print(channel.pulsePerRev);
+    _transport.print(" ");
+    _transport.print(channel.rpmFilterDepth);
+    _transport.print(" ");
+    _transport.println(_loopInterval);
+  }
+  else if(cmd.code=='K')
+  {
+    //RPM filter kind command.  'K<type> [<a> [<b>]]', where type is one of
+    //RpmFilterType.  For the EMA, boxcar and median filters a is the
+    //depth/window (same as 'F').  For the alpha-beta tracker a and b are
+    //the gains in thousandths.  'K' on its own just reports the settings.
+    long type, a, b;
+    if(cmd.fieldToLong(0, type) && type >= 0 && type < RPM_FILTER_TYPE_COUNT)
+    {
+      channel.rpmFilterType = type;
+      if(type == RPM_FILTER_ALPHA_BETA)
+      {
+        if(cmd.fieldToLong(1, a) && a > 0)
+          channel.rpmFilterAlpha = a;
+        if(cmd.fieldToLong(2, b) && b >= 0)
+          channel.rpmFilterBeta = b;
+      }
+      else if(cmd.fieldToLong(1, a) && a >= 0 && a <= RPM_FILTER_MAX_DEPTH)
+      {
+        channel.rpmFilterDepth = a;
+      }
+      channel.configureFilter();
+      SettingsChanged();
+      _transport.print("Received Filter Kind Command: ");
+      _transport.println(channel.rpmFilterType);
+    }
+    _transport.print("K ");
+    _transport.print(channel.rpmFilterType);
+    _transport.print(" ");
+    _transport.print(channel.rpmFilterDepth);
+    _transport.print(" ");
+    _transport.print(channel.rpmFilterAlpha);
+    _transport.print(" ");
+    _transport.println(channel.rpmFilterBeta);
+  }
+  else if(cmd.code=='C')
+  {
+    //Channel command.
+    //  'C'              lists the channels.
+    //  'C<ch>'          makes ch the channel that P, F, K, R and S talk to.
+    //  'C<ch> <a> <b>'  puts channel ch on pins a and b, and selects it.
+    //  'C<ch> -1'       turns channel ch off.
+    long index, a, b;
+    if(cmd.fieldToLong(0, index) && index >= 0 && index < MAX_CHANNELS)
+    {
+      _activeChannel = index;
+      Channel &target = _channels[index];
+      bool disable = cmd.fieldToLong(1, a) && a == CHANNEL_NO_PIN;
+      bool repin = cmd.fieldToLong(1, a) && a >= 0 && cmd.fieldToLong(2, b) && b >= 0;
+      if(disable || repin)
+      {
+        ReattachChannel(target, [&]() {
+          target.aPin = disable ? CHANNEL_NO_PIN : a;
+          target.bPin = disable ? CHANNEL_NO_PIN : b;
+        }, false);
+        SettingsChanged();
+      }
+      _transport.print("Received Channel Command: ");
+      _transport.println(_activeChannel);
+    }
+    for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+    {
+      //'C ch enabled apin bpin ppr', one line per channel.
+      _transport.print("C ");
+      _transport.print(i);
+      _transport.print(" ");
+      _transport.print(_channels[i].encoder.isAttached() ? 1 : 0);
+      _transport.print(" ");
+      _transport.print(_channels[i].aPin);
+      _transport.print(" ");
+      _transport.print(_channels[i].bPin);
+      _transport.print(" ");
+      _transport.println(_channels[i].pulsePerRev);
+    }
+  }
+  else if(cmd.code=='B')
+  {
+    //Output format command.  'B0' for ASCII lines, 'B1' for binary frames.
+    if(cmd.parameterToLong(val) && (val == OUTPUT_FORMAT_ASCII || val == OUTPUT_FORMAT_BINARY))
+    {
+      _outputFormat = val;
+      SettingsChanged();
+      _transport.print("Received Output Format Command: ");
+      _transport.println(_outputFormat);
+    }
+  }
+  else if(cmd.code=='Q')
+  {
+    //Report policy, i.e. which samples are sent.
+    //  'Q<deadband> [<minMs> [<heartbeatMs> [<slowRpm> <decimation>]]]'
+    //      sends a sample once a channel has moved more than deadband
+    //      counts from what was last sent, no more often than every minMs,
+    //      and at least every heartbeatMs even if nothing has moved.  Below
+    //      slowRpm only every decimation'th sample that would have gone
+    //      is sent.  Any left off stay as they are.  'Q0 0 0 0 1' is the
+    //      original behaviour, a sample for every change.
+    //  'QR' starts the sent and skipped counts again.
+    //  'Q' on its own reports 'Q deadband minMs heartbeatMs slowRpm
+    //  decimation', then 'Q sent skipped'.
+    long field;
+    if(cmd.hasParameter() && cmd.parameter[0] == 'R')
+    {
+      _reportPolicy.resetStats();
+    }
+    else if(cmd.fieldToLong(0, field) && field >= 0)
+    {
+      ReportSettings report = _reportPolicy.settings();
+      report.deadbandCounts = field;
+      if(cmd.fieldToLong(1, field) && field >= 0)
+        report.minIntervalMs = field;
+      if(cmd.fieldToLong(2, field) && field >= 0)
+        report.heartbeatMs = field;
+      if(cmd.fieldToLong(3, field) && field >= 0)
+        report.slowRpm = field;
+      if(cmd.fieldToLong(4, field) && field > 0)
+        report.slowDecimation = field;
+      _reportPolicy.configure(report);
+      SettingsChanged();
+      _transport.println("Received Report Policy Command");
+    }
+    _transport.print("Q ");
+    PrintReportPolicy();
+    _transport.print("Q ");
+    _transport.print(_reportPolicy.sent());
+    _transport.print(" ");
+    _transport.println(_reportPolicy.skipped());
+  }
+  else if(cmd.code=='A')
+  {
+    //Burst capture on the active channel.
+    //  'A<hz> <samples> [<trigger> <value> [<pretrigger>]]' arms it, to
+    //      take samples at hz into RAM once the trigger (see BurstTrigger)
+    //      goes, keeping pretrigger of them from before it.
+    //  'A0' stops it.
+    //  'A' on its own reports 'A state channel written length periodUs'.
+    long hz, samples, trigger = BURST_TRIGGER_NONE, value = 0, pretrigger = 0;
+    if(cmd.fieldToLong(0, hz) && hz == 0)
+    {
+      _burstCapture.stop();
+      _burstDumping = false;
+      _transport.println("Received Burst Command: stopped");
+    }
+    else if(cmd.fieldToLong(0, hz) && hz > 0 && cmd.fieldToLong(1, samples) && samples > 0)
+    {
+      cmd.fieldToLong(2, trigger);
+      cmd.fieldToLong(3, value);
+      cmd.fieldToLong(4, pretrigger);
+      _burstDumping = false;
+      _burstChannel = _activeChannel;
+      bool armed = channel.encoder.isAttached() && trigger >= 0 && pretrigger >= 0 &&
+                   _burstCapture.arm(channel.encoder, channel.scale, 1000000UL / hz, samples,
+                                     trigger, value, pretrigger);
+      _transport.print("Received Burst Command: ");
+      _transport.println(armed ? "armed" : "rejected");
+    }
+    _transport.print("A ");
+    _transport.print(_burstCapture.state());
+    _transport.print(" ");
+    _transport.print(_burstChannel);
+    _transport.print(" ");
+    _transport.print(_burstCapture.written());
+    _transport.print(" ");
+    _transport.print(_burstCapture.length());
+    _transport.print(" ");
+    _transport.println(_burstCapture.periodUs());
+  }
+  else if(cmd.code=='U')
+  {
+    //Dump a finished burst.  'U samples periodUs pretrigger' first, then a
+    //'u us count' line per sample, us being from the trigger sample, so
+    //the ones before it are negative.
+    _burstDumping = _burstCapture.state() == BURST_DONE;
+    _burstDumpNext = 0;
+    _transport.print("U ");
+    _transport.print(_burstCapture.length());
+    _transport.print(" ");
+    _transport.print(_burstCapture.periodUs());
+    _transport.print(" ");
+    _transport.println(_burstDumping ? _burstCapture.pretrigger() : 0);
+  }
+  else if(cmd.code=='Z')
+  {
+    //Index (Z) homing.  The index pulse sets the count in its own
+    //interrupt, with no round trip to the PC.
+    //  'Z<ch> <pin> <mode> [<deg>]'  watches pin for channel ch's index.
+    //      mode is 0 off, 1 home on the first index only, 2 home on
+    //      every index.  deg is the angle at the index, 0 if left off.
+    //  'ZR' starts the figures again.
+    //  'Z' on its own reports 'Z ch pin mode deg hits homed lastErr minErr
+    //  maxErr corrections', the errors in counts.
+    long index, pin, mode, angle;
+    if(cmd.hasParameter() && cmd.parameter[0] == 'R')
+    {
+      _indexHoming.resetStats();
+    }
+    else if(cmd.fieldToLong(0, index) && index >= 0 && index < MAX_CHANNELS &&
+            cmd.fieldToLong(1, pin) && pin >= CHANNEL_NO_PIN &&
+            cmd.fieldToLong(2, mode) && mode >= INDEX_MODE_OFF && mode <= INDEX_MODE_EVERY)
+    {
+      _indexChannel = index;
+      _indexPin = pin;
+      _indexMode = mode;
+      _indexHomeAngle = cmd.fieldToLong(3, angle) ? angle * ENCODER_SCALE_ANGLE : 0;
+      AttachIndex();
+      SettingsChanged();
+      _transport.print("Received Index Command: ");
+      _transport.println(_indexMode);
+    }
 
-      //Is it a Reset?
-      if(commandChar == 'R')
+    IndexStats stats = _indexHoming.stats();
+    _transport.print("Z ");
+    _transport.print(_indexChannel);
+    _transport.print(" ");
+    _transport.print(_indexPin);
+    _transport.print(" ");
+    _transport.print(_indexHoming.attached() ? _indexMode : INDEX_MODE_OFF);
+    _transport.print(" ");
+    _transport.print(_indexHomeAngle / ENCODER_SCALE_ANGLE);
+    _transport.print(" ");
+    _transport.print(stats.hits);
+    _transport.print(" ");
+    _transport.print(_indexHoming.homed() ? 1 : 0);
+    _transport.print(" ");
+    _transport.print(stats.lastError);
+    _transport.print(" ");
+    _transport.print(stats.minError);
+    _transport.print(" ");
+    _transport.print(stats.maxError);
+    _transport.print(" ");
+    _transport.println(_indexHoming.corrections());
+  }
+  else if(cmd.code=='G')
+  {
+    //PCNT glitch filter on the active channel.  Pulses on the encoder pins
+    //shorter than this are ignored, which stops noise counting, but also
+    //caps how fast the shaft can go.
+    //  'G<cycles>'  sets it, in 12.5 ns APB cycles, 0 to 1023, 0 is off.
+    //  'GC[<ms>]'   calibrates: with the filter off, times every edge for
+    //               ms (FILTER_CAL_DEFAULT_MS if left off) while the shaft
+    //               is run as fast as it will go, then reports 'G C edges
+    //               minUs glitches maxGlitchUs glitchesPerSec recommended
+    //               maxRpm headroom'.  The filter is put back as it was,
+    //               use 'G<recommended>' to take the suggestion.
+    //  'G' on its own reports 'G ch cycles ns maxRpm'.
+    if(cmd.hasParameter() && cmd.parameter[0] == 'C')
+    {
+      char *end;
+      long ms = strtol(cmd.parameter + 1, &end, 10);
+      //It needs the edge capture to itself, and a backend that has it.
+      if(!_calibrating && !_edgeCapture.hooked() && channel.enabled() && ms >= 0)
+        ReattachChannel(channel, [&]() { _edgeCapture.hook(channel.encoder); }, true);
+      bool started = !_calibrating && _edgeCapture.hooked();
+      if(started)
       {
-          Serial.println("Received Reset Command");
-
-          //Yes it is! Reset the encoder count.
-          if(parameter.length() == 0)
-          {
-            //we have an angle, to use as the reset value, so now
-            //we need to do some math.
-            
-            long resetAngle = 270;//parameter.toInt();
-            long resetPos = (long)resetAngle * (((float)_pulsePerRev) / 360.0f);
-            
-            //Dump this text to the serial port to see the results.
-            Serial.print("Resetting encoder to ");
-            Serial.print(resetAngle);
-            Serial.print(" deg. Pos: ");
-            Serial.print(resetPos);
-            Serial.print(" of ");
-            Serial.println(_pulsePerRev);
-
-            ResetEncoder(resetPos);
-          }
-          else
-          {
-            //no parameter sent with the reset, so just plain old
-            //reset to 0.
-            Serial.println("Resetting encoder to 0");
-            ResetEncoder(0);
-          }            
-          _justReset = true;
+        _calibrateMs = ms > 0 ? ms : FILTER_CAL_DEFAULT_MS;
+        _calibrateStart = millis();
+        _edgeChannel = channel.index;
+        _edgeMode = EDGE_MODE_CAPTURE;
+        //Attaching puts the channel's own filter on, so this comes after.
+        channel.encoder.setFilter(0);
+        _filterCalibration.begin(esp_timer_get_time(), channel.countMode);
+        _calibrating = true;
       }
-      else if(commandChar == 'F')
+      _transport.print("Received Glitch Filter Calibrate Command: ");
+      _transport.println(started ? _calibrateMs : 0);
+    }
+    else if(cmd.parameterToLong(val))
+    {
+      if(channel.setGlitchFilter(val))
+        SettingsChanged();
+      _transport.print("Received Glitch Filter Command: ");
+      _transport.println(channel.glitchFilter);
+    }
+    _transport.print("G ");
+    _transport.print(channel.index);
+    _transport.print(" ");
+    _transport.print(channel.glitchFilter);
+    _transport.print(" ");
+    _transport.print(channel.glitchFilter * 1000000000ULL / PCNT_FILTER_APB_HZ);
+    _transport.print(" ");
+    _transport.println(channel.maxRpm());
+  }
+  else if(cmd.code=='H')
+  {
+    //Polled counting on the active channel.  The PCNT unit's wrap
+    //interrupts go off, and the poll timer reads its counter often enough
+    //that the shaft can't get half way round the counter between reads.
+    //  'H1 [<maxRpm>]'  polls fast enough for maxRpm, or if left off for
+    //                   the fastest the glitch filter lets counts through.
+    //  'H0'             goes back to the wrap interrupts.
+    //  'HR'             starts the poll figures again.
+    //Refused if the speed needs polling quicker than POLL_MIN_PERIOD_US.
+    //Edge capture ('E', 'GC') needs the interrupts, so while it has the
+    //channel it isn't polled.  Then reports 'H ch polled maxRpm periodUs
+    //polls maxGapUs late', see PollStats.
+    long mode, rpm;
+    if(cmd.hasParameter() && cmd.parameter[0] == 'R')
+    {
+      _poller.resetStats();
+    }
+    else if(cmd.fieldToLong(0, mode) && (mode == 0 || mode == 1))
+    {
+      if(mode == 0)
+        rpm = 0;
+      else if(!cmd.fieldToLong(1, rpm) || rpm <= 0)
+        rpm = channel.maxRpm();
+      if(channel.setPolled(rpm))
       {
-        prefs.begin(PREFS_NAMESPACE);
-        //This is an RPM filter depth command;
-        //This should have a parameter with it, to say what the filter
-        //depth is..
-        if(parameter.length() > 0)
-        {
-          //cracking - now lets see if we can parse it to a numeric value..
-          int val = parameter.toInt();
-          //if that succeeded, then val should not be NAN.
-          if(val != NAN)
-          {
-            //...aaaand set it to the filter depth variable.
-            _rpmFilterDepth = parameter.toInt();
-            //and to flash
-            prefs.begin(PREFS_NAMESPACE);
-            prefs.putLong(PREFS_RPM_FILTER_DEPTH, _rpmFilterDepth);
-            prefs.end();
-            Serial.print("Received Filter Command: ");
-            Serial.println(_rpmFilterDepth);
-          }
-        }
+        UpdateSamplerChannels();
+        SettingsChanged();
       }
-      else if(commandChar == 'P')
+      _transport.print("Received Poll Command: ");
+      _transport.println(channel.pollMaxRpm);
+    }
+
+    PollStats stats = _poller.stats();
+    _transport.print("H ");
+    _transport.print(channel.index);
+    _transport.print(" ");
+    _transport.print(channel.encoder.isPolled() ? 1 : 0);
+    _transport.print(" ");
+    _transport.print(channel.pollMaxRpm);
+    _transport.print(" ");
+    _transport.print(channel.pollPeriodUs());
+    _transport.print(" ");
+    _transport.print(stats.polls);
+    _transport.print(" ");
+    _transport.print((long)stats.maxGapUs);
+    _transport.print(" ");
+    _transport.println(stats.late);
+  }
+  else if(cmd.code=='O')
+  {
+    //The output ring, see OutputRing.h, which everything going to the PC
+    //waits in so a slow or stalled PC never holds up the sampling.
+    //  'O<policy> [<seq>]'  what to drop when the samples waiting fill it:
+    //                       0 the oldest, 1 the new one, 2 all but the new
+    //                       one.  With seq 1 the D and M lines carry the
+    //                       sample sequence number last, as the binary
+    //                       frames always do, so the PC can see the gaps.
+    //  'OR'                 starts the figures again.
+    //Then reports 'O policy seq records dropped maxQueued textDropped
+    //pending', see OutputStats.
+    OutputRing &output = _transport.output();
+    long policy, sequence;
+    if(cmd.hasParameter() && cmd.parameter[0] == 'R')
+    {
+      output.resetStats();
+    }
+    else if(cmd.fieldToLong(0, policy) && policy >= 0 && policy < OUTPUT_POLICY_COUNT)
+    {
+      output.setPolicy((uint8_t)policy);
+      if(cmd.fieldToLong(1, sequence))
+        _lineSequence = sequence != 0;
+      SettingsChanged();
+      _transport.print("Received Output Command: ");
+      _transport.println(output.policy());
+    }
+
+    OutputStats stats = output.stats();
+    _transport.print("O ");
+    _transport.print(output.policy());
+    _transport.print(" ");
+    _transport.print(_lineSequence ? 1 : 0);
+    _transport.print(" ");
+    _transport.print(stats.records);
+    _transport.print(" ");
+    _transport.print(stats.dropped);
+    _transport.print(" ");
+    _transport.print(stats.maxQueued);
+    _transport.print(" ");
+    _transport.print(stats.textDropped);
+    _transport.print(" ");
+    _transport.println(output.pending());
+  }
+  else if(cmd.code=='X')
+  {
+    //Metrics, see Metrics.h, since power up or the last 'XR'.
+    //  'X'   one line each, 'X name count' for a counter, 'X name count
+    //        min mean max' for a gauge, after 'X since_ms ms'.
+    //  'XC'  all on one line, 'X C ms' then the same figures in MetricId
+    //        order, for logging.
+    //  'XR'  zeroes them.
+    bool compact = cmd.hasParameter() && cmd.parameter[0] == 'C';
+    if(cmd.hasParameter() && cmd.parameter[0] == 'R')
+    {
+      MetricsReset();
+      _transport.println("Metrics reset");
+    }
+    else
+    {
+      _transport.print(compact ? "X C " : "X since_ms ");
+      _transport.print(millis() - MetricsSince());
+      for(uint8_t i = 0; i < METRIC_COUNT; i++)
       {
-        prefs.begin(PREFS_NAMESPACE);
-        //This is a Pulse Per Rev setting command;
-        //This should have a parameter with it,
-        if(parameter.length() > 0)
+        MetricValue value = MetricRead((MetricId)i);
+        if(!compact)
         {
-          //good - now lets see if we can parse it to a numeric value..
-          int val = parameter.toInt();
-          //if that succeeded, then val should not be NAN.
-          if(val != NAN)
-          {
-            //...aaaand set it to the PPR variable
-            _pulsePerRev = parameter.toInt();
-            //and to flash
-            prefs.begin(PREFS_NAMESPACE);
-            prefs.putLong(PREFS_PULSE_PER_REV, _pulsePerRev);
-            prefs.end(); 
-            Serial.print("Received PPR Command: ");
-            Serial.println(_pulsePerRev);
-          }
+          _transport.println();
+          _transport.print("X ");
+          _transport.print(MetricName((MetricId)i));
         }
-      }
-      else if(commandChar == 'L')
-      {
-        prefs.begin(PREFS_NAMESPACE);
-        //This is a Loop Interval setting command;
-        //This should have a parameter with it,
-        if(parameter.length() > 0)
+        _transport.print(" ");
+        _transport.print(value.count);
+        if(value.kind == METRIC_GAUGE)
         {
-          //good - now lets see if we can parse it to a numeric value..
-          int val = parameter.toInt();
-          //if that succeeded, then val should not be NAN.
-          if(val != NAN)
-          {
-            //...aaaand set it to the PPR variable
-            _loopInterval = parameter.toInt();
-            //and to flash
-            prefs.begin(PREFS_NAMESPACE);
-            prefs.putLong(PREFS_LOOP_INTERVAL, _loopInterval);
-            prefs.end(); 
-            Serial.print("Received Loop Interval Command: ");
-            Serial.println(_loopInterval);
-          }
+          _transport.print(" ");
+          _transport.print(value.min);
+          _transport.print(" ");
+          _transport.print(value.mean);
+          _transport.print(" ");
+          _transport.print(value.max);
         }
       }
-      else if(commandChar=='S')
+      _transport.println();
+    }
+  }
+  else if(cmd.code=='W')
+  {
+    //Write the settings to flash now, rather than waiting for them to be
+    //left alone for SETTINGS_QUIET_MS.  Settings from newer firmware are
+    //only ever overwritten by this.  Replies 'W saved commits', saved
+    //being 0 if there was nothing to write.
+    bool saved = _settings.save();
+    _transport.print("W ");
+    _transport.print(saved ? 1 : 0);
+    _transport.print(" ");
+    _transport.println(_settings.commits());
+  }
+  else if(cmd.code=='J')
+  {
+    //Report how evenly the sample timer is really firing, all in us.
+    //'JR' throws the figures away and starts measuring again.
+    if(cmd.hasParameter() && cmd.parameter[0] == 'R')
+    {
+      _sampler.resetJitter();
+      _transport.println("Jitter reset");
+    }
+    else
+    {
+      JitterStats stats = _sampler.jitter();
+      _transport.print("J ");
+      _transport.print(stats.nominalUs);
+      _transport.print(" ");
+      _transport.print((long)stats.minUs);
+      _transport.print(" ");
+      _transport.print((long)stats.maxUs);
+      _transport.print(" ");
+      _transport.print((long)stats.meanUs);
+      _transport.print(" ");
+      _transport.print(stats.periods);
+      _transport.print(" ");
+      _transport.println(stats.overruns);
+    }
+  }
+  else if(cmd.code=='E')
+  {
+    //Edge capture.  Interrupts on every edge of one channel and times it,
+    //which gives the RPM estimator exact edge times at low speed.
+    //  'E'               reports 'E ch mode edges overflows minUs maxUs'.
+    //  'E<ch> <mode>'    0 off, 1 capture, 2 capture and send every edge
+    //                    as 'e us count dir'.
+    //  'ER'              starts the figures again.
+    //Can't be changed while 'GC' has it.
+    long index, mode;
+    if(cmd.hasParameter() && cmd.parameter[0] == 'R')
+    {
+      _edgeCapture.resetStats();
+    }
+    else if(!_calibrating && cmd.fieldToLong(0, index) && index >= 0 && index < MAX_CHANNELS &&
+            cmd.fieldToLong(1, mode) && mode >= EDGE_MODE_OFF && mode <= EDGE_MODE_STREAM)
+    {
+      //Unhook whichever channel had it, then hook the new one.  The count
+      //is kept, only the interrupts change.
+      Channel &old = _channels[_edgeChannel];
+      if(_edgeCapture.hooked())
+        ReattachChannel(old, [&]() { _edgeCapture.unhook(old.encoder); }, true);
+
+      _edgeChannel = index;
+      _edgeMode = mode;
+      Channel &target = _channels[_edgeChannel];
+      if(_edgeMode != EDGE_MODE_OFF && target.enabled())
+        ReattachChannel(target, [&]() { _edgeCapture.hook(target.encoder); }, true);
+      _transport.print("Received Edge Capture Command: ");
+      _transport.println(_edgeMode);
+    }
+
+    EdgeStats stats = _edgeCapture.stats();
+    _transport.print("E ");
+    _transport.print(_edgeChannel);
+    _transport.print(" ");
+    _transport.print(_edgeCapture.hooked() ? _edgeMode : EDGE_MODE_OFF);
+    _transport.print(" ");
+    _transport.print(stats.edges);
+    _transport.print(" ");
+    _transport.print(stats.overflows);
+    _transport.print(" ");
+    _transport.print((long)stats.minPeriodUs);
+    _transport.print(" ");
+    _transport.println((long)stats.maxPeriodUs);
+  }
+  else if(cmd.code=='V')
+  {
+    //Latency compensation.
+    //  'V<mode> [<leadUs> [<alpha> <beta> <gamma>]]'  mode 1 sends each
+    //      sample's angle and RPM as predicted for the moment it goes out,
+    //      plus leadUs, with the acceleration (RPM/s) on the end of the
+    //      line.  Binary frames carry the predicted count and RPM, and the
+    //      time they were predicted for as the timestamp.  mode 0 sends
+    //      them as sampled again.  The gains, in thousandths, are the
+    //      active channel's estimator's, see PvaEstimator.
+    //  'V' on its own reports 'V mode leadUs alpha beta gamma', then
+    //  'V ch ang rpm accel' for each attached channel, as of now plus the
+    //  lead.
+    long mode, lead, alpha, beta, gamma;
+    if(cmd.fieldToLong(0, mode) && (mode == PREDICT_OFF || mode == PREDICT_ON))
+    {
+      _predictMode = mode;
+      if(cmd.fieldToLong(1, lead) && lead >= -PVA_MAX_PREDICT_US && lead <= PVA_MAX_PREDICT_US)
+        _predictLeadUs = lead;
+      if(cmd.fieldToLong(2, alpha) && cmd.fieldToLong(3, beta) && cmd.fieldToLong(4, gamma) &&
+         alpha > 0 && beta >= 0 && gamma >= 0)
+        channel.pva.setGains(alpha, beta, gamma);
+      _transport.print("Received Prediction Command: ");
+      _transport.println(_predictMode);
+    }
+    _transport.print("V ");
+    _transport.print(_predictMode);
+    _transport.print(" ");
+    _transport.print(_predictLeadUs);
+    _transport.print(" ");
+    _transport.print(channel.pva.alpha());
+    _transport.print(" ");
+    _transport.print(channel.pva.beta());
+    _transport.print(" ");
+    _transport.println(channel.pva.gamma());
+    int64_t atUs = esp_timer_get_time() + _predictLeadUs;
+    for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+    {
+      if(!_channels[i].encoder.isAttached())
+        continue;
+      PvaPrediction prediction = _channels[i].pva.predict(atUs);
+      char text[FIXED_TEXT_SIZE];
+      _transport.print("V ");
+      _transport.print(i);
+      _transport.print(" ");
+      FormatFixed(text, prediction.angle, ENCODER_SCALE_ANGLE, 2);
+      _transport.print(text);
+      _transport.print(" ");
+      FormatFixed(text, prediction.rpm, ENCODER_SCALE_RPM, 2);
+      _transport.print(text);
+      _transport.print(" ");
+      FormatFixed(text, prediction.accel, ENCODER_SCALE_RPM, 2);
+      _transport.println(text);
+    }
+  }
+  else if(cmd.code=='Y')
+  {
+    //Clock sync, so the PC can put the samples on its own clock.
+    //  'Y[<token>]' pings.  The reply is 'Y token rxUs txUs', the times
+    //      (esp_timer, low 32 bits, as in the binary frames) the command's
+    //      line end came off the serial port and the reply went to it.
+    //      With its own send and receive times either side the PC works
+    //      out the offset and drift NTP style, see tools/clock_sync.py.
+    //  'YT1' puts the sample timestamp on the end of every D and M line,
+    //      after the acceleration if 'V' is on, and before the sequence
+    //      number if 'O' has asked for it.  'YT0' takes it off.
+    if(cmd.hasParameter() && cmd.parameter[0] == 'T')
+    {
+      _sampleTimestamps = cmd.parameter[1] == '1';
+      _transport.print("Received Timestamp Command: ");
+      _transport.println(_sampleTimestamps ? 1 : 0);
+    }
+    else
+    {
+      long token = 0;
+      cmd.parameterToLong(token);
+      //As late as it can be, with the reply about to go.
+      uint32_t txUs = (uint32_t)esp_timer_get_time();
+      _transport.print("Y ");
+      _transport.print(token);
+      _transport.print(" ");
+      _transport.print((unsigned long)(uint32_t)_commandRxUs);
+      _transport.print(" ");
+      _transport.println((unsigned long)txUs);
+    }
+  }
+  else if(cmd.code=='T')
+  {
+    //This is a test mode.  It mirrors the behaviour of a turning encoder
+    //shaft, on every attached channel, to exercise the PC software.
+    //  'T' on its own turns at a steady 60 RPM.
+    //  'T<type> <speed> [<periodMs> [<jitter> [<stepUs>]]]' runs a
+    //      profile, see MotionType.  speed is RPM, or wraps a second for
+    //      type 5.  jitter is counts either side, stepUs how often the
+    //      encoders are moved, 1000 if left off.
+    //Reports 'T type speed periodMs jitter stepUs startUs', startUs being
+    //the sample timestamp the profile counts from.
+    long type = MOTION_CONSTANT, speed = 60, periodMs = 0, jitter = 0, stepUs = MOTION_DEFAULT_STEP_US;
+    if(cmd.hasParameter())
+    {
+      cmd.fieldToLong(0, type);
+      cmd.fieldToLong(1, speed);
+      cmd.fieldToLong(2, periodMs);
+      cmd.fieldToLong(3, jitter);
+      cmd.fieldToLong(4, stepUs);
+    }
+    MotionSettings settings;
+    settings.type = type > 0 && type < MOTION_TYPE_COUNT ? type : MOTION_OFF;
+    settings.speed = speed;
+    settings.periodMs = periodMs > 0 ? periodMs : 0;
+    settings.jitterCounts = jitter > 0 ? jitter : 0;
+    settings.stepUs = stepUs > 0 ? stepUs : 0;
+    _transport.print("Received Test Mode Command: ");
+    _transport.println(_motion.start(settings) ? "running" : "rejected");
+    ReportMotion();
+  }
+  else if(cmd.code=='N')
+  {
+    //back to normal mode, if we have been in test mode.
+    _transport.println("Normal operating mode");
+    _motion.stop();
+  }
+  else
+  {
+    //Nothing we know.  No reply, as ever, but it shows in the metrics.
+    MetricCount(METRIC_COMMAND_ERRORS);
+  }
+}
+
+/// @brief Move whatever the serial port has for us into the command parser,
+/// and run at most one complete command.  This never waits for data, and the
+/// work done per call is bounded, so it can run on every pass of loop().
+/// @param currentTime millis() at the start of this pass.
+void PollCommands(unsigned long currentTime)
+{
+  //Only take as much as the ring can hold, and never more than a handful
+  //per pass.  Anything left stays in the serial driver until next time.
+  int pending = _transport.available();
+  size_t space = _commandParser.space();
+  if(pending > COMMAND_MAX_BYTES_PER_LOOP)
+    pending = COMMAND_MAX_BYTES_PER_LOOP;
+  if((size_t)pending > space)
+    pending = space;
+
+  int64_t readUs = esp_timer_get_time();
+  while(pending-- > 0)
+  {
+    int b = _transport.read();
+    if(b < 0)
+      break;
+    if(b == '\n' || b == '\r')
+      _commandRxUs = readUs;
+    _commandParser.push((uint8_t)b, currentTime);
+  }
+
+  Command cmd;
+  if(_commandParser.next(cmd, currentTime))
+  {
+    FlashLED(currentTime);
+    HandleCommand(cmd);
+  }
+}
+
+/// @brief What goes out for one channel of a sample.
+struct SentChannel
+{
+  int64_t count;
+  int64_t ang;
+  int32_t rpm;
+  int32_t accel;
+};
+
+/// @brief The channel as sampled, or with prediction on, as the PVA
+/// estimator has it at atUs.
+SentChannel ChannelToSend(const Channel &channel, int64_t atUs)
+{
+  SentChannel sent;
+  if(_predictMode == PREDICT_ON)
+  {
+    PvaPrediction prediction = channel.pva.predict(atUs);
+    sent.count = prediction.count;
+    sent.ang = prediction.angle;
+    sent.rpm = prediction.rpm;
+    sent.accel = prediction.accel;
+  }
+  else
+  {
+    sent.count = channel.pos;
+    sent.ang = channel.ang;
+    sent.rpm = channel.rpm;
+    sent.accel = 0;
+  }
+  return sent;
+}
+
+/// @brief Send the channels in a sample out to the PC.  With just channel
+/// 0 running this is the original 'D' line (or sample frame), otherwise
+/// all the channels go out together as one 'M' line (or multi frame).
+/// With prediction on, the acceleration goes on the end of each channel's
+/// figures in the lines, with 'YT1' the timestamp on the end of the line,
+/// and with 'O' asking, the sequence number after that.  Each goes on the
+/// output ring as one record.
+/// @param sample The sample they were all updated from.
+void SendSample(const Sample &sample)
+{
+  MetricGauge(METRIC_SAMPLE_AGE_US, (int32_t)(esp_timer_get_time() - sample.timestampUs));
+  //With prediction on, the figures are for when they reach the PC: now,
+  //plus the time for whatever is already waiting in the ring to go ahead
+  //of them, plus the lead asked for.
+  int64_t atUs = sample.timestampUs;
+  if(_predictMode == PREDICT_ON)
+    atUs = esp_timer_get_time() + (int64_t)_transport.output().pending() * _transport.byteNs() / 1000 +
+           _predictLeadUs;
+  uint16_t sequence = _sampleSequence++;
+
+  if(sample.channelMask == 1)
+  {
+    SentChannel sent = ChannelToSend(_channels[0], atUs);
+    if(_outputFormat == OUTPUT_FORMAT_BINARY)
+    {
+      TelemetrySample frame;
+      frame.sequence = sequence;
+      frame.timestampUs = (uint32_t)atUs;
+      frame.count = sent.count;
+      frame.rpmMilli = sent.rpm;
+
+      uint8_t buf[TELEMETRY_SAMPLE_FRAME_SIZE];
+      _sampleWriter.write(buf, EncodeTelemetrySample(frame, buf));
+    }
+    else
+    {
+      _sampleWriter.print("D ");
+      _sampleWriter.printFixed(sent.ang, ENCODER_SCALE_ANGLE);
+      _sampleWriter.print(" ");
+      _sampleWriter.print((long)sent.count);
+      _sampleWriter.print(" ");
+      _sampleWriter.printFixed(sent.rpm, ENCODER_SCALE_RPM);
+      if(_predictMode == PREDICT_ON)
       {
-        //this is a request to return all the settings parameters
-        //to the GUI. These will have to be packaged differently to the
-        Serial.print("S ");
-        Serial.print(_pulsePerRev);
-        Serial.print(" ");
-        Serial.print(_rpmFilterDepth);
-        Serial.print(" ");
-        Serial.println(_loopInterval);
+        _sampleWriter.print(" ");
+        _sampleWriter.printFixed(sent.accel, ENCODER_SCALE_RPM);
       }
-      else if(commandChar=='T')
+      if(_sampleTimestamps)
       {
-        //This is a test mode.  It will mirror the behaviour of having
-        //a constantly turning encoder shaft to excericse the PC software.
-        Serial.println("Test Mode");
-        _testMode = true;
+        _sampleWriter.print(" ");
+        _sampleWriter.print((unsigned long)(uint32_t)atUs);
       }
-      else if(commandChar=='N')
+      if(_lineSequence)
       {
-        //back to normal mode, if we have been in test mode.
-        Serial.println("Normal operating mode");
-        _testMode = false;
+        _sampleWriter.print(" ");
+        _sampleWriter.print(sequence);
       }
+      _sampleWriter.println();
     }
+    //One record, so the ring drops it whole if it has to.
+    _sampleWriter.flush();
+    return;
+  }
 
-    //Check to see if we are in test mode.  If we are, then we'll need to 
-    //manually increment the encoder count here.  No need to worry about
-    //rollover, the Encoder library takes care of that.
-    if(_testMode)
+  if(_outputFormat == OUTPUT_FORMAT_BINARY)
+  {
+    TelemetryMultiSample frame;
+    frame.sequence = sequence;
+    frame.timestampUs = (uint32_t)atUs;
+    frame.channelMask = sample.channelMask;
+    for(uint8_t i = 0; i < MAX_CHANNELS; i++)
     {
-      _encoder.setCount(_encoder.getCount() + 10);
+      SentChannel sent = ChannelToSend(_channels[i], atUs);
+      frame.count[i] = _predictMode == PREDICT_ON ? sent.count : sample.count[i];
+      frame.rpmMilli[i] = sent.rpm;
     }
 
-    //Right, now to the meat and potatoes.
-    //Get the current count from the encoder library.
-    long newPos = _encoder.getCount();
-    
-    //Convert this to an angle.  We know that on our encoder we are seeing
-    //1200 edges (qudrature).  Make this better in the future, as hard
-    //coding this value is not cool.
-    double newAng = (((double)newPos) * 0.3);
-
-    //Check to see if the last position is different from the new one..
-    if (pos != newPos) 
+    uint8_t buf[TELEMETRY_MAX_FRAME_SIZE];
+    _sampleWriter.write(buf, EncodeTelemetryMultiSample(frame, buf));
+  }
+  else
+  {
+    //'M ch ang pos rpm ch ang pos rpm ...', with accel after each rpm
+    //when predicting, and the timestamp last if asked for.
+    _sampleWriter.print("M");
+    for(uint8_t i = 0; i < MAX_CHANNELS; i++)
     {
-      //It is!  Fab, the thing is still spinning.
-      long newRpm = 0;
-      //Lets check to see if we have just done a reset before this loop.
-      if(_justReset)
+      if(!(sample.channelMask & (1 << i)))
+        continue;
+      SentChannel sent = ChannelToSend(_channels[i], atUs);
+      _sampleWriter.print(" ");
+      _sampleWriter.print(i);
+      _sampleWriter.print(" ");
+      _sampleWriter.printFixed(sent.ang, ENCODER_SCALE_ANGLE);
+      _sampleWriter.print(" ");
+      _sampleWriter.print((long)sent.count);
+      _sampleWriter.print(" ");
+      _sampleWriter.printFixed(sent.rpm, ENCODER_SCALE_RPM);
+      if(_predictMode == PREDICT_ON)
       {
-        //aha.  We have.  So we dont scare the user, we'll quietly zero the 
-        //global rpm, so that it doesnt spike to something silly...
-        rpm = 0;
-        pos = 0;
-        //and then reset the flag.
-        _justReset = false;
+        _sampleWriter.print(" ");
+        _sampleWriter.printFixed(sent.accel, ENCODER_SCALE_RPM);
       }
-      
-      //Now we can use the pulse delta, to calculate the new rpm...
-      newRpm = ((newPos - pos) * (1000 / _loopInterval) * 60) / _pulsePerRev;
+    }
+    if(_sampleTimestamps)
+    {
+      _sampleWriter.print(" ");
+      _sampleWriter.print((unsigned long)(uint32_t)atUs);
+    }
+    if(_lineSequence)
+    {
+      _sampleWriter.print(" ");
+      _sampleWriter.print(sequence);
+    }
+    _sampleWriter.println();
+  }
+  _sampleWriter.flush();
+}
+
+/// @brief Work out the angle and RPM for each channel in a sample from the
+/// sampler, and send them on to the PC if any shaft has moved.
+/// @param sample The latched counts and their timestamp.
+/// @param currentTime millis() at the start of this pass of loop().
+void ProcessSample(const Sample &sample, unsigned long currentTime)
+{
+  //Right, now to the meat and potatoes.  Update every channel from the
+  //counts the sampler latched from the encoder library, and check to see
+  //if any of the positions is different from the last one..
+  bool moved = false;
+  int32_t speed = 0;
+
+  //Homing makes the count jump, so start the RPM afresh rather than have
+  //it spike, from the first sample after the index moved it.
+  if(_indexHoming.homed() != _indexHomed)
+  {
+    _indexHomed = _indexHoming.homed();
+    _channels[_indexChannel].restartRpm(_indexHoming.stats().lastUs);
+  }
 
-      //...and run that through the inlince filter at the filter depth requested.
-      rpm = ((rpm * _rpmFilterDepth) + newRpm) / (_rpmFilterDepth + 1);
+  for(uint8_t i = 0; i < MAX_CHANNELS; i++)
+  {
+    if(!(sample.channelMask & (1 << i)))
+      continue;
+    moved |= _channels[i].update(sample.count[i], sample.timestampUs);
+    int32_t rpm = _channels[i].rpm < 0 ? -_channels[i].rpm : _channels[i].rpm;
+    if(rpm > speed)
+      speed = rpm;
+  }
 
-      //oh, and just lift the LED pin high, so that it glows when the 
-      //encoder spins.
-      digitalWrite(LED_BUILTIN, HIGH); 
+  //The LED follows the shaft, the report policy decides what is sent.
+  if(_reportPolicy.decide(sample, speed) != REPORT_SKIP)
+    SendSample(sample);
 
-      //Write the values out..
-      Serial.print("D ");
-      Serial.print(newAng);
-      Serial.print(" ");
-      Serial.print(newPos);
-      Serial.print(" ");
-      Serial.println(rpm);
-      pos = newPos;
+  if (moved) 
+  {
+    //It is!  Fab, the thing is still spinning.
+    //oh, and just lift the LED pin high, so that it glows when the 
+    //encoder spins.
+    digitalWrite(LED_BUILTIN, HIGH); 
+  }
+  else if((long)(currentTime - _ledFlashUntil) >= 0)
+  {
+    //If we dont have a new position on this loop, then 
+    //drop the LED pin low again to turn it off, unless
+    //it is still showing a received command.
+    digitalWrite(LED_BUILTIN, LOW); 
+  }
+}
+
+/// @brief Feed captured edges to the channel's RPM estimator, and send
+/// them on if asked to.
+/// @param untilUs Only edges up to this time, so they go in in order with
+/// the samples either side of them.
+void DrainEdges(int64_t untilUs)
+{
+  if(!_edgeCapture.hooked())
+    return;
+
+  Channel &channel = _channels[_edgeChannel];
+  EdgeEvent edge;
+  while(_edgeCapture.read(edge, untilUs))
+  {
+    channel.estimator.edge(edge.count, edge.timestampUs);
+    if(_calibrating)
+      _filterCalibration.edge(edge);
+    if(_edgeMode == EDGE_MODE_STREAM)
+    {
+      _sampleWriter.print("e ");
+      _sampleWriter.print(edge.timestampUs);
+      _sampleWriter.print(" ");
+      _sampleWriter.print(edge.count);
+      _sampleWriter.print(" ");
+      _sampleWriter.println(edge.direction);
+      _sampleWriter.flush();
     }
-    else 
+  }
+}
+
+/// @brief Once the glitch filter calibration has run its time, give the
+/// edge capture back, put the channel's filter back on, and report.
+void FinishCalibration(unsigned long currentTime)
+{
+  if(!_calibrating || currentTime - _calibrateStart < _calibrateMs)
+    return;
+
+  _calibrating = false;
+  Channel &channel = _channels[_edgeChannel];
+  FilterCalibrationResult result = _filterCalibration.result(esp_timer_get_time());
+  ReattachChannel(channel, [&]() { _edgeCapture.unhook(channel.encoder); }, true);
+  _edgeMode = EDGE_MODE_OFF;
+
+  _transport.print("G C ");
+  _transport.print(result.edges);
+  _transport.print(" ");
+  _transport.print((long)result.minIntervalUs);
+  _transport.print(" ");
+  _transport.print(result.glitches);
+  _transport.print(" ");
+  _transport.print((long)result.maxGlitchUs);
+  _transport.print(" ");
+  _transport.print(result.glitchRate);
+  _transport.print(" ");
+  _transport.print(result.recommended);
+  _transport.print(" ");
+  _transport.print(FilterMaxRpm(channel.pulsePerRev, result.recommended));
+  _transport.print(" ");
+  _transport.println(result.headroom ? 1 : 0);
+}
+
+/// @brief Send the next few lines of a burst dump, if there is one going.
+/// A whole burst in one go would hold loop() up for seconds on the UART.
+void DumpBurst()
+{
+  if(!_burstDumping)
+    return;
+
+  BurstRecord trigger, record;
+  _burstCapture.record(_burstCapture.pretrigger(), trigger);
+  for(uint8_t i = 0; i < BURST_DUMP_LINES_PER_LOOP; i++)
+  {
+    //The dump is text, which the ring never drops to make room, so it
+    //only goes on as fast as the PC takes it.
+    if(_transport.output().textSpace() < BURST_DUMP_LINE_MAX)
+      return;
+    if(!_burstCapture.record(_burstDumpNext, record))
     {
-      //If we dont have a new position on this loop, then 
-      //drop the LED pin low again to turn it off.
-      digitalWrite(LED_BUILTIN, LOW); 
+      _burstDumping = false;
+      return;
     }
+    _burstDumpNext++;
+    _transport.print("u ");
+    _transport.print((int32_t)(record.timestampUs - trigger.timestampUs));
+    _transport.print(" ");
+    _transport.println(record.count);
   }
 }
 
+/// @brief Main Loop - free running.  The encoders are sampled on the
+/// sampler's timer at the loop interval, all we do here is look after
+/// the serial port and report whatever samples have been queued up.
+void loop(){
+
+  unsigned long currentTime = millis();
+  int64_t passStartUs = esp_timer_get_time();
+  bool sampled = false;
+
+  //Check incoming Serial commands on every pass, rather than only
+  //when the sample interval comes round.  This doesn't block.
+  PollCommands(currentTime);
+
+  Sample sample;
+  while(_sampler.read(sample))
+  {
+    //Any edges from before this sample go in first.
+    DrainEdges(sample.timestampUs);
+    ProcessSample(sample, currentTime);
+    sampled = true;
+  }
+
+  //And the rest now, before the ring fills.  The next sample will be
+  //later than all of them.
+  DrainEdges(INT64_MAX);
+  FinishCalibration(currentTime);
+  DumpBurst();
+
+  //Hand the port whatever it has room for.  If the PC isn't reading, it
+  //all waits in the ring, and the policy sees to the samples.
+  _transport.poll();
+
+  //Settings changed by commands go to flash once they have been left
+  //alone for a bit.  The sample timer carries on while it writes.
+  _settings.poll(currentTime);
+
+  //The encoder library only keeps a running total of its interrupts.
+  uint32_t interrupts = ESP32Encoder::interruptCount;
+  if(interrupts != _metricInterrupts)
+  {
+    MetricCount(METRIC_PCNT_INTERRUPTS, interrupts - _metricInterrupts);
+    _metricInterrupts = interrupts;
+  }
+  //Only passes that had a sample to deal with are timed, the idle ones
+  //would swamp the mean.
+  if(sampled)
+  {
+    int64_t passUs = esp_timer_get_time() - passStartUs;
+    MetricGauge(METRIC_LOOP_US, (int32_t)passUs);
+    if(passUs > (int64_t)_loopInterval * 1000)
+      MetricCount(METRIC_LOOP_OVERRUNS);
+  }
+}
@@ -0,0 +1,186 @@
+//CommandParser fed the way the serial port really delivers commands: split
+//at every byte, run together, with \r\n, with no terminator at all, and
+//through passes of loop() that take at most COMMAND_MAX_BYTES_PER_LOOP
+//bytes and handle one command each, as PollCommands() does.
+//  pio test -e native -f test_command_parser
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "CommandParser.h"
+
+//Three commands back to back, one with a parameter split by spaces.
+static const char *STREAM = "R\nF 12\nK1 4 \r\n";
+
+static std::string Describe(const Command &cmd)
+{
+  return std::string(1, cmd.code) + "|" + std::string(cmd.parameter, cmd.parameterLength);
+}
+
+static std::vector<std::string> Expected()
+{
+  return {"R|", "F|12", "K|1 4"};
+}
+
+/// @brief Push text, then take every command next() has, all at nowMs.
+static void Feed(CommandParser &parser, const std::string &text, unsigned long nowMs,
+                 std::vector<std::string> &got)
+{
+  for(char c : text)
+    TEST_ASSERT_TRUE(parser.push((uint8_t)c, nowMs));
+  Command cmd;
+  while(parser.next(cmd, nowMs))
+    got.push_back(Describe(cmd));
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_back_to_back()
+{
+  CommandParser parser;
+  std::vector<std::string> got;
+  Feed(parser, STREAM, 0, got);
+  TEST_ASSERT_TRUE(got == Expected());
+  TEST_ASSERT_EQUAL_UINT32(0, parser.droppedBytes());
+}
+
+void test_split_at_every_byte()
+{
+  //Every way of cutting the stream in two, and then in three.
+  std::string stream = STREAM;
+  for(size_t i = 0; i <= stream.size(); i++)
+  {
+    for(size_t j = i; j <= stream.size(); j++)
+    {
+      CommandParser parser;
+      std::vector<std::string> got;
+      Feed(parser, stream.substr(0, i), 0, got);
+      Feed(parser, stream.substr(i, j - i), 1, got);
+      Feed(parser, stream.substr(j), 2, got);
+      TEST_ASSERT_TRUE_MESSAGE(got == Expected(), stream.substr(0, i).c_str());
+    }
+  }
+}
+
+void test_one_byte_at_a_time()
+{
+  CommandParser parser;
+  std::vector<std::string> got;
+  for(char c : std::string(STREAM))
+    Feed(parser, std::string(1, c), 0, got);
+  TEST_ASSERT_TRUE(got == Expected());
+}
+
+void test_crlf_and_blank_lines()
+{
+  CommandParser parser;
+  std::vector<std::string> got;
+  Feed(parser, "\r\n\r\nP\r\n\n  \nL 100\r\n", 0, got);
+  std::vector<std::string> want = {"P|", "L|100"};
+  TEST_ASSERT_TRUE(got == want);
+}
+
+void test_no_terminator_waits_for_the_idle_gap()
+{
+  CommandParser parser;
+  std::vector<std::string> got;
+  Feed(parser, "F2", 100, got);
+  //More of it could still be on the way.
+  Feed(parser, "", 100 + COMMAND_IDLE_TIMEOUT_MS - 1, got);
+  TEST_ASSERT_EQUAL(0, got.size());
+  Feed(parser, "5", 100 + COMMAND_IDLE_TIMEOUT_MS - 1, got);
+  Feed(parser, "", 100 + 2 * COMMAND_IDLE_TIMEOUT_MS - 1, got);
+  TEST_ASSERT_EQUAL(1, got.size());
+  TEST_ASSERT_EQUAL_STRING("F|25", got[0].c_str());
+}
+
+void test_overlong_line_is_dropped_whole()
+{
+  CommandParser parser;
+  std::vector<std::string> got;
+  std::string junk(COMMAND_MAX_LENGTH + 10, 'F');
+  //Split in the middle of the junk, so the discard carries across pushes.
+  Feed(parser, junk.substr(0, 30), 0, got);
+  Feed(parser, junk.substr(30) + "\nR\n", 0, got);
+  std::vector<std::string> want = {"R|"};
+  TEST_ASSERT_TRUE(got == want);
+  TEST_ASSERT_EQUAL_UINT32(1, parser.overlongFrames());
+
+  //Exactly the longest there is still gets through.
+  std::string longest = "F" + std::string(COMMAND_MAX_LENGTH - 1, '1');
+  got.clear();
+  Feed(parser, longest + "\n", 0, got);
+  TEST_ASSERT_EQUAL(1, got.size());
+  TEST_ASSERT_EQUAL_UINT32(1, parser.overlongFrames());
+}
+
+void test_full_ring_drops_and_counts()
+{
+  CommandParser parser;
+  for(int i = 0; i < COMMAND_RING_SIZE; i++)
+    TEST_ASSERT_TRUE(parser.push(' ', 0));
+  TEST_ASSERT_EQUAL(0, parser.space());
+  TEST_ASSERT_FALSE(parser.push('R', 0));
+  TEST_ASSERT_EQUAL_UINT32(1, parser.droppedBytes());
+
+  //Framing it all frees the ring up again.
+  Command cmd;
+  TEST_ASSERT_FALSE(parser.next(cmd, 0));
+  TEST_ASSERT_EQUAL(COMMAND_RING_SIZE, parser.space());
+}
+
+void test_loop_passes()
+{
+  //A burst of commands well past what the ring holds, all sent at once,
+  //taken the way PollCommands() takes them.  Nothing can be lost, since it
+  //never reads more than the ring has room for, and each pass does a
+  //bounded amount: no more than COMMAND_MAX_BYTES_PER_LOOP bytes read and
+  //no more than one command.
+  std::string port;
+  std::vector<std::string> want;
+  for(int i = 0; i < 40; i++)
+  {
+    port += "L " + std::to_string(100 + i) + "\r\n";
+    want.push_back("L|" + std::to_string(100 + i));
+  }
+
+  CommandParser parser;
+  std::vector<std::string> got;
+  size_t read = 0;
+  int passes = 0;
+  unsigned long nowMs = 0;
+  while((read < port.size() || got.size() < want.size()) && passes < 1000)
+  {
+    size_t pending = port.size() - read;
+    if(pending > COMMAND_MAX_BYTES_PER_LOOP)
+      pending = COMMAND_MAX_BYTES_PER_LOOP;
+    if(pending > parser.space())
+      pending = parser.space();
+    for(size_t i = 0; i < pending; i++)
+      TEST_ASSERT_TRUE(parser.push((uint8_t)port[read++], nowMs));
+
+    Command cmd;
+    if(parser.next(cmd, nowMs))
+      got.push_back(Describe(cmd));
+    passes++;
+    nowMs++;
+  }
+  TEST_ASSERT_TRUE(got == want);
+  TEST_ASSERT_EQUAL_UINT32(0, parser.droppedBytes());
+  //One pass per command, and the port is never the hold up.
+  TEST_ASSERT_EQUAL(want.size(), passes);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_back_to_back);
+  RUN_TEST(test_split_at_every_byte);
+  RUN_TEST(test_one_byte_at_a_time);
+  RUN_TEST(test_crlf_and_blank_lines);
+  RUN_TEST(test_no_terminator_waits_for_the_idle_gap);
+  RUN_TEST(test_overlong_line_is_dropped_whole);
+  RUN_TEST(test_full_ring_drops_and_counts);
+  RUN_TEST(test_loop_passes);
+  return UNITY_END();
+}
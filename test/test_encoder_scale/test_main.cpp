@@ -0,0 +1,145 @@
+//EncoderScale's fixed point angle and RPM against the same sums done in
+//double, for PPRs from 1 to the largest it takes, in every counting mode.
+//  pio test -e native -f test_encoder_scale
+#include <math.h>
+#include <stdio.h>
+#include <unity.h>
+#include "EncoderScale.h"
+
+//The most either can be out from the double, in its own units (thousandths
+//of a degree, thousandths of an RPM).  Half a unit is the rounding.  The
+//angle's Q32.32 reciprocal is only ever multiplied by less than a rev of
+//half counts, under 2^30, so adds at most an eighth of a unit.  The RPM is
+//one exact divide, so the rest allows only for the double's own rounding.
+#define ANGLE_TOLERANCE (0.5 + 0.125)
+#define RPM_TOLERANCE 0.5
+#define RPM_RELATIVE_TOLERANCE 1e-12
+
+#define RANDOM_CASES 20000
+
+static const uint32_t PPRS[] = {1, 3, 7, 100, 360, 1000, 1024, 1200, 2048, 4096, 10000, 65536,
+                                1u << 20, 0x10000000};
+static const uint8_t MODES[] = {ENCODER_COUNT_SINGLE, ENCODER_COUNT_HALF, ENCODER_COUNT_FULL};
+
+//Same sequence every run.
+static uint64_t _random = 88172645463325252ULL;
+
+static uint64_t Random()
+{
+  _random ^= _random << 13;
+  _random ^= _random >> 7;
+  _random ^= _random << 17;
+  return _random;
+}
+
+static double CountsPerRev(uint32_t ppr, uint8_t mode)
+{
+  return (double)ppr * mode / 2.0;
+}
+
+static void CheckAngle(const EncoderScale &scale, int32_t count)
+{
+  double expected = (double)count * 360.0 * ENCODER_SCALE_ANGLE /
+                    CountsPerRev(scale.pulsePerRev(), scale.countMode());
+  int64_t got = scale.angle(count);
+  if(fabs((double)got - expected) > ANGLE_TOLERANCE)
+  {
+    char message[96];
+    snprintf(message, sizeof(message), "ppr %u mode %u count %ld: %lld, double %.3f",
+             (unsigned)scale.pulsePerRev(), scale.countMode(), (long)count, (long long)got, expected);
+    TEST_FAIL_MESSAGE(message);
+  }
+}
+
+static void CheckRpm(const EncoderScale &scale, int64_t deltaCount, int64_t deltaUs)
+{
+  double expected = (double)deltaCount * 60e6 * ENCODER_SCALE_RPM /
+                    ((double)deltaUs * CountsPerRev(scale.pulsePerRev(), scale.countMode()));
+  int32_t got = scale.rpm(deltaCount, deltaUs);
+  //Anything past int32 is held at its end.
+  if(fabs(expected) >= INT32_MAX)
+  {
+    TEST_ASSERT_EQUAL_INT32(expected > 0 ? INT32_MAX : -INT32_MAX, got);
+    return;
+  }
+  if(fabs((double)got - expected) > RPM_TOLERANCE + fabs(expected) * RPM_RELATIVE_TOLERANCE)
+  {
+    char message[112];
+    snprintf(message, sizeof(message), "ppr %u mode %u %lld counts in %lld us: %ld, double %.3f",
+             (unsigned)scale.pulsePerRev(), scale.countMode(), (long long)deltaCount,
+             (long long)deltaUs, (long)got, expected);
+    TEST_FAIL_MESSAGE(message);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_angle_matches_double()
+{
+  for(uint32_t ppr : PPRS)
+  {
+    for(uint8_t mode : MODES)
+    {
+      EncoderScale scale;
+      scale.configure(ppr, mode);
+      uint32_t rev = ppr * mode / 2 + 1;
+      //Either side of zero, the first few revs, and both ends of the range.
+      for(int32_t n = 0; n < 100; n++)
+      {
+        CheckAngle(scale, n);
+        CheckAngle(scale, -n);
+        CheckAngle(scale, INT32_MAX - n);
+        CheckAngle(scale, INT32_MIN + n);
+      }
+      for(int i = 0; i < RANDOM_CASES; i++)
+      {
+        CheckAngle(scale, (int32_t)Random());
+        CheckAngle(scale, (int32_t)(Random() % (4 * (uint64_t)rev)) - (int32_t)(2 * (uint64_t)rev));
+      }
+    }
+  }
+}
+
+void test_rpm_matches_double()
+{
+  for(uint32_t ppr : PPRS)
+  {
+    for(uint8_t mode : MODES)
+    {
+      EncoderScale scale;
+      scale.configure(ppr, mode);
+      for(int i = 0; i < RANDOM_CASES; i++)
+      {
+        //A count or two over a long edge period, up to a fast shaft over a
+        //short one.
+        int64_t deltaUs = 1 + (int64_t)(Random() % 1000000);
+        CheckRpm(scale, (int64_t)(Random() % 201) - 100, deltaUs);
+        CheckRpm(scale, (int64_t)(Random() % 2000001) - 1000000, deltaUs);
+        CheckRpm(scale, (int64_t)(Random() % 100000001) - 50000000, 1 + (int64_t)(Random() % 100000000));
+      }
+    }
+  }
+}
+
+void test_rpm_limits()
+{
+  EncoderScale scale;
+  scale.configure(1200, ENCODER_COUNT_HALF);
+  TEST_ASSERT_EQUAL_INT32(0, scale.rpm(100, 0));
+  TEST_ASSERT_EQUAL_INT32(0, scale.rpm(100, -5));
+  //A wild count change is held at the end of the range, not wrapped.
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, scale.rpm(INT64_MAX / 2, 1));
+  TEST_ASSERT_EQUAL_INT32(-INT32_MAX, scale.rpm(-(INT64_MAX / 2), 1));
+  //One count a second at 1200 counts a rev.
+  TEST_ASSERT_EQUAL_INT32(50, scale.rpm(1, 1000000));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_angle_matches_double);
+  RUN_TEST(test_rpm_matches_double);
+  RUN_TEST(test_rpm_limits);
+  return UNITY_END();
+}
@@ -0,0 +1,229 @@
+//ESP32Encoder's count read against a wrap interrupt landing anywhere in it.
+//The simulated PCNT steps the unit over its limit at the n-th point of a
+//call, the points being either side of each counter read it makes, for
+//every n the call gets to.  So the edge (and the interrupt it raises)
+//comes between the pending wrap check and the register, between the
+//register and the sequence check, and so on through any retries.
+//The interrupt then runs at once, at the next point, or only once the call
+//has returned, as a long ISR latency would have it.
+//  pio test -e native -f test_encoder_snapshot
+#include <stdio.h>
+#include <unity.h>
+#include <SimHAL.h>
+#include "ESP32Encoder.h"
+
+//Just short of the limit, so a step of INJECT wraps the counter.
+#define PARK 32764
+#define INJECT 3
+#define SET_TO 1000000
+
+enum IsrTiming
+{
+  ISR_AT_ONCE,
+  ISR_NEXT_READ,
+  ISR_AFTER_CALL
+};
+
+static ESP32Encoder _encoder;
+
+//What the read hook does, and when.  Points count both sides of each read.
+static struct
+{
+  int points;
+  int stepAt;
+  int32_t steps;
+  int releaseAt;
+  bool stepped;
+} _inject;
+
+static void OnRead(int unit, bool after, void *arg)
+{
+  (void)after;
+  (void)arg;
+  if(unit != _encoder.unit)
+    return;
+  _inject.points++;
+  if(_inject.points == _inject.stepAt)
+  {
+    SimPcntStep(unit, _inject.steps);
+    _inject.stepped = true;
+  }
+  if(_inject.points == _inject.releaseAt)
+    SimPcntHoldIsr(false);
+}
+
+/// @brief Start from a count of dir * PARK, with nothing pending.
+static int64_t Park(int dir)
+{
+  SimPcntSetReadHook(nullptr, nullptr);
+  SimPcntHoldIsr(false);
+  _encoder.clearCount();
+  SimPcntStep(_encoder.unit, dir * PARK);
+  TEST_ASSERT_EQUAL_INT64(dir * PARK, _encoder.getCount());
+  return dir * PARK;
+}
+
+/// @brief Arm the hook to step at point n of the next call.
+static void Arm(int n, int dir, IsrTiming timing)
+{
+  _inject.points = 0;
+  _inject.stepAt = n;
+  _inject.steps = dir * INJECT;
+  _inject.releaseAt = timing == ISR_NEXT_READ ? n + 1 : 0;
+  _inject.stepped = false;
+  SimPcntHoldIsr(timing != ISR_AT_ONCE);
+  SimPcntSetReadHook(OnRead, nullptr);
+}
+
+/// @brief Let anything held run, as it would once the call has returned.
+static void Settle()
+{
+  SimPcntSetReadHook(nullptr, nullptr);
+  SimPcntHoldIsr(false);
+}
+
+void setUp()
+{
+  static bool attached = false;
+  if(!attached)
+    _encoder.attachHalfQuad(1, 2);
+  attached = true;
+  TEST_ASSERT_TRUE(_encoder.isAttached());
+}
+
+void tearDown()
+{
+  Settle();
+}
+
+/// @brief The wrap at every point getSnapshot() gets to, until it gets to
+/// no more.  The count has to be the one from before the edge or the one
+/// from after it, never a limit out.
+static void WalkSnapshot(int dir, IsrTiming timing)
+{
+  int n;
+  for(n = 1; n < 100; n++)
+  {
+    int64_t before = Park(dir);
+    int64_t after = before + dir * INJECT;
+    uint32_t interrupts = SimPcntInterrupts();
+    Arm(n, dir, timing);
+    EncoderSnapshot snap = _encoder.getSnapshot();
+    bool stepped = _inject.stepped;
+    Settle();
+    if(!stepped)
+      break;
+
+    char message[64];
+    snprintf(message, sizeof(message), "dir %d timing %d point %d: %lld", dir, (int)timing, n,
+             (long long)snap.count);
+    TEST_ASSERT_TRUE_MESSAGE(snap.count == before || snap.count == after, message);
+    TEST_ASSERT_EQUAL_INT64_MESSAGE(after, _encoder.getCount(), message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(interrupts + 1, SimPcntInterrupts(), message);
+  }
+  //Undisturbed it reads the counter once, so has two points.
+  TEST_ASSERT_GREATER_THAN(2, n);
+}
+
+/// @brief The same for setCount().  Every point it gets to comes
+/// before the new count is stored, so an edge at any of them is one the
+/// new count already has in it, whenever the interrupt runs.
+static void WalkSetCount(int dir, IsrTiming timing)
+{
+  int n;
+  for(n = 1; n < 100; n++)
+  {
+    Park(dir);
+    Arm(n, dir, timing);
+    _encoder.setCount(SET_TO);
+    bool stepped = _inject.stepped;
+    Settle();
+    if(!stepped)
+      break;
+
+    char message[64];
+    snprintf(message, sizeof(message), "dir %d timing %d point %d", dir, (int)timing, n);
+    TEST_ASSERT_EQUAL_INT64_MESSAGE(SET_TO, _encoder.getCount(), message);
+    //And it carries on counting from there.
+    SimPcntStep(_encoder.unit, dir);
+    TEST_ASSERT_EQUAL_INT64_MESSAGE(SET_TO + dir, _encoder.getCount(), message);
+  }
+  TEST_ASSERT_GREATER_THAN(2, n);
+}
+
+void test_snapshot_every_interleaving()
+{
+  for(int dir = -1; dir <= 1; dir += 2)
+  {
+    WalkSnapshot(dir, ISR_AT_ONCE);
+    WalkSnapshot(dir, ISR_NEXT_READ);
+    WalkSnapshot(dir, ISR_AFTER_CALL);
+  }
+}
+
+void test_set_count_every_interleaving()
+{
+  for(int dir = -1; dir <= 1; dir += 2)
+  {
+    WalkSetCount(dir, ISR_AT_ONCE);
+    WalkSetCount(dir, ISR_NEXT_READ);
+    WalkSetCount(dir, ISR_AFTER_CALL);
+  }
+}
+
+void test_wrap_pending_on_entry()
+{
+  //The counter has already gone back to zero, and the ISR has yet to run
+  //when each call starts.
+  for(int dir = -1; dir <= 1; dir += 2)
+  {
+    int64_t after = Park(dir) + dir * INJECT;
+    SimPcntHoldIsr(true);
+    SimPcntStep(_encoder.unit, dir * INJECT);
+    TEST_ASSERT_EQUAL_INT64(after, _encoder.getSnapshot().count);
+    Settle();
+    TEST_ASSERT_EQUAL_INT64(after, _encoder.getCount());
+
+    Park(dir);
+    SimPcntHoldIsr(true);
+    SimPcntStep(_encoder.unit, dir * INJECT);
+    _encoder.setCount(SET_TO);
+    Settle();
+    TEST_ASSERT_EQUAL_INT64(SET_TO, _encoder.getCount());
+
+    //Cleared, the wrap no longer counts for anything.
+    Park(dir);
+    SimPcntHoldIsr(true);
+    SimPcntStep(_encoder.unit, dir * INJECT);
+    _encoder.clearCount();
+    Settle();
+    TEST_ASSERT_EQUAL_INT64(0, _encoder.getCount());
+  }
+}
+
+void test_critical_section_holds_the_isr()
+{
+  //A limit reached inside a critical section waits for it to end, as it
+  //would with interrupts masked on the chip.
+  Park(1);
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t interrupts = SimPcntInterrupts();
+  portENTER_CRITICAL(&mux);
+  portENTER_CRITICAL(&mux);
+  SimPcntStep(_encoder.unit, INJECT);
+  portEXIT_CRITICAL(&mux);
+  TEST_ASSERT_EQUAL_UINT32(interrupts, SimPcntInterrupts());
+  portEXIT_CRITICAL(&mux);
+  TEST_ASSERT_EQUAL_UINT32(interrupts + 1, SimPcntInterrupts());
+  TEST_ASSERT_EQUAL_INT64(PARK + INJECT, _encoder.getCount());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_snapshot_every_interleaving);
+  RUN_TEST(test_set_count_every_interleaving);
+  RUN_TEST(test_wrap_pending_on_entry);
+  RUN_TEST(test_critical_section_holds_the_isr);
+  return UNITY_END();
+}
@@ -0,0 +1,137 @@
+//InterruptEncoder's table decoder, driven through the simulated pins the
+//way the encoder lines would drive the GPIO interrupts: forward, back,
+//on pins in either input register, with bounce, and with an interrupt
+//lost so both pins have changed by the time the ISR runs.
+//  pio test -e native -f test_interrupt_encoder
+#include <unity.h>
+#include <SimHAL.h>
+#include <InterruptEncoder.h>
+
+//The A/B levels, (A << 1) | B, counting up: B leads A.
+static const uint8_t GRAY[4] = {0, 1, 3, 2};
+
+static InterruptEncoder _encoder;
+//Where the lines are in GRAY.
+static int _position;
+
+static void SetLines(int aPin, int bPin, int position)
+{
+  uint8_t state = GRAY[position & 3];
+  SimSetPin(aPin, state >> 1);
+  SimSetPin(bPin, state & 1);
+  _position = position;
+}
+
+static void SetPosition(int position)
+{
+  SetLines(_encoder.apin, _encoder.bpin, position);
+}
+
+/// @brief Move the lines steps quadrature edges, one pin at a time.
+static void Step(int steps)
+{
+  int dir = steps > 0 ? 1 : -1;
+  for(int i = 0; i != steps; i += dir)
+    SetPosition(_position + dir);
+}
+
+static void Attach(int aPin, int bPin)
+{
+  //The lines are somewhere before the decoder is attached to them.
+  _encoder.detach();
+  SetLines(aPin, bPin, 0);
+  _encoder.attach(aPin, bPin);
+}
+
+void setUp()
+{
+  Attach(1, 2);
+}
+
+void tearDown()
+{
+  _encoder.detach();
+}
+
+void test_counts_every_edge()
+{
+  Step(400);
+  TEST_ASSERT_EQUAL_INT64(400, _encoder.read());
+  Step(-1000);
+  TEST_ASSERT_EQUAL_INT64(-600, _encoder.read());
+  Step(600);
+  TEST_ASSERT_EQUAL_INT64(0, _encoder.read());
+  TEST_ASSERT_EQUAL_UINT32(0, _encoder.illegalTransitions());
+}
+
+void test_both_input_registers()
+{
+  //GPIO 32 up are in the second input register, and a pair can straddle
+  //the two.
+  const int pins[][2] = {{33, 34}, {31, 32}, {40, 5}};
+  for(auto &pair : pins)
+  {
+    Attach(pair[0], pair[1]);
+    Step(123);
+    Step(-23);
+    TEST_ASSERT_EQUAL_INT64(100, _encoder.read());
+    TEST_ASSERT_EQUAL_UINT32(0, _encoder.illegalTransitions());
+  }
+}
+
+void test_bounce_comes_to_nothing()
+{
+  //Chatter on one line, an edge back and forth, moves the count and puts
+  //it back again, with no debounce to lose a real edge to.
+  Step(10);
+  for(int i = 0; i < 50; i++)
+  {
+    Step(1);
+    Step(-1);
+  }
+  TEST_ASSERT_EQUAL_INT64(10, _encoder.read());
+  Step(1);
+  TEST_ASSERT_EQUAL_INT64(11, _encoder.read());
+  TEST_ASSERT_EQUAL_UINT32(0, _encoder.illegalTransitions());
+}
+
+void test_lost_interrupt_is_illegal()
+{
+  Step(8);
+  //B's interrupt never comes, so when A's does both pins have moved.
+  detachInterrupt(digitalPinToInterrupt(_encoder.bpin));
+  Step(1);
+  attachInterruptArg(digitalPinToInterrupt(_encoder.bpin), InterruptEncoder::isr, &_encoder, CHANGE);
+  Step(1);
+  TEST_ASSERT_EQUAL_UINT32(1, _encoder.illegalTransitions());
+  //Neither edge counts, and it carries on from the new state.
+  TEST_ASSERT_EQUAL_INT64(8, _encoder.read());
+  Step(4);
+  TEST_ASSERT_EQUAL_INT64(12, _encoder.read());
+  TEST_ASSERT_EQUAL_UINT32(1, _encoder.illegalTransitions());
+}
+
+void test_reattach_starts_from_the_pins()
+{
+  //Detached part way round a cycle, the lines move on, and attaching
+  //again takes them as they are rather than as a first, illegal edge.
+  Step(5);
+  _encoder.detach();
+  SetPosition(_position + 1);
+  _encoder.attach(_encoder.apin, _encoder.bpin);
+  TEST_ASSERT_EQUAL_INT64(0, _encoder.read());
+  Step(-3);
+  TEST_ASSERT_EQUAL_INT64(-3, _encoder.read());
+  TEST_ASSERT_EQUAL_UINT32(0, _encoder.illegalTransitions());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_counts_every_edge);
+  RUN_TEST(test_both_input_registers);
+  RUN_TEST(test_bounce_comes_to_nothing);
+  RUN_TEST(test_lost_interrupt_is_illegal);
+  RUN_TEST(test_reattach_starts_from_the_pins);
+  return UNITY_END();
+}
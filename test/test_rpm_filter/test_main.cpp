@@ -0,0 +1,106 @@
+//The RPM filters: the depth limit wherever a depth comes in, the EMA at
+//its limits, and each filter's response to a step.
+//  pio test -e native -f test_rpm_filter
+#include <unity.h>
+#include <initializer_list>
+#include "Channel.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_configure_holds_depth()
+{
+  RpmFilter filter;
+  //Used to wrap depth + 1 to zero and divide by it.
+  TEST_ASSERT_TRUE(filter.configure(RPM_FILTER_EMA, 4294967295u, 500, 100));
+  TEST_ASSERT_EQUAL_UINT32(RPM_FILTER_MAX_DEPTH, filter.depth());
+  filter.update(1000, 0, 0);
+
+  TEST_ASSERT_TRUE(filter.configure(RPM_FILTER_EMA, RPM_FILTER_MAX_DEPTH, 500, 100));
+  TEST_ASSERT_EQUAL_UINT32(RPM_FILTER_MAX_DEPTH, filter.depth());
+}
+
+void test_channel_load_holds_depth()
+{
+  //A blob written by a build with no limit.
+  ChannelSettings settings = {};
+  settings.aPin = CHANNEL_NO_PIN;
+  settings.bPin = CHANNEL_NO_PIN;
+  settings.pulsePerRev = 1200;
+  settings.countMode = ENCODER_COUNT_HALF;
+  settings.rpmFilterDepth = 2000000000u;
+  settings.rpmFilterType = RPM_FILTER_EMA;
+  Channel channel;
+  channel.load(settings);
+  TEST_ASSERT_EQUAL_UINT32(RPM_FILTER_MAX_DEPTH, channel.rpmFilterDepth);
+  TEST_ASSERT_EQUAL_UINT32(RPM_FILTER_MAX_DEPTH, channel.filter.depth());
+}
+
+void test_deepest_ema_at_full_scale()
+{
+  //The biggest RPM there is, through the deepest EMA, against the same
+  //sum in doubles.  Nothing may overflow on the way.  Each divide drops
+  //less than 1/256 of a count, and the filter remembers depth + 1 samples'
+  //worth of them.
+  const double tolerance = (RPM_FILTER_MAX_DEPTH + 1) / 256.0 + 1;
+  for(int32_t x : {INT32_MAX, INT32_MIN + 1})
+  {
+    EmaFilter ema;
+    ema.setDepth(RPM_FILTER_MAX_DEPTH);
+    double reference = 0;
+    for(int i = 0; i < 20000; i++)
+    {
+      int32_t out = ema.update(x);
+      reference = (reference * RPM_FILTER_MAX_DEPTH + x) / (RPM_FILTER_MAX_DEPTH + 1);
+      TEST_ASSERT_DOUBLE_WITHIN(tolerance, reference, (double)out);
+    }
+  }
+}
+
+/// @brief Samples after a step from 0 to 1000 RPM until the filter is at
+/// 90% of it.
+static int SamplesTo90(RpmFilterType type, uint32_t depth)
+{
+  //The tracker works from the count, the others from the RPM, so the
+  //shaft really does step: 1200 counts a rev, a sample every 10 ms.
+  EncoderScale scale;
+  scale.configure(1200, ENCODER_COUNT_HALF);
+  RpmFilter filter;
+  filter.setScale(scale);
+  filter.configure(type, depth, 500, 100);
+  const int32_t rpm = 1000 * ENCODER_SCALE_RPM;
+  const int64_t countsPerSample = 1000LL * 1200 / 60 / 100;
+  int64_t count = 0;
+  for(int i = 0; i < 10; i++)
+    filter.update(0, count, i * 10000LL);
+  for(int n = 1; n < 1000; n++)
+  {
+    count += countsPerSample;
+    if(filter.update(rpm, count, (9 + n) * 10000LL) >= rpm * 9 / 10)
+      return n;
+  }
+  return -1;
+}
+
+void test_step_response()
+{
+  //The boxcar and median get there in a fixed number of samples.
+  TEST_ASSERT_EQUAL(1, SamplesTo90(RPM_FILTER_NONE, 5));
+  TEST_ASSERT_EQUAL(5, SamplesTo90(RPM_FILTER_BOXCAR, 5));
+  TEST_ASSERT_EQUAL(3, SamplesTo90(RPM_FILTER_MEDIAN, 5));
+  //The EMA's time constant is depth + 1 samples, so 90% takes about 2.3
+  //of them.
+  TEST_ASSERT_INT_WITHIN(1, 13, SamplesTo90(RPM_FILTER_EMA, 5));
+  int tracker = SamplesTo90(RPM_FILTER_ALPHA_BETA, 5);
+  TEST_ASSERT_TRUE(tracker > 0 && tracker < 20);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_configure_holds_depth);
+  RUN_TEST(test_channel_load_holds_depth);
+  RUN_TEST(test_deepest_ema_at_full_scale);
+  RUN_TEST(test_step_response);
+  return UNITY_END();
+}
@@ -0,0 +1,84 @@
+//The sampler's timer and its jitter figures, on the simulated clock.
+//  pio test -e native -f test_sampler
+#include <unity.h>
+#include <SimHAL.h>
+#include "Sampler.h"
+
+#define PERIOD_US 1000
+
+static Sampler _sampler;
+
+/// @brief Take everything off the queue.
+static uint32_t Drain()
+{
+  Sample sample;
+  uint32_t n = 0;
+  while(_sampler.read(sample))
+    n++;
+  return n;
+}
+
+void setUp()
+{
+  static bool begun = false;
+  if(!begun)
+    TEST_ASSERT_TRUE(_sampler.begin(PERIOD_US));
+  begun = true;
+  _sampler.setPeriod(PERIOD_US);
+  Drain();
+}
+
+void tearDown() {}
+
+void test_steady_timer()
+{
+  SimAdvanceUs(10 * PERIOD_US);
+  //The first sample after the restart has nothing to be measured against.
+  JitterStats stats = _sampler.jitter();
+  TEST_ASSERT_EQUAL_UINT32(PERIOD_US, stats.nominalUs);
+  TEST_ASSERT_EQUAL_UINT32(9, stats.periods);
+  TEST_ASSERT_EQUAL_INT64(PERIOD_US, stats.minUs);
+  TEST_ASSERT_EQUAL_INT64(PERIOD_US, stats.maxUs);
+  TEST_ASSERT_EQUAL_INT64(PERIOD_US, stats.meanUs);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.overruns);
+  TEST_ASSERT_EQUAL_UINT32(10, Drain());
+}
+
+void test_reset_and_new_period()
+{
+  SimAdvanceUs(5 * PERIOD_US);
+  _sampler.resetJitter();
+  //Nothing until the timer has been round again.
+  TEST_ASSERT_EQUAL_UINT32(4, _sampler.jitter().periods);
+  SimAdvanceUs(PERIOD_US);
+  JitterStats stats = _sampler.jitter();
+  TEST_ASSERT_EQUAL_UINT32(0, stats.periods);
+  TEST_ASSERT_EQUAL_INT64(0, stats.minUs);
+  TEST_ASSERT_EQUAL_INT64(0, stats.meanUs);
+
+  _sampler.setPeriod(3 * PERIOD_US);
+  SimAdvanceUs(30 * PERIOD_US);
+  stats = _sampler.jitter();
+  TEST_ASSERT_EQUAL_UINT32(3 * PERIOD_US, stats.nominalUs);
+  TEST_ASSERT_EQUAL_UINT32(9, stats.periods);
+  TEST_ASSERT_EQUAL_INT64(3 * PERIOD_US, stats.meanUs);
+}
+
+void test_overruns_when_loop_falls_behind()
+{
+  //Nothing takes the samples off, so the queue fills and the rest are
+  //counted rather than lost without trace.
+  SimAdvanceUs((SAMPLER_QUEUE_SIZE + 5) * PERIOD_US);
+  JitterStats stats = _sampler.jitter();
+  TEST_ASSERT_EQUAL_UINT32(5, stats.overruns);
+  TEST_ASSERT_EQUAL_UINT32(SAMPLER_QUEUE_SIZE, Drain());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_steady_timer);
+  RUN_TEST(test_reset_and_new_period);
+  RUN_TEST(test_overruns_when_loop_falls_behind);
+  return UNITY_END();
+}
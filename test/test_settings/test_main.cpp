@@ -0,0 +1,256 @@
+//Settings against the simulated flash: how many writes a run of changes
+//costs, how long they hold loop() up, bringing the old keys across, and
+//leaving newer firmware's blob alone.
+//  pio test -e native -f test_settings
+#include <stddef.h>
+#include <string.h>
+#include <unity.h>
+#include <SimHAL.h>
+#include "Settings.h"
+#include "TelemetryFrame.h"
+
+//The header in front of the blob, as Settings writes it.
+struct BlobHeader
+{
+  uint16_t version;
+  uint16_t length;
+  uint16_t crc;
+  uint16_t reserved;
+};
+
+/// @brief Put a blob in flash the way some firmware would have, data
+/// being length bytes of the given pattern.
+static void SeedBlob(uint16_t version, uint16_t length, uint8_t pattern)
+{
+  uint8_t blob[sizeof(BlobHeader) + 1024];
+  TEST_ASSERT_TRUE(length <= 1024);
+  BlobHeader header = {version, length, 0, 0};
+  memset(blob + sizeof(header), pattern, length);
+  header.crc = TelemetryCrc16(blob + sizeof(header), length);
+  memcpy(blob, &header, sizeof(header));
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE);
+  prefs.putBytes(PREFS_SETTINGS, blob, sizeof(header) + length);
+  prefs.end();
+}
+
+/// @brief The blob in flash, empty if there is none.
+static size_t ReadBlob(uint8_t *buf, size_t maxLen)
+{
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  size_t len = prefs.getBytes(PREFS_SETTINGS, buf, maxLen);
+  prefs.end();
+  return len;
+}
+
+/// @brief poll() once a ms from now for ms, as loop() would.
+/// @return The flash writes it made.
+static uint32_t PollFor(Settings &settings, unsigned long ms)
+{
+  uint32_t writes = SimPrefsWrites();
+  for(unsigned long i = 0; i < ms; i++)
+  {
+    SimAdvanceUs(1000);
+    settings.poll(millis());
+  }
+  return SimPrefsWrites() - writes;
+}
+
+void setUp()
+{
+  SimPrefsClear();
+}
+
+void tearDown() {}
+
+void test_first_boot_saves_defaults_once()
+{
+  Settings settings;
+  TEST_ASSERT_EQUAL(SETTINGS_DEFAULTS, settings.begin());
+  TEST_ASSERT_EQUAL_UINT32(1, SimPrefsWrites());
+  TEST_ASSERT_EQUAL_UINT32(100, settings.data().loopInterval);
+
+  //And the next boot loads them, without writing.
+  Settings again;
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, again.begin());
+  TEST_ASSERT_EQUAL_UINT32(1, SimPrefsWrites());
+}
+
+void test_migrates_old_keys()
+{
+  SimPrefsSeed(PREFS_NAMESPACE, PREFS_LOOP_INTERVAL, 20);
+  SimPrefsSeed(PREFS_NAMESPACE, PREFS_PULSE_PER_REV, 2048);
+  SimPrefsSeed(PREFS_NAMESPACE, PREFS_RPM_FILTER_DEPTH, 8);
+  Settings settings;
+  TEST_ASSERT_EQUAL(SETTINGS_MIGRATED, settings.begin());
+  TEST_ASSERT_EQUAL_UINT32(1, SimPrefsWrites());
+  TEST_ASSERT_EQUAL_UINT32(20, settings.data().loopInterval);
+  TEST_ASSERT_EQUAL_UINT32(2048, settings.data().channels[0].pulsePerRev);
+  TEST_ASSERT_EQUAL_UINT32(8, settings.data().channels[0].rpmFilterDepth);
+  //The other channels never had keys of their own.
+  TEST_ASSERT_EQUAL_UINT32(1200, settings.data().channels[1].pulsePerRev);
+
+  Settings again;
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, again.begin());
+  TEST_ASSERT_EQUAL_UINT32(2048, again.data().channels[0].pulsePerRev);
+}
+
+void test_migrates_any_one_key()
+{
+  //The old firmware only saved what had been changed.
+  SimPrefsSeed(PREFS_NAMESPACE, PREFS_RPM_FILTER_DEPTH, 3);
+  Settings settings;
+  TEST_ASSERT_EQUAL(SETTINGS_MIGRATED, settings.begin());
+  TEST_ASSERT_EQUAL_UINT32(3, settings.data().channels[0].rpmFilterDepth);
+  TEST_ASSERT_EQUAL_UINT32(100, settings.data().loopInterval);
+  TEST_ASSERT_EQUAL_UINT32(1200, settings.data().channels[0].pulsePerRev);
+}
+
+void test_older_blob_keeps_defaults_past_its_end()
+{
+  //Version 1 stops short of the report policy.
+  SeedBlob(1, offsetof(SettingsData, report), 0);
+  uint32_t writes = SimPrefsWrites();
+  Settings settings;
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, settings.begin());
+  TEST_ASSERT_EQUAL_UINT32(writes, SimPrefsWrites());
+  TEST_ASSERT_EQUAL_UINT32(0, settings.data().loopInterval);
+  TEST_ASSERT_EQUAL_UINT32(1, settings.data().report.slowDecimation);
+  TEST_ASSERT_EQUAL_UINT32(OUTPUT_DROP_OLDEST, settings.data().outputPolicy);
+}
+
+void test_damaged_blob_is_replaced()
+{
+  SeedBlob(SETTINGS_VERSION, sizeof(SettingsData), 0);
+  //Flip a bit, so the CRC no longer matches.
+  uint8_t blob[sizeof(BlobHeader) + sizeof(SettingsData)];
+  TEST_ASSERT_EQUAL(sizeof(blob), ReadBlob(blob, sizeof(blob)));
+  blob[sizeof(BlobHeader) + 5] ^= 1;
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE);
+  prefs.putBytes(PREFS_SETTINGS, blob, sizeof(blob));
+  prefs.end();
+
+  uint32_t writes = SimPrefsWrites();
+  Settings settings;
+  TEST_ASSERT_EQUAL(SETTINGS_DEFAULTS, settings.begin());
+  TEST_ASSERT_EQUAL_UINT32(writes + 1, SimPrefsWrites());
+  Settings again;
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, again.begin());
+}
+
+/// @brief A blob newer firmware wrote has to come through boot, and any
+/// amount of changes, just as it was, until 'W'.
+static void CheckNewerKept(uint16_t version, uint16_t length)
+{
+  SeedBlob(version, length, 0x5A);
+  //Old keys too, which mustn't be brought across over it.
+  SimPrefsSeed(PREFS_NAMESPACE, PREFS_PULSE_PER_REV, 2048);
+  uint8_t before[sizeof(BlobHeader) + 1024];
+  size_t len = ReadBlob(before, sizeof(before));
+  uint32_t writes = SimPrefsWrites();
+
+  Settings settings;
+  TEST_ASSERT_EQUAL(SETTINGS_NEWER, settings.begin());
+  TEST_ASSERT_EQUAL_UINT32(1200, settings.data().channels[0].pulsePerRev);
+  settings.data().loopInterval = 10;
+  settings.markDirty(millis());
+  TEST_ASSERT_EQUAL_UINT32(0, PollFor(settings, 3 * SETTINGS_QUIET_MS));
+  TEST_ASSERT_EQUAL_UINT32(writes, SimPrefsWrites());
+
+  //A reboot finds it still there.
+  uint8_t after[sizeof(before)];
+  TEST_ASSERT_EQUAL(len, ReadBlob(after, sizeof(after)));
+  TEST_ASSERT_EQUAL_MEMORY(before, after, len);
+  Settings again;
+  TEST_ASSERT_EQUAL(SETTINGS_NEWER, again.begin());
+
+  //Only asking for it writes over it, and from then on it is ours.
+  TEST_ASSERT_TRUE(settings.save());
+  Settings ours;
+  TEST_ASSERT_EQUAL(SETTINGS_LOADED, ours.begin());
+  TEST_ASSERT_EQUAL_UINT32(10, ours.data().loopInterval);
+}
+
+void test_newer_version_is_kept()
+{
+  CheckNewerKept(SETTINGS_VERSION + 1, sizeof(SettingsData));
+}
+
+void test_longer_blob_is_kept()
+{
+  CheckNewerKept(SETTINGS_VERSION + 1, sizeof(SettingsData) + 64);
+}
+
+void test_changes_go_in_one_write()
+{
+  Settings settings;
+  settings.begin();
+  uint32_t commits = settings.commits();
+
+  //A GUI sending a change every 100 ms for 5 s, then leaving it alone.
+  uint32_t writes = 0;
+  for(int i = 0; i < 50; i++)
+  {
+    settings.data().loopInterval = 10 + i;
+    settings.markDirty(millis());
+    writes += PollFor(settings, 100);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, writes);
+  TEST_ASSERT_EQUAL_UINT32(0, PollFor(settings, SETTINGS_QUIET_MS - 200));
+  TEST_ASSERT_EQUAL_UINT32(1, PollFor(settings, 400));
+  TEST_ASSERT_EQUAL_UINT32(commits + 1, settings.commits());
+  TEST_ASSERT_FALSE(settings.dirty());
+  //Nothing more to write.
+  TEST_ASSERT_EQUAL_UINT32(0, PollFor(settings, 2 * SETTINGS_QUIET_MS));
+}
+
+void test_loop_only_waits_for_the_write()
+{
+  Settings settings;
+  settings.begin();
+
+  //Marking and polling with nothing to write take no time at all.
+  int64_t start = SimNowUs();
+  for(int i = 0; i < 1000; i++)
+  {
+    settings.markDirty(millis());
+    settings.poll(millis());
+  }
+  TEST_ASSERT_EQUAL_INT64(start, SimNowUs());
+
+  //One pass of loop() waits for the one write, the rest none.
+  int64_t longest = 0;
+  int slow = 0;
+  for(int i = 0; i < 3 * SETTINGS_QUIET_MS; i++)
+  {
+    SimAdvanceUs(1000);
+    int64_t before = SimNowUs();
+    settings.poll(millis());
+    int64_t took = SimNowUs() - before;
+    if(took > 0)
+      slow++;
+    if(took > longest)
+      longest = took;
+  }
+  TEST_ASSERT_EQUAL(1, slow);
+  TEST_ASSERT_TRUE(longest > 0);
+  //The write itself, one NVS entry and no more.
+  TEST_ASSERT_TRUE(longest <= 10000);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_boot_saves_defaults_once);
+  RUN_TEST(test_migrates_old_keys);
+  RUN_TEST(test_migrates_any_one_key);
+  RUN_TEST(test_older_blob_keeps_defaults_past_its_end);
+  RUN_TEST(test_damaged_blob_is_replaced);
+  RUN_TEST(test_newer_version_is_kept);
+  RUN_TEST(test_longer_blob_is_kept);
+  RUN_TEST(test_changes_go_in_one_write);
+  RUN_TEST(test_loop_only_waits_for_the_write);
+  return UNITY_END();
+}
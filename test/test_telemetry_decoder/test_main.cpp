@@ -0,0 +1,219 @@
+//TelemetryDecoder fed what the PC really gets: frames mixed in with ASCII
+//replies, corrupted bytes, false sync bytes and dropped frames.
+//  pio test -e native -f test_telemetry_decoder
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "TelemetryFrame.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static TelemetrySample Sample(uint16_t sequence)
+{
+  TelemetrySample sample;
+  sample.sequence = sequence;
+  sample.timestampUs = 1000u * sequence;
+  sample.count = -3LL * sequence;
+  sample.rpmMilli = 60000 + sequence;
+  return sample;
+}
+
+static void AppendSample(Bytes &out, uint16_t sequence)
+{
+  uint8_t buf[TELEMETRY_SAMPLE_FRAME_SIZE];
+  out.insert(out.end(), buf, buf + EncodeTelemetrySample(Sample(sequence), buf));
+}
+
+static void AppendMulti(Bytes &out, uint16_t sequence, uint8_t mask)
+{
+  TelemetryMultiSample sample = {};
+  sample.sequence = sequence;
+  sample.timestampUs = 1000u * sequence;
+  sample.channelMask = mask;
+  for(uint8_t i = 0; i < TELEMETRY_MAX_CHANNELS; i++)
+  {
+    sample.count[i] = (int64_t)sequence * 100 + i;
+    sample.rpmMilli[i] = -(int32_t)i;
+  }
+  uint8_t buf[TELEMETRY_MAX_FRAME_SIZE];
+  out.insert(out.end(), buf, buf + EncodeTelemetryMultiSample(sample, buf));
+}
+
+static void AppendText(Bytes &out, const char *text)
+{
+  out.insert(out.end(), text, text + strlen(text));
+}
+
+/// @brief Feed it all, and list the sequence number of every frame that
+/// came out, checking each one's contents on the way.
+static std::vector<uint16_t> Decode(TelemetryDecoder &decoder, const Bytes &in)
+{
+  std::vector<uint16_t> got;
+  for(uint8_t b : in)
+  {
+    if(!decoder.feed(b))
+      continue;
+    do
+    {
+      if(decoder.type() == TELEMETRY_TYPE_SAMPLE)
+      {
+        const TelemetrySample &s = decoder.sample();
+        TelemetrySample want = Sample(s.sequence);
+        TEST_ASSERT_EQUAL_UINT32(want.timestampUs, s.timestampUs);
+        TEST_ASSERT_EQUAL_INT64(want.count, s.count);
+        TEST_ASSERT_EQUAL_INT32(want.rpmMilli, s.rpmMilli);
+        got.push_back(s.sequence);
+      }
+      else
+      {
+        const TelemetryMultiSample &s = decoder.multiSample();
+        for(uint8_t i = 0; i < TELEMETRY_MAX_CHANNELS; i++)
+          if(s.channelMask & (1 << i))
+            TEST_ASSERT_EQUAL_INT64((int64_t)s.sequence * 100 + i, s.count[i]);
+        got.push_back(s.sequence);
+      }
+    } while(decoder.next());
+  }
+  return got;
+}
+
+static std::vector<uint16_t> Range(uint16_t from, uint16_t to)
+{
+  std::vector<uint16_t> v;
+  for(uint16_t i = from; i <= to; i++)
+    v.push_back(i);
+  return v;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_interleaved_text()
+{
+  Bytes in;
+  AppendText(in, "Received PPR Command: 1200 4\r\n");
+  AppendSample(in, 1);
+  AppendText(in, "S 1200 5 100\r\n");
+  AppendMulti(in, 2, 0x05);
+  AppendSample(in, 3);
+  AppendText(in, "X");
+  TelemetryDecoder decoder;
+  TEST_ASSERT_TRUE(Decode(decoder, in) == Range(1, 3));
+  TEST_ASSERT_EQUAL_UINT32(strlen("Received PPR Command: 1200 4\r\nS 1200 5 100\r\nX"), decoder.skippedBytes());
+  TEST_ASSERT_EQUAL_UINT32(0, decoder.crcErrors());
+  TEST_ASSERT_EQUAL_UINT32(0, decoder.lostFrames());
+}
+
+void test_crc_error_loses_only_that_frame()
+{
+  Bytes in;
+  for(uint16_t i = 1; i <= 3; i++)
+    AppendSample(in, i);
+  in[TELEMETRY_SAMPLE_FRAME_SIZE + 10] ^= 0x40;
+  TelemetryDecoder decoder;
+  std::vector<uint16_t> want = {1, 3};
+  TEST_ASSERT_TRUE(Decode(decoder, in) == want);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder.crcErrors());
+  //Which the sequence numbers show as a lost frame.
+  TEST_ASSERT_EQUAL_UINT32(1, decoder.lostFrames());
+}
+
+void test_any_one_byte_corrupted()
+{
+  //Whichever byte of the stream goes bad, only the frame it was in is
+  //lost, and nothing made up gets through.
+  Bytes clean;
+  AppendSample(clean, 1);
+  AppendMulti(clean, 2, 0x83);
+  AppendText(clean, "ok\n");
+  AppendSample(clean, 3);
+  AppendSample(clean, 4);
+  for(size_t i = 0; i < clean.size(); i++)
+  {
+    for(uint8_t flip : {0x01, 0x80, 0xFF})
+    {
+      Bytes in = clean;
+      in[i] ^= flip;
+      TelemetryDecoder decoder;
+      std::vector<uint16_t> got = Decode(decoder, in);
+      TEST_ASSERT_TRUE(got.size() >= 3);
+      for(size_t j = 1; j < got.size(); j++)
+        TEST_ASSERT_TRUE(got[j] > got[j - 1]);
+    }
+  }
+}
+
+void test_frames_inside_a_false_frame()
+{
+  //A stray sync and multi type, as line noise might make, claiming all
+  //eight channels.  The decoder holds on for a whole multi frame's worth
+  //before the CRC fails, and every frame in that stretch has to come out
+  //of the rescan.
+  Bytes in = {TELEMETRY_SYNC, TELEMETRY_TYPE_MULTI, 0, 0, 0, 0, 0, 0, 0xFF};
+  for(uint16_t i = 1; i <= 6; i++)
+    AppendSample(in, i);
+  TEST_ASSERT_TRUE(in.size() > TELEMETRY_MAX_FRAME_SIZE);
+  TelemetryDecoder decoder;
+  TEST_ASSERT_TRUE(Decode(decoder, in) == Range(1, 6));
+  TEST_ASSERT_EQUAL_UINT32(1, decoder.crcErrors());
+  TEST_ASSERT_EQUAL_UINT32(9, decoder.skippedBytes());
+}
+
+void test_false_sync_in_text()
+{
+  //A sync byte on its own, then one with a type, each followed by a real
+  //frame straight away.
+  Bytes in;
+  in.push_back(TELEMETRY_SYNC);
+  AppendSample(in, 1);
+  in.push_back(TELEMETRY_SYNC);
+  in.push_back(TELEMETRY_TYPE_SAMPLE);
+  AppendSample(in, 2);
+  AppendSample(in, 3);
+  TelemetryDecoder decoder;
+  TEST_ASSERT_TRUE(Decode(decoder, in) == Range(1, 3));
+}
+
+void test_sequence_gaps()
+{
+  Bytes in;
+  AppendSample(in, 65533);
+  AppendSample(in, 65534);
+  //Over the wrap, one missing.
+  AppendSample(in, 0);
+  AppendSample(in, 1);
+  AppendMulti(in, 5, 0x01);
+  TelemetryDecoder decoder;
+  std::vector<uint16_t> want = {65533, 65534, 0, 1, 5};
+  TEST_ASSERT_TRUE(Decode(decoder, in) == want);
+  TEST_ASSERT_EQUAL_UINT32(1 + 3, decoder.lostFrames());
+}
+
+void test_split_anywhere()
+{
+  //Fed in two goes, cut anywhere, the frames come out the same.
+  Bytes in;
+  AppendSample(in, 1);
+  AppendMulti(in, 2, 0xFF);
+  for(size_t cut = 0; cut <= in.size(); cut++)
+  {
+    TelemetryDecoder decoder;
+    std::vector<uint16_t> got = Decode(decoder, Bytes(in.begin(), in.begin() + cut));
+    std::vector<uint16_t> rest = Decode(decoder, Bytes(in.begin() + cut, in.end()));
+    got.insert(got.end(), rest.begin(), rest.end());
+    TEST_ASSERT_TRUE(got == Range(1, 2));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_interleaved_text);
+  RUN_TEST(test_crc_error_loses_only_that_frame);
+  RUN_TEST(test_any_one_byte_corrupted);
+  RUN_TEST(test_frames_inside_a_false_frame);
+  RUN_TEST(test_false_sync_in_text);
+  RUN_TEST(test_sequence_gaps);
+  RUN_TEST(test_split_anywhere);
+  return UNITY_END();
+}
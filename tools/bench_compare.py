@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""Compare two runs of the cycle benchmark (bench/Bench.cpp).
+
+    bench_compare.py old.txt new.txt [--threshold 10] [--min-cycles 10]
+                     [--column p50]
+
+Each file is the serial output of a bench build; anything that isn't one of
+the bench's CSV records (boot messages and so on) is ignored.  Prints one line
+per stage with the old and new figure and the change, and exits with status 1
+if any stage got slower by more than the threshold, in percent, and by more
+than --min-cycles (so the tiny stages don't trip it on noise alone).
+"""
+import argparse
+import sys
+
+COLUMNS = ["min", "p50", "p90", "p99", "max", "mean"]
+
+
+def load(path):
+    header = None
+    stages = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if fields[0] == "BENCH" and len(fields) >= 6:
+                header = {"version": fields[1], "target": fields[2], "mhz": fields[3],
+                          "iterations": fields[4]}
+            elif fields[0] == "STAGE" and len(fields) == 2 + len(COLUMNS):
+                stages[fields[1]] = dict(zip(COLUMNS, map(int, fields[2:])))
+    if header is None:
+        sys.exit("%s: no BENCH header, is this bench output?" % path)
+    return header, stages
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="percent slowdown that counts as a regression")
+    parser.add_argument("--min-cycles", type=int, default=10,
+                        help="ignore slowdowns smaller than this many cycles")
+    parser.add_argument("--column", choices=COLUMNS, default="p50",
+                        help="which figure to compare")
+    args = parser.parse_args()
+
+    old_header, old = load(args.old)
+    new_header, new = load(args.new)
+    if old_header["target"] != new_header["target"]:
+        print("warning: comparing %s with %s" % (old_header["target"], new_header["target"]))
+
+    regressed = False
+    print("%-20s %10s %10s %8s" % ("stage", "old", "new", "change"))
+    for name in list(old) + [n for n in new if n not in old]:
+        if name not in old or name not in new:
+            print("%-20s %10s %10s" % (name, old.get(name, {}).get(args.column, "-"),
+                                       new.get(name, {}).get(args.column, "-")))
+            continue
+        a = old[name][args.column]
+        b = new[name][args.column]
+        change = (b - a) * 100.0 / a if a else 0.0
+        flag = ""
+        if change > args.threshold and b - a > args.min_cycles:
+            flag = "  REGRESSION"
+            regressed = True
+        print("%-20s %10d %10d %+7.1f%%%s" % (name, a, b, change, flag))
+
+    sys.exit(1 if regressed else 0)
+
+
+if __name__ == "__main__":
+    main()
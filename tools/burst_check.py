@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Check burst capture ('A' and 'U') against the simulated encoder.
+
+    burst_check.py PROGRAM [--jitter-us 0]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  Each case arms a burst, lets the simulated
+shaft run, dumps it, and checks the dump:
+
+  * the samples are evenly spaced at the requested period, to within
+    --jitter-us;
+  * there are as many as asked for, with the trigger at the pretrigger index;
+  * the trigger sample is the first one that meets the trigger, even after
+    the pretrigger ring has wrapped many times waiting for it;
+  * the counts follow the simulated shaft.
+
+Prints one line per case and exits with status 1 if any of them fail.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+CPR = 1200
+
+
+def run(program, directory, commands, seconds, rpm=None, trace=None):
+    script = os.path.join(directory, "script.txt")
+    with open(script, "w") as f:
+        for ms, command in commands:
+            f.write("%d %s\n" % (ms, command))
+    args = [program, "--seconds", str(seconds), "--cpr", str(CPR), "--tick", "20",
+            "--script", script]
+    if rpm is not None:
+        args += ["--rpm", str(rpm)]
+    if trace is not None:
+        path = os.path.join(directory, "shaft.trace")
+        with open(path, "w") as f:
+            for ms, count in trace:
+                f.write("%.3f %.3f\n" % (ms, count))
+        args += ["--trace", path]
+    out = subprocess.run(args, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                         check=True).stdout.decode(errors="replace")
+
+    header, samples = None, []
+    for line in out.splitlines():
+        fields = line.split()
+        if fields[:1] == ["U"] and len(fields) == 4:
+            header = tuple(int(x) for x in fields[1:])
+        elif fields[:1] == ["u"] and len(fields) == 3:
+            samples.append((int(fields[1]), int(fields[2])))
+    return header, samples
+
+
+def check(name, header, samples, length, period, pretrigger, jitter, trigger_ok, before_ok):
+    problems = []
+    if header is None:
+        problems.append("no dump header")
+    elif header != (length, period, pretrigger):
+        problems.append("header %s, wanted %s" % (header, (length, period, pretrigger)))
+    if len(samples) != length:
+        problems.append("%d samples, wanted %d" % (len(samples), length))
+    else:
+        gaps = [b[0] - a[0] for a, b in zip(samples, samples[1:])]
+        worst = max(abs(g - period) for g in gaps) if gaps else 0
+        if worst > jitter:
+            problems.append("period off by up to %d us" % worst)
+        if samples[pretrigger][0] != 0:
+            problems.append("trigger sample at index %d is %d us from the trigger" %
+                            (pretrigger, samples[pretrigger][0]))
+        if not trigger_ok(samples[pretrigger][1]):
+            problems.append("trigger sample count %d doesn't meet the trigger" % samples[pretrigger][1])
+        early = [c for _, c in samples[:pretrigger] if not before_ok(c)]
+        if early:
+            problems.append("%d pretrigger samples already met the trigger" % len(early))
+    print("%-28s %s" % (name, "ok" if not problems else "FAIL: " + "; ".join(problems)))
+    return not problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--jitter-us", type=int, default=0)
+    args = parser.parse_args()
+    jitter = args.jitter_us
+
+    results = []
+    with tempfile.TemporaryDirectory() as d:
+        #No trigger: starts straight away, 2 kHz.
+        header, samples = run(args.program, d, [(0, "A2000 500"), (400, "U")], 1, rpm=60)
+        ok = check("immediate 2kHz", header, samples, 500, 500, 0, jitter,
+                   lambda c: True, lambda c: True)
+        #At 60 RPM the count goes up by 1.2 every ms.
+        if ok:
+            moved = samples[-1][1] - samples[0][1]
+            expected = CPR * (samples[-1][0] - samples[0][0]) / 60e6 * 60
+            if abs(moved - expected) > 2:
+                print("%-28s FAIL: moved %d counts, wanted %.1f" % ("immediate counts", moved, expected))
+                ok = False
+        results.append(ok)
+
+        #Count trigger a good while after arming, so the 200 sample ring has
+        #wrapped a few times first.
+        header, samples = run(args.program, d, [(0, "A1000 300 1 3000 200"), (3000, "U")], 3.5,
+                              rpm=60)
+        results.append(check("count above, ring wrapped", header, samples, 300, 1000, 200, jitter,
+                             lambda c: c >= 3000, lambda c: c < 3000))
+
+        #Count below, turning backwards.
+        header, samples = run(args.program, d, [(0, "A5000 1000 2 -600 250"), (1200, "U")], 3,
+                              rpm=-60)
+        results.append(check("count below, 5kHz", header, samples, 1000, 200, 250, jitter,
+                             lambda c: c <= -600, lambda c: c > -600))
+
+        #RPM trigger: still for a second, then straight to 300 RPM.
+        trace = [(0, 0), (1000, 0), (2000, 300 * CPR / 60.0)]
+        header, samples = run(args.program, d, [(0, "A1000 400 3 200 100"), (2000, "U")], 2.5,
+                              trace=trace)
+        ok = check("rpm above", header, samples, 400, 1000, 100, jitter,
+                   lambda c: True, lambda c: True)
+        #Before the trigger the shaft should have been still until a second
+        #in, and the trigger should land once it is well past 200 RPM.
+        if ok and not all(c == 0 for _, c in samples[:40]):
+            print("%-28s FAIL: shaft moved in the early pretrigger" % "rpm above, still before")
+            ok = False
+        results.append(ok)
+
+        #Asking for more than fits is turned down.
+        header, samples = run(args.program, d, [(0, "A1000 100000"), (100, "U")], 0.2, rpm=60)
+        ok = header == (0, 0, 0) and not samples
+        print("%-28s %s" % ("too long rejected", "ok" if ok else "FAIL: dump %s" % (header,)))
+        results.append(ok)
+
+    return 0 if all(results) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+"""Check every channel gets its samples at the configured rate, for 1 to 4 channels.
+
+    channel_rate_sim.py PROGRAM [--interval 20] [--seconds 3]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  Channels 1 up are given pins ('C<ch> <a> <b>')
+until N are running, each with its own PPR ('P'), and the motion
+generator turns them all at 60 RPM ('T1 60'), so each one's count goes up
+by its PPR a second.  Each N runs once with binary frames and once with
+'M' lines, carrying the sample timestamp ('YT1') and sequence ('O0 1').
+One channel is the 'D' line or the single sample frame.
+
+For each run, over the seconds after the generator starts:
+
+  * every sample carries all N channels, and no sequence numbers are
+    missing;
+  * there are as many samples as the interval allows, give or take one,
+    so each channel gets its full rate;
+  * each channel's count keeps to its own PPR, to within a step of the
+    motion generator, so no channel's figures end up in another's place.
+
+The settings are saved ('W') before the figures start, as the simulated
+flash write holds the loop up.
+
+Prints one line per run and exits with status 1 if any of them fail.
+"""
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+from motion_profile_sim import SYNC, crc16, decode
+
+START_MS = 300
+TYPE_MULTI = 0x02
+MULTI_HEADER_SIZE = 9
+CHANNEL_SIZE = 12
+MAX_CHANNELS = 4
+#A different PPR on each channel, so their counts can't be mistaken.
+PPR = [1200, 1000, 800, 600]
+#The motion generator's default step, in us.
+STEP_US = 1000
+
+
+def decode_multi(out):
+    """(sequence, timestamp, {channel: count}) for each multi frame, and the
+    output with them cut out, for decode() to find the rest in."""
+    frames, rest = [], bytearray()
+    i = 0
+    while i < len(out):
+        if out[i] == SYNC and i + MULTI_HEADER_SIZE <= len(out) and out[i + 1] == TYPE_MULTI:
+            mask = out[i + 8]
+            length = MULTI_HEADER_SIZE + bin(mask).count("1") * CHANNEL_SIZE
+            if i + length + 2 <= len(out):
+                frame = out[i:i + length + 2]
+                if crc16(frame[1:length]) == struct.unpack_from("<H", frame, length)[0]:
+                    sequence, timestamp = struct.unpack_from("<HI", frame, 2)
+                    counts, at = {}, MULTI_HEADER_SIZE
+                    for ch in range(MAX_CHANNELS):
+                        if mask & (1 << ch):
+                            counts[ch] = struct.unpack_from("<q", frame, at)[0]
+                            at += CHANNEL_SIZE
+                    frames.append((sequence, timestamp, counts))
+                    i += length + 2
+                    continue
+        rest.append(out[i])
+        i += 1
+    return frames, bytes(rest)
+
+
+def parse_lines(lines):
+    """The same from 'D' and 'M' lines, with timestamp and sequence last."""
+    samples = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 6 and fields[0] == "D":
+            samples.append((int(fields[5]), int(fields[4]), {0: int(fields[2])}))
+        elif len(fields) >= 6 and fields[0] == "M" and (len(fields) - 3) % 4 == 0:
+            counts = {}
+            for at in range(1, len(fields) - 2, 4):
+                counts[int(fields[at])] = int(fields[at + 2])
+            samples.append((int(fields[-1]), int(fields[-2]), counts))
+    return samples
+
+
+def run(program, directory, channels, interval, seconds, binary):
+    script = os.path.join(directory, "script.txt")
+    with open(script, "w") as f:
+        f.write("50 L%d\n60 B%d\n70 YT1\n80 O0 1\n" % (interval, 1 if binary else 0))
+        at = 100
+        for ch in range(channels):
+            # Channel 0 is on its pins already.  'C<ch>' on its own just
+            # selects it for the 'P'.
+            if ch == 0:
+                f.write("%d C0\n" % at)
+            else:
+                f.write("%d C%d %d %d\n" % (at, ch, 2 * ch + 1, 2 * ch + 2))
+            f.write("%d P%d\n" % (at + 10, PPR[ch]))
+            at += 20
+        f.write("%d W\n%d T1 60\n" % (at, START_MS))
+    result = subprocess.run([program, "--seconds", str(seconds), "--script", script],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True,
+                            timeout=120)
+    multi, rest = decode_multi(result.stdout)
+    frames, lines = decode(rest)
+    if binary:
+        samples = [(f[0], f[1], {0: f[2]}) for f in frames] + multi
+        samples.sort(key=lambda s: s[1])
+    else:
+        samples = parse_lines(lines)
+    report = [l.split() for l in lines if l.startswith("T ")]
+    start_us = int(report[-1][6]) if report else None
+    return samples, start_us
+
+
+def check(program, directory, channels, interval, seconds, binary):
+    samples, start_us = run(program, directory, channels, interval, seconds, binary)
+    problems = []
+    label = "%d %-6s" % (channels, "binary" if binary else "lines")
+    if start_us is None:
+        return ["generator didn't start"], label
+
+    # From half a second in, to half a second before the end.
+    window_s = seconds - START_MS / 1000.0 - 1.0
+    since = lambda s: ((s[1] - start_us) & 0xFFFFFFFF) / 1e6
+    measured = [s for s in samples if 0.5 <= since(s) < 0.5 + window_s]
+
+    wanted = set(range(channels))
+    short = sum(1 for s in measured if set(s[2]) != wanted)
+    if short:
+        problems.append("%d samples without all %d channels" % (short, channels))
+    gaps = sum(1 for a, b in zip(measured, measured[1:]) if (b[0] - a[0]) & 0xFFFF != 1)
+    if gaps:
+        problems.append("%d sequence gaps" % gaps)
+
+    expected = window_s * 1000.0 / interval
+    if abs(len(measured) - expected) > 1:
+        problems.append("%d samples, expected %.0f" % (len(measured), expected))
+
+    worst = 0.0
+    for s in measured:
+        for ch, count in s[2].items():
+            if ch < channels:
+                error = abs(count - PPR[ch] * since(s)) / (PPR[ch] * STEP_US / 1e6 + 1)
+                worst = max(worst, error)
+    if worst > 1:
+        problems.append("a count is %.1f steps out" % worst)
+
+    return problems, "%s %7d %8.0f %8.1f" % (label, len(measured), expected,
+                                               len(measured) / window_s)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--interval", type=int, default=20, help="sample interval in ms")
+    parser.add_argument("--seconds", type=float, default=3)
+    args = parser.parse_args()
+
+    print("%s %-6s %7s %8s %8s" % ("n", "output", "samples", "expected", "per s"))
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for channels in range(1, MAX_CHANNELS + 1):
+            for binary in (True, False):
+                problems, line = check(args.program, directory, channels, args.interval,
+                                       args.seconds, binary)
+                print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+                ok = ok and not problems
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""Ping the board with 'Y', and put its clock on the PC's.
+
+    clock_sync.py PROGRAM [--pings 200] [--period-ms 25] [--drift-ppm 50]
+                  [--interval 10] [--rpm 60] [--bytes-per-s 11520]
+    clock_sync.py --port /dev/ttyACM0 [--baud 115200] [--pings 200] ...
+
+Each ping is 'Y<n>', and the board replies 'Y n rxUs txUs' with its own
+times for when the line came in and the reply went out.  With the PC's
+send and receive times either side, that is the four timestamps of an NTP
+exchange:
+
+    offset = ((rx - sent) + (tx - received)) / 2
+    delay  = (received - sent) - (tx - rx)
+
+The pings with the least delay have the least queueing in them, so the
+offset is fitted against time over the quicker half, a straight line whose
+slope is the drift between the two clocks.  The PC's times are moved on by
+the time the bytes themselves take on the link (--bytes-per-s), which the
+exchange would otherwise take as a one sided delay.
+
+Given PROGRAM, the native build (pio run -e native, then
+.pio/build/native/program), the pings are run through the simulator with
+samples streaming at --interval, and the PC's clock is made up from the
+simulated one, --drift-ppm fast and a long way off.  As the true mapping is
+known, it also reports how far out the fitted one puts the board's
+timestamps.  With --port it talks to a real board instead (needs pyserial).
+
+Reports round trip percentiles, the board's turnaround, the fitted offset
+and drift, and the fit's residuals.
+"""
+import argparse
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+HOST_BASE_US = 1000000000
+START_MS = 200
+
+
+def unwrap(values):
+    """The board's times are the low 32 bits of its clock."""
+    out, last, high = [], None, 0
+    for v in values:
+        if last is not None and v < last and last - v > 1 << 31:
+            high += 1 << 32
+        out.append(v + high)
+        last = v
+    return out
+
+
+def parse_reply(line):
+    fields = line.split()
+    if len(fields) != 4 or fields[0] != "Y":
+        return None
+    try:
+        return int(fields[1]), int(fields[2]), int(fields[3])
+    except ValueError:
+        return None
+
+
+def run_sim(args):
+    """Returns [(sentUs, rxUs, txUs, receivedUs, replyBytes)], and the true
+    board to PC mapping."""
+    rng = random.Random(1)
+    sends = []
+    with tempfile.TemporaryDirectory() as directory:
+        script = os.path.join(directory, "script.txt")
+        arrivals = os.path.join(directory, "arrivals.txt")
+        with open(script, "w") as f:
+            f.write("50 L%d\n" % args.interval)
+            for n in range(args.pings):
+                # A fraction of a ms on each, so they don't all land at the
+                # same point in the firmware's loop.
+                ms = START_MS + n * args.period_ms + rng.uniform(0, 1)
+                sends.append(ms)
+                f.write("%.3f Y%d\n" % (ms, n))
+        seconds = (START_MS + args.pings * args.period_ms) / 1000.0 + 0.5
+        subprocess.run([args.program, "--seconds", str(seconds), "--rpm", str(args.rpm),
+                        "--script", script, "--arrivals", arrivals],
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True,
+                       timeout=120)
+        received, start = {}, None
+        with open(arrivals, errors="replace") as f:
+            for line in f:
+                us, _, text = line.rstrip("\n").partition(" ")
+                if us == "#":
+                    start = int(text.split()[1])
+                    continue
+                reply = parse_reply(text)
+                if reply is not None:
+                    received[reply[0]] = (int(us), reply[1], reply[2], len(text) + 2)
+
+    rate = 1 + args.drift_ppm * 1e-6
+
+    def host(sim_us):
+        return (sim_us - start) * rate + HOST_BASE_US
+
+    exchanges = []
+    for n, ms in enumerate(sends):
+        if n in received:
+            arrived, rx, tx, size = received[n]
+            exchanges.append((host(start + ms * 1000), rx, tx, host(arrived), size))
+    return exchanges, host
+
+
+def run_port(args):
+    import serial
+
+    exchanges = []
+    with serial.Serial(args.port, args.baud, timeout=0.5) as port:
+        port.reset_input_buffer()
+        for n in range(args.pings):
+            command = ("Y%d\n" % n).encode()
+            sent = time.monotonic_ns() / 1000.0
+            port.write(command)
+            port.flush()
+            deadline = time.monotonic() + 1
+            while time.monotonic() < deadline:
+                line = port.readline()
+                received = time.monotonic_ns() / 1000.0
+                reply = parse_reply(line.decode(errors="replace").strip())
+                if reply is not None and reply[0] == n:
+                    # Sent once the command's last byte is on the wire.
+                    sent += len(command) * 1e6 / args.bytes_per_s
+                    exchanges.append((sent, reply[1], reply[2], received, len(line)))
+                    break
+            time.sleep(args.period_ms / 1000.0)
+    return exchanges, None
+
+
+def fit(points):
+    """Least squares line through (x, y)."""
+    n = len(points)
+    mx = sum(x for x, _ in points) / n
+    my = sum(y for _, y in points) / n
+    sxx = sum((x - mx) ** 2 for x, _ in points)
+    sxy = sum((x - mx) * (y - my) for x, y in points)
+    slope = sxy / sxx if sxx else 0.0
+    return my - slope * mx, slope
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(p / 100.0 * len(ordered)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program", nargs="?")
+    parser.add_argument("--port")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--pings", type=int, default=200)
+    parser.add_argument("--period-ms", type=float, default=25)
+    parser.add_argument("--drift-ppm", type=float, default=50)
+    parser.add_argument("--interval", type=int, default=10, help="sample interval in ms")
+    parser.add_argument("--rpm", type=float, default=60)
+    parser.add_argument("--bytes-per-s", type=float, default=None,
+                        help="link speed, baud / 10 if left off")
+    args = parser.parse_args()
+    if args.bytes_per_s is None:
+        args.bytes_per_s = args.baud / 10.0
+    if (args.program is None) == (args.port is None):
+        parser.error("give either PROGRAM or --port")
+
+    exchanges, truth = run_port(args) if args.port else run_sim(args)
+    if len(exchanges) < 4:
+        print("only %d replies" % len(exchanges))
+        return 1
+
+    rx = unwrap([e[1] for e in exchanges])
+    tx = unwrap([e[2] for e in exchanges])
+    rows = []
+    for (sent, _, _, received, size), r, t in zip(exchanges, rx, tx):
+        # The reply's own bytes take this long to come in after it starts.
+        arrived = received - size * 1e6 / args.bytes_per_s
+        offset = ((r - sent) + (t - arrived)) / 2.0
+        delay = (arrived - sent) - (t - r)
+        rows.append((sent, r, t, received - sent, t - r, offset, delay))
+
+    rtt = [row[3] for row in rows]
+    turnaround = [row[4] for row in rows]
+    print("%d of %d pings answered" % (len(rows), args.pings))
+    print("round trip us    p50 %8.0f  p90 %8.0f  p99 %8.0f  max %8.0f" %
+          (percentile(rtt, 50), percentile(rtt, 90), percentile(rtt, 99), max(rtt)))
+    print("turnaround us    p50 %8.0f  p90 %8.0f  p99 %8.0f  max %8.0f" %
+          (percentile(turnaround, 50), percentile(turnaround, 90), percentile(turnaround, 99),
+           max(turnaround)))
+
+    quick = sorted(rows, key=lambda row: row[6])[:max(2, len(rows) // 2)]
+    intercept, slope = fit([(row[0], row[5]) for row in quick])
+    residuals = [row[5] - (intercept + slope * row[0]) for row in quick]
+    rms = (sum(x * x for x in residuals) / len(residuals)) ** 0.5
+    print("offset us        %.1f at the first ping, drift %.2f ppm, fit residual rms %.1f us" %
+          (intercept + slope * rows[0][0], slope * 1e6, rms))
+
+    if truth is not None:
+        # Board time to PC time, from the fit: board = pc + intercept + slope * pc.
+        errors = [(b - intercept) / (1 + slope) - truth(b) for b in rx]
+        worst = max(abs(e) for e in errors)
+        mean = sum(errors) / len(errors)
+        print("true drift       %.2f ppm" % -args.drift_ppm)
+        print("alignment us     mean %.1f  worst %.1f" % (mean, worst))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
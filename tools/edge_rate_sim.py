@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Find the fastest edge rate edge capture keeps up with, and check bursts past the ring.
+
+    edge_rate_sim.py PROGRAM [--gaps 2000 5000 10000] [--seconds 3]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  Edge capture is turned on for channel 0
+('E0 1'), so the simulated PCNT interrupts on every edge and pushes it into
+the ring, which loop() empties on each pass.
+
+Steady shaft.  --tick sets the gap between passes of loop(), the longest
+the ring has to hold edges for.  For each gap, a binary search on the
+speed finds the fastest that loses nothing, to within 1%.  The gaps
+are long enough that twice that rate is still slower than the PCNT glitch
+filter lets through.  Each gap checks:
+
+  * the fastest rate is the ring's EDGE_CAPTURE_RING_SIZE edges over the
+    gap, to within 5%, so nothing but the ring is the limit;
+  * at every speed tried, the edges read plus the overflows counted ('E')
+    are the edges the shaft made, so each lost edge is counted.
+
+Bursts.  From stood still, the shaft jumps some edges in one pass of
+loop() (a --trace step, with passes BURST_TICK_US apart so the edges
+aren't too short for the filter), fewer than the ring holds, exactly that,
+and more.  Each burst checks the ring takes all it has room for and counts
+the rest as overflows.
+
+The settings are saved ('W') before the figures start, as the simulated
+flash write holds the loop up.
+
+Prints one line per gap and per burst, and exits with status 1 if any of
+them fail.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+#EDGE_CAPTURE_RING_SIZE in EdgeCapture.h.
+RING_SIZE = 256
+CPR = 1200
+#ms.  The figures start again at RESET_MS and are read at the end.
+RESET_MS = 500
+BURST_MS = 1000
+BURST_TICK_US = 20000
+BURSTS = [100, RING_SIZE, RING_SIZE + 1, 1000]
+
+
+def capture(program, directory, seconds, extra):
+    """Edges read and overflows, between RESET_MS and the end of the run."""
+    script = os.path.join(directory, "script.txt")
+    end_ms = int(seconds * 1000) - 100
+    with open(script, "w") as f:
+        f.write("50 L10\n60 E0 1\n70 W\n%d ER\n%d E\n" % (RESET_MS, end_ms))
+    result = subprocess.run([program, "--seconds", str(seconds), "--cpr", str(CPR),
+                             "--script", script] + extra,
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True,
+                            timeout=300)
+    lines = result.stdout.decode(errors="replace").splitlines()
+    # 'E ch mode edges overflows minUs maxUs'.
+    report = [l.split() for l in lines if l.startswith("E ")]
+    if not report:
+        return None, None, (end_ms - RESET_MS) / 1000.0
+    return int(report[-1][3]), int(report[-1][4]), (end_ms - RESET_MS) / 1000.0
+
+
+def steady(program, directory, gap_us, rate, seconds, problems):
+    """Overflows at a steady rate, checking every edge is accounted for."""
+    rpm = rate * 60.0 / CPR
+    edges, overflows, window = capture(program, directory, seconds,
+                                       ["--tick", str(gap_us), "--rpm", "%.3f" % rpm])
+    if edges is None:
+        problems.append("no E at %d/s" % rate)
+        return 0
+    made = rate * window
+    if abs(edges + overflows - made) > rate * gap_us / 1e6 + 1:
+        problems.append("%d/s: %d read + %d overflows, shaft made %.0f" %
+                        (rate, edges, overflows, made))
+    return overflows
+
+
+def check_gap(program, directory, gap_us, seconds):
+    problems = []
+    limit = RING_SIZE / (gap_us / 1e6)
+    low, high = int(limit / 2), int(limit * 2)
+    if steady(program, directory, gap_us, low, seconds, problems):
+        problems.append("overflows at %d/s" % low)
+    if not steady(program, directory, gap_us, high, seconds, problems):
+        problems.append("no overflows at %d/s" % high)
+    while high - low > low / 100:
+        middle = (low + high) // 2
+        if steady(program, directory, gap_us, middle, seconds, problems):
+            high = middle
+        else:
+            low = middle
+    if abs(low - limit) > limit * 0.05:
+        problems.append("keeps up to %d/s, ring allows %.0f/s" % (low, limit))
+    return problems, "gap %6d us  %8d edges/s  (ring over gap %8.0f)" % (gap_us, low, limit)
+
+
+def check_burst(program, directory, size, seconds):
+    problems = []
+    trace = os.path.join(directory, "trace.txt")
+    with open(trace, "w") as f:
+        # Stood still, then the whole burst inside one tick.
+        f.write("0 0\n%d 0\n%.3f %d\n" % (BURST_MS, BURST_MS + 0.01, size))
+    edges, overflows, _ = capture(program, directory, seconds,
+                                  ["--tick", str(BURST_TICK_US), "--trace", trace])
+    if edges is None:
+        return ["no E"], "burst %5d" % size
+    want = min(size, RING_SIZE)
+    if edges != want or overflows != size - want:
+        problems.append("expected %d read, %d overflows" % (want, size - want))
+    return problems, "burst %5d  %6d read  %6d overflows" % (size, edges, overflows)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--gaps", type=int, nargs="+", default=[2000, 5000, 10000],
+                        help="us between passes of loop()")
+    parser.add_argument("--seconds", type=float, default=3)
+    args = parser.parse_args()
+
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for gap_us in args.gaps:
+            problems, line = check_gap(args.program, directory, gap_us, args.seconds)
+            print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+            ok = ok and not problems
+        for size in BURSTS:
+            problems, line = check_burst(args.program, directory, size, args.seconds)
+            print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+            ok = ok and not problems
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Glitch filter (G) speed limit and calibration, on the simulated PCNT.
+
+    glitch_filter_sim.py PROGRAM [--filters 100 250 500 1023] [--cpr 1200]
+                         [--glitch-us 2] [--glitch-rate 200]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  The simulated PCNT drops any pulse on a pin
+shorter than its filter, as the real one does.
+
+First, for each filter setting, the firmware is asked ('G') what the
+fastest the shaft can go is, and the shaft is run at 90% and 110% of that
+then stopped.  Below the limit the count has to end up exactly where the
+shaft is, above it counts have to have been lost, or the limit is wrong.
+
+Then calibration ('GC') is run with spikes of --glitch-us on a pin, and its
+recommendation checked: it has to be longer than the spikes, and with it
+set, edge capture ('E') has to see the shaft's edges and none of the
+spikes.
+
+Exits with status 1 if anything is off.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+RUN_MS = 500
+STOP_MS = 300
+
+
+def simulate(program, directory, script_lines, seconds, extra):
+    script = os.path.join(directory, "script.txt")
+    with open(script, "w") as f:
+        f.write("".join("%d %s\n" % line for line in script_lines))
+    return subprocess.run([program, "--seconds", str(seconds), "--script", script] + extra,
+                          stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                          check=True).stdout.decode(errors="replace").splitlines()
+
+
+def last(lines, prefix, fields):
+    found = None
+    for line in lines:
+        f = line.split()
+        if f[:len(prefix)] == prefix and len(f) == fields:
+            found = f
+    return found
+
+
+def max_rpm(program, directory, filt, cpr):
+    out = simulate(program, directory, [(0, "G%d" % filt), (10, "G")], 0.1, ["--cpr", str(cpr)])
+    g = last(out, ["G"], 5)
+    return int(g[4]) if g else None
+
+
+def speed_run(program, directory, filt, rpm, cpr):
+    counts_per_ms = rpm * cpr / 60000.0
+    final = round(counts_per_ms * RUN_MS)
+    trace = os.path.join(directory, "shaft.trace")
+    with open(trace, "w") as f:
+        f.write("0 0\n%d %d\n%d %d\n" % (RUN_MS, final, RUN_MS + STOP_MS, final))
+    #The heartbeat gets a sample out once the shaft has stopped.  The long
+    #tick is so each step is plenty of counts, and the pulse width worked
+    #out from it doesn't jump about by a count in a few.
+    out = simulate(program, directory, [(0, "G%d" % filt), (0, "Q0 0 100")],
+                   (RUN_MS + STOP_MS) / 1000.0,
+                   ["--cpr", str(cpr), "--trace", trace, "--tick", "1000"])
+    d = last(out, ["D"], 4)
+    return (int(d[2]) if d else None), final
+
+
+def edges_seen(program, directory, filt, args, rpm):
+    out = simulate(program, directory, [(0, "G%d" % filt), (0, "E0 1"), (RUN_MS, "E")],
+                   RUN_MS / 1000.0 + 0.05,
+                   ["--cpr", str(args.cpr), "--rpm", str(rpm), "--tick", "5",
+                    "--glitch-rate", str(args.glitch_rate), "--glitch-us", str(args.glitch_us)])
+    e = last(out, ["E"], 7)
+    return int(e[3]) if e else None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--filters", type=int, nargs="+", default=[100, 250, 500, 1023])
+    parser.add_argument("--cpr", type=int, default=1200)
+    parser.add_argument("--glitch-us", type=float, default=2)
+    parser.add_argument("--glitch-rate", type=float, default=200)
+    args = parser.parse_args()
+
+    failed = False
+    with tempfile.TemporaryDirectory() as d:
+        print("%7s %9s %9s %10s %10s" % ("filter", "max rpm", "rpm", "count", "shaft"))
+        for filt in args.filters:
+            limit = max_rpm(args.program, d, filt, args.cpr)
+            if limit is None:
+                print("%7d  FAIL: no G reply" % filt)
+                failed = True
+                continue
+            for factor, should_track in ((0.9, True), (1.1, False)):
+                rpm = limit * factor
+                count, final = speed_run(args.program, d, filt, rpm, args.cpr)
+                bad = count is None or (count == final) != should_track
+                failed |= bad
+                print("%7d %9d %9.0f %10s %10d%s" % (filt, limit, rpm, count, final,
+                                                      "  FAIL" if bad else ""))
+
+        #Calibration, slow enough that each tick makes at most one count, so
+        #every edge has its own time.
+        rpm = 1000
+        out = simulate(args.program, d, [(0, "GC%d" % RUN_MS)], RUN_MS / 1000.0 + 0.1,
+                       ["--cpr", str(args.cpr), "--rpm", str(rpm), "--tick", "5",
+                        "--glitch-rate", str(args.glitch_rate), "--glitch-us", str(args.glitch_us)])
+        cal = last(out, ["G", "C"], 10)
+        print()
+        if cal is None:
+            print("calibration: FAIL, no result")
+            return 1
+        edges, min_us, glitches, max_glitch_us, rate, rec, rec_rpm, headroom = map(int, cal[2:])
+        print("calibration: %d edges, min %d us, %d glitches (%d/s) up to %d us, recommends %d (max %d RPM)%s" %
+              (edges, min_us, glitches, rate, max_glitch_us, rec, rec_rpm,
+               "" if headroom else ", no headroom"))
+        expected_glitches = args.glitch_rate * RUN_MS / 1000.0
+        if abs(glitches - expected_glitches) > 2 or rec * 12.5 <= args.glitch_us * 1000 or not headroom:
+            print("calibration: FAIL")
+            failed = True
+
+        unfiltered = edges_seen(args.program, d, 0, args, rpm)
+        filtered = edges_seen(args.program, d, rec, args, rpm)
+        shaft = round(rpm * args.cpr / 60000.0 * RUN_MS)
+        print("edges over %d ms: shaft %d, filter off %s, filter %d %s" %
+              (RUN_MS, shaft, unfiltered, rec, filtered))
+        if filtered is None or abs(filtered - shaft) > 1 or unfiltered is None or unfiltered <= shaft + 1:
+            print("edges: FAIL")
+            failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
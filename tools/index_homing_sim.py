@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Homing error off the index (Z) input at a range of shaft speeds.
+
+    index_homing_sim.py PROGRAM [--rpm 60 600 ...] [--latency-us 3]
+                        [--cpr 1200] [--pin 5]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  For each speed and homing mode the simulated
+shaft runs up to speed through the index a few times, then stops dead.  The
+count the firmware ends up with is compared with where the shaft really
+is, which is the homing error.  --latency-us is how long the index
+interrupt takes to read the count, the shaft carrying on meanwhile, so the
+expected error is speed times latency.
+
+Prints a line per run with the index hits, the spread of the per-index
+errors the firmware measured ('Z'), and the homing error in counts and
+degrees.  Exits with status 1 if any homing error is more than the latency
+allows, plus a count.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+RUN_MS = 1000
+STOP_MS = 400
+
+
+def run(program, directory, rpm, mode, args):
+    counts_per_ms = rpm * args.cpr / 60000.0
+    start = 1
+    final = start + round(counts_per_ms * RUN_MS)
+    trace = os.path.join(directory, "shaft.trace")
+    with open(trace, "w") as f:
+        f.write("0 %d\n%d %d\n%d %d\n" % (start, RUN_MS, final, RUN_MS + STOP_MS, final))
+    script = os.path.join(directory, "script.txt")
+    with open(script, "w") as f:
+        #The heartbeat gets a sample out once the shaft has stopped.
+        f.write("0 Z0 %d %d 0\n0 Q0 0 100\n%d Z\n" % (args.pin, mode, RUN_MS + STOP_MS - 50))
+
+    out = subprocess.run([program, "--seconds", str((RUN_MS + STOP_MS) / 1000.0),
+                          "--cpr", str(args.cpr), "--tick", "20", "--trace", trace,
+                          "--script", script, "--index", str(args.pin),
+                          "--index-latency", str(args.latency_us)],
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                         check=True).stdout.decode(errors="replace")
+
+    pos, z = None, None
+    for line in out.splitlines():
+        fields = line.split()
+        if fields[:1] == ["D"] and len(fields) == 4:
+            pos = int(fields[2])
+        elif fields[:1] == ["Z"] and len(fields) == 11:
+            z = [int(x) for x in fields[1:]]
+    if pos is None or z is None:
+        return None
+
+    #Home is count 0 at shaft count 0, so once homed the count should match
+    #the shaft to within whole revs.
+    error = (pos - final) % args.cpr
+    if error > args.cpr // 2:
+        error -= args.cpr
+    return {"hits": z[4], "homed": z[5], "min": z[7], "max": z[8], "error": error}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--rpm", type=float, nargs="+", default=[60, 600, 3000, 6000, 12000])
+    parser.add_argument("--latency-us", type=float, default=3)
+    parser.add_argument("--cpr", type=int, default=1200)
+    parser.add_argument("--pin", type=int, default=5)
+    args = parser.parse_args()
+
+    failed = False
+    print("%8s %5s %5s %12s %7s %9s %9s" % ("rpm", "mode", "hits", "index err", "allowed",
+                                            "home err", "deg"))
+    with tempfile.TemporaryDirectory() as d:
+        for rpm in args.rpm:
+            allowed = rpm * args.cpr / 60e6 * args.latency_us + 1
+            for mode in (1, 2):
+                r = run(args.program, d, rpm, mode, args)
+                if r is None or not r["homed"]:
+                    print("%8.0f %5d  FAIL: never homed" % (rpm, mode))
+                    failed = True
+                    continue
+                bad = abs(r["error"]) > allowed
+                failed |= bad
+                print("%8.0f %5d %5d %5d..%-5d %7.1f %9d %9.3f%s" %
+                      (rpm, mode, r["hits"], r["min"], r["max"], allowed, r["error"],
+                       r["error"] * 360.0 / args.cpr, "  FAIL" if bad else ""))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
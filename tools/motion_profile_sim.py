@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Check the 'T' motion profiles end to end, through the binary frames.
+
+    motion_profile_sim.py PROGRAM [--interval 10] [--seconds 3] [--cpr 1200]
+                          [--profile "T..."]... [--no-pcnt]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  The simulated shaft is left still, so the only
+motion is the generator's.  Each profile is run with binary frames ('B1')
+at the given sample interval, and the frames are decoded and checked:
+
+  * every frame's CRC is good and the sequence numbers have no gaps;
+  * each frame's count is where the profile had the shaft at the frame's
+    timestamp, to within what the shaft covers in one generator step, plus
+    the jitter asked for;
+  * for the wrap profile (type 5), the PCNT unit wrapped as often as asked,
+    unless --no-pcnt says PROGRAM was built with another encoder backend.
+
+It also prints how many frames and bytes a second got through, so with a
+short --interval it shows what the link carries.  Runs are on simulated
+time, so the same arguments always give the same figures.  The UART build
+takes about 2 ms a frame at 115200 baud, so for --interval 1 use the
+native_usb build, or the sampler outruns the link and the output ring drops
+frames, which show up as sequence gaps.
+
+Prints one line per profile and exits with status 1 if any of them fail.
+"""
+import argparse
+import math
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+SYNC = 0xA5
+TYPE_SAMPLE = 0x01
+SAMPLE_FRAME_SIZE = 22
+WRAP_COUNTS = 32766
+START_MS = 200
+
+DEFAULT_PROFILES = [
+    "T1 600",
+    "T2 600 400",
+    "T3 300 500",
+    "T4 600 250",
+    "T1 60 0 3",
+    "T3 120 300 2 250",
+    "T5 20",
+]
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def profile_counts(kind, speed, period_ms, cpr, seconds):
+    """Same as MotionCounts() in MotionProfile.cpp."""
+    v = speed * WRAP_COUNTS if kind == 5 else speed * cpr / 60.0
+    period = period_ms / 1000.0
+    if kind in (1, 5):
+        return v * seconds
+    if kind == 2:
+        cycles = math.floor(seconds / (2 * period))
+        t = seconds - cycles * 2 * period
+        counts = cycles * v * period
+        if t < period:
+            return counts + v * t * t / (2 * period)
+        t -= period
+        return counts + v * period / 2 + v * t - v * t * t / (2 * period)
+    if kind == 3:
+        return v * period / (2 * math.pi) * (1 - math.cos(2 * math.pi * seconds / period))
+    if kind == 4:
+        t = math.fmod(seconds, 2 * period)
+        return v * t if t < period else v * (2 * period - t)
+    return 0
+
+
+def decode(out):
+    """Split the output into sample frames and text lines."""
+    frames, lines, text = [], [], bytearray()
+    i = 0
+    while i < len(out):
+        if out[i] == SYNC and i + SAMPLE_FRAME_SIZE <= len(out) and out[i + 1] == TYPE_SAMPLE:
+            frame = out[i:i + SAMPLE_FRAME_SIZE]
+            if crc16(frame[1:20]) == struct.unpack_from("<H", frame, 20)[0]:
+                frames.append(struct.unpack_from("<HIqi", frame, 2))
+                i += SAMPLE_FRAME_SIZE
+                continue
+        if out[i] == ord("\n"):
+            lines.append(text.decode(errors="replace").strip())
+            text = bytearray()
+        else:
+            text.append(out[i])
+        i += 1
+    return frames, lines
+
+
+def run(program, directory, profile, interval, seconds, cpr):
+    script = os.path.join(directory, "script.txt")
+    with open(script, "w") as f:
+        f.write("50 L%d\n100 B1\n%d %s\n" % (interval, START_MS, profile))
+    result = subprocess.run([program, "--seconds", str(seconds), "--cpr", str(cpr),
+                             "--script", script],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True,
+                            timeout=120)
+    return decode(result.stdout) + (result.stderr.decode(errors="replace"),)
+
+
+def check(program, directory, profile, interval, seconds, cpr, pcnt):
+    frames, lines, summary = run(program, directory, profile, interval, seconds, cpr)
+    fields = [int(x) for x in profile[1:].split()]
+    kind, speed = fields[0], fields[1]
+    period_ms = fields[2] if len(fields) > 2 else 0
+    jitter = fields[3] if len(fields) > 3 else 0
+    step_us = fields[4] if len(fields) > 4 else 1000
+
+    problems = []
+    report = [l.split() for l in lines if l.startswith("T ")]
+    if not report or int(report[-1][1]) != kind:
+        problems.append("generator didn't start")
+        start_us = 0
+    else:
+        start_us = int(report[-1][6])
+
+    gaps = sum(1 for a, b in zip(frames, frames[1:]) if (b[0] - a[0]) & 0xFFFF != 1)
+    if gaps:
+        problems.append("%d sequence gaps" % gaps)
+
+    v = speed * WRAP_COUNTS if kind == 5 else speed * cpr / 60.0
+    bound = abs(v) * step_us / 1e6 + jitter + 1
+    worst, checked = 0.0, 0
+    for _, timestamp, count, _ in frames:
+        since = ((timestamp - start_us) & 0xFFFFFFFF) / 1e6
+        if since > seconds:
+            continue
+        worst = max(worst, abs(count - profile_counts(kind, speed, period_ms, cpr, since)))
+        checked += 1
+    if checked == 0:
+        problems.append("no frames")
+    elif worst > bound:
+        problems.append("count off by up to %.1f, allowed %.1f" % (worst, bound))
+
+    match = re.search(r"Simulated ([\d.]+) s, (\d+) bytes sent, (\d+) PCNT interrupts", summary)
+    wraps = int(match.group(3)) if match else 0
+    if kind == 5 and pcnt:
+        expected = speed * (seconds - START_MS / 1000.0)
+        if abs(wraps - expected) > 1:
+            problems.append("%d wraps, wanted %.0f" % (wraps, expected))
+
+    frame_rate = len(frames) / seconds
+    byte_rate = int(match.group(2)) / seconds if match else 0
+    print("%-20s %7d %9.0f %9.0f %8.1f %7.1f %6d  %s" %
+          (profile, len(frames), frame_rate, byte_rate, worst, bound, wraps,
+           "ok" if not problems else "FAIL: " + "; ".join(problems)))
+    return not problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--profile", action="append", default=[])
+    parser.add_argument("--interval", type=int, default=10, help="sample interval in ms")
+    parser.add_argument("--seconds", type=float, default=3)
+    parser.add_argument("--cpr", type=int, default=1200)
+    parser.add_argument("--no-pcnt", action="store_true",
+                        help="PROGRAM was built with ENCODER_BACKEND 1 or 2")
+    args = parser.parse_args()
+
+    print("%-20s %7s %9s %9s %8s %7s %6s" %
+          ("profile", "frames", "frames/s", "bytes/s", "max err", "allowed", "wraps"))
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for profile in args.profile or DEFAULT_PROFILES:
+            ok = check(args.program, directory, profile, args.interval, args.seconds,
+                       args.cpr, not args.no_pcnt) and ok
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""Check a stalled PC can't hold the sampling up, through the output ring.
+
+    output_stall_sim.py PROGRAM [--interval 10] [--seconds 3]
+                        [--stall-at 1000] [--stall-ms 500]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  The PC stops reading the serial port for
+--stall-ms (the simulator's --stall), long enough for the samples to fill
+the output ring, once for each of the ring's policies ('O'), with binary
+frames and again with sequenced 'D' lines.  Then once with no stall, which
+should lose nothing, and once at a 1 ms interval, which the UART can't keep
+up with at all and used to block on for good.
+
+For each run:
+
+  * 'J' has the sample timer on time with no overruns;
+  * 'XC' has no pass of loop() as long as a sample interval (loop_us, and
+    no loop_overruns), and no sample_drops from the sampler's own queue;
+  * the gaps in the sequence numbers add up to the samples the ring says
+    it dropped ('O'), so the PC can account for every one;
+  * a stall drops some, and each policy drops the ones it should: the
+    newest keeps the start of the stall, the others the end of it.
+
+The runs start and end at a long interval, so the ring is empty when its
+figures start and has emptied again by the final 'O', and the settings are
+saved ('W') before the figures start, as the simulated flash write takes
+longer than a short interval.
+
+Prints one line per run and exits with status 1 if any of them fail.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+from motion_profile_sim import decode
+
+START_MS = 200
+POLICIES = {0: "oldest", 1: "newest", 2: "coalesce"}
+#OUTPUT_RECORD_SLOTS in OutputRing.h.
+RECORD_SLOTS = 16
+#ms, slow enough for the UART to keep up with, at the start and end of a
+#run.
+SETTLE_INTERVAL = 100
+
+
+def run(program, directory, interval, seconds, policy, binary, stall):
+    script = os.path.join(directory, "script.txt")
+    arrivals = os.path.join(directory, "arrivals.txt")
+    end_ms = seconds * 1000
+    with open(script, "w") as f:
+        # Slow, so the ring is empty when its figures start, then the
+        # settings go to flash now rather than in the middle of it all.
+        f.write("50 L%d\n100 B%d\n150 O%d 1\n" % (SETTLE_INTERVAL, 1 if binary else 0, policy))
+        f.write("180 OR\n185 L%d\n190 W\n%d XR\n%d JR\n" % (interval, START_MS, START_MS))
+        # The motion generator turns the shaft, whatever the encoder backend.
+        f.write("%d T1 60\n" % START_MS)
+        # Well after the stall, so the replies don't wait behind it.  Then
+        # slow enough that the ring empties and stops dropping, so its
+        # count can be set against the gaps.
+        f.write("%d J\n%d XC\n" % (end_ms - 400, end_ms - 390))
+        f.write("%d L%d\n%d O\n" % (end_ms - 350, SETTLE_INTERVAL, end_ms - 40))
+    args = [program, "--seconds", str(seconds), "--script", script, "--arrivals", arrivals]
+    if stall:
+        args += ["--stall", str(stall[0]), str(stall[1])]
+    result = subprocess.run(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True,
+                            timeout=120)
+    start_us = 0
+    with open(arrivals, errors="replace") as f:
+        for line in f:
+            if line.startswith("# start"):
+                start_us = int(line.split()[2])
+    frames, lines = decode(result.stdout)
+    return frames, lines, start_us
+
+
+def samples(frames, lines, binary, start_us):
+    """(sequence, ms from the start) of every sample that got through."""
+    if binary:
+        return [(f[0], ((f[1] - start_us) & 0xFFFFFFFF) / 1000.0) for f in frames]
+    got = []
+    for line in lines:
+        fields = line.split()
+        # 'D ang pos rpm seq', sequenced but with no timestamp.
+        if len(fields) == 5 and fields[0] == "D":
+            got.append((int(fields[4]), None))
+    return got
+
+
+def check(program, directory, interval, seconds, policy, binary, stall):
+    frames, lines, start_us = run(program, directory, interval, seconds, policy, binary, stall)
+    problems = []
+
+    jitter = [l.split() for l in lines if l.startswith("J ")]
+    if not jitter:
+        problems.append("no J")
+    else:
+        nominal, low, high, _, periods, overruns = (int(x) for x in jitter[-1][1:7])
+        if overruns or high - low > nominal / 10 or periods == 0:
+            problems.append("timer %d..%d us, %d overruns" % (low, high, overruns))
+
+    metrics = [l.split() for l in lines if l.startswith("X C ")]
+    longest = -1
+    if not metrics:
+        problems.append("no XC")
+    else:
+        # 'X C ms', loop_us count min mean max, loop_overruns, sample_drops.
+        longest = int(metrics[-1][6])
+        overruns, drops = int(metrics[-1][7]), int(metrics[-1][8])
+        if longest >= interval * 1000:
+            problems.append("loop took %d us" % longest)
+        if overruns or drops:
+            problems.append("%d loop overruns, %d sample drops" % (overruns, drops))
+
+    report = [l.split() for l in lines if l.startswith("O ")]
+    dropped = int(report[-1][4]) if report else -1
+    got = samples(frames, lines, binary, start_us)
+    gaps = [(a, b) for a, b in zip(got, got[1:]) if (b[0] - a[0]) & 0xFFFF != 1]
+    missing = sum(((b[0] - a[0]) & 0xFFFF) - 1 for a, b in gaps)
+    if not report:
+        problems.append("no O")
+    elif missing != dropped:
+        problems.append("%d missing, ring dropped %d" % (missing, dropped))
+    if len(got) < 2:
+        problems.append("no samples")
+
+    if stall and dropped <= 0:
+        problems.append("stall dropped nothing")
+    if not stall and interval >= 10 and dropped != 0:
+        problems.append("dropped %d unstalled" % dropped)
+
+    # Which end of the stall the ring kept.  Dropping the newest, the first
+    # gap only starts once the ring is full of the start of the stall.
+    # Otherwise what follows the last gap is from the end of the stall.
+    if stall and binary and gaps:
+        stall_from, stall_to = stall[0], stall[0] + stall[1]
+        span = (RECORD_SLOTS - 1) * interval
+        if policy == 1 and gaps[0][0][1] < stall_from + span:
+            problems.append("gap from %.0f ms, start of the stall not kept" % gaps[0][0][1])
+        if policy != 1 and gaps[-1][1][1] < stall_to - span:
+            problems.append("gap to %.0f ms, end of the stall not kept" % gaps[-1][1][1])
+
+    sent = len(got) + max(dropped, 0)
+    return problems, "%-9s %-6s %-8s %6d %7d %7d %5d %7d" % (
+        POLICIES[policy], "binary" if binary else "lines",
+        "%d ms" % stall[1] if stall else "none", interval, sent, dropped, len(gaps), longest)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--interval", type=int, default=10, help="sample interval in ms")
+    parser.add_argument("--seconds", type=float, default=3)
+    parser.add_argument("--stall-at", type=float, default=1000, help="ms from the start")
+    parser.add_argument("--stall-ms", type=float, default=500)
+    args = parser.parse_args()
+
+    stall = (args.stall_at, args.stall_ms)
+    runs = [(p, True, stall) for p in POLICIES] + [(p, False, stall) for p in POLICIES]
+    runs.append((0, True, None))
+    print("%-9s %-6s %-8s %6s %7s %7s %5s %7s" %
+          ("policy", "output", "stall", "ms", "samples", "dropped", "gaps", "loop us"))
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for policy, binary, window in runs:
+            problems, line = check(args.program, directory, args.interval, args.seconds,
+                                   policy, binary, window)
+            print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+            ok = ok and not problems
+
+        # Faster than the UART carries frames.  The ring drops what it
+        # can't send, rather than the loop waiting on the port.
+        problems, line = check(args.program, directory, 1, args.seconds, 0, True, None)
+        print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+        ok = ok and not problems
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Check polled counting ('H') keeps every count, against the wrap interrupts.
+
+    polled_count_sim.py PROGRAM [--max-rpm 16000] [--cpr 1200] [--seconds 3]
+                        [--interval 10]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program), with the PCNT backend.  The shaft is turned by
+the motion generator (see motion_profile_sim.py) at up to --max-rpm, the
+speed the channel is told to poll for, and each profile is run in three
+ways:
+
+  * interrupts, the wrap interrupts on as they always were ('H0');
+  * polled, 'H1 max-rpm' before the shaft starts;
+  * switched, starting on the interrupts, polled from a third of the way
+    in and back on the interrupts at two thirds, which exercises the hand
+    over both ways with the counter part way round.
+
+Every binary frame's count has to be where the profile had the shaft at
+the frame's timestamp, to within one generator step, with no sequence
+gaps.  For each run it prints the PCNT interrupts a second, and for the
+polled ones the polls a second, the longest gap between polls and any that
+came late (see PollStats).
+
+Last, a run well past what the poll rate was worked out for, which should
+lose counts, to show the check can see it.  Exits with status 1 if any run
+but that one fails, or it doesn't.
+"""
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+from motion_profile_sim import decode, profile_counts, START_MS
+
+#POLL_MARGIN in CountPoller.h.  Going this much over the top speed still
+#polls in time, so the over speed run goes well past it.
+POLL_MARGIN = 4
+OVER_SPEED = 2 * POLL_MARGIN
+
+
+def run(program, directory, profile, mode, max_rpm, interval, seconds, cpr):
+    script = os.path.join(directory, "script.txt")
+    third = START_MS + (seconds * 1000 - START_MS) / 3
+    with open(script, "w") as f:
+        f.write("50 L%d\n100 B1\n" % interval)
+        f.write("150 H%d %d\n" % (1 if mode == "polled" else 0, max_rpm))
+        f.write("%d %s\n" % (START_MS, profile))
+        if mode == "switched":
+            f.write("%.3f H1 %d\n%.3f H0\n" % (third, max_rpm, 2 * third))
+        f.write("%.3f H\n" % (seconds * 1000 - 5))
+    result = subprocess.run([program, "--seconds", str(seconds), "--cpr", str(cpr),
+                             "--script", script],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True,
+                            timeout=120)
+    return decode(result.stdout) + (result.stderr.decode(errors="replace"),)
+
+
+def check(program, directory, profile, mode, max_rpm, interval, seconds, cpr):
+    frames, lines, summary = run(program, directory, profile, mode, max_rpm, interval,
+                                 seconds, cpr)
+    fields = [int(x) for x in profile[1:].split()]
+    kind, speed = fields[0], fields[1]
+    period_ms = fields[2] if len(fields) > 2 else 0
+
+    problems = []
+    report = [l.split() for l in lines if l.startswith("T ")]
+    start_us = int(report[-1][6]) if report else 0
+    if not report:
+        problems.append("generator didn't start")
+
+    gaps = sum(1 for a, b in zip(frames, frames[1:]) if (b[0] - a[0]) & 0xFFFF != 1)
+    if gaps:
+        problems.append("%d sequence gaps" % gaps)
+
+    # One 1 ms generator step, as motion_profile_sim.py allows.
+    bound = abs(speed) * cpr / 60.0 * 1e-3 + 1
+    worst, checked = 0.0, 0
+    for _, timestamp, count, _ in frames:
+        since = ((timestamp - start_us) & 0xFFFFFFFF) / 1e6
+        if since > seconds:
+            continue
+        worst = max(worst, abs(count - profile_counts(kind, speed, period_ms, cpr, since)))
+        checked += 1
+    if checked == 0:
+        problems.append("no frames")
+    elif worst > bound:
+        problems.append("count off by up to %.0f" % worst)
+
+    poll = [l.split() for l in lines if l.startswith("H ")]
+    polled = int(poll[-1][2]) if poll else 0
+    if mode == "polled" and not polled:
+        problems.append("not polled")
+    polls, max_gap, late = (int(x) for x in poll[-1][5:8]) if poll else (0, 0, 0)
+    if late:
+        problems.append("%d late polls" % late)
+
+    match = re.search(r"Simulated ([\d.]+) s, (\d+) bytes sent, (\d+) PCNT interrupts", summary)
+    interrupts = int(match.group(3)) if match else 0
+    run_s = seconds - START_MS / 1000.0
+    return problems, "%-18s %-10s %7d %8.0f %8.0f %9.0f %8d %5d" % (
+        profile, mode, len(frames), worst, interrupts / run_s,
+        polls / run_s if mode != "interrupts" else 0, max_gap, late)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--max-rpm", type=int, default=16000,
+                        help="what the channel polls for, the glitch filter's limit at 1200 PPR")
+    parser.add_argument("--cpr", type=int, default=1200)
+    parser.add_argument("--seconds", type=float, default=3)
+    parser.add_argument("--interval", type=int, default=10, help="sample interval in ms")
+    args = parser.parse_args()
+
+    top = args.max_rpm
+    profiles = ["T1 %d" % top, "T1 %d" % -top, "T4 %d 250" % top, "T3 %d 500" % top]
+    print("%-18s %-10s %7s %8s %8s %9s %8s %5s" %
+          ("profile", "mode", "frames", "max err", "intr/s", "polls/s", "gap us", "late"))
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for profile in profiles:
+            for mode in ("interrupts", "polled", "switched"):
+                problems, line = check(args.program, directory, profile, mode, top,
+                                       args.interval, args.seconds, args.cpr)
+                print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+                ok = ok and not problems
+
+        # Past the speed it was set up for, the counter gets more than half
+        # way round between polls, and counts go missing.
+        profile = "T1 %d" % (top * OVER_SPEED)
+        problems, line = check(args.program, directory, profile, "polled", top,
+                               args.interval, args.seconds, args.cpr)
+        lost = any(p.startswith("count off") for p in problems)
+        print(line + "  " + ("lost counts, as it should" if lost else "FAIL: kept count"))
+        ok = ok and lost
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
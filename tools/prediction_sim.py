@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""How well the 'V' prediction keeps up with the shaft, against latency.
+
+    prediction_sim.py PROGRAM [--lead US]... [--profile "T..."]...
+                      [--interval 10] [--seconds 4] [--gains "A B G"]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  The shaft is turned by the motion generator
+(see motion_profile_sim.py) through ramps and oscillations, and the binary
+frames are compared with where the profile really had it:
+
+  * as sampled ('V0'), the count is taken as the angle lead us after the
+    sample, which is what a PC that just adds its own latency sees;
+  * predicted ('V1 lead'), the frame's count is compared with the profile
+    at the frame's timestamp, which is the moment it was predicted for.
+
+For each profile and lead it prints the RMS and worst angle error of both,
+in degrees, and the RMS RPM error.  Runs are on simulated time, so the
+same arguments always give the same figures.
+"""
+import argparse
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+from motion_profile_sim import decode, profile_counts, START_MS
+
+DEFAULT_LEADS = [0, 5000, 10000, 20000, 50000]
+DEFAULT_PROFILES = [
+    "T1 300",
+    "T2 600 500",
+    "T3 300 1000",
+    "T3 600 400",
+    "T4 300 500",
+]
+#Let the estimator settle on the profile before it's judged, for this
+#long or this many samples, whichever is longer.
+SETTLE_S = 0.2
+SETTLE_SAMPLES = 20
+
+
+def run(program, directory, profile, interval, seconds, cpr, predict, lead, gains):
+    script = os.path.join(directory, "script.txt")
+    with open(script, "w") as f:
+        f.write("50 L%d\n100 B1\n" % interval)
+        f.write("150 V%d %d %s\n" % (1 if predict else 0, lead, gains))
+        f.write("%d %s\n" % (START_MS, profile))
+    out = subprocess.run([program, "--seconds", str(seconds), "--cpr", str(cpr),
+                          "--script", script],
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, check=True,
+                         timeout=120).stdout
+    return decode(out)
+
+
+def errors(frames, lines, profile, cpr, seconds, shift_us, settle):
+    fields = [int(x) for x in profile[1:].split()]
+    kind, speed = fields[0], fields[1]
+    period_ms = fields[2] if len(fields) > 2 else 0
+    report = [l.split() for l in lines if l.startswith("T ")]
+    if not report:
+        return None
+    start_us = int(report[-1][6])
+
+    angle, rpm = [], []
+    for _, timestamp, count, rpm_milli in frames:
+        since = (((timestamp - start_us) & 0xFFFFFFFF) + shift_us) / 1e6
+        if since < settle or since > seconds:
+            continue
+        true = profile_counts(kind, speed, period_ms, cpr, since)
+        # Speed by a small central difference, near enough for the check.
+        h = 1e-4
+        true_rpm = (profile_counts(kind, speed, period_ms, cpr, since + h) -
+                    profile_counts(kind, speed, period_ms, cpr, max(since - h, 0))) / \
+                   (since + h - max(since - h, 0)) * 60.0 / cpr
+        angle.append((count - true) * 360.0 / cpr)
+        rpm.append(rpm_milli / 1000.0 - true_rpm)
+    if not angle:
+        return None
+    rms = lambda xs: math.sqrt(sum(x * x for x in xs) / len(xs))
+    return rms(angle), max(abs(x) for x in angle), rms(rpm)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--lead", type=int, action="append", default=[])
+    parser.add_argument("--profile", action="append", default=[])
+    parser.add_argument("--interval", type=int, default=10, help="sample interval in ms")
+    parser.add_argument("--seconds", type=float, default=4)
+    parser.add_argument("--cpr", type=int, default=1200)
+    parser.add_argument("--gains", default="", help='"alpha beta gamma" in thousandths')
+    args = parser.parse_args()
+
+    print("%-14s %7s | %-26s | %-26s" % ("", "", "as sampled", "predicted"))
+    print("%-14s %7s | %8s %8s %8s | %8s %8s %8s" %
+          ("profile", "lead us", "rms deg", "max deg", "rms rpm", "rms deg", "max deg", "rms rpm"))
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for profile in args.profile or DEFAULT_PROFILES:
+            for lead in args.lead or DEFAULT_LEADS:
+                results = []
+                for predict in (False, True):
+                    frames, lines = run(args.program, directory, profile, args.interval,
+                                        args.seconds, args.cpr, predict, lead, args.gains)
+                    results.append(errors(frames, lines, profile, args.cpr, args.seconds,
+                                          0 if predict else lead,
+                                          max(SETTLE_S, SETTLE_SAMPLES * args.interval / 1000.0)))
+                if None in results:
+                    print("%-14s %7d | no frames" % (profile, lead))
+                    ok = False
+                    continue
+                print("%-14s %7d | %8.3f %8.3f %8.2f | %8.3f %8.3f %8.2f" %
+                      ((profile, lead) + results[0] + results[1]))
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
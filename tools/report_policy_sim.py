@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""Bytes sent for shaft motion traces under different report policies.
+
+    report_policy_sim.py PROGRAM [--trace FILE]... [--policy "Q..."]...
+                         [--interval 10] [--cpr 1200]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  Each trace is played back through the simulated
+encoder once per policy, with the sample interval set by 'L' and the policy
+by the given 'Q' command, and the D lines that come out are counted.  With no
+--trace a few made up traces are used (a dithering idle shaft, a slow crawl
+and a start-run-stop cycle), and with no --policy a handful of typical ones.
+
+A trace file is "<ms> <count>" lines, the same as the simulator's --trace.
+"""
+import argparse
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+DEFAULT_POLICIES = [
+    "Q0 0 0 0 1",
+    "Q1 0 0 0 1",
+    "Q1 0 1000 0 1",
+    "Q0 100 1000 0 1",
+    "Q1 0 1000 30 5",
+]
+
+
+def dither_trace(seconds, seed=1):
+    """Still shaft sat on an edge, flicking between two counts."""
+    rng = random.Random(seed)
+    points, t, count = [(0, 0)], 0.0, 0
+    while t < seconds * 1000:
+        t += rng.uniform(20, 300)
+        count = 1 - count
+        points += [(t, 1 - count), (t + 0.01, count)]
+    return points
+
+
+def crawl_trace(seconds, rpm=2, cpr=1200):
+    return [(0, 0), (seconds * 1000, rpm * cpr * seconds / 60.0)]
+
+
+def start_stop_trace(seconds, rpm=600, cpr=1200):
+    """Quarter still, quarter spinning up, quarter at speed, quarter stopping."""
+    quarter = seconds * 1000 / 4.0
+    counts_per_ms = rpm * cpr / 60000.0
+    ramp = counts_per_ms * quarter / 2
+    return [(0, 0), (quarter, 0), (2 * quarter, ramp),
+            (3 * quarter, ramp + counts_per_ms * quarter),
+            (4 * quarter, 2 * ramp + counts_per_ms * quarter)]
+
+
+def write_points(points, directory, name):
+    path = os.path.join(directory, name + ".trace")
+    with open(path, "w") as f:
+        for ms, count in points:
+            f.write("%.3f %.3f\n" % (ms, count))
+    return path
+
+
+def run(program, trace, policy, interval, cpr, seconds, directory):
+    script = os.path.join(directory, "script.txt")
+    with open(script, "w") as f:
+        f.write("0 L%d\n0 %s\n" % (interval, policy))
+    out = subprocess.run([program, "--seconds", str(seconds), "--cpr", str(cpr),
+                          "--trace", trace, "--script", script],
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, check=True).stdout
+    lines = [l for l in out.split(b"\n") if l.startswith(b"D ")]
+    return len(lines), sum(len(l) + 2 for l in lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--trace", action="append", default=[])
+    parser.add_argument("--policy", action="append", default=[])
+    parser.add_argument("--interval", type=int, default=10, help="sample interval in ms")
+    parser.add_argument("--cpr", type=int, default=1200)
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    policies = args.policy or DEFAULT_POLICIES
+    with tempfile.TemporaryDirectory() as directory:
+        traces = [(os.path.basename(t), t) for t in args.trace]
+        if not traces:
+            traces = [
+                ("dither", write_points(dither_trace(args.seconds), directory, "dither")),
+                ("crawl", write_points(crawl_trace(args.seconds, cpr=args.cpr), directory, "crawl")),
+                ("start_stop", write_points(start_stop_trace(args.seconds, cpr=args.cpr),
+                                            directory, "start_stop")),
+            ]
+
+        print("%-12s %-18s %8s %9s %7s" % ("trace", "policy", "lines", "bytes", "of 1st"))
+        for name, path in traces:
+            baseline = None
+            for policy in policies:
+                lines, sent = run(args.program, path, policy, args.interval, args.cpr,
+                                  args.seconds, directory)
+                if baseline is None:
+                    baseline = sent
+                share = "%6.1f%%" % (100.0 * sent / baseline) if baseline else "     -"
+                print("%-12s %-18s %8d %9d %7s" % (name, policy, lines, sent, share))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Check 'R' never makes the RPM jump, even with samples queued from before it.
+
+    reset_rpm_sim.py PROGRAM [--rpm 300] [--seconds 10]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  The simulated shaft turns at a steady --rpm
+and is sampled every INTERVAL_MS, and the count is set to a different
+angle with 'R' every RESET_EVERY_MS.  The 'D' lines carry the sample
+timestamp ('YT1') and sequence ('O0 1').
+
+The sampler takes its samples on its own timer, so when loop() gets to
+an 'R' there is already a sample queued from before it, with the old
+count in it.  In the second run an 'L' goes SETTINGS_QUIET_MS and a bit
+before each 'R', so the settings are written to flash at the end of the
+loop() pass just before it, and the write holds the loop up for long
+enough that several samples are queued.  Each run checks:
+
+  * every 'R' lands: a sample after it has the count the angle asks for,
+    to within the counts the shaft turns in a sample or two;
+  * the RPM never goes past the shaft's speed by more than RPM_MARGIN, or
+    below zero, from the first reset on;
+  * it is back on the shaft's speed, to within RPM_MARGIN, by the next
+    'R'.
+
+The settings are saved ('W') before the figures start, so the only
+flash writes part way through are the ones asked for.
+
+Prints one line per run and exits with status 1 if any of them fail.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+from motion_profile_sim import decode
+
+CPR = 1200
+INTERVAL_MS = 2
+FIRST_RESET_MS = 2500
+RESET_EVERY_MS = 2500
+ANGLES = [90, 270, 0]
+RPM_MARGIN = 0.05
+#How long the simulated flash write holds the loop up, SIM_PREFS_WRITE_US.
+FLASH_WRITE_MS = 6
+#SETTINGS_QUIET_MS, and a couple of ms so the write comes the pass before.
+WRITE_BEFORE_MS = 2000 + 2
+
+
+def run(program, directory, held, rpm, seconds):
+    script = os.path.join(directory, "script.txt")
+    resets = []
+    with open(script, "w") as f:
+        f.write("50 L%d\n60 YT1\n70 O0 1\n100 W\n" % INTERVAL_MS)
+        at = FIRST_RESET_MS
+        for angle in ANGLES:
+            if at > seconds * 1000 - RESET_EVERY_MS:
+                break
+            if held:
+                f.write("%d L%d\n" % (at - WRITE_BEFORE_MS, INTERVAL_MS))
+            f.write("%d R%d\n" % (at, angle))
+            resets.append((at, angle))
+            at += RESET_EVERY_MS
+    arrivals = os.path.join(directory, "arrivals.txt")
+    result = subprocess.run([program, "--seconds", str(seconds),
+                             "--rpm", str(rpm), "--cpr", str(CPR), "--script", script,
+                             "--arrivals", arrivals],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True,
+                            timeout=120)
+    _, lines = decode(result.stdout)
+    # The timestamps count from boot, the script from the start of the run.
+    start_us = 0
+    with open(arrivals) as f:
+        for line in f:
+            if line.startswith("# start"):
+                start_us = int(line.split()[2])
+    # 'D angle count rpm timestamp sequence', in ms from the start.
+    samples = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 6 and fields[0] == "D":
+            samples.append(((int(fields[4]) - start_us) / 1000.0, int(fields[2]), float(fields[3])))
+    return samples, resets
+
+
+def check(program, directory, held, rpm, seconds):
+    samples, resets = run(program, directory, held, rpm, seconds)
+    problems = []
+    label = "%-7s" % ("held" if held else "as is")
+    if not samples or not resets:
+        return ["no samples"], label
+
+    counts_per_ms = rpm * CPR / 60000.0
+    slack = counts_per_ms * (2 * INTERVAL_MS + (FLASH_WRITE_MS if held else 0)) + 1
+    highest, lowest = 0.0, rpm
+    for i, (at, angle) in enumerate(resets):
+        end = resets[i + 1][0] if i + 1 < len(resets) else seconds * 1000
+        window = [s for s in samples if at <= s[0] < end]
+        if not window:
+            problems.append("nothing after R%d" % angle)
+            continue
+        # The count the angle asks for, turned on by the time since the 'R'.
+        landed = [s for s in window if abs(s[1] - (angle * CPR / 360.0 + (s[0] - at) * counts_per_ms)) <= slack]
+        if not landed:
+            problems.append("R%d didn't set the count" % angle)
+        for s in window:
+            highest = max(highest, s[2])
+            lowest = min(lowest, s[2])
+        if abs(window[-1][2] - rpm) > rpm * RPM_MARGIN:
+            problems.append("%.2f RPM before the next R" % window[-1][2])
+    if highest > rpm * (1 + RPM_MARGIN):
+        problems.append("RPM jumped to %.2f" % highest)
+    if lowest < 0:
+        problems.append("RPM went to %.2f" % lowest)
+    return problems, "%s  %d resets  RPM %.2f to %.2f" % (label, len(resets), lowest, highest)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--rpm", type=float, default=300)
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for held in (False, True):
+            problems, line = check(args.program, directory, held, args.rpm, args.seconds)
+            print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+            ok = ok and not problems
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Check the RPM estimate against the simulated shaft from 0.1 to 10,000 RPM.
+
+    rpm_error_sim.py PROGRAM [--interval 100] [--cpr 1200]
+
+PROGRAM is the native build (pio run -e native, then
+.pio/build/native/program).  The simulated shaft turns at a steady speed
+(--rpm), at speeds spread over five decades and chosen so a sample doesn't
+hold a whole number of counts.  Each speed runs once timing the edges by
+the sample times, and once with edge capture on ('E0 1').  The filter is
+off ('K0') and every sample is sent ('Q' with a heartbeat of one
+interval), as binary frames, so each figure is the estimator's own.
+
+Once the estimator has settled (a second, or three edges, whichever is
+longer), each run checks:
+
+  * every estimate is within the error the sampling allows: 1%, or one
+    count in the counts a sample sees, whichever is more.  Below one count
+    a sample, with only the sample times to go by, an edge period can be
+    measured a whole sample period short.  With edge capture on, 1%;
+  * the mean of the estimates is within 1% of the true speed, unless it
+    is below one count a sample without edge capture, where the periods
+    are a mix of whole sample periods and the mean of their inverses is
+    biased high.
+
+The settings are saved ('W') before the figures start, as the simulated
+flash write holds the loop up, and the edges with it.
+
+Prints one line per run and exits with status 1 if any of them fail.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+from motion_profile_sim import decode
+
+SPEEDS = [0.1, 0.27, 0.61, 1.55, 4.2, 12.34, 33.3, 98.7, 345.6, 1234.5, 4321.1, 10000]
+
+
+def run(program, directory, rpm, interval, cpr, seconds, capture):
+    script = os.path.join(directory, "script.txt")
+    with open(script, "w") as f:
+        f.write("50 L%d\n60 K0\n70 Q0 0 %d\n80 B1\n" % (interval, interval))
+        if capture:
+            f.write("90 E0 1\n")
+        # Saved now, not part way through the figures.
+        f.write("100 W\n")
+    result = subprocess.run([program, "--seconds", "%.1f" % seconds, "--rpm", str(rpm),
+                             "--cpr", str(cpr), "--script", script],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True,
+                            timeout=300)
+    frames, _ = decode(result.stdout)
+    return frames
+
+
+def counts_per_sample(rpm, interval, cpr):
+    return rpm * cpr / 60.0 * interval / 1000.0
+
+
+def allowed(rpm, interval, cpr, capture):
+    """Largest error, as a fraction, any one estimate can have."""
+    if capture:
+        return 0.01
+    counts = counts_per_sample(rpm, interval, cpr)
+    # One count in the count difference, or an edge period of P timed as
+    # P - T by the samples either side, T being the sample period.
+    quantisation = 1.0 / counts if counts >= 1 else counts / (1 - counts)
+    return max(0.01, quantisation)
+
+
+def check(program, directory, rpm, interval, cpr, capture):
+    edge_s = 60.0 / (rpm * cpr)
+    settle_s = max(1.0, 3 * edge_s)
+    seconds = 4 + settle_s + max(5.0, 20 * edge_s)
+    frames = run(program, directory, rpm, interval, cpr, seconds, capture)
+
+    problems = []
+    if not frames:
+        return ["no frames"], "%9g %-7s" % (rpm, "edges" if capture else "samples")
+    start = frames[0][1]
+    estimates = [f[3] / 1000.0 for f in frames if ((f[1] - start) & 0xFFFFFFFF) / 1e6 >= settle_s]
+    if len(estimates) < 10:
+        problems.append("only %d estimates" % len(estimates))
+        estimates = estimates or [0]
+    errors = [(e - rpm) / rpm for e in estimates]
+    mean = sum(errors) / len(errors)
+    worst = max(errors, key=abs)
+    limit = allowed(rpm, interval, cpr, capture)
+    if abs(mean) > 0.01 and (capture or counts_per_sample(rpm, interval, cpr) >= 1):
+        problems.append("mean off by %+.2f%%" % (mean * 100))
+    if abs(worst) > limit * 1.001:
+        problems.append("%+.2f%% is past %.2f%%" % (worst * 100, limit * 100))
+    return problems, "%9g %-7s %6d %+8.3f%% %+8.2f%% %8.2f%%" % (
+        rpm, "edges" if capture else "samples", len(estimates), mean * 100, worst * 100, limit * 100)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("program")
+    parser.add_argument("--interval", type=int, default=100, help="sample interval in ms")
+    parser.add_argument("--cpr", type=int, default=1200, help="counts per rev")
+    args = parser.parse_args()
+
+    print("%9s %-7s %6s %9s %9s %9s" % ("rpm", "edges", "n", "mean", "worst", "allowed"))
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for capture in (False, True):
+            for rpm in SPEEDS:
+                problems, line = check(args.program, directory, rpm, args.interval, args.cpr, capture)
+                print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+                ok = ok and not problems
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Report the samples a second each transport sustains, UART and USB CDC.
+
+    transport_rate_sim.py PROGRAM... [--seconds 3]
+
+Each PROGRAM is a native build: pio run -e native for the UART, then
+.pio/build/native/program, and -e native_usb for USB CDC,
+.pio/build/native_usb/program.  Which transport a build has comes from
+its start up banner.  The simulated UART drains at TRANSPORT_UART_BAUD / 10
+bytes a second, the USB CDC port at about 1 MB/s.
+
+Each build samples at 1 kHz ('L1') with the motion generator turning the
+shaft, so every sample goes, with 1 and with 4 channels, as binary frames
+and as sequenced, timestamped lines ('O0 1', 'YT1').  For each run:
+
+  * the gaps in the sequence numbers add up to the samples the output
+    ring says it dropped ('O'), so the PC can account for every one;
+  * if nothing was dropped, every sample arrived, 1000 a second;
+  * if some were dropped, it is because the link is full: what did arrive
+    kept a UART at least 90% busy.  USB CDC never should drop any.
+
+The samples a second are counted by their timestamps, from half a second
+in to before the end, where the run slows down again so the ring can
+empty for the final 'O'.
+
+Prints one line per run and exits with status 1 if any of them fail.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+from channel_rate_sim import CHANNEL_SIZE, MULTI_HEADER_SIZE, decode_multi, parse_lines
+from motion_profile_sim import SAMPLE_FRAME_SIZE, decode
+
+#TRANSPORT_UART_BAUD in Transport.h, in bytes a second.
+UART_BYTES_PER_SECOND = 115200 / 10
+INTERVAL_MS = 1
+START_MS = 200
+#Slow enough for the UART to empty the ring, at the end of a run.
+SETTLE_INTERVAL = 100
+
+
+def run(program, directory, channels, binary, seconds):
+    script = os.path.join(directory, "script.txt")
+    end_ms = int(seconds * 1000)
+    with open(script, "w") as f:
+        f.write("50 L%d\n60 B%d\n70 YT1\n80 O0 1\n" % (SETTLE_INTERVAL, 1 if binary else 0))
+        for ch in range(1, channels):
+            f.write("%d C%d %d %d\n" % (90 + ch, ch, 2 * ch + 1, 2 * ch + 2))
+        # Saved now, not part way through the figures.
+        f.write("150 W\n180 L%d\n%d T1 600\n" % (INTERVAL_MS, START_MS))
+        f.write("%d L%d\n%d O\n" % (end_ms - 400, SETTLE_INTERVAL, end_ms - 40))
+    result = subprocess.run([program, "--seconds", str(seconds), "--script", script],
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True,
+                            timeout=300)
+    multi, rest = decode_multi(result.stdout)
+    frames, lines = decode(rest)
+    if binary:
+        samples = [(f[0], f[1], {0: f[2]}) for f in frames] + multi
+        samples.sort(key=lambda s: s[1])
+        size = SAMPLE_FRAME_SIZE if channels == 1 else MULTI_HEADER_SIZE + CHANNEL_SIZE * channels + 2
+        sizes = [size] * len(samples)
+    else:
+        sample_lines = [l for l in lines if l.startswith("D ") or l.startswith("M ")]
+        samples = parse_lines(sample_lines)
+        # Each with its \r\n.
+        sizes = [len(l) + 2 for l in sample_lines if parse_lines([l])]
+    transport = "?"
+    for line in lines:
+        if line.startswith("Transport: "):
+            transport = line[len("Transport: "):]
+    report = [l.split() for l in lines if l.startswith("O ")]
+    dropped = int(report[-1][4]) if report else None
+    return transport, samples, sizes, dropped
+
+
+def check(program, directory, channels, binary, seconds):
+    transport, samples, sizes, dropped = run(program, directory, channels, binary, seconds)
+    problems = []
+    label = "%-8s %d %-6s" % (transport, channels, "binary" if binary else "lines")
+    if not samples or dropped is None:
+        return ["no samples" if not samples else "no O"], label
+
+    gaps = sum(((b[0] - a[0]) & 0xFFFF) - 1 for a, b in zip(samples, samples[1:])
+               if (b[0] - a[0]) & 0xFFFF != 1)
+    if gaps != dropped:
+        problems.append("%d missing, ring dropped %d" % (gaps, dropped))
+
+    # From half a second after the shaft starts, to before the slow down.
+    start_us = samples[0][1]
+    window_from, window_s = 0.5, seconds - START_MS / 1000.0 - 1.0
+    since = lambda s: ((s[1] - start_us) & 0xFFFFFFFF) / 1e6
+    measured = [i for i, s in enumerate(samples) if window_from <= since(s) < window_from + window_s]
+    rate = len(measured) / window_s
+    mean_size = sum(sizes[i] for i in measured) / len(measured) if measured else 0
+    busy = rate * mean_size / UART_BYTES_PER_SECOND
+
+    wanted = 1000.0 / INTERVAL_MS
+    if dropped == 0 and abs(rate - wanted) > wanted / 100:
+        problems.append("%.0f samples/s with none dropped" % rate)
+    if dropped > 0:
+        if transport != "UART":
+            problems.append("%s dropped %d" % (transport, dropped))
+        elif busy < 0.9:
+            problems.append("dropped %d with the UART %.0f%% busy" % (dropped, busy * 100))
+
+    return problems, "%s %9.0f %6.1f %9.0f %7d" % (label, rate, mean_size, rate * mean_size, dropped)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("programs", nargs="+", metavar="program")
+    parser.add_argument("--seconds", type=float, default=3)
+    args = parser.parse_args()
+
+    print("%-8s %s %-6s %9s %6s %9s %7s" %
+          ("link", "n", "output", "samples/s", "bytes", "bytes/s", "dropped"))
+    ok = True
+    with tempfile.TemporaryDirectory() as directory:
+        for program in args.programs:
+            for channels in (1, 4):
+                for binary in (True, False):
+                    problems, line = check(program, directory, channels, binary, args.seconds)
+                    print(line + "  " + ("ok" if not problems else "FAIL: " + "; ".join(problems)))
+                    ok = ok and not problems
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())